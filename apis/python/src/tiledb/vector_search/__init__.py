@@ -1,5 +1,5 @@
 from . import utils
-from .index import FlatIndex, IVFFlatIndex
+from .index import FlatIndex, IVFFlatIndex, IVFPQIndex, HNSWIndex, VamanaIndex
 from .ingestion import ingest
 from .storage_formats import storage_formats, STORAGE_VERSION
 from .module import load_as_array
@@ -14,6 +14,27 @@ from .module import (
     ivf_index,
     ivf_index_tdb,
     partition_ivf_index,
+    kmeans_mini_batch,
+    ivf_ingest,
+    ivf_pq_ingest,
+    hnsw_ingest,
+    vamana_ingest,
+    rerank,
+    build_id_positions,
+    build_binary_codes,
+    ivf_query_ram_binary,
+    build_partition_stats,
+    compute_partition_stats,
+    ivf_query_pruned,
+    ivf_query_ram_adaptive,
+    ivf_query_ram_pruned,
+    id_bitmap,
+    ivf_query_filtered,
+    ivf_query_ram_filtered,
+    read_id_bitmap,
+    read_coarse_quantizer,
+    ivf_query_coarse,
+    ivf_query_ram_coarse,
 )
 
 # Re-import mode from cloud.dag
@@ -22,6 +43,9 @@ from tiledb.cloud.dag.mode import Mode
 __all__ = [
     "FlatIndex",
     "IVFFlatIndex",
+    "IVFPQIndex",
+    "HNSWIndex",
+    "VamanaIndex",
     "Mode",
     "load_as_array",
     "load_as_matrix",
@@ -35,5 +59,26 @@ __all__ = [
     "ivf_index_tdb",
     "array_to_matrix",
     "partition_ivf_index",
+    "kmeans_mini_batch",
+    "ivf_ingest",
+    "ivf_pq_ingest",
+    "hnsw_ingest",
+    "vamana_ingest",
+    "rerank",
+    "build_id_positions",
+    "build_binary_codes",
+    "ivf_query_ram_binary",
+    "build_partition_stats",
+    "compute_partition_stats",
+    "ivf_query_pruned",
+    "ivf_query_ram_adaptive",
+    "ivf_query_ram_pruned",
+    "id_bitmap",
+    "ivf_query_filtered",
+    "ivf_query_ram_filtered",
+    "read_id_bitmap",
+    "read_coarse_quantizer",
+    "ivf_query_coarse",
+    "ivf_query_ram_coarse",
     "utils",
 ]
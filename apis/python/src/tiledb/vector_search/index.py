@@ -30,13 +30,17 @@ class FlatIndex(Index):
     ----------
     uri: str
         URI of datataset
-    dtype: numpy.dtype
-        datatype float32 or uint8
+    memory_budget: int
+        Largest number of bytes of vectors held in memory at a time by a
+        query; the vectors are read in blocks of at most half of this, the
+        next block being read while the current one is searched. If not
+        provided, all of the vectors are read at once
     """
 
     def __init__(
         self,
         uri: str,
+        memory_budget: int = -1,
         config: Optional[Mapping[str, Any]] = None,
     ):
         # If the user passes a tiledb python Config object convert to a dictionary
@@ -44,29 +48,47 @@ class FlatIndex(Index):
             config = dict(config)
 
         self.uri = uri
-        self._index = None
+        self._db = None
         self.ctx = Ctx(config)
         self.config = config
         group = tiledb.Group(uri, ctx=tiledb.Ctx(config))
         self.storage_version = group.meta.get("storage_version", "0.1")
-        self._db = load_as_matrix(
-            group[storage_formats[self.storage_version]["PARTS_ARRAY_NAME"]].uri,
-            ctx=self.ctx,
-            config=config,
-        )
+        self.db_uri = group[
+            storage_formats[self.storage_version]["PARTS_ARRAY_NAME"]
+        ].uri
 
         dtype = group.meta.get("dtype", None)
         if dtype is None:
-            self.dtype = self._db.dtype
+            schema = tiledb.ArraySchema.load(self.db_uri, ctx=tiledb.Ctx(config))
+            self.dtype = schema.attr(0).dtype
         else:
             self.dtype = np.dtype(dtype)
 
+        if memory_budget == -1:
+            memory_budget = 0
+        if self.dtype == np.float32:
+            self._index = FlatIndex_f32(self.ctx, self.db_uri, "", memory_budget)
+        elif self.dtype == np.uint8:
+            self._index = FlatIndex_u8(self.ctx, self.db_uri, "", memory_budget)
+        else:
+            raise TypeError("Unknown type!")
+
+        # Ids (column numbers) of deleted vectors, skipped by every query
+        self._tombstones = None
+        tombstones_name = storage_formats[self.storage_version].get(
+            "TOMBSTONES_ARRAY_NAME"
+        )
+        if tombstones_name is not None and tombstones_name in group:
+            self._tombstones = IdBitmap(self.ctx, group[tombstones_name].uri)
+            self._index.set_deleted(self._tombstones)
+
     def query(
         self,
         targets: np.ndarray,
         k: int = 10,
         nthreads: int = 8,
-        query_type="heap",
+        query_type="auto",
+        return_distances: bool = False,
     ):
         """
         Query a flat index
@@ -77,19 +99,44 @@ class FlatIndex(Index):
             ND Array of query targets
         k: int
             Number of top results to return per target
-        nqueries: int
-            Number of queries
         nthreads: int
             Number of threads to use for query
-        """
-        # TODO:
-        # - typecheck targets
-        # - add all the options and query strategies
+        query_type: str
+            "auto" streams the vectors in blocks and picks the search kernel
+            by the number of targets. "heap" and "nth" load all of the
+            vectors and use the corresponding vq kernel
+        return_distances: bool
+            Whether to also return the (squared L2) distances of the results.
+            Only supported with query_type "auto"
 
+        Returns
+        -------
+        The ids of the results, nearest first, or a tuple of the distances
+        and the ids if return_distances is set
+        """
         assert targets.dtype == np.float32
 
+        if targets.ndim == 1:
+            targets = np.array([targets])
+
         targets_m = array_to_matrix(np.transpose(targets))
 
+        if query_type == "auto":
+            distances, ids = self._index.search(targets_m, k, nthreads)
+            if return_distances:
+                return np.transpose(np.array(distances)), np.transpose(
+                    np.array(ids)
+                )
+            return np.transpose(np.array(ids))
+
+        if return_distances:
+            raise ValueError("Distances are only returned by query_type auto")
+        if self._tombstones is not None and len(self._tombstones) > 0:
+            raise ValueError(
+                "Only query_type auto is supported once vectors are deleted"
+            )
+        if self._db is None:
+            self._db = load_as_matrix(self.db_uri, ctx=self.ctx, config=self.config)
         if query_type == "heap":
             r = query_vq_heap(self._db, targets_m, k, nthreads)
         elif query_type == "nth":
@@ -99,6 +146,52 @@ class FlatIndex(Index):
 
         return np.transpose(np.array(r))
 
+    def delete(self, ids):
+        """
+        Delete the vectors with the given ids (column numbers), which are
+        then skipped by every query.  The ids are recorded in a bitmap in the
+        index group, so the vectors themselves are not rewritten.
+
+        Parameters
+        ----------
+        ids: numpy.ndarray
+            Ids of the vectors to delete; ids not in the index are ignored
+        """
+        ids = np.asarray(ids, dtype=np.uint64)
+        ids = ids[ids < len(self._index)]
+        self._tombstones = _write_tombstones(
+            self.uri,
+            self.storage_version,
+            self.ctx,
+            self.config,
+            self._tombstones,
+            ids,
+        )
+        self._index.set_deleted(self._tombstones)
+
+
+def _write_tombstones(uri, storage_version, ctx, config, tombstones, ids):
+    """
+    Add ids to the tombstones of the index group at uri, creating the
+    tombstones array if the group has none yet.  Only the ids not already
+    deleted are appended to the array.
+    """
+    name = storage_formats[storage_version].get("TOMBSTONES_ARRAY_NAME")
+    if name is None:
+        raise ValueError(
+            f"Storage version {storage_version} does not support deletions"
+        )
+    tombstones_uri = f"{uri}/{name}"
+    if tombstones is not None:
+        tombstones.update(ctx, ids, tombstones_uri)
+        return tombstones
+    tombstones = id_bitmap(ids)
+    tombstones.write(ctx, tombstones_uri)
+    group = tiledb.Group(uri, "w", ctx=tiledb.Ctx(config))
+    group.add(tombstones_uri, name=name)
+    group.close()
+    return tombstones
+
 
 class IVFFlatIndex(Index):
     """
@@ -124,10 +217,14 @@ class IVFFlatIndex(Index):
         if isinstance(config, tiledb.Config):
             config = dict(config)
 
+        self.uri = uri
         self.config = config
         self.ctx = Ctx(config)
         group = tiledb.Group(uri, ctx=tiledb.Ctx(config))
         self.storage_version = group.meta.get("storage_version", "0.1")
+        self._id_positions = None
+        self._binary_codes = None
+        self._partition_stats = None
         self.parts_db_uri = group[
             storage_formats[self.storage_version]["PARTS_ARRAY_NAME"]
         ].uri
@@ -159,11 +256,56 @@ class IVFFlatIndex(Index):
         else:
             self.dtype = np.dtype(dtype)
 
+        # SQ8 indexes store uint8 codes, which are queried with the queries
+        # mapped into code space
+        self.codec = group.meta.get("codec", None)
+        if self.codec == "SQ8":
+            sq8_uri = group[storage_formats[self.storage_version]["SQ8_ARRAY_NAME"]].uri
+            with tiledb.open(sq8_uri, ctx=tiledb.Ctx(self.config)) as A:
+                params = A[:]["values"]
+            self._sq8_min = params[:, 0].astype(np.float32)
+            step = float(np.max(params[:, 1] - params[:, 0])) / 255.0
+            self._sq8_step = np.float32(step if step > 0 else 1.0)
+            self.dtype = np.dtype(np.uint8)
+
         self.partitions = group.meta.get("partitions", -1)
         if self.partitions == -1:
             schema = tiledb.ArraySchema.load(self.centroids_uri, ctx=tiledb.Ctx(self.config))
             self.partitions = schema.domain.dim("cols").domain[1] + 1
 
+        # Partition statistics let queries skip probed partitions that cannot
+        # hold a neighbor.  Older indexes have none; in-memory ones compute
+        # them on first use.
+        stats_name = storage_formats[self.storage_version].get(
+            "PARTITION_STATS_ARRAY_NAME"
+        )
+        if stats_name is not None and stats_name in group:
+            self._partition_stats = PartitionStats(self.ctx, group[stats_name].uri)
+
+        # Indexes with many partitions have a coarse quantizer, which selects
+        # the partitions to probe without scoring every centroid
+        self._coarse_quantizer = None
+        coarse_name = storage_formats[self.storage_version].get(
+            "COARSE_CENTROIDS_ARRAY_NAME"
+        )
+        if coarse_name is not None and coarse_name in group:
+            formats = storage_formats[self.storage_version]
+            self._coarse_quantizer = read_coarse_quantizer(
+                group[coarse_name].uri,
+                group[formats["COARSE_OFFSETS_ARRAY_NAME"]].uri,
+                group[formats["COARSE_MEMBERS_ARRAY_NAME"]].uri,
+                ctx=self.ctx,
+            )
+
+        # Ids of deleted vectors, skipped by every query until the index is
+        # ingested again
+        self._tombstones = None
+        tombstones_name = storage_formats[self.storage_version].get(
+            "TOMBSTONES_ARRAY_NAME"
+        )
+        if tombstones_name is not None and tombstones_name in group:
+            self._tombstones = IdBitmap(self.ctx, group[tombstones_name].uri)
+
     def query(
         self,
         queries: np.ndarray,
@@ -174,6 +316,9 @@ class IVFFlatIndex(Index):
         mode: Mode = None,
         num_partitions: int = -1,
         num_workers: int = -1,
+        binary_survivors: int = 0,
+        adaptive: bool = False,
+        filter_ids=None,
     ):
         """
         Query an IVF_FLAT index
@@ -199,7 +344,29 @@ class IVFFlatIndex(Index):
         num_workers: int
             Only relevant for taskgraph based execution.
             If provided, this is the number of workers to use for the query execution.
+        binary_survivors: int
+            If nonzero, only this many vectors of each probed partition, chosen
+            by the Hamming distance between their binary codes and the query's,
+            are scored with the full distance.  Requires an in-memory index
+            (memory_budget=-1) with binary codes, see build_binary_codes().
+        adaptive: bool
+            If True, nprobe is the largest number of partitions probed: each
+            query probes its partitions in order of centroid distance and stops
+            once no further partition can hold a nearer vector than its k-th
+            result, judged by the partition statistics.  Requires an
+            in-memory index (memory_budget=-1).
+        filter_ids: numpy.ndarray
+            If provided, only vectors with these ids are returned.  The ids
+            are tested before vectors are scored, and if few enough vectors
+            pass, all of them are searched rather than nprobe partitions.
+
+        Vectors removed with delete() are never returned. Once there are any,
+        mode is not supported.
 
+        Indexes with a coarse quantizer (written by ingestion for many
+        partitions) use it to select the nprobe partitions of each query,
+        unless filter_ids, adaptive, binary_survivors or
+        use_nuv_implementation is given.
         """
         assert queries.dtype == np.float32
 
@@ -209,10 +376,145 @@ class IVFFlatIndex(Index):
         if nthreads == -1:
             nthreads = multiprocessing.cpu_count()
 
+        if self.codec == "SQ8":
+            queries = ((queries - self._sq8_min) / self._sq8_step).astype(np.float32)
+
         nprobe = min(nprobe, self.partitions)
+        deleted = None
+        if self._tombstones is not None and len(self._tombstones) > 0:
+            deleted = self._tombstones
+            if mode is not None:
+                raise ValueError("mode is not supported once vectors are deleted")
         if mode is None:
             queries_m = array_to_matrix(np.transpose(queries))
-            if self.memory_budget == -1:
+            if filter_ids is not None:
+                if adaptive or binary_survivors > 0:
+                    raise ValueError(
+                        "filter_ids does not support adaptive or binary_survivors"
+                    )
+                if deleted is not None:
+                    filter_ids = np.setdiff1d(
+                        np.asarray(filter_ids, dtype=np.uint64), deleted.ids()
+                    )
+                filter = id_bitmap(filter_ids)
+                if self.memory_budget == -1:
+                    r = ivf_query_ram_filtered(
+                        self.dtype,
+                        self._db,
+                        self._centroids,
+                        queries_m,
+                        self._index,
+                        self._ids,
+                        filter,
+                        nprobe=nprobe,
+                        k_nn=k,
+                        nthreads=nthreads,
+                    )
+                else:
+                    r = ivf_query_filtered(
+                        self.dtype,
+                        self.parts_db_uri,
+                        self._centroids,
+                        queries_m,
+                        self._index,
+                        self.ids_uri,
+                        filter,
+                        nprobe=nprobe,
+                        k_nn=k,
+                        memory_budget=self.memory_budget,
+                        nthreads=nthreads,
+                        ctx=self.ctx,
+                    )
+            elif adaptive:
+                if self.memory_budget != -1:
+                    raise ValueError(
+                        "adaptive requires an in-memory index (memory_budget=-1)"
+                    )
+                if binary_survivors > 0:
+                    raise ValueError("adaptive does not support binary_survivors")
+                r = ivf_query_ram_adaptive(
+                    self.dtype,
+                    self._db,
+                    self._centroids,
+                    self._load_partition_stats(nthreads),
+                    queries_m,
+                    self._index,
+                    self._ids,
+                    max_nprobe=nprobe,
+                    k_nn=k,
+                    nthreads=nthreads,
+                    deleted=deleted,
+                )
+            elif binary_survivors > 0:
+                if self.memory_budget != -1:
+                    raise ValueError(
+                        "binary_survivors requires an in-memory index (memory_budget=-1)"
+                    )
+                r = ivf_query_ram_binary(
+                    self.dtype,
+                    self._db,
+                    self._load_binary_codes(),
+                    self._centroids,
+                    queries_m,
+                    self._index,
+                    self._ids,
+                    nprobe=nprobe,
+                    k_nn=k,
+                    num_survivors=binary_survivors,
+                    nthreads=nthreads,
+                    deleted=deleted,
+                )
+            elif self._coarse_quantizer is not None and (
+                deleted is not None or not use_nuv_implementation
+            ):
+                if self.memory_budget == -1:
+                    r = ivf_query_ram_coarse(
+                        self.dtype,
+                        self._db,
+                        self._coarse_quantizer,
+                        self._centroids,
+                        queries_m,
+                        self._index,
+                        self._ids,
+                        nprobe=nprobe,
+                        k_nn=k,
+                        nthreads=nthreads,
+                        deleted=deleted,
+                    )
+                else:
+                    r = ivf_query_coarse(
+                        self.dtype,
+                        self.parts_db_uri,
+                        self._coarse_quantizer,
+                        self._centroids,
+                        queries_m,
+                        self._index,
+                        self.ids_uri,
+                        nprobe=nprobe,
+                        k_nn=k,
+                        memory_budget=self.memory_budget,
+                        nthreads=nthreads,
+                        ctx=self.ctx,
+                        deleted=deleted,
+                    )
+            elif self.memory_budget == -1 and (
+                deleted is not None or not use_nuv_implementation
+            ):
+                # The nuv implementation does not skip deleted vectors
+                r = ivf_query_ram_pruned(
+                    self.dtype,
+                    self._db,
+                    self._centroids,
+                    self._load_partition_stats(nthreads),
+                    queries_m,
+                    self._index,
+                    self._ids,
+                    nprobe=nprobe,
+                    k_nn=k,
+                    nthreads=nthreads,
+                    deleted=deleted,
+                )
+            elif self.memory_budget == -1:
                 r = ivf_query_ram(
                     self.dtype,
                     self._db,
@@ -227,6 +529,40 @@ class IVFFlatIndex(Index):
                     ctx=self.ctx,
                     use_nuv_implementation=use_nuv_implementation,
                 )
+            elif self._partition_stats is not None and (
+                deleted is not None or not use_nuv_implementation
+            ):
+                r = ivf_query_pruned(
+                    self.dtype,
+                    self.parts_db_uri,
+                    self._centroids,
+                    self._partition_stats,
+                    queries_m,
+                    self._index,
+                    self.ids_uri,
+                    nprobe=nprobe,
+                    k_nn=k,
+                    memory_budget=self.memory_budget,
+                    nthreads=nthreads,
+                    ctx=self.ctx,
+                    deleted=deleted,
+                )
+            elif deleted is not None:
+                r = ivf_query(
+                    self.dtype,
+                    self.parts_db_uri,
+                    self._centroids,
+                    queries_m,
+                    self._index,
+                    self.ids_uri,
+                    nprobe=nprobe,
+                    k_nn=k,
+                    memory_budget=self.memory_budget,
+                    nth=True,
+                    nthreads=nthreads,
+                    ctx=self.ctx,
+                    deleted=deleted,
+                )
             else:
                 r = ivf_query(
                     self.dtype,
@@ -246,6 +582,8 @@ class IVFFlatIndex(Index):
 
             return np.transpose(np.array(r))
         else:
+            if filter_ids is not None:
+                raise ValueError("filter_ids is not supported with mode")
             return self.taskgraph_query(
                 queries=queries,
                 k=k,
@@ -257,6 +595,218 @@ class IVFFlatIndex(Index):
                 config=self.config,
             )
 
+    def rerank(
+        self,
+        queries: np.ndarray,
+        candidates,
+        k: int = 10,
+        nthreads: int = -1,
+    ):
+        """
+        Find the k nearest of the given candidates of each query, by exact
+        distance to the vectors stored in the index.  The vectors are fetched
+        by id from TileDB, coalescing the reads into ranges, so they never
+        pass through Python.
+
+        Parameters
+        ----------
+        queries: numpy.ndarray
+            ND Array of queries
+        candidates: list
+            One sequence of candidate ids per query, e.g. merged from several
+            retrieval systems.  Ids not in the index, or deleted, are
+            ignored
+        k: int
+            Number of top results to return per query
+        nthreads: int
+            Number of threads to use
+
+        Returns
+        -------
+        Arrays of the distances and ids of the results, one row per query,
+        nearest first. Rows with fewer than k candidates are padded with the
+        maximum float and uint64 values.
+        """
+        assert queries.dtype == np.float32
+
+        if queries.ndim == 1:
+            queries = np.array([queries])
+        if len(candidates) != queries.shape[0]:
+            raise ValueError("Need one list of candidates per query")
+
+        if nthreads == -1:
+            nthreads = multiprocessing.cpu_count()
+
+        if self._id_positions is None:
+            group = tiledb.Group(self.uri, ctx=tiledb.Ctx(self.config))
+            name = storage_formats[self.storage_version].get(
+                "ID_POSITIONS_ARRAY_NAME"
+            )
+            if name is None or name not in group:
+                raise ValueError(
+                    "Index has no id to position map, call build_id_positions()"
+                )
+            self._id_positions = IdPositionMap(self.ctx, group[name].uri)
+
+        scale = 1.0
+        if self.codec == "SQ8":
+            queries = ((queries - self._sq8_min) / self._sq8_step).astype(np.float32)
+            scale = float(self._sq8_step) ** 2
+
+        deleted = None
+        if self._tombstones is not None and len(self._tombstones) > 0:
+            deleted = self._tombstones
+
+        queries_m = array_to_matrix(np.transpose(queries))
+        distances, ids = rerank(
+            self.dtype,
+            self.parts_db_uri,
+            self._id_positions,
+            queries_m,
+            candidates,
+            k_nn=k,
+            nthreads=nthreads,
+            ctx=self.ctx,
+            deleted=deleted,
+        )
+        distances = np.transpose(np.array(distances))
+        if scale != 1.0:
+            valid = distances != np.finfo(np.float32).max
+            distances[valid] *= scale
+        return distances, np.transpose(np.array(ids))
+
+    def delete(self, ids):
+        """
+        Delete the vectors with the given ids, which are then skipped by
+        every query.  The ids are recorded in a bitmap in the index group, so
+        the partitioned vectors are not rewritten.
+
+        Parameters
+        ----------
+        ids: numpy.ndarray
+            Ids of the vectors to delete; ids not in the index are ignored
+        """
+        index_ids = self._ids if self.memory_budget == -1 else None
+        if index_ids is None:
+            index_ids = read_vector_u64(self.ctx, self.ids_uri)
+        ids = np.asarray(ids, dtype=np.uint64)
+        ids = ids[np.isin(ids, np.array(index_ids, dtype=np.uint64))]
+        self._tombstones = _write_tombstones(
+            self.uri,
+            self.storage_version,
+            self.ctx,
+            self.config,
+            self._tombstones,
+            ids,
+        )
+
+    def build_id_positions(self):
+        """
+        Write the map from ids to positions used by rerank() to the index
+        group.  Indexes ingested natively already have one.
+        """
+        name = storage_formats[self.storage_version].get("ID_POSITIONS_ARRAY_NAME")
+        if name is None:
+            raise ValueError(
+                f"Storage version {self.storage_version} does not support rerank"
+            )
+        positions_uri = f"{self.uri}/{name}"
+        build_id_positions(self.ctx, self.ids_uri, positions_uri)
+        group = tiledb.Group(self.uri, "w", ctx=tiledb.Ctx(self.config))
+        group.add(positions_uri, name=name)
+        group.close()
+        self._id_positions = None
+
+    def build_binary_codes(self, nthreads: int = -1):
+        """
+        Write the binary codes of the vectors used by
+        query(binary_survivors=...) to the index group.
+        """
+        codes_name = storage_formats[self.storage_version].get(
+            "BINARY_CODES_ARRAY_NAME"
+        )
+        center_name = storage_formats[self.storage_version].get(
+            "BINARY_CENTER_ARRAY_NAME"
+        )
+        if codes_name is None:
+            raise ValueError(
+                f"Storage version {self.storage_version} does not support binary codes"
+            )
+        if nthreads == -1:
+            nthreads = multiprocessing.cpu_count()
+        codes_uri = f"{self.uri}/{codes_name}"
+        center_uri = f"{self.uri}/{center_name}"
+        build_binary_codes(
+            self.dtype,
+            self.parts_db_uri,
+            codes_uri,
+            center_uri,
+            memory_budget=max(self.memory_budget, 0),
+            nthreads=nthreads,
+            ctx=self.ctx,
+        )
+        group = tiledb.Group(self.uri, "w", ctx=tiledb.Ctx(self.config))
+        group.add(codes_uri, name=codes_name)
+        group.add(center_uri, name=center_name)
+        group.close()
+        self._binary_codes = None
+
+    def build_partition_stats(self, nthreads: int = -1):
+        """
+        Write the partition statistics used to skip partitions at query time
+        to the index group, for indexes ingested without them.  The vectors
+        are read memory_budget at a time.
+        """
+        name = storage_formats[self.storage_version].get(
+            "PARTITION_STATS_ARRAY_NAME"
+        )
+        if name is None:
+            raise ValueError(
+                f"Storage version {self.storage_version} does not support partition statistics"
+            )
+        if nthreads == -1:
+            nthreads = multiprocessing.cpu_count()
+        stats_uri = f"{self.uri}/{name}"
+        build_partition_stats(
+            self.dtype,
+            self.parts_db_uri,
+            self._centroids,
+            self._index,
+            stats_uri,
+            memory_budget=max(self.memory_budget, 0),
+            nthreads=nthreads,
+            ctx=self.ctx,
+        )
+        group = tiledb.Group(self.uri, "w", ctx=tiledb.Ctx(self.config))
+        group.add(stats_uri, name=name)
+        group.close()
+        self._partition_stats = PartitionStats(self.ctx, stats_uri)
+
+    def _load_partition_stats(self, nthreads: int):
+        if self._partition_stats is None:
+            self._partition_stats = compute_partition_stats(
+                self.dtype, self._db, self._centroids, self._index, nthreads
+            )
+        return self._partition_stats
+
+    def _load_binary_codes(self):
+        if self._binary_codes is None:
+            group = tiledb.Group(self.uri, ctx=tiledb.Ctx(self.config))
+            codes_name = storage_formats[self.storage_version].get(
+                "BINARY_CODES_ARRAY_NAME"
+            )
+            if codes_name is None or codes_name not in group:
+                raise ValueError(
+                    "Index has no binary codes, call build_binary_codes()"
+                )
+            center_name = storage_formats[self.storage_version][
+                "BINARY_CENTER_ARRAY_NAME"
+            ]
+            self._binary_codes = BinaryCodes(
+                self.ctx, group[codes_name].uri, group[center_name].uri
+            )
+        return self._binary_codes
+
     def taskgraph_query(
         self,
         queries: np.ndarray,
@@ -418,3 +968,239 @@ class IVFFlatIndex(Index):
                 tmp.append((float(0.0), int(0)))
             results_per_query.append(np.array(tmp, dtype=np.dtype("float,int"))["f1"])
         return results_per_query
+
+
+class IVFPQIndex(Index):
+    """
+    Open an IVF_PQ index
+
+    Parameters
+    ----------
+    uri: str
+        URI of the index group
+    memory_budget: int
+        Main memory budget, in vectors. If not provided the PQ codes are
+        loaded in memory, otherwise they are read from TileDB at query time
+        for the partitions that are probed. Ignored for 4-bit codes, which
+        are always loaded in memory.
+    """
+
+    def __init__(
+        self,
+        uri,
+        memory_budget: int = -1,
+        config: Optional[Mapping[str, Any]] = None,
+    ):
+        # If the user passes a tiledb python Config object convert to a dictionary
+        if isinstance(config, tiledb.Config):
+            config = dict(config)
+
+        self.uri = uri
+        self.config = config
+        self.ctx = Ctx(config)
+        self.memory_budget = memory_budget
+        group = tiledb.Group(uri, ctx=tiledb.Ctx(config))
+        self.dtype = np.dtype(group.meta["dtype"])
+        self.partitions = group.meta.get("partitions", -1)
+        self.num_subspaces = group.meta["num_subspaces"]
+        self.num_bits = group.meta.get("num_bits", 8)
+        # 4-bit codes can only be searched in memory
+        if self.num_bits != 8:
+            self.memory_budget = -1
+
+        if self.dtype == np.float32:
+            self._index = IVFPQIndex_f32(0, 0, 1)
+        elif self.dtype == np.uint8:
+            self._index = IVFPQIndex_u8(0, 0, 1)
+        else:
+            raise TypeError("Unknown type!")
+        self._index.load(self.ctx, uri, load_codes=self.memory_budget == -1)
+
+    def query(
+        self,
+        queries: np.ndarray,
+        k: int = 10,
+        nprobe: int = 1,
+        nthreads: int = -1,
+    ):
+        """
+        Query an IVF_PQ index. Distances are approximated from the PQ codes,
+        so the results may differ from those of an exact search.
+
+        Parameters
+        ----------
+        queries: numpy.ndarray
+            ND Array of queries
+        k: int
+            Number of top results to return per target
+        nprobe: int
+            number of probes
+        nthreads: int
+            Number of threads to use for query
+        """
+        assert queries.dtype == np.float32
+
+        if queries.ndim == 1:
+            queries = np.array([queries])
+
+        if nthreads == -1:
+            nthreads = multiprocessing.cpu_count()
+
+        if self.partitions != -1:
+            nprobe = min(nprobe, self.partitions)
+
+        queries_m = array_to_matrix(np.transpose(queries))
+        if self.memory_budget == -1:
+            r = self._index.search(queries_m, nprobe, k, nthreads)
+        else:
+            r = self._index.search_finite_ram(
+                self.ctx, queries_m, nprobe, k, self.memory_budget, nthreads
+            )
+        return np.transpose(np.array(r))
+
+
+class HNSWIndex(Index):
+    """
+    Open an HNSW index. The vectors and the graph are loaded in memory.
+
+    Parameters
+    ----------
+    uri: str
+        URI of the index group
+    """
+
+    def __init__(
+        self,
+        uri,
+        config: Optional[Mapping[str, Any]] = None,
+    ):
+        # If the user passes a tiledb python Config object convert to a dictionary
+        if isinstance(config, tiledb.Config):
+            config = dict(config)
+
+        self.uri = uri
+        self.config = config
+        self.ctx = Ctx(config)
+        group = tiledb.Group(uri, ctx=tiledb.Ctx(config))
+        self.dtype = np.dtype(group.meta["dtype"])
+
+        if self.dtype == np.float32:
+            self._index = HNSWIndex_f32(0)
+        elif self.dtype == np.uint8:
+            self._index = HNSWIndex_u8(0)
+        else:
+            raise TypeError("Unknown type!")
+        self._index.load(self.ctx, uri)
+
+    def query(
+        self,
+        queries: np.ndarray,
+        k: int = 10,
+        ef_search: int = 0,
+        nthreads: int = -1,
+    ):
+        """
+        Query an HNSW index.
+
+        Parameters
+        ----------
+        queries: numpy.ndarray
+            ND Array of queries
+        k: int
+            Number of top results to return per target
+        ef_search: int
+            Width of the search in the bottom layer of the graph; larger values
+            are slower but more accurate. If not provided, the value the index
+            was saved with (or last queried with) is used. At least k is used
+        nthreads: int
+            Number of threads to use for query
+        """
+        assert queries.dtype == np.float32
+
+        if queries.ndim == 1:
+            queries = np.array([queries])
+
+        if nthreads == -1:
+            nthreads = multiprocessing.cpu_count()
+
+        queries_m = array_to_matrix(np.transpose(queries))
+        r = self._index.search(queries_m, k, ef_search, nthreads)
+        return np.transpose(np.array(r))
+
+
+class VamanaIndex(Index):
+    """
+    Open a Vamana (DiskANN) index. Only the PQ codes of the vectors are
+    loaded in memory; queries read the vectors and the graph from the index
+    group as they search it.
+
+    Parameters
+    ----------
+    uri: str
+        URI of the index group
+    """
+
+    def __init__(
+        self,
+        uri,
+        config: Optional[Mapping[str, Any]] = None,
+    ):
+        # If the user passes a tiledb python Config object convert to a dictionary
+        if isinstance(config, tiledb.Config):
+            config = dict(config)
+
+        self.uri = uri
+        self.config = config
+        self.ctx = Ctx(config)
+        group = tiledb.Group(uri, ctx=tiledb.Ctx(config))
+        self.dtype = np.dtype(group.meta["dtype"])
+
+        if self.dtype == np.float32:
+            self._index = VamanaIndex_f32(0)
+        elif self.dtype == np.uint8:
+            self._index = VamanaIndex_u8(0)
+        else:
+            raise TypeError("Unknown type!")
+        self._index.load(self.ctx, uri)
+
+    def query(
+        self,
+        queries: np.ndarray,
+        k: int = 10,
+        search_list_size: int = 0,
+        beam_width: int = 0,
+        nthreads: int = -1,
+    ):
+        """
+        Query a Vamana index.
+
+        Parameters
+        ----------
+        queries: numpy.ndarray
+            ND Array of queries
+        k: int
+            Number of top results to return per target
+        search_list_size: int
+            Length of the candidate list of the search; larger values are
+            slower but more accurate. If not provided, the value the index
+            was saved with (or last queried with) is used. At least k is used
+        beam_width: int
+            Number of vectors read together at each step of the search. If
+            not provided, the value the index was saved with (or last
+            queried with) is used
+        nthreads: int
+            Number of threads to use for query
+        """
+        assert queries.dtype == np.float32
+
+        if queries.ndim == 1:
+            queries = np.array([queries])
+
+        if nthreads == -1:
+            nthreads = multiprocessing.cpu_count()
+
+        queries_m = array_to_matrix(np.transpose(queries))
+        r = self._index.search(
+            self.ctx, queries_m, k, search_list_size, beam_width, nthreads
+        )
+        return np.transpose(np.array(r))
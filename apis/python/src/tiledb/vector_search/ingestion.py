@@ -2,7 +2,14 @@ from typing import Optional, Tuple
 from functools import partial
 
 from tiledb.cloud.dag import Mode
-from tiledb.vector_search.index import FlatIndex, IVFFlatIndex, Index
+from tiledb.vector_search.index import (
+    FlatIndex,
+    IVFFlatIndex,
+    IVFPQIndex,
+    HNSWIndex,
+    VamanaIndex,
+    Index,
+)
 
 
 def ingest(
@@ -17,8 +24,17 @@ def ingest(
     partitions: int = -1,
     copy_centroids_uri: str = None,
     training_sample_size: int = -1,
+    num_subspaces: int = -1,
+    num_bits: int = 8,
+    sq8: bool = False,
+    M: int = 16,
+    ef_construction: int = 200,
+    R: int = 64,
+    L_build: int = 100,
+    alpha: float = 1.2,
     workers: int = -1,
     input_vectors_per_work_item: int = -1,
+    spill_dir: Optional[str] = None,
     verbose: bool = False,
     trace_id: Optional[str] = None,
     mode: Mode = Mode.LOCAL,
@@ -29,7 +45,7 @@ def ingest(
     Parameters
     ----------
     index_type: str
-        Type of vector index (FLAT, IVF_FLAT)
+        Type of vector index (FLAT, IVF_FLAT, IVF_PQ, HNSW, VAMANA)
     array_uri: str
         Vector array URI
     source_uri: str
@@ -52,12 +68,44 @@ def ingest(
     training_sample_size: int = -1
         vector sample size to train centroids with,
         if not provided, is auto-configured based on the dataset size
+    num_subspaces: int = -1
+        IVF_PQ and VAMANA only: number of subspaces, i.e., bytes per encoded
+        vector, if not provided, one per 8 dimensions for IVF_PQ and one per
+        4 dimensions for VAMANA
+    num_bits: int = 8
+        IVF_PQ only: bits per code, 8, or 4 for a smaller index searched
+        with the fast-scan kernel
+    sq8: bool = False
+        IVF_FLAT only: store float32 vectors as SQ8 codes (one byte per
+        element, quantized with per-dimension ranges), which cuts storage
+        and query bandwidth by 4x at a small loss of accuracy. Requires
+        LOCAL mode and a TileDB array or local file source
+    M: int = 16
+        HNSW only: maximum number of neighbors per vector in the upper layers
+        of the graph (twice that in the bottom layer)
+    ef_construction: int = 200
+        HNSW only: width of the search used to find the neighbors of each
+        inserted vector
+    R: int = 64
+        VAMANA only: maximum number of neighbors per vector in the graph
+    L_build: int = 100
+        VAMANA only: length of the candidate list of the searches used to
+        find the neighbors of each inserted vector
+    alpha: float = 1.2
+        VAMANA only: pruning factor of the graph build; larger values keep
+        more long edges
     workers: int = -1
         number of workers for vector ingestion,
         if not provided, is auto-configured based on the dataset size
     input_vectors_per_work_item: int = -1
         number of vectors per ingestion work item,
         if not provided, is auto-configured
+    spill_dir: Optional[str]
+        IVF_FLAT LOCAL ingestion only: local directory for the intermediate
+        files written when the input does not fit in one work item (about as
+        large as the input). They are removed when ingestion finishes. If not
+        provided, the directory containing array_uri is used when it is
+        local, otherwise the system temporary directory
     verbose: bool
         verbose logging, defaults to False
     trace_id: Optional[str]
@@ -89,9 +137,29 @@ def ingest(
         "PARTIAL_WRITE_ARRAY_DIR"
     ]
     DEFAULT_ATTR_FILTERS = storage_formats[STORAGE_VERSION]["DEFAULT_ATTR_FILTERS"]
+    SQ8_ARRAY_NAME = storage_formats[STORAGE_VERSION]["SQ8_ARRAY_NAME"]
+    ID_POSITIONS_ARRAY_NAME = storage_formats[STORAGE_VERSION][
+        "ID_POSITIONS_ARRAY_NAME"
+    ]
+    PARTITION_STATS_ARRAY_NAME = storage_formats[STORAGE_VERSION][
+        "PARTITION_STATS_ARRAY_NAME"
+    ]
+    COARSE_CENTROIDS_ARRAY_NAME = storage_formats[STORAGE_VERSION][
+        "COARSE_CENTROIDS_ARRAY_NAME"
+    ]
+    COARSE_OFFSETS_ARRAY_NAME = storage_formats[STORAGE_VERSION][
+        "COARSE_OFFSETS_ARRAY_NAME"
+    ]
+    COARSE_MEMBERS_ARRAY_NAME = storage_formats[STORAGE_VERSION][
+        "COARSE_MEMBERS_ARRAY_NAME"
+    ]
+    # Indexes with at least this many partitions get a coarse quantizer
+    COARSE_MIN_PARTITIONS = 16384
     VECTORS_PER_WORK_ITEM = 20000000
     MAX_TASKS_PER_STAGE = 100
     CENTRALISED_KMEANS_MAX_SAMPLE_SIZE = 1000000
+    MINI_BATCH_KMEANS_BLOCK_SIZE = 1000000
+    MINI_BATCH_KMEANS_BATCH_SIZE = 10000
     DEFAULT_IMG_NAME = "3.9-vectorsearch"
 
     class SourceType(enum.Enum):
@@ -654,6 +722,200 @@ def ingest(
                     np.array(km.cluster_centers_)
                 )
 
+    def mini_batch_kmeans(
+        array_uri: str,
+        source_uri: str,
+        vector_type: np.dtype,
+        partitions: int,
+        dimensions: int,
+        training_sample_size: int,
+        threads: int,
+        max_iter: int = 10,
+        config: Optional[Mapping[str, Any]] = None,
+        verbose: bool = False,
+        trace_id: Optional[str] = None,
+    ):
+        from tiledb.vector_search.module import kmeans_mini_batch
+
+        with tiledb.scope_ctx(ctx_or_config=config):
+            logger = setup(config, verbose)
+            group = tiledb.Group(array_uri)
+            centroids_uri = group[CENTROIDS_ARRAY_NAME].uri
+            logger.debug("Start mini-batch kmeans training")
+            centroids = kmeans_mini_batch(
+                dtype=vector_type,
+                db_uri=source_uri,
+                dimensions=dimensions,
+                partitions=partitions,
+                max_iter=max_iter,
+                upper_bound=MINI_BATCH_KMEANS_BLOCK_SIZE,
+                batch_size=MINI_BATCH_KMEANS_BATCH_SIZE,
+                max_vectors=training_sample_size,
+                nthreads=threads,
+                config=config,
+            )
+            logger.debug("Writing centroids to array %s", centroids_uri)
+            with tiledb.open(centroids_uri, mode="w") as A:
+                A[0:dimensions, 0:partitions] = np.array(centroids)
+
+    # --------------------------------------------------------------------
+    # native ingestion
+    # --------------------------------------------------------------------
+    def native_ivf_ingest(
+        array_uri: str,
+        source_uri: str,
+        source_type: str,
+        vector_type: np.dtype,
+        size: int,
+        partitions: int,
+        copy_centroids_uri: str,
+        training_sample_size: int,
+        upper_bound: int,
+        threads: int,
+        max_iter: int = 10,
+        sq8: bool = False,
+        spill_dir: Optional[str] = None,
+        config: Optional[Mapping[str, Any]] = None,
+        verbose: bool = False,
+        trace_id: Optional[str] = None,
+    ):
+        """
+        Train, partition and shuffle the input vectors in a single C++ call,
+        writing straight into the final arrays.  Local files are memory mapped
+        rather than read through numpy.  With sq8, the vectors are written as
+        SQ8 codes and the codec parameters to a new array in the group.
+        """
+        from tiledb.vector_search.module import (
+            Ctx,
+            ivf_ingest,
+            build_id_positions,
+            build_partition_stats,
+            load_as_matrix,
+            read_vector_u64,
+        )
+
+        if copy_centroids_uri is not None:
+            copy_centroids(
+                array_uri=array_uri,
+                copy_centroids_uri=copy_centroids_uri,
+                config=config,
+                verbose=verbose,
+                trace_id=trace_id,
+            )
+        with tiledb.scope_ctx(ctx_or_config=config):
+            logger = setup(config, verbose)
+            group = tiledb.Group(array_uri)
+            sq8_uri = f"{array_uri}/{SQ8_ARRAY_NAME}" if sq8 else ""
+            if spill_dir is None:
+                # Next to the index, rather than in a temporary directory
+                # that may be too small for a copy of the input
+                spill_dir = (
+                    os.path.dirname(os.path.abspath(array_uri))
+                    if "://" not in array_uri
+                    else ""
+                )
+            coarse_uri = f"{array_uri}/coarse"
+            logger.debug("Start native ingestion, spilling to %s", spill_dir)
+            ingested = ivf_ingest(
+                dtype=vector_type,
+                source_uri=source_uri,
+                source_type=source_type,
+                centroids_uri=group[CENTROIDS_ARRAY_NAME].uri,
+                index_uri=group[INDEX_ARRAY_NAME].uri,
+                ids_uri=group[IDS_ARRAY_NAME].uri,
+                parts_uri=group[PARTS_ARRAY_NAME].uri,
+                size=size,
+                partitions=partitions,
+                training_sample_size=training_sample_size,
+                max_iter=max_iter,
+                upper_bound=upper_bound,
+                nthreads=threads,
+                train=copy_centroids_uri is None,
+                sq8_uri=sq8_uri,
+                spill_dir=spill_dir,
+                coarse_uri=coarse_uri,
+                coarse_min_partitions=COARSE_MIN_PARTITIONS,
+                config=config,
+            )
+            logger.debug("Ingested %d vectors", ingested)
+            ids_uri = group[IDS_ARRAY_NAME].uri
+            centroids_uri = group[CENTROIDS_ARRAY_NAME].uri
+            index_uri = group[INDEX_ARRAY_NAME].uri
+            parts_uri = group[PARTS_ARRAY_NAME].uri
+            group.close()
+
+            # Map from ids to positions, for fetching vectors by id
+            id_positions_uri = f"{array_uri}/{ID_POSITIONS_ARRAY_NAME}"
+            build_id_positions(Ctx(config), ids_uri, id_positions_uri)
+
+            # Partition statistics, for skipping partitions at query time
+            partition_stats_uri = f"{array_uri}/{PARTITION_STATS_ARRAY_NAME}"
+            build_partition_stats(
+                dtype=np.dtype(np.uint8) if sq8 else vector_type,
+                parts_uri=parts_uri,
+                centroids_db=load_as_matrix(centroids_uri, config=config),
+                indices=read_vector_u64(Ctx(config), index_uri),
+                stats_uri=partition_stats_uri,
+                memory_budget=upper_bound,
+                nthreads=threads,
+                ctx=Ctx(config),
+            )
+
+            group = tiledb.Group(array_uri, "w")
+            group.add(id_positions_uri, name=ID_POSITIONS_ARRAY_NAME)
+            group.add(partition_stats_uri, name=PARTITION_STATS_ARRAY_NAME)
+            if sq8:
+                group.add(sq8_uri, name=SQ8_ARRAY_NAME)
+                group.meta["codec"] = "SQ8"
+            if partitions >= COARSE_MIN_PARTITIONS:
+                group.add(f"{coarse_uri}_centroids", name=COARSE_CENTROIDS_ARRAY_NAME)
+                group.add(f"{coarse_uri}_offsets", name=COARSE_OFFSETS_ARRAY_NAME)
+                group.add(f"{coarse_uri}_members", name=COARSE_MEMBERS_ARRAY_NAME)
+            group.close()
+
+    def native_ivf_pq_ingest(
+        array_uri: str,
+        source_uri: str,
+        source_type: str,
+        vector_type: np.dtype,
+        size: int,
+        partitions: int,
+        num_subspaces: int,
+        num_bits: int,
+        training_sample_size: int,
+        upper_bound: int,
+        threads: int,
+        max_iter: int = 10,
+        config: Optional[Mapping[str, Any]] = None,
+        verbose: bool = False,
+        trace_id: Optional[str] = None,
+    ):
+        """
+        Train, encode and write an IVF_PQ index in a single C++ call, which
+        also creates the group.
+        """
+        from tiledb.vector_search.module import ivf_pq_ingest
+
+        with tiledb.scope_ctx(ctx_or_config=config):
+            logger = setup(config, verbose)
+            logger.debug("Start native IVF_PQ ingestion")
+            ingested = ivf_pq_ingest(
+                dtype=vector_type,
+                source_uri=source_uri,
+                source_type=source_type,
+                index_uri=array_uri,
+                size=size,
+                partitions=partitions,
+                num_subspaces=num_subspaces,
+                num_bits=num_bits,
+                training_sample_size=training_sample_size,
+                max_iter=max_iter,
+                upper_bound=upper_bound,
+                nthreads=threads,
+                config=config,
+            )
+            logger.debug("Ingested %d vectors", ingested)
+
     # --------------------------------------------------------------------
     # distributed kmeans UDFs
     # --------------------------------------------------------------------
@@ -1223,6 +1485,23 @@ def ingest(
                         resources={"cpu": "8", "memory": "32Gi"},
                         image_name=DEFAULT_IMG_NAME,
                     )
+                elif source_type == "TILEDB_ARRAY":
+                    centroids_node = submit(
+                        mini_batch_kmeans,
+                        array_uri=array_uri,
+                        source_uri=source_uri,
+                        vector_type=vector_type,
+                        partitions=partitions,
+                        dimensions=dimensions,
+                        training_sample_size=training_sample_size,
+                        threads=threads,
+                        config=config,
+                        verbose=verbose,
+                        trace_id=trace_id,
+                        name="mini-batch-kmeans",
+                        resources={"cpu": str(threads), "memory": "16Gi"},
+                        image_name=DEFAULT_IMG_NAME,
+                    )
                 else:
                     internal_centroids_node = submit(
                         init_centroids,
@@ -1398,6 +1677,123 @@ def ingest(
     with tiledb.scope_ctx(ctx_or_config=config):
         logger = setup(config, verbose)
         logger.debug("Ingesting Vectors into %r", array_uri)
+        if index_type == "HNSW":
+            # The graph is built in memory by native ingestion
+            if mode != Mode.LOCAL or not (
+                source_type == "TILEDB_ARRAY"
+                or (
+                    source_type in ("U8BIN", "F32BIN", "FVEC", "BVEC")
+                    and "://" not in source_uri
+                )
+            ):
+                raise ValueError(
+                    "HNSW ingestion requires LOCAL mode and a TileDB array "
+                    "or local file source"
+                )
+            in_size, dimensions, vector_type = read_source_metadata(
+                source_uri=source_uri, source_type=source_type, logger=logger
+            )
+            if size == -1 or size > in_size:
+                size = in_size
+            from tiledb.vector_search.module import hnsw_ingest
+
+            ingested = hnsw_ingest(
+                dtype=vector_type,
+                source_uri=source_uri,
+                source_type=source_type,
+                index_uri=array_uri,
+                size=size,
+                M=M,
+                ef_construction=ef_construction,
+                nthreads=multiprocessing.cpu_count(),
+                config=config,
+            )
+            logger.debug("Ingested %d vectors", ingested)
+            return HNSWIndex(uri=array_uri, config=config)
+
+        if index_type == "VAMANA":
+            # The graph is built in memory by native ingestion
+            if mode != Mode.LOCAL or not (
+                source_type == "TILEDB_ARRAY"
+                or (
+                    source_type in ("U8BIN", "F32BIN", "FVEC", "BVEC")
+                    and "://" not in source_uri
+                )
+            ):
+                raise ValueError(
+                    "VAMANA ingestion requires LOCAL mode and a TileDB array "
+                    "or local file source"
+                )
+            in_size, dimensions, vector_type = read_source_metadata(
+                source_uri=source_uri, source_type=source_type, logger=logger
+            )
+            if size == -1 or size > in_size:
+                size = in_size
+            if input_vectors_per_work_item == -1:
+                input_vectors_per_work_item = VECTORS_PER_WORK_ITEM
+            from tiledb.vector_search.module import vamana_ingest
+
+            ingested = vamana_ingest(
+                dtype=vector_type,
+                source_uri=source_uri,
+                source_type=source_type,
+                index_uri=array_uri,
+                size=size,
+                R=R,
+                L_build=L_build,
+                alpha=alpha,
+                num_subspaces=max(num_subspaces, 0),
+                memory_budget=input_vectors_per_work_item,
+                nthreads=multiprocessing.cpu_count(),
+                config=config,
+            )
+            logger.debug("Ingested %d vectors", ingested)
+            return VamanaIndex(uri=array_uri, config=config)
+
+        if index_type == "IVF_PQ":
+            # Only supported by native ingestion, which writes the whole group
+            if mode != Mode.LOCAL or not (
+                source_type == "TILEDB_ARRAY"
+                or (
+                    source_type in ("U8BIN", "F32BIN", "FVEC", "BVEC")
+                    and "://" not in source_uri
+                )
+            ):
+                raise ValueError(
+                    "IVF_PQ ingestion requires LOCAL mode and a TileDB array "
+                    "or local file source"
+                )
+            in_size, dimensions, vector_type = read_source_metadata(
+                source_uri=source_uri, source_type=source_type, logger=logger
+            )
+            if size == -1 or size > in_size:
+                size = in_size
+            if partitions == -1:
+                partitions = int(math.sqrt(size))
+            if training_sample_size == -1:
+                training_sample_size = min(size, 100 * partitions)
+            if num_subspaces == -1:
+                num_subspaces = max(1, dimensions // 8)
+            if input_vectors_per_work_item == -1:
+                input_vectors_per_work_item = VECTORS_PER_WORK_ITEM
+            native_ivf_pq_ingest(
+                array_uri=array_uri,
+                source_uri=source_uri,
+                source_type=source_type,
+                vector_type=vector_type,
+                size=size,
+                partitions=partitions,
+                num_subspaces=num_subspaces,
+                num_bits=num_bits,
+                training_sample_size=training_sample_size,
+                upper_bound=max(input_vectors_per_work_item, training_sample_size),
+                threads=multiprocessing.cpu_count(),
+                config=config,
+                verbose=verbose,
+                trace_id=trace_id,
+            )
+            return IVFPQIndex(uri=array_uri, config=config)
+
         try:
             tiledb.group_create(array_uri)
         except tiledb.TileDBError as err:
@@ -1434,6 +1830,21 @@ def ingest(
         group.meta["partitions"] = partitions
         group.meta["storage_version"] = STORAGE_VERSION
 
+        native_source = source_type == "TILEDB_ARRAY" or (
+            source_type in ("U8BIN", "F32BIN", "FVEC", "BVEC")
+            and "://" not in source_uri
+        )
+        if sq8 and (
+            index_type != "IVF_FLAT"
+            or vector_type != np.float32
+            or mode != Mode.LOCAL
+            or not native_source
+        ):
+            raise ValueError(
+                "SQ8 requires an IVF_FLAT index of float32 vectors, LOCAL mode "
+                "and a TileDB array or local file source"
+            )
+
         if input_vectors_per_work_item == -1:
             input_vectors_per_work_item = VECTORS_PER_WORK_ITEM
         input_vectors_work_items = int(math.ceil(size / input_vectors_per_work_item))
@@ -1484,37 +1895,57 @@ def ingest(
             dimensions=dimensions,
             partitions=partitions,
             input_vectors_work_tasks=input_vectors_work_tasks,
-            vector_type=vector_type,
+            vector_type=np.dtype(np.uint8) if sq8 else vector_type,
             logger=logger,
         )
         group.close()
 
-        logger.debug("Creating ingestion graph")
-        d = create_ingestion_dag(
-            index_type=index_type,
-            array_uri=array_uri,
-            source_uri=source_uri,
-            source_type=source_type,
-            vector_type=vector_type,
-            size=size,
-            partitions=partitions,
-            dimensions=dimensions,
-            copy_centroids_uri=copy_centroids_uri,
-            training_sample_size=training_sample_size,
-            input_vectors_per_work_item=input_vectors_per_work_item,
-            input_vectors_work_items_per_worker=input_vectors_work_items_per_worker,
-            table_partitions_per_work_item=table_partitions_per_work_item,
-            table_partitions_work_items_per_worker=table_partitions_work_items_per_worker,
-            workers=workers,
-            config=config,
-            verbose=verbose,
-            trace_id=trace_id,
-            mode=mode,
-        )
-        logger.debug("Submitting ingestion graph")
-        d.compute()
-        logger.debug("Submitted ingestion graph")
-        d.wait()
+        if index_type == "IVF_FLAT" and mode == Mode.LOCAL and native_source:
+            logger.debug("Ingesting natively")
+            native_ivf_ingest(
+                array_uri=array_uri,
+                source_uri=source_uri,
+                source_type=source_type,
+                vector_type=vector_type,
+                size=size,
+                partitions=partitions,
+                copy_centroids_uri=copy_centroids_uri,
+                training_sample_size=training_sample_size,
+                upper_bound=input_vectors_per_work_item,
+                threads=multiprocessing.cpu_count(),
+                sq8=sq8,
+                spill_dir=spill_dir,
+                config=config,
+                verbose=verbose,
+                trace_id=trace_id,
+            )
+        else:
+            logger.debug("Creating ingestion graph")
+            d = create_ingestion_dag(
+                index_type=index_type,
+                array_uri=array_uri,
+                source_uri=source_uri,
+                source_type=source_type,
+                vector_type=vector_type,
+                size=size,
+                partitions=partitions,
+                dimensions=dimensions,
+                copy_centroids_uri=copy_centroids_uri,
+                training_sample_size=training_sample_size,
+                input_vectors_per_work_item=input_vectors_per_work_item,
+                input_vectors_work_items_per_worker=input_vectors_work_items_per_worker,
+                table_partitions_per_work_item=table_partitions_per_work_item,
+                table_partitions_work_items_per_worker=table_partitions_work_items_per_worker,
+                workers=workers,
+                config=config,
+                verbose=verbose,
+                trace_id=trace_id,
+                mode=mode,
+            )
+            logger.debug("Submitting ingestion graph")
+            d.compute()
+            logger.debug("Submitted ingestion graph")
+            d.wait()
         consolidate_and_vacuum(array_uri=array_uri, config=config)
 
         if index_type == "FLAT":
@@ -6,8 +6,14 @@
 
 #include "linalg.h"
 #include "ivf_index.h"
+#include "ivf_pq_index.h"
+#include "hnsw_index.h"
+#include "vamana_index.h"
 #include "ivf_query.h"
+#include "detail/ivf/ingest.h"
+#include "detail/ivf/rerank.h"
 #include "flat_query.h"
+#include "flat_index.h"
 
 namespace py = pybind11;
 using Ctx = tiledb::Context;
@@ -269,6 +275,941 @@ static void declare_ivf_index_tdb(py::module& m, const std::string& suffix) {
         }, py::keep_alive<1,2>());
 }
 
+template <typename T>
+static void declare_kmeans_mini_batch(py::module& m, const std::string& suffix) {
+  m.def(("kmeans_mini_batch_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+        const std::string& db_uri,
+        size_t dimension,
+        size_t nlist,
+        size_t max_iter,
+        double tol,
+        size_t upper_bound,
+        size_t batch_size,
+        size_t max_vectors,
+        size_t nthreads) -> ColMajorMatrix<float> {
+            auto index = kmeans_index<float, uint64_t, uint64_t>(
+                dimension, nlist, max_iter, tol, nthreads);
+            index.template train_mini_batch<T>(
+                ctx, db_uri, upper_bound, batch_size, max_vectors);
+            return std::move(index.get_centroids());
+        }, py::keep_alive<1,2>());
+}
+
+/**
+ * Map the source types used by Python ingestion to file formats.
+ */
+static vecs_format source_type_to_vecs_format(const std::string& source_type) {
+  if (source_type == "FVEC") {
+    return vecs_format::fvecs;
+  } else if (source_type == "IVEC") {
+    return vecs_format::ivecs;
+  } else if (source_type == "BVEC") {
+    return vecs_format::bvecs;
+  } else if (source_type == "U8BIN") {
+    return vecs_format::u8bin;
+  } else if (source_type == "F32BIN") {
+    return vecs_format::f32bin;
+  }
+  throw std::runtime_error("Unsupported source type " + source_type);
+}
+
+template <typename T>
+static void declare_ivf_ingest(py::module& m, const std::string& suffix) {
+  m.def(("ivf_ingest_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+        const std::string& source_uri,
+        const std::string& source_type,
+        const std::string& centroids_uri,
+        const std::string& index_uri,
+        const std::string& ids_uri,
+        const std::string& parts_uri,
+        size_t size,
+        size_t nlist,
+        size_t training_sample_size,
+        size_t max_iter,
+        double tol,
+        size_t upper_bound,
+        size_t nthreads,
+        bool train,
+        const std::string& sq8_uri,
+        const std::string& spill_dir,
+        double max_partition_factor,
+        const std::string& coarse_uri,
+        size_t coarse_min_nlist) -> size_t {
+            auto ingest = [&](auto&& make_source) {
+              return detail::ivf::ivf_ingest<T, uint64_t, uint64_t, float>(
+                  ctx,
+                  make_source,
+                  centroids_uri,
+                  index_uri,
+                  ids_uri,
+                  parts_uri,
+                  size,
+                  nlist,
+                  training_sample_size,
+                  max_iter,
+                  tol,
+                  nthreads,
+                  train,
+                  sq8_uri,
+                  spill_dir,
+                  max_partition_factor,
+                  coarse_uri,
+                  coarse_min_nlist);
+            };
+            if (source_type == "TILEDB_ARRAY") {
+              return ingest([&]() {
+                return tdbColMajorMatrix<T>(ctx, source_uri, upper_bound);
+              });
+            }
+            auto format = source_type_to_vecs_format(source_type);
+            return ingest([&]() {
+              return mmapColMajorMatrix<T>(source_uri, format, upper_bound);
+            });
+        }, py::keep_alive<1,2>());
+}
+
+template <typename T>
+static void declare_ivf_pq(py::module& m, const std::string& suffix) {
+  using Index = ivf_pq_index<T, uint64_t, uint64_t>;
+
+  m.def(("ivf_pq_ingest_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+        const std::string& source_uri,
+        const std::string& source_type,
+        const std::string& index_uri,
+        size_t size,
+        size_t nlist,
+        size_t num_subspaces,
+        size_t num_bits,
+        size_t training_sample_size,
+        size_t max_iter,
+        double tol,
+        size_t upper_bound,
+        size_t nthreads) -> size_t {
+            auto ingest = [&](auto&& make_source) {
+              // Train with (at most) the first block of source vectors
+              auto db = make_source();
+              if (!db.load()) {
+                throw std::runtime_error("Source is empty");
+              }
+              auto num_train = db.num_cols();
+              if (size != 0) {
+                num_train = std::min(num_train, size);
+              }
+              if (training_sample_size != 0) {
+                num_train = std::min(num_train, training_sample_size);
+              }
+              auto sample = ColMajorMatrix<T>(db.num_rows(), num_train);
+              std::copy(
+                  db.data(), db.data() + db.num_rows() * num_train, sample.data());
+
+              auto index = Index(
+                  db.num_rows(),
+                  nlist,
+                  num_subspaces,
+                  max_iter,
+                  tol,
+                  nthreads,
+                  num_bits);
+              index.train(sample);
+              auto num_added = index.add_blocked(make_source, size);
+              index.save(ctx, index_uri);
+              return num_added;
+            };
+            if (source_type == "TILEDB_ARRAY") {
+              return ingest([&]() {
+                return tdbColMajorMatrix<T>(ctx, source_uri, upper_bound);
+              });
+            }
+            auto format = source_type_to_vecs_format(source_type);
+            return ingest([&]() {
+              return mmapColMajorMatrix<T>(source_uri, format, upper_bound);
+            });
+        }, py::keep_alive<1,2>());
+
+  py::class_<Index>(m, ("IVFPQIndex_" + suffix).c_str())
+      .def(py::init<size_t, size_t, size_t, size_t, double, size_t, size_t>(),
+           py::arg("dimension"),
+           py::arg("nlist"),
+           py::arg("num_subspaces"),
+           py::arg("max_iter") = 10,
+           py::arg("tol") = 1e-4,
+           py::arg("nthreads") = 0,
+           py::arg("num_bits") = 8)
+      .def("load", &Index::load,
+           py::arg("ctx"),
+           py::arg("uri"),
+           py::arg("load_codes") = true)
+      .def("search",
+           [](Index& index,
+              const ColMajorMatrix<float>& query,
+              size_t nprobe,
+              size_t k_nn,
+              size_t nthreads) -> ColMajorMatrix<size_t> {
+             index.set_nthreads(nthreads);
+             return index.search(query, nprobe, k_nn);
+           })
+      .def("search_finite_ram",
+           [](Index& index,
+              tiledb::Context& ctx,
+              const ColMajorMatrix<float>& query,
+              size_t nprobe,
+              size_t k_nn,
+              size_t upper_bound,
+              size_t nthreads) -> ColMajorMatrix<size_t> {
+             index.set_nthreads(nthreads);
+             return index.search_finite_ram(ctx, query, nprobe, k_nn, upper_bound);
+           })
+      .def_property_readonly("dimension", &Index::dimension)
+      .def_property_readonly("num_subspaces", &Index::num_subspaces)
+      .def_property_readonly("num_bits", &Index::num_bits);
+}
+
+template <typename T>
+static void declare_hnsw(py::module& m, const std::string& suffix) {
+  using Index = hnsw_index<T, uint64_t>;
+
+  m.def(("hnsw_ingest_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+        const std::string& source_uri,
+        const std::string& source_type,
+        const std::string& index_uri,
+        size_t size,
+        size_t M,
+        size_t ef_construction,
+        size_t nthreads) -> size_t {
+            // The graph is built in memory, so read the source in one block
+            auto build = [&](auto&& db) {
+              if (!db.load()) {
+                throw std::runtime_error("Source is empty");
+              }
+              auto index = Index(db.num_rows(), M, ef_construction, nthreads);
+              index.add(db);
+              index.save(ctx, index_uri);
+              return index.num_vectors();
+            };
+            if (source_type == "TILEDB_ARRAY") {
+              return build(tdbColMajorMatrix<T>(ctx, source_uri, size));
+            }
+            auto format = source_type_to_vecs_format(source_type);
+            return build(mmapColMajorMatrix<T>(source_uri, format, size));
+        }, py::keep_alive<1,2>());
+
+  py::class_<Index>(m, ("HNSWIndex_" + suffix).c_str())
+      .def(py::init<size_t, size_t, size_t, size_t>(),
+           py::arg("dimension"),
+           py::arg("M") = 16,
+           py::arg("ef_construction") = 200,
+           py::arg("nthreads") = 0)
+      .def("add",
+           [](Index& index,
+              const ColMajorMatrix<T>& vectors,
+              const std::vector<uint64_t>& ids) { index.add(vectors, ids); })
+      .def("save", &Index::save)
+      .def("load", &Index::load)
+      .def("search",
+           [](Index& index,
+              const ColMajorMatrix<float>& query,
+              size_t k_nn,
+              size_t ef_search,
+              size_t nthreads) -> ColMajorMatrix<size_t> {
+             index.set_nthreads(nthreads);
+             if (ef_search != 0) {
+               index.set_ef_search(ef_search);
+             }
+             return index.search(query, k_nn);
+           })
+      .def_property("ef_search", &Index::ef_search, &Index::set_ef_search)
+      .def_property_readonly("dimension", &Index::dimension)
+      .def_property_readonly("M", &Index::M)
+      .def_property_readonly("ef_construction", &Index::ef_construction)
+      .def("__len__", &Index::num_vectors);
+}
+
+template <typename T>
+static void declare_vamana(py::module& m, const std::string& suffix) {
+  using Index = vamana_index<T, uint64_t>;
+
+  m.def(("vamana_ingest_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+        const std::string& source_uri,
+        const std::string& source_type,
+        const std::string& index_uri,
+        size_t size,
+        size_t R,
+        size_t L_build,
+        float alpha,
+        size_t num_subspaces,
+        size_t upper_bound,
+        size_t nthreads) -> size_t {
+            auto ingest = [&](auto&& make_source) {
+              auto db = make_source();
+              if (!db.load()) {
+                throw std::runtime_error("Source is empty");
+              }
+              auto index = Index(
+                  db.num_rows(), R, L_build, alpha, num_subspaces, nthreads);
+              auto num_added = index.add_blocked(make_source, size);
+              index.save(ctx, index_uri);
+              return num_added;
+            };
+            if (source_type == "TILEDB_ARRAY") {
+              return ingest([&]() {
+                return tdbColMajorMatrix<T>(ctx, source_uri, upper_bound);
+              });
+            }
+            auto format = source_type_to_vecs_format(source_type);
+            return ingest([&]() {
+              return mmapColMajorMatrix<T>(source_uri, format, upper_bound);
+            });
+        }, py::keep_alive<1,2>());
+
+  py::class_<Index>(m, ("VamanaIndex_" + suffix).c_str())
+      .def(py::init<size_t, size_t, size_t, float, size_t, size_t>(),
+           py::arg("dimension"),
+           py::arg("R") = 64,
+           py::arg("L_build") = 100,
+           py::arg("alpha") = 1.2f,
+           py::arg("num_subspaces") = 0,
+           py::arg("nthreads") = 0)
+      .def("add",
+           [](Index& index,
+              const ColMajorMatrix<T>& vectors,
+              const std::vector<uint64_t>& ids) { index.add(vectors, ids); })
+      .def("save", &Index::save)
+      .def("load", &Index::load)
+      .def("search",
+           [](Index& index,
+              tiledb::Context& ctx,
+              const ColMajorMatrix<float>& query,
+              size_t k_nn,
+              size_t search_list_size,
+              size_t beam_width,
+              size_t nthreads) -> ColMajorMatrix<size_t> {
+             index.set_nthreads(nthreads);
+             if (search_list_size != 0) {
+               index.set_search_list_size(search_list_size);
+             }
+             if (beam_width != 0) {
+               index.set_beam_width(beam_width);
+             }
+             return index.search_finite_ram(ctx, query, k_nn);
+           })
+      .def_property(
+          "search_list_size",
+          &Index::search_list_size,
+          &Index::set_search_list_size)
+      .def_property("beam_width", &Index::beam_width, &Index::set_beam_width)
+      .def_property_readonly("dimension", &Index::dimension)
+      .def_property_readonly("R", &Index::R)
+      .def_property_readonly("L_build", &Index::L_build)
+      .def_property_readonly("alpha", &Index::alpha)
+      .def_property_readonly("num_subspaces", &Index::num_subspaces)
+      .def("__len__", &Index::num_vectors);
+}
+
+static void declare_id_position_map(py::module& m) {
+  using IdPositionMap = detail::ivf::id_position_map<uint64_t>;
+
+  py::class_<IdPositionMap>(m, "IdPositionMap")
+      .def(py::init<const tiledb::Context&, const std::string&>())
+      .def("__len__", &IdPositionMap::size)
+      .def("find", &IdPositionMap::find);
+
+  m.def("build_id_positions",
+      [](tiledb::Context& ctx,
+         const std::string& ids_uri,
+         const std::string& positions_uri) {
+        auto ids = read_vector<uint64_t>(ctx, ids_uri);
+        IdPositionMap(ids).save(ctx, positions_uri);
+      });
+}
+
+// The candidates of query j are
+// candidate_ids[candidate_offsets[j] : candidate_offsets[j+1]]
+static auto rerank_candidates(
+    const ColMajorMatrix<float>& query,
+    py::array_t<uint64_t, py::array::c_style> candidate_ids,
+    py::array_t<uint64_t, py::array::c_style> candidate_offsets) {
+  auto ids = candidate_ids.data();
+  auto offsets = candidate_offsets.data();
+  if (static_cast<size_t>(candidate_offsets.size()) != query.num_cols() + 1) {
+    throw std::runtime_error("Need one candidate offset per query + 1");
+  }
+  std::vector<std::span<const uint64_t>> candidates;
+  for (size_t j = 0; j < query.num_cols(); ++j) {
+    if (offsets[j] > offsets[j + 1] ||
+        offsets[j + 1] > static_cast<size_t>(candidate_ids.size())) {
+      throw std::runtime_error("Invalid candidate offsets");
+    }
+    candidates.emplace_back(ids + offsets[j], offsets[j + 1] - offsets[j]);
+  }
+  return candidates;
+}
+
+template <typename T>
+static void declare_rerank(py::module& m, const std::string& suffix) {
+  m.def(("rerank_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const detail::ivf::id_position_map<uint64_t>& map,
+         const ColMajorMatrix<float>& query,
+         py::array_t<uint64_t, py::array::c_style> candidate_ids,
+         py::array_t<uint64_t, py::array::c_style> candidate_offsets,
+         size_t k_nn,
+         size_t nthreads,
+         size_t max_gap)
+          -> std::tuple<ColMajorMatrix<float>, ColMajorMatrix<size_t>> {
+        auto candidates =
+            rerank_candidates(query, candidate_ids, candidate_offsets);
+        return detail::ivf::rerank<T>(
+            ctx, parts_uri, map, query, candidates, k_nn, nthreads, max_gap);
+      });
+
+  m.def(("live_rerank_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const detail::ivf::id_position_map<uint64_t>& map,
+         const ColMajorMatrix<float>& query,
+         py::array_t<uint64_t, py::array::c_style> candidate_ids,
+         py::array_t<uint64_t, py::array::c_style> candidate_offsets,
+         const id_bitmap& deleted,
+         size_t k_nn,
+         size_t nthreads,
+         size_t max_gap)
+          -> std::tuple<ColMajorMatrix<float>, ColMajorMatrix<size_t>> {
+        auto candidates =
+            rerank_candidates(query, candidate_ids, candidate_offsets);
+        return detail::ivf::rerank<T>(
+            ctx,
+            parts_uri,
+            map,
+            query,
+            candidates,
+            k_nn,
+            nthreads,
+            max_gap,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+}
+
+static void declare_binary_codes(py::module& m) {
+  using BinaryCodes = detail::ivf::binary_codes;
+
+  py::class_<BinaryCodes>(m, "BinaryCodes")
+      .def(py::init<
+           const tiledb::Context&,
+           const std::string&,
+           const std::string&>())
+      .def("__len__", &BinaryCodes::num_vectors)
+      .def("save", &BinaryCodes::save);
+}
+
+template <typename T>
+static void declare_binary_prefilter(py::module& m, const std::string& suffix) {
+  m.def(("build_binary_codes_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         size_t upper_bound,
+         size_t nthreads) {
+        return detail::ivf::build_binary_codes<T>(
+            ctx, parts_uri, upper_bound, nthreads);
+      });
+
+  m.def(("binary_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const detail::ivf::binary_codes& codes,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         size_t nprobe,
+         size_t k_nn,
+         size_t num_survivors,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::binary_query_infinite_ram(
+            parts,
+            codes,
+            centroids,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            num_survivors,
+            nthreads);
+      });
+}
+
+static void declare_partition_stats(py::module& m) {
+  using PartitionStats = detail::ivf::partition_stats;
+
+  py::class_<PartitionStats>(m, "PartitionStats")
+      .def(py::init<const tiledb::Context&, const std::string&>())
+      .def("__len__", &PartitionStats::num_partitions)
+      .def("save", &PartitionStats::save);
+}
+
+template <typename T>
+static void declare_partition_pruning(py::module& m, const std::string& suffix) {
+  m.def(("compute_partition_stats_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         std::vector<uint64_t>& indices,
+         size_t nthreads) {
+        return detail::ivf::partition_stats::compute(
+            parts, centroids, indices, nthreads);
+      });
+
+  m.def(("build_partition_stats_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const ColMajorMatrix<float>& centroids,
+         std::vector<uint64_t>& indices,
+         size_t upper_bound,
+         size_t nthreads) {
+        return detail::ivf::build_partition_stats<T>(
+            ctx, parts_uri, centroids, indices, upper_bound, nthreads);
+      });
+
+  m.def(("pruned_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         const detail::ivf::partition_stats& stats,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         size_t nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::pruned_query_infinite_ram(
+            parts,
+            centroids,
+            stats,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nthreads);
+      });
+
+  m.def(("pruned_query_finite_ram_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const ColMajorMatrix<float>& centroids,
+         const detail::ivf::partition_stats& stats,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         const std::string& ids_uri,
+         size_t nprobe,
+         size_t k_nn,
+         size_t upper_bound,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::pruned_query_finite_ram<T, uint64_t>(
+            ctx,
+            parts_uri,
+            centroids,
+            stats,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            upper_bound,
+            nthreads);
+      });
+
+  m.def(("adaptive_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         const detail::ivf::partition_stats& stats,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         size_t max_nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::adaptive_query_infinite_ram(
+            parts,
+            centroids,
+            stats,
+            query_vectors,
+            indices,
+            ids,
+            max_nprobe,
+            k_nn,
+            nthreads);
+      });
+}
+
+static void declare_id_bitmap(py::module& m) {
+  py::class_<id_bitmap>(m, "IdBitmap")
+      .def(py::init([](py::array_t<uint64_t, py::array::c_style> ids) {
+        auto bitmap = id_bitmap{};
+        auto data = ids.data();
+        for (py::ssize_t i = 0; i < ids.size(); ++i) {
+          bitmap.set(data[i]);
+        }
+        return bitmap;
+      }))
+      .def(py::init([](const tiledb::Context& ctx, const std::string& uri) {
+        return read_id_bitmap(ctx, uri);
+      }))
+      .def("__len__", &id_bitmap::count)
+      .def("__contains__", &id_bitmap::contains)
+      .def("ids",
+           [](const id_bitmap& bitmap) {
+             auto ids = bitmap.ids();
+             return py::array_t<uint64_t>(ids.size(), ids.data());
+           })
+      .def("write",
+           [](const id_bitmap& bitmap,
+              const tiledb::Context& ctx,
+              const std::string& uri) { write_id_bitmap(ctx, bitmap, uri); })
+      .def("update",
+           [](id_bitmap& bitmap,
+              const tiledb::Context& ctx,
+              py::array_t<uint64_t, py::array::c_style> ids,
+              const std::string& uri) {
+             auto data = ids.data();
+             auto v = std::vector<uint64_t>(data, data + ids.size());
+             return update_id_bitmap(ctx, bitmap, v, uri);
+           });
+}
+
+static void declare_coarse_quantizer(py::module& m) {
+  using CoarseQuantizer = detail::ivf::coarse_quantizer<float, uint64_t>;
+
+  py::class_<CoarseQuantizer>(m, "CoarseQuantizer")
+      .def(py::init<
+           const tiledb::Context&,
+           const std::string&,
+           const std::string&,
+           const std::string&>())
+      .def("__len__", &CoarseQuantizer::num_fine)
+      .def_property(
+          "nprobe", &CoarseQuantizer::nprobe, &CoarseQuantizer::set_nprobe);
+}
+
+template <typename T>
+static void declare_coarse_query(py::module& m, const std::string& suffix) {
+  using CoarseQuantizer = detail::ivf::coarse_quantizer<float, uint64_t>;
+
+  m.def(("coarse_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const CoarseQuantizer& quantizer,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         size_t nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::coarse_query_infinite_ram(
+            parts,
+            quantizer,
+            centroids,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nthreads,
+            [](auto&&) { return true; });
+      });
+
+  m.def(("coarse_query_finite_ram_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const CoarseQuantizer& quantizer,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         const std::string& ids_uri,
+         size_t nprobe,
+         size_t k_nn,
+         size_t upper_bound,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::coarse_query_finite_ram<T, uint64_t>(
+            ctx,
+            parts_uri,
+            quantizer,
+            centroids,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            upper_bound,
+            nthreads,
+            [](auto&&) { return true; });
+      });
+
+  m.def(("live_coarse_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const CoarseQuantizer& quantizer,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::coarse_query_infinite_ram(
+            parts,
+            quantizer,
+            centroids,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+
+  m.def(("live_coarse_query_finite_ram_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const CoarseQuantizer& quantizer,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         const std::string& ids_uri,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         size_t upper_bound,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::coarse_query_finite_ram<T, uint64_t>(
+            ctx,
+            parts_uri,
+            quantizer,
+            centroids,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            upper_bound,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+}
+
+template <typename T>
+static void declare_live_query(py::module& m, const std::string& suffix) {
+  m.def(("live_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         bool nth,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::qv_query_heap_infinite_ram(
+            parts,
+            centroids,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nth,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+
+  m.def(("live_query_finite_ram_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         const std::string& ids_uri,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         size_t upper_bound,
+         bool nth,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::qv_query_heap_finite_ram<T, uint64_t>(
+            ctx,
+            parts_uri,
+            centroids,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            upper_bound,
+            nth,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+
+  m.def(("live_binary_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const detail::ivf::binary_codes& codes,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         size_t num_survivors,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::binary_query_infinite_ram(
+            parts,
+            codes,
+            centroids,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            num_survivors,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+
+  m.def(("live_pruned_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         const detail::ivf::partition_stats& stats,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::pruned_query_infinite_ram(
+            parts,
+            centroids,
+            stats,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+
+  m.def(("live_pruned_query_finite_ram_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const ColMajorMatrix<float>& centroids,
+         const detail::ivf::partition_stats& stats,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         const std::string& ids_uri,
+         const id_bitmap& deleted,
+         size_t nprobe,
+         size_t k_nn,
+         size_t upper_bound,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::pruned_query_finite_ram<T, uint64_t>(
+            ctx,
+            parts_uri,
+            centroids,
+            stats,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            upper_bound,
+            nthreads,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+
+  m.def(("live_adaptive_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         const detail::ivf::partition_stats& stats,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         const id_bitmap& deleted,
+         size_t max_nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::adaptive_query_infinite_ram(
+            parts,
+            centroids,
+            stats,
+            query_vectors,
+            indices,
+            ids,
+            max_nprobe,
+            k_nn,
+            nthreads,
+            nullptr,
+            [&deleted](auto&& id) { return !deleted.contains(id); });
+      });
+}
+
+template <typename T>
+static void declare_filtered_query(py::module& m, const std::string& suffix) {
+  m.def(("filtered_query_infinite_ram_" + suffix).c_str(),
+      [](const ColMajorMatrix<T>& parts,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         std::vector<uint64_t>& ids,
+         const id_bitmap& filter,
+         size_t nprobe,
+         size_t k_nn,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::filtered_query_infinite_ram(
+            parts,
+            centroids,
+            query_vectors,
+            indices,
+            ids,
+            filter,
+            nprobe,
+            k_nn,
+            nthreads);
+      });
+
+  m.def(("filtered_query_finite_ram_" + suffix).c_str(),
+      [](tiledb::Context& ctx,
+         const std::string& parts_uri,
+         const ColMajorMatrix<float>& centroids,
+         const ColMajorMatrix<float>& query_vectors,
+         std::vector<uint64_t>& indices,
+         const std::string& ids_uri,
+         const id_bitmap& filter,
+         size_t nprobe,
+         size_t k_nn,
+         size_t upper_bound,
+         size_t nthreads) -> ColMajorMatrix<size_t> {
+        return detail::ivf::filtered_query_finite_ram<T, uint64_t>(
+            ctx,
+            parts_uri,
+            centroids,
+            query_vectors,
+            indices,
+            ids_uri,
+            filter,
+            nprobe,
+            k_nn,
+            upper_bound,
+            nthreads);
+      });
+}
+
 template <class T=float, class U=size_t>
 static void declareFixedMinPairHeap(py::module& mod) {
   using PyFixedMinPairHeap = py::class_<fixed_min_pair_heap<T, U>>;
@@ -353,7 +1294,19 @@ void declarePartitionIvfIndex(py::module& m, const std::string& suffix) {
            ColMajorMatrix<T>& query,
            size_t nprobe,
            size_t nthreads) {
-          return detail::ivf::partition_ivf_index(centroids, query, nprobe, nthreads);
+          auto&& [active_partitions, active_queries] =
+              detail::ivf::partition_ivf_index(centroids, query, nprobe, nthreads);
+          // Python expects a list of queries per partition
+          using parts_type = typename std::remove_cvref_t<
+              decltype(active_partitions)>::value_type;
+          std::vector<std::vector<parts_type>> part_queries(
+              size(active_partitions));
+          for (size_t p = 0; p < size(active_partitions); ++p) {
+            part_queries[p].assign(
+                begin(active_queries[p]), end(active_queries[p]));
+          }
+          return std::make_tuple(
+              std::move(active_partitions), std::move(part_queries));
            }
         );
 }
@@ -395,6 +1348,37 @@ static void declare_vq_query_heap(py::module& m, const std::string& suffix) {
         });
 }
 
+template <typename T>
+static void declare_flat(py::module& m, const std::string& suffix) {
+  using Index = flat_index<T, uint64_t>;
+
+  py::class_<Index>(m, ("FlatIndex_" + suffix).c_str())
+      .def(py::init<
+               const tiledb::Context&,
+               const std::string&,
+               const std::string&,
+               size_t,
+               size_t>(),
+           py::arg("ctx"),
+           py::arg("uri"),
+           py::arg("ids_uri") = "",
+           py::arg("memory_budget") = 0,
+           py::arg("nthreads") = 0)
+      .def("search",
+           [](Index& index,
+              const ColMajorMatrix<float>& query,
+              size_t k_nn,
+              size_t nthreads) {
+             index.set_nthreads(nthreads);
+             return index.search(query, k_nn);
+           })
+      .def("set_deleted", &Index::set_deleted)
+      .def_property(
+          "memory_budget", &Index::memory_budget, &Index::set_memory_budget)
+      .def_property_readonly("dimension", &Index::dimension)
+      .def("__len__", &Index::num_vectors);
+}
+
 } // anonymous namespace
 
 
@@ -517,6 +1501,9 @@ PYBIND11_MODULE(_tiledbvspy, m) {
   declare_vq_query_heap<uint8_t>(m, "u8");
   declare_vq_query_heap<float>(m, "f32");
 
+  declare_flat<uint8_t>(m, "u8");
+  declare_flat<float>(m, "f32");
+
   declare_qv_query_heap_infinite_ram<uint8_t>(m, "u8");
   declare_qv_query_heap_infinite_ram<float>(m, "f32");
   declare_qv_query_heap_finite_ram<uint8_t>(m, "u8");
@@ -531,6 +1518,41 @@ PYBIND11_MODULE(_tiledbvspy, m) {
   declare_ivf_index_tdb<uint8_t>(m, "u8");
   declare_ivf_index_tdb<float>(m, "f32");
 
+  declare_kmeans_mini_batch<uint8_t>(m, "u8");
+  declare_kmeans_mini_batch<float>(m, "f32");
+
+  declare_ivf_ingest<uint8_t>(m, "u8");
+  declare_ivf_ingest<float>(m, "f32");
+
+  declare_ivf_pq<uint8_t>(m, "u8");
+  declare_ivf_pq<float>(m, "f32");
+
+  declare_hnsw<uint8_t>(m, "u8");
+  declare_hnsw<float>(m, "f32");
+
+  declare_vamana<uint8_t>(m, "u8");
+  declare_vamana<float>(m, "f32");
+
+  declare_id_position_map(m);
+  declare_rerank<uint8_t>(m, "u8");
+  declare_rerank<float>(m, "f32");
+
+  declare_binary_codes(m);
+  declare_binary_prefilter<uint8_t>(m, "u8");
+  declare_binary_prefilter<float>(m, "f32");
+
+  declare_partition_stats(m);
+  declare_partition_pruning<uint8_t>(m, "u8");
+  declare_partition_pruning<float>(m, "f32");
+  declare_id_bitmap(m);
+  declare_filtered_query<uint8_t>(m, "u8");
+  declare_filtered_query<float>(m, "f32");
+  declare_live_query<uint8_t>(m, "u8");
+  declare_live_query<float>(m, "f32");
+  declare_coarse_quantizer(m);
+  declare_coarse_query<uint8_t>(m, "u8");
+  declare_coarse_query<float>(m, "f32");
+
   declarePartitionIvfIndex<uint8_t>(m, "u8");
   declarePartitionIvfIndex<float>(m, "f32");
 
@@ -177,6 +177,451 @@ def ivf_index(
         raise TypeError("Unknown type!")
 
 
+def kmeans_mini_batch(
+    dtype: np.dtype,
+    db_uri: str,
+    dimensions: int,
+    partitions: int,
+    max_iter: int = 10,
+    tol: float = 1e-4,
+    upper_bound: int = 1000000,
+    batch_size: int = 10000,
+    max_vectors: int = 0,
+    nthreads: int = 8,
+    config: Dict = None,
+):
+    """
+    Train centroids with mini-batch k-means, streaming the training vectors
+    from a TileDB array rather than loading them all into memory
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    db_uri: str
+        URI of the array holding the training vectors
+    dimensions: int
+        Vector dimensions
+    partitions: int
+        Number of centroids to compute
+    max_iter: int
+        Maximum number of passes over the training vectors
+    tol: float
+        Relative centroid shift at which to stop iterating
+    upper_bound: int
+        Number of vectors to hold in memory at a time
+    batch_size: int
+        Number of vectors in each mini batch
+    max_vectors: int
+        Maximum number of training vectors to use, 0 to use all of them
+    nthreads: int
+        Number of threads
+    config: Dict
+        TileDB configuration parameters
+
+    Returns
+    -------
+    ColMajorMatrix_f32 with one centroid per column
+    """
+    if config is None:
+        ctx = Ctx({})
+    else:
+        ctx = Ctx(config)
+
+    args = tuple(
+        [
+            ctx,
+            db_uri,
+            dimensions,
+            partitions,
+            max_iter,
+            tol,
+            upper_bound,
+            batch_size,
+            max_vectors,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return kmeans_mini_batch_f32(*args)
+    elif dtype == np.uint8:
+        return kmeans_mini_batch_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def ivf_ingest(
+    dtype: np.dtype,
+    source_uri: str,
+    centroids_uri: str,
+    index_uri: str,
+    ids_uri: str,
+    parts_uri: str,
+    size: int = 0,
+    partitions: int = 0,
+    training_sample_size: int = 0,
+    max_iter: int = 10,
+    tol: float = 1e-4,
+    upper_bound: int = 1000000,
+    nthreads: int = 0,
+    train: bool = True,
+    source_type: str = "TILEDB_ARRAY",
+    sq8_uri: str = "",
+    spill_dir: str = "",
+    max_partition_factor: float = 0.0,
+    coarse_uri: str = "",
+    coarse_min_partitions: int = 16384,
+    config: Dict = None,
+):
+    """
+    Build an IVF_FLAT index from a TileDB array, or a local file in one of the
+    benchmark formats, in a single process: train the centroids, assign every
+    vector to a partition and write the shuffled vectors, ids and partition
+    index.  The output arrays must already exist.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    source_uri: str
+        URI of the array holding the input vectors, or path of a local file
+    centroids_uri: str
+        URI of the centroids array, output if train is True, input otherwise
+    index_uri: str
+        URI of the partition index array
+    ids_uri: str
+        URI of the shuffled ids array
+    parts_uri: str
+        URI of the shuffled vectors array
+    size: int
+        Number of input vectors to ingest, 0 to ingest all of them
+    partitions: int
+        Number of partitions to compute
+    training_sample_size: int
+        Number of vectors to train the centroids with, 0 to use all of them
+    max_iter: int
+        Maximum number of kmeans iterations
+    tol: float
+        Relative centroid shift at which to stop iterating
+    upper_bound: int
+        Number of input vectors to hold in memory at a time
+    nthreads: int
+        Number of threads, 0 to use all cores
+    train: bool
+        Whether to train the centroids or read them from centroids_uri
+    source_type: str
+        TILEDB_ARRAY, or the format of a local file (U8BIN, F32BIN, FVEC,
+        BVEC), which is memory mapped
+    sq8_uri: str
+        If not empty, the shuffled vectors are written as SQ8 codes to a uint8
+        parts array, the centroids are written in code space and the codec
+        parameters to a new array at this URI
+    spill_dir: str
+        Local directory under which the intermediate files are written when
+        the input does not fit in upper_bound vectors, empty to use the system
+        temporary directory.  They take about as much space as the input
+    max_partition_factor: float
+        If nonzero, no partition receives more than this multiple of the mean
+        partition size (computed per block of upper_bound vectors)
+    coarse_uri: str
+        If not empty and there are at least coarse_min_partitions partitions,
+        a coarse quantizer over the centroids is written to new arrays at
+        this URI followed by _centroids, _offsets and _members, see
+        read_coarse_quantizer()
+    coarse_min_partitions: int
+        Smallest number of partitions for which the coarse quantizer is built
+    config: Dict
+        TileDB configuration parameters
+
+    Returns
+    -------
+    The number of vectors ingested
+    """
+    if config is None:
+        ctx = Ctx({})
+    else:
+        ctx = Ctx(config)
+
+    args = tuple(
+        [
+            ctx,
+            source_uri,
+            source_type,
+            centroids_uri,
+            index_uri,
+            ids_uri,
+            parts_uri,
+            size,
+            partitions,
+            training_sample_size,
+            max_iter,
+            tol,
+            upper_bound,
+            nthreads,
+            train,
+            sq8_uri,
+            spill_dir,
+            max_partition_factor,
+            coarse_uri,
+            coarse_min_partitions,
+        ]
+    )
+
+    if dtype == np.float32:
+        return ivf_ingest_f32(*args)
+    elif dtype == np.uint8:
+        return ivf_ingest_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def ivf_pq_ingest(
+    dtype: np.dtype,
+    source_uri: str,
+    index_uri: str,
+    size: int = 0,
+    partitions: int = 0,
+    num_subspaces: int = 1,
+    num_bits: int = 8,
+    training_sample_size: int = 0,
+    max_iter: int = 10,
+    tol: float = 1e-4,
+    upper_bound: int = 1000000,
+    nthreads: int = 0,
+    source_type: str = "TILEDB_ARRAY",
+    config: Dict = None,
+):
+    """
+    Build an IVF_PQ index from a TileDB array, or a local file in one of the
+    benchmark formats, in a single process, and write it to a new TileDB
+    group.  The centroids and PQ codebooks are trained on (at most) the first
+    upper_bound input vectors; every vector is then stored as one byte per
+    subspace.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    source_uri: str
+        URI of the array holding the input vectors, or path of a local file
+    index_uri: str
+        URI of the group to create
+    size: int
+        Number of input vectors to ingest, 0 to ingest all of them
+    partitions: int
+        Number of partitions to compute
+    num_subspaces: int
+        Number of subspaces (codes per encoded vector), at most the dimension
+    num_bits: int
+        Bits per code, 8, or 4 for a smaller index searched with the fast-scan
+        kernel
+    training_sample_size: int
+        Number of vectors to train with, 0 to use the first block
+    max_iter: int
+        Maximum number of kmeans iterations
+    tol: float
+        Relative centroid shift at which to stop iterating
+    upper_bound: int
+        Number of input vectors to hold in memory at a time
+    nthreads: int
+        Number of threads, 0 to use all cores
+    source_type: str
+        TILEDB_ARRAY, or the format of a local file (U8BIN, F32BIN, FVEC,
+        BVEC), which is memory mapped
+    config: Dict
+        TileDB configuration parameters
+
+    Returns
+    -------
+    The number of vectors ingested
+    """
+    if config is None:
+        ctx = Ctx({})
+    else:
+        ctx = Ctx(config)
+
+    args = tuple(
+        [
+            ctx,
+            source_uri,
+            source_type,
+            index_uri,
+            size,
+            partitions,
+            num_subspaces,
+            num_bits,
+            training_sample_size,
+            max_iter,
+            tol,
+            upper_bound,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return ivf_pq_ingest_f32(*args)
+    elif dtype == np.uint8:
+        return ivf_pq_ingest_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def hnsw_ingest(
+    dtype: np.dtype,
+    source_uri: str,
+    index_uri: str,
+    size: int = 0,
+    M: int = 16,
+    ef_construction: int = 200,
+    nthreads: int = 0,
+    source_type: str = "TILEDB_ARRAY",
+    config: Dict = None,
+):
+    """
+    Build an HNSW index from a TileDB array, or a local file in one of the
+    benchmark formats, in a single process, and write it to a new TileDB
+    group.  The input vectors are all held in memory while the graph is
+    built.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    source_uri: str
+        URI of the array holding the input vectors, or path of a local file
+    index_uri: str
+        URI of the group to create
+    size: int
+        Number of input vectors to ingest, 0 to ingest all of them
+    M: int
+        Maximum number of neighbors per node in the upper layers of the
+        graph (twice that in the bottom layer)
+    ef_construction: int
+        Width of the search used to find the neighbors of inserted vectors
+    nthreads: int
+        Number of threads, 0 to use all cores
+    source_type: str
+        TILEDB_ARRAY, or the format of a local file (U8BIN, F32BIN, FVEC,
+        BVEC), which is memory mapped
+    config: Dict
+        TileDB configuration parameters
+
+    Returns
+    -------
+    The number of vectors ingested
+    """
+    if config is None:
+        ctx = Ctx({})
+    else:
+        ctx = Ctx(config)
+
+    args = tuple(
+        [
+            ctx,
+            source_uri,
+            source_type,
+            index_uri,
+            size,
+            M,
+            ef_construction,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return hnsw_ingest_f32(*args)
+    elif dtype == np.uint8:
+        return hnsw_ingest_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def vamana_ingest(
+    dtype: np.dtype,
+    source_uri: str,
+    index_uri: str,
+    size: int = 0,
+    R: int = 64,
+    L_build: int = 100,
+    alpha: float = 1.2,
+    num_subspaces: int = 0,
+    memory_budget: int = 0,
+    nthreads: int = 0,
+    source_type: str = "TILEDB_ARRAY",
+    config: Dict = None,
+):
+    """
+    Build a Vamana (DiskANN) index from a TileDB array, or a local file in
+    one of the benchmark formats, in a single process, and write it to a new
+    TileDB group.  The source is read a block at a time, but the input
+    vectors are all held in memory while the graph is built.  Queries only
+    hold the PQ codes in memory and read the vectors and the graph from the
+    group.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    source_uri: str
+        URI of the array holding the input vectors, or path of a local file
+    index_uri: str
+        URI of the group to create
+    size: int
+        Number of input vectors to ingest, 0 to ingest all of them
+    R: int
+        Maximum number of neighbors per node of the graph
+    L_build: int
+        Length of the candidate list of the searches used to find the
+        neighbors of inserted vectors; at least R
+    alpha: float
+        Pruning factor of the graph build; larger values keep more long edges
+    num_subspaces: int
+        Number of PQ subspaces (bytes per in-memory code), 0 for one per four
+        dimensions
+    memory_budget: int
+        Maximum number of source vectors read at a time, 0 for all of them
+    nthreads: int
+        Number of threads, 0 to use all cores
+    source_type: str
+        TILEDB_ARRAY, or the format of a local file (U8BIN, F32BIN, FVEC,
+        BVEC), which is memory mapped
+    config: Dict
+        TileDB configuration parameters
+
+    Returns
+    -------
+    The number of vectors ingested
+    """
+    if config is None:
+        ctx = Ctx({})
+    else:
+        ctx = Ctx(config)
+
+    args = tuple(
+        [
+            ctx,
+            source_uri,
+            source_type,
+            index_uri,
+            size,
+            R,
+            L_build,
+            alpha,
+            num_subspaces,
+            memory_budget,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return vamana_ingest_f32(*args)
+    elif dtype == np.uint8:
+        return vamana_ingest_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
 def ivf_query_ram(
     dtype: np.dtype,
     parts_db: "colMajorMatrix",
@@ -190,6 +635,7 @@ def ivf_query_ram(
     nthreads: int,
     ctx: "Ctx" = None,
     use_nuv_implementation: bool = False,
+    deleted: "IdBitmap" = None,
 ):
     """
     Run IVF vector query using infinite RAM
@@ -218,10 +664,37 @@ def ivf_query_ram(
         Number of theads
     ctx: Ctx
         Tiledb Context
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored. Not supported by the nuv implementation
     """
     if ctx is None:
         ctx = Ctx({})
 
+    if deleted is not None:
+        if use_nuv_implementation:
+            raise ValueError("deleted is not supported by the nuv implementation")
+        args = tuple(
+            [
+                parts_db,
+                centroids_db,
+                query_vectors,
+                indices,
+                ids,
+                deleted,
+                nprobe,
+                k_nn,
+                nth,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_query_infinite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_query_infinite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
     args = tuple(
         [
             parts_db,
@@ -264,6 +737,7 @@ def ivf_query(
     nthreads: int,
     ctx: "Ctx" = None,
     use_nuv_implementation: bool = False,
+    deleted: "IdBitmap" = None,
 ):
     """
     Run IVF vector query using a memory budget
@@ -294,10 +768,39 @@ def ivf_query(
         Number of theads
     ctx: Ctx
         Tiledb Context
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored. Not supported by the nuv implementation
     """
     if ctx is None:
         ctx = Ctx({})
 
+    if deleted is not None:
+        if use_nuv_implementation:
+            raise ValueError("deleted is not supported by the nuv implementation")
+        args = tuple(
+            [
+                ctx,
+                parts_uri,
+                centroids,
+                query_vectors,
+                indices,
+                ids_uri,
+                deleted,
+                nprobe,
+                k_nn,
+                memory_budget,
+                nth,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_query_finite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_query_finite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
     args = tuple(
         [
             ctx,
@@ -328,6 +831,975 @@ def ivf_query(
         raise TypeError("Unknown type!")
 
 
+def rerank(
+    dtype: np.dtype,
+    parts_uri: str,
+    id_positions: "IdPositionMap",
+    query_vectors: "colMajorMatrix",
+    candidates,
+    k_nn: int,
+    nthreads: int,
+    max_gap: int = 16,
+    ctx: "Ctx" = None,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Find the k_nn nearest candidates of each query by exact L2 distance to the
+    vectors of an index, fetched from TileDB by id.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of the stored vectors, float32 or uint8
+    parts_uri: str
+        URI of the shuffled vectors array
+    id_positions: IdPositionMap
+        Map from ids to positions in the shuffled vectors array
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    candidates: list
+        One sequence of candidate ids per query.  Ids not in the index are
+        ignored
+    k_nn: int
+        Number of results per query
+    nthreads: int
+        Number of threads
+    max_gap: int
+        Largest gap between candidates that are read with a single range
+    ctx: Ctx
+        Tiledb Context
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are ignored as candidates
+
+    Returns
+    -------
+    Matrices of the distances and ids of the nearest candidates, one column
+    per query, nearest first
+    """
+    if ctx is None:
+        ctx = Ctx({})
+
+    lengths = [len(c) for c in candidates]
+    offsets = np.zeros(len(candidates) + 1, dtype=np.uint64)
+    np.cumsum(lengths, out=offsets[1:])
+    if sum(lengths) == 0:
+        ids = np.zeros(0, dtype=np.uint64)
+    else:
+        ids = np.concatenate([np.asarray(c, dtype=np.uint64) for c in candidates])
+
+    if deleted is not None:
+        args = tuple(
+            [
+                ctx,
+                parts_uri,
+                id_positions,
+                query_vectors,
+                ids,
+                offsets,
+                deleted,
+                k_nn,
+                nthreads,
+                max_gap,
+            ]
+        )
+        if dtype == np.float32:
+            return live_rerank_f32(*args)
+        elif dtype == np.uint8:
+            return live_rerank_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            ctx,
+            parts_uri,
+            id_positions,
+            query_vectors,
+            ids,
+            offsets,
+            k_nn,
+            nthreads,
+            max_gap,
+        ]
+    )
+
+    if dtype == np.float32:
+        return rerank_f32(*args)
+    elif dtype == np.uint8:
+        return rerank_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def build_binary_codes(
+    dtype: np.dtype,
+    parts_uri: str,
+    codes_uri: str,
+    center_uri: str,
+    memory_budget: int = 0,
+    nthreads: int = 0,
+    ctx: "Ctx" = None,
+):
+    """
+    Compute the binary (sign) codes of the shuffled vectors of an IVF_FLAT
+    index and write them, and the center they were computed against, to
+    TileDB.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of the stored vectors, float32 or uint8
+    parts_uri: str
+        URI of the shuffled vectors array
+    codes_uri: str
+        URI of the codes array to create
+    center_uri: str
+        URI of the center array to create
+    memory_budget: int
+        Maximum number of vectors read at a time, 0 for no limit
+    nthreads: int
+        Number of threads
+    ctx: Ctx
+        Tiledb Context
+    """
+    if ctx is None:
+        ctx = Ctx({})
+
+    if dtype == np.float32:
+        codes = build_binary_codes_f32(ctx, parts_uri, memory_budget, nthreads)
+    elif dtype == np.uint8:
+        codes = build_binary_codes_u8(ctx, parts_uri, memory_budget, nthreads)
+    else:
+        raise TypeError("Unknown type!")
+    codes.save(ctx, codes_uri, center_uri)
+
+
+def ivf_query_ram_binary(
+    dtype: np.dtype,
+    parts_db: "colMajorMatrix",
+    binary_codes: "BinaryCodes",
+    centroids_db: "colMajorMatrix",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids: "Vector",
+    nprobe: int,
+    k_nn: int,
+    num_survivors: int,
+    nthreads: int,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Run an in-memory IVF_FLAT query, scoring only the num_survivors vectors
+    of each probed partition whose binary codes are nearest the query's in
+    Hamming distance.
+
+    Parameters
+    ----------
+    parts_db: colMajorMatrix
+        Partitioned vectors
+    binary_codes: BinaryCodes
+        Binary codes of the partitioned vectors
+    centroids_db: colMajorMatrix
+        Centroids
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids: Vector
+        Vector ids
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    num_survivors: int
+        Number of vectors per partition and query scored with the full
+        distance
+    nthreads: int
+        Number of threads
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored
+    """
+    if deleted is not None:
+        args = tuple(
+            [
+                parts_db,
+                binary_codes,
+                centroids_db,
+                query_vectors,
+                indices,
+                ids,
+                deleted,
+                nprobe,
+                k_nn,
+                num_survivors,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_binary_query_infinite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_binary_query_infinite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            parts_db,
+            binary_codes,
+            centroids_db,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            num_survivors,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return binary_query_infinite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return binary_query_infinite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def compute_partition_stats(
+    dtype: np.dtype,
+    parts_db: "colMajorMatrix",
+    centroids_db: "colMajorMatrix",
+    indices: "Vector",
+    nthreads: int,
+):
+    """
+    Compute the statistics of each partition of an in-memory IVF_FLAT index:
+    its radius (the largest distance from its centroid to one of its
+    vectors), size, and smallest and largest vector norms.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    parts_db: colMajorMatrix
+        Partitioned vectors
+    centroids_db: colMajorMatrix
+        Centroids
+    indices: Vector
+        Partition indices
+    nthreads: int
+        Number of threads
+    """
+    args = tuple([parts_db, centroids_db, indices, nthreads])
+
+    if dtype == np.float32:
+        return compute_partition_stats_f32(*args)
+    elif dtype == np.uint8:
+        return compute_partition_stats_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def build_partition_stats(
+    dtype: np.dtype,
+    parts_uri: str,
+    centroids_db: "colMajorMatrix",
+    indices: "Vector",
+    stats_uri: str,
+    memory_budget: int = 0,
+    nthreads: int = 0,
+    ctx: "Ctx" = None,
+):
+    """
+    Compute the partition statistics of an IVF_FLAT index from its shuffled
+    vectors array and write them to TileDB.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of the stored vectors, float32 or uint8
+    parts_uri: str
+        URI of the shuffled vectors array
+    centroids_db: colMajorMatrix
+        Centroids
+    indices: Vector
+        Partition indices
+    stats_uri: str
+        URI of the statistics array to create
+    memory_budget: int
+        Maximum number of vectors read at a time, 0 for no limit
+    nthreads: int
+        Number of threads
+    ctx: Ctx
+        Tiledb Context
+    """
+    if ctx is None:
+        ctx = Ctx({})
+
+    args = tuple([ctx, parts_uri, centroids_db, indices, memory_budget, nthreads])
+
+    if dtype == np.float32:
+        stats = build_partition_stats_f32(*args)
+    elif dtype == np.uint8:
+        stats = build_partition_stats_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+    stats.save(ctx, stats_uri)
+
+
+def ivf_query_ram_pruned(
+    dtype: np.dtype,
+    parts_db: "colMajorMatrix",
+    centroids_db: "colMajorMatrix",
+    partition_stats: "PartitionStats",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids: "Vector",
+    nprobe: int,
+    k_nn: int,
+    nthreads: int,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Run an in-memory IVF_FLAT query as ivf_query_ram does, but skip the
+    probed partitions whose statistics show that they cannot hold one of a
+    query's k_nn nearest vectors. The results are the same.
+
+    Parameters
+    ----------
+    parts_db: colMajorMatrix
+        Partitioned vectors
+    centroids_db: colMajorMatrix
+        Centroids
+    partition_stats: PartitionStats
+        Partition statistics of the index
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids: Vector
+        Vector ids
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    nthreads: int
+        Number of threads
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored
+    """
+    if deleted is not None:
+        args = tuple(
+            [
+                parts_db,
+                centroids_db,
+                partition_stats,
+                query_vectors,
+                indices,
+                ids,
+                deleted,
+                nprobe,
+                k_nn,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_pruned_query_infinite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_pruned_query_infinite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            parts_db,
+            centroids_db,
+            partition_stats,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return pruned_query_infinite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return pruned_query_infinite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def ivf_query_pruned(
+    dtype: np.dtype,
+    parts_uri: str,
+    centroids: "colMajorMatrix",
+    partition_stats: "PartitionStats",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids_uri: str,
+    nprobe: int,
+    k_nn: int,
+    memory_budget: int,
+    nthreads: int,
+    ctx: "Ctx" = None,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Run an IVF_FLAT query using a memory budget as ivf_query does, but skip
+    the probed partitions whose statistics show that they cannot hold one of
+    a query's k_nn nearest vectors. The results are the same.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    parts_uri: str
+        Partition URI
+    centroids: colMajorMatrix
+        Centroids
+    partition_stats: PartitionStats
+        Partition statistics of the index
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids_uri: str
+        URI for id mappings
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    memory_budget: int
+        Main memory budget
+    nthreads: int
+        Number of threads
+    ctx: Ctx
+        Tiledb Context
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored
+    """
+    if ctx is None:
+        ctx = Ctx({})
+
+    if deleted is not None:
+        args = tuple(
+            [
+                ctx,
+                parts_uri,
+                centroids,
+                partition_stats,
+                query_vectors,
+                indices,
+                ids_uri,
+                deleted,
+                nprobe,
+                k_nn,
+                memory_budget,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_pruned_query_finite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_pruned_query_finite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            ctx,
+            parts_uri,
+            centroids,
+            partition_stats,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            memory_budget,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return pruned_query_finite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return pruned_query_finite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def read_coarse_quantizer(
+    centroids_uri: str, offsets_uri: str, members_uri: str, ctx: "Ctx" = None
+):
+    """
+    Read the coarse quantizer of an IVF_FLAT index, which selects the
+    partitions closest to a query by comparing it with the centroids of a few
+    groups of partitions, rather than with every centroid.
+
+    Parameters
+    ----------
+    centroids_uri: str
+        URI of the coarse centroids array
+    offsets_uri: str
+        URI of the array delimiting the partitions of each coarse centroid
+    members_uri: str
+        URI of the array listing the partitions of each coarse centroid
+    ctx: Ctx
+        Tiledb Context
+    """
+    if ctx is None:
+        ctx = Ctx({})
+    return CoarseQuantizer(ctx, centroids_uri, offsets_uri, members_uri)
+
+
+def ivf_query_ram_coarse(
+    dtype: np.dtype,
+    parts_db: "colMajorMatrix",
+    quantizer: "CoarseQuantizer",
+    centroids_db: "colMajorMatrix",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids: "Vector",
+    nprobe: int,
+    k_nn: int,
+    nthreads: int,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Run an in-memory IVF_FLAT query as ivf_query_ram does, but select the
+    nprobe partitions of each query with a coarse quantizer. The partitions
+    may differ from the nprobe nearest ones; searching more coarse partitions
+    (quantizer.nprobe) makes them agree more often.
+
+    Parameters
+    ----------
+    parts_db: colMajorMatrix
+        Partitioned vectors
+    quantizer: CoarseQuantizer
+        Coarse quantizer over the centroids, see read_coarse_quantizer()
+    centroids_db: colMajorMatrix
+        Centroids
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids: Vector
+        Vector ids
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    nthreads: int
+        Number of threads
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored
+    """
+    if deleted is not None:
+        args = tuple(
+            [
+                parts_db,
+                quantizer,
+                centroids_db,
+                query_vectors,
+                indices,
+                ids,
+                deleted,
+                nprobe,
+                k_nn,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_coarse_query_infinite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_coarse_query_infinite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            parts_db,
+            quantizer,
+            centroids_db,
+            query_vectors,
+            indices,
+            ids,
+            nprobe,
+            k_nn,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return coarse_query_infinite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return coarse_query_infinite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def ivf_query_coarse(
+    dtype: np.dtype,
+    parts_uri: str,
+    quantizer: "CoarseQuantizer",
+    centroids: "colMajorMatrix",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids_uri: str,
+    nprobe: int,
+    k_nn: int,
+    memory_budget: int,
+    nthreads: int,
+    ctx: "Ctx" = None,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Run an IVF_FLAT query using a memory budget as ivf_query does, but select
+    the nprobe partitions of each query with a coarse quantizer, see
+    ivf_query_ram_coarse().
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    parts_uri: str
+        Partition URI
+    quantizer: CoarseQuantizer
+        Coarse quantizer over the centroids, see read_coarse_quantizer()
+    centroids: colMajorMatrix
+        Centroids
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids_uri: str
+        URI for id mappings
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    memory_budget: int
+        Main memory budget
+    nthreads: int
+        Number of threads
+    ctx: Ctx
+        Tiledb Context
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored
+    """
+    if ctx is None:
+        ctx = Ctx({})
+
+    if deleted is not None:
+        args = tuple(
+            [
+                ctx,
+                parts_uri,
+                quantizer,
+                centroids,
+                query_vectors,
+                indices,
+                ids_uri,
+                deleted,
+                nprobe,
+                k_nn,
+                memory_budget,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_coarse_query_finite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_coarse_query_finite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            ctx,
+            parts_uri,
+            quantizer,
+            centroids,
+            query_vectors,
+            indices,
+            ids_uri,
+            nprobe,
+            k_nn,
+            memory_budget,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return coarse_query_finite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return coarse_query_finite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def ivf_query_ram_filtered(
+    dtype: np.dtype,
+    parts_db: "colMajorMatrix",
+    centroids_db: "colMajorMatrix",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids: "Vector",
+    filter: "IdBitmap",
+    nprobe: int,
+    k_nn: int,
+    nthreads: int,
+):
+    """
+    Run an in-memory IVF_FLAT query for the nearest neighbors among the
+    vectors whose ids are in filter. The filter is tested before vectors are
+    scored; if few enough vectors pass, all of them are searched rather than
+    nprobe partitions.
+
+    Parameters
+    ----------
+    parts_db: colMajorMatrix
+        Partitioned vectors
+    centroids_db: colMajorMatrix
+        Centroids
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids: Vector
+        Vector ids
+    filter: IdBitmap
+        Ids of the vectors that may be returned
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    nthreads: int
+        Number of threads
+    """
+    args = tuple(
+        [
+            parts_db,
+            centroids_db,
+            query_vectors,
+            indices,
+            ids,
+            filter,
+            nprobe,
+            k_nn,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return filtered_query_infinite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return filtered_query_infinite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def ivf_query_filtered(
+    dtype: np.dtype,
+    parts_uri: str,
+    centroids: "colMajorMatrix",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids_uri: str,
+    filter: "IdBitmap",
+    nprobe: int,
+    k_nn: int,
+    memory_budget: int,
+    nthreads: int,
+    ctx: "Ctx" = None,
+):
+    """
+    Run an IVF_FLAT query using a memory budget for the nearest neighbors
+    among the vectors whose ids are in filter, as ivf_query_ram_filtered
+    does. When all the passing vectors are searched, only their columns of
+    the partitioned vectors array are read.
+
+    Parameters
+    ----------
+    dtype: numpy.dtype
+        Type of vector, float32 or uint8
+    parts_uri: str
+        Partition URI
+    centroids: colMajorMatrix
+        Centroids
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids_uri: str
+        URI for id mappings
+    filter: IdBitmap
+        Ids of the vectors that may be returned
+    nprobe: int
+        Number of probes
+    k_nn: int
+        Number of nn
+    memory_budget: int
+        Main memory budget
+    nthreads: int
+        Number of threads
+    ctx: Ctx
+        Tiledb Context
+    """
+    if ctx is None:
+        ctx = Ctx({})
+
+    args = tuple(
+        [
+            ctx,
+            parts_uri,
+            centroids,
+            query_vectors,
+            indices,
+            ids_uri,
+            filter,
+            nprobe,
+            k_nn,
+            memory_budget,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return filtered_query_finite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return filtered_query_finite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
+def id_bitmap(ids):
+    """
+    Make an IdBitmap, the filter taken by the filtered queries, holding the
+    given ids.  Its size depends on the number of ids, not on how large they
+    are.
+
+    Parameters
+    ----------
+    ids: numpy.ndarray
+        Ids in the set
+    """
+    return IdBitmap(np.ascontiguousarray(ids, dtype=np.uint64))
+
+
+def read_id_bitmap(uri: str, ctx: "Ctx" = None):
+    """
+    Read an IdBitmap, e.g., the ids of the deleted vectors of an index,
+    written with IdBitmap.write().
+
+    Parameters
+    ----------
+    uri: str
+        URI of the array holding the bitmap
+    ctx: Ctx
+        Tiledb Context
+    """
+    if ctx is None:
+        ctx = Ctx({})
+    return IdBitmap(ctx, uri)
+
+
+def ivf_query_ram_adaptive(
+    dtype: np.dtype,
+    parts_db: "colMajorMatrix",
+    centroids_db: "colMajorMatrix",
+    partition_stats: "PartitionStats",
+    query_vectors: "colMajorMatrix",
+    indices: "Vector",
+    ids: "Vector",
+    max_nprobe: int,
+    k_nn: int,
+    nthreads: int,
+    deleted: "IdBitmap" = None,
+):
+    """
+    Run an in-memory IVF_FLAT query that probes the partitions of each query
+    in order of centroid distance, stopping once the partition statistics show
+    that no further partition can hold a nearer vector, or after max_nprobe
+    partitions.
+
+    Parameters
+    ----------
+    parts_db: colMajorMatrix
+        Partitioned vectors
+    centroids_db: colMajorMatrix
+        Centroids
+    partition_stats: PartitionStats
+        Partition statistics of the index
+    query_vectors: colMajorMatrix
+        Queries, one per column
+    indices: Vector
+        Partition indices
+    ids: Vector
+        Vector ids
+    max_nprobe: int
+        Largest number of partitions probed per query
+    k_nn: int
+        Number of nn
+    nthreads: int
+        Number of threads
+    deleted: IdBitmap
+        If provided, ids of deleted vectors, which are skipped before they
+        are scored
+    """
+    if deleted is not None:
+        args = tuple(
+            [
+                parts_db,
+                centroids_db,
+                partition_stats,
+                query_vectors,
+                indices,
+                ids,
+                deleted,
+                max_nprobe,
+                k_nn,
+                nthreads,
+            ]
+        )
+        if dtype == np.float32:
+            return live_adaptive_query_infinite_ram_f32(*args)
+        elif dtype == np.uint8:
+            return live_adaptive_query_infinite_ram_u8(*args)
+        else:
+            raise TypeError("Unknown type!")
+
+    args = tuple(
+        [
+            parts_db,
+            centroids_db,
+            partition_stats,
+            query_vectors,
+            indices,
+            ids,
+            max_nprobe,
+            k_nn,
+            nthreads,
+        ]
+    )
+
+    if dtype == np.float32:
+        return adaptive_query_infinite_ram_f32(*args)
+    elif dtype == np.uint8:
+        return adaptive_query_infinite_ram_u8(*args)
+    else:
+        raise TypeError("Unknown type!")
+
+
 def partition_ivf_index(centroids, query, nprobe=1, nthreads=0):
     if query.dtype == np.float32:
         return partition_ivf_index_f32(centroids, query, nprobe, nthreads)
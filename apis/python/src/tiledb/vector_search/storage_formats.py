@@ -16,6 +16,15 @@ storage_formats = {
         "PARTS_ARRAY_NAME": "shuffled_vectors",
         "PARTIAL_WRITE_ARRAY_DIR": "temp_data",
         "DEFAULT_ATTR_FILTERS": tiledb.FilterList([tiledb.ZstdFilter()]),
+        "SQ8_ARRAY_NAME": "sq8_params",
+        "ID_POSITIONS_ARRAY_NAME": "id_positions",
+        "BINARY_CODES_ARRAY_NAME": "binary_codes",
+        "BINARY_CENTER_ARRAY_NAME": "binary_center",
+        "PARTITION_STATS_ARRAY_NAME": "partition_stats",
+        "TOMBSTONES_ARRAY_NAME": "tombstones",
+        "COARSE_CENTROIDS_ARRAY_NAME": "coarse_centroids",
+        "COARSE_OFFSETS_ARRAY_NAME": "coarse_offsets",
+        "COARSE_MEMBERS_ARRAY_NAME": "coarse_members",
     },
 }
 
@@ -1,7 +1,13 @@
 from common import *
 
 from tiledb.vector_search.ingestion import ingest
-from tiledb.vector_search.index import FlatIndex, IVFFlatIndex
+from tiledb.vector_search.index import (
+    FlatIndex,
+    HNSWIndex,
+    IVFFlatIndex,
+    IVFPQIndex,
+    VamanaIndex,
+)
 from tiledb.cloud.dag import Mode
 
 import pytest
@@ -199,3 +205,266 @@ def test_ivf_flat_ingestion_fvec(tmp_path):
 
     result = index_ram.query(query_vectors, k=k, nprobe=nprobe, mode=Mode.LOCAL)
     assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+
+def test_ivf_flat_ingestion_spill_dir(tmp_path):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    spill_dir = os.path.join(tmp_path, "spill")
+    os.mkdir(spill_dir)
+    k = 10
+    size = 20000
+    dimensions = 64
+    partitions = 50
+    nqueries = 100
+    nprobe = 10
+
+    create_random_dataset_f32(nb=size, d=dimensions, nq=nqueries, k=k, path=dataset_dir)
+    source_type = "F32BIN"
+    dtype = np.float32
+
+    query_vectors = get_queries(dataset_dir, dtype=dtype)
+    gt_i, gt_d = get_groundtruth(dataset_dir, k)
+
+    # The input is ten times larger than a work item, so the training
+    # sample and the partitions are spilled to files while shuffling
+    index = ingest(
+        index_type="IVF_FLAT",
+        array_uri=os.path.join(tmp_path, "array"),
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type=source_type,
+        partitions=partitions,
+        training_sample_size=int(size / 2),
+        input_vectors_per_work_item=int(size / 10),
+        spill_dir=spill_dir,
+    )
+    result = index.query(query_vectors, k=k, nprobe=nprobe)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+    assert os.listdir(spill_dir) == []
+
+    # By default the files go next to the index
+    index = ingest(
+        index_type="IVF_FLAT",
+        array_uri=os.path.join(tmp_path, "array2"),
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type=source_type,
+        partitions=partitions,
+        training_sample_size=int(size / 2),
+        input_vectors_per_work_item=int(size / 10),
+    )
+    result = index.query(query_vectors, k=k, nprobe=nprobe)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+    assert sorted(os.listdir(tmp_path)) == ["array", "array2", "dataset", "spill"]
+
+
+def exact_neighbors(data, queries, ids, k):
+    """Ids of the k nearest of the vectors data[ids] to each query."""
+    ids = np.asarray(ids, dtype=np.uint64)
+    vectors = np.asarray(data[ids], dtype=np.float64)
+    queries = np.asarray(queries, dtype=np.float64)
+    distances = (
+        (queries**2).sum(axis=1)[:, None]
+        - 2 * queries @ vectors.T
+        + (vectors**2).sum(axis=1)[None, :]
+    )
+    return ids[np.argsort(distances, axis=1)[:, :k]]
+
+
+def test_ivf_pq_ingestion(tmp_path):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    array_uri = os.path.join(tmp_path, "array")
+    k = 10
+    size = 10000
+    dimensions = 16
+    partitions = 20
+    nqueries = 100
+
+    create_random_dataset_f32(nb=size, d=dimensions, nq=nqueries, k=k, path=dataset_dir)
+    query_vectors = get_queries(dataset_dir, dtype=np.float32)
+    gt_i, gt_d = get_groundtruth(dataset_dir, k)
+
+    # One dimension per subspace, so the codes lose little accuracy
+    index = ingest(
+        index_type="IVF_PQ",
+        array_uri=array_uri,
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type="F32BIN",
+        partitions=partitions,
+        num_subspaces=dimensions,
+    )
+    result = index.query(query_vectors, k=k, nprobe=partitions)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+    index_finite = IVFPQIndex(uri=array_uri, memory_budget=int(size / 10))
+    result = index_finite.query(query_vectors, k=k, nprobe=partitions)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+
+def test_hnsw_ingestion(tmp_path):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    array_uri = os.path.join(tmp_path, "array")
+    k = 10
+    create_random_dataset_f32(nb=10000, d=64, nq=100, k=k, path=dataset_dir)
+    query_vectors = get_queries(dataset_dir, dtype=np.float32)
+    gt_i, gt_d = get_groundtruth(dataset_dir, k)
+
+    index = ingest(
+        index_type="HNSW",
+        array_uri=array_uri,
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type="F32BIN",
+    )
+    result = index.query(query_vectors, k=k, ef_search=100)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+    result = HNSWIndex(uri=array_uri).query(query_vectors, k=k, ef_search=100)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+
+def test_vamana_ingestion(tmp_path):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    array_uri = os.path.join(tmp_path, "array")
+    k = 10
+    create_random_dataset_f32(nb=10000, d=64, nq=100, k=k, path=dataset_dir)
+    query_vectors = get_queries(dataset_dir, dtype=np.float32)
+    gt_i, gt_d = get_groundtruth(dataset_dir, k)
+
+    index = ingest(
+        index_type="VAMANA",
+        array_uri=array_uri,
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type="F32BIN",
+    )
+    result = index.query(query_vectors, k=k, search_list_size=100)
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+    result = VamanaIndex(uri=array_uri).query(
+        query_vectors, k=k, search_list_size=100
+    )
+    assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+
+def test_ivf_flat_rerank(tmp_path):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    array_uri = os.path.join(tmp_path, "array")
+    k = 10
+    size = 10000
+    create_random_dataset_f32(nb=size, d=64, nq=100, k=k, path=dataset_dir)
+    query_vectors = get_queries(dataset_dir, dtype=np.float32)
+    gt_i, gt_d = get_groundtruth(dataset_dir, k)
+
+    index = ingest(
+        index_type="IVF_FLAT",
+        array_uri=array_uri,
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type="F32BIN",
+        partitions=50,
+    )
+    index.build_id_positions()
+
+    # The true neighbors, shuffled and mixed with ids from elsewhere and ids
+    # not in the index, come back in order with their squared distances
+    rng = np.random.default_rng(1)
+    candidates = []
+    for i in range(len(query_vectors)):
+        ids = np.concatenate(
+            [gt_i[i], rng.integers(0, size, 20), [size + 1, size + 2]]
+        ).astype(np.uint64)
+        candidates.append(rng.permutation(ids))
+    distances, ids = index.rerank(query_vectors, candidates, k=k)
+    assert accuracy(ids, gt_i) == 1.0
+    assert np.allclose(distances, gt_d**2, rtol=1e-3)
+
+    # Deleted candidates are skipped, and short lists are padded
+    index.delete(gt_i[:, 0])
+    distances, ids = index.rerank(
+        query_vectors, [gt_i[i][:3] for i in range(len(query_vectors))], k=3
+    )
+    assert np.all(ids[:, 2] == np.iinfo(np.uint64).max)
+    assert np.all(distances[:, 2] == np.finfo(np.float32).max)
+    assert not np.isin(ids[:, :2], gt_i[:, 0]).any()
+
+
+def test_ivf_flat_filter_ids(tmp_path):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    array_uri = os.path.join(tmp_path, "array")
+    k = 10
+    size = 10000
+    partitions = 50
+    nprobe = 10
+    create_random_dataset_f32(nb=size, d=64, nq=100, k=k, path=dataset_dir)
+    data = xbin_mmap(os.path.join(dataset_dir, "data"), dtype=np.float32)
+    query_vectors = get_queries(dataset_dir, dtype=np.float32)
+
+    ingest(
+        index_type="IVF_FLAT",
+        array_uri=array_uri,
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type="F32BIN",
+        partitions=partitions,
+    )
+
+    # Half of the vectors pass, so nprobe partitions are searched; with a
+    # few hundred the filter falls back to an exhaustive search
+    for filter_ids in [np.arange(0, size, 2), np.arange(0, size, 50)]:
+        gt_i = exact_neighbors(data, query_vectors, filter_ids, k)
+        for index in [
+            IVFFlatIndex(uri=array_uri),
+            IVFFlatIndex(uri=array_uri, memory_budget=int(size / 10)),
+        ]:
+            result = index.query(
+                query_vectors, k=k, nprobe=nprobe, filter_ids=filter_ids
+            )
+            assert np.isin(result, filter_ids).all()
+            assert accuracy(result, gt_i) > MINIMUM_ACCURACY
+
+
+@pytest.mark.parametrize("index_type", ["FLAT", "IVF_FLAT"])
+def test_delete(tmp_path, index_type):
+    dataset_dir = os.path.join(tmp_path, "dataset")
+    array_uri = os.path.join(tmp_path, "array")
+    k = 10
+    size = 10000
+    partitions = 50
+    create_random_dataset_f32(nb=size, d=64, nq=100, k=k, path=dataset_dir)
+    data = xbin_mmap(os.path.join(dataset_dir, "data"), dtype=np.float32)
+    query_vectors = get_queries(dataset_dir, dtype=np.float32)
+    gt_i, gt_d = get_groundtruth(dataset_dir, k)
+
+    def open_index():
+        if index_type == "FLAT":
+            return FlatIndex(uri=array_uri)
+        return IVFFlatIndex(uri=array_uri)
+
+    def check(index, deleted):
+        if index_type == "FLAT":
+            result = index.query(query_vectors, k=k)
+        else:
+            result = index.query(query_vectors, k=k, nprobe=partitions)
+        assert not np.isin(result, deleted).any()
+        live = np.setdiff1d(np.arange(size), deleted)
+        gt = exact_neighbors(data, query_vectors, live, k)
+        assert accuracy(result, gt) > MINIMUM_ACCURACY
+
+    index = ingest(
+        index_type=index_type,
+        array_uri=array_uri,
+        source_uri=os.path.join(dataset_dir, "data"),
+        source_type="F32BIN",
+        partitions=partitions,
+    )
+
+    # The first deletion writes the tombstones array, which is read back
+    # when the index is opened again
+    first = np.unique(gt_i[:, 0])
+    index.delete(first)
+    check(index, first)
+    index = open_index()
+    check(index, first)
+
+    # Later deletions append to it; ids already deleted, or not in the
+    # index, are ignored
+    second = np.unique(gt_i[:, 1])
+    index.delete(np.concatenate([second, first, np.array([size + 1], np.uint64)]))
+    deleted = np.union1d(first, second)
+    check(index, deleted)
+    check(open_index(), deleted)
@@ -43,3 +43,34 @@ def test_context(tmpdir):
 
     vspy.Ctx({})
     vspy.Ctx({"vfs.s3.region": "us-east-1"})
+
+
+def test_kmeans_mini_batch(tmpdir):
+    p = str(tmpdir.mkdir("test").join("kmeans.tdb"))
+    centers = np.array(
+        [[10, 10, 10, 10], [100, 10, 10, 100], [10, 100, 100, 10]], dtype=np.float32
+    )
+    noise = np.random.rand(300, 4).astype(np.float32)
+    data = np.transpose(np.repeat(centers, 100, axis=0) + noise)
+
+    schema = tiledb.ArraySchema(
+        domain=tiledb.Domain(
+            tiledb.Dim(name="rows", domain=(0, 3), tile=4, dtype="int32"),
+            tiledb.Dim(name="cols", domain=(0, 299), tile=100, dtype="int32"),
+        ),
+        attrs=[tiledb.Attr(name="values", dtype="float32")],
+        cell_order="col-major",
+        tile_order="col-major",
+    )
+    tiledb.Array.create(p, schema)
+    with tiledb.open(p, "w") as A:
+        A[:] = data
+
+    centroids = np.array(
+        vs.kmeans_mini_batch(
+            np.float32, p, 4, 3, upper_bound=100, batch_size=32, nthreads=2
+        )
+    )
+    assert centroids.shape == (4, 3)
+    for c in centers:
+        assert np.min(np.linalg.norm(np.transpose(centroids) - c, axis=1)) < 4
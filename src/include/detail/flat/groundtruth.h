@@ -0,0 +1,254 @@
+/**
+ * @file   flat/groundtruth.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Exact ground truth for databases too large to search in one pass.
+ *
+ * The database is scored against the queries with a `flat_index`, which
+ * streams it from TileDB in blocks no larger than its memory budget (and,
+ * with BLAS, scores each block with tiled gemms folded straight into the
+ * top-k heaps).  The database is processed `checkpoint_interval` columns at
+ * a time; after each interval the heaps are written to a checkpoint group,
+ * so that an interrupted run resumes from the last interval it completed
+ * rather than from the start.
+ *
+ * The checkpoint group holds two slots, each a pair of `k x num_queries`
+ * arrays of the database columns and the distances in the heaps.  Slots are
+ * written alternately and the group metadata records the slot that was last
+ * written completely, so a run interrupted while writing a slot leaves the
+ * previous one intact.
+ *
+ */
+
+#ifndef TILEDB_FLAT_GROUNDTRUTH_H
+#define TILEDB_FLAT_GROUNDTRUTH_H
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "flat_index.h"
+#include "utils/timer.h"
+
+namespace detail::flat {
+
+// Names of the arrays of checkpoint slot `slot`
+inline std::string groundtruth_cols_name(size_t slot) {
+  return "cols_" + std::to_string(slot);
+}
+
+inline std::string groundtruth_distances_name(size_t slot) {
+  return "distances_" + std::to_string(slot);
+}
+
+/**
+ * @brief Copy the heaps to matrices of their database columns and distances,
+ * padding with the maximum column and float.
+ */
+template <class heap_type>
+auto heaps_to_matrices(const std::vector<heap_type>& min_scores, size_t k_nn) {
+  auto cols = ColMajorMatrix<uint64_t>(k_nn, size(min_scores));
+  auto distances = ColMajorMatrix<float>(k_nn, size(min_scores));
+  for (size_t j = 0; j < size(min_scores); ++j) {
+    size_t i = 0;
+    for (auto&& [score, col] : min_scores[j]) {
+      cols(i, j) = col;
+      distances(i, j) = score;
+      ++i;
+    }
+    for (; i < k_nn; ++i) {
+      cols(i, j) = std::numeric_limits<uint64_t>::max();
+      distances(i, j) = std::numeric_limits<float>::max();
+    }
+  }
+  return std::make_tuple(std::move(cols), std::move(distances));
+}
+
+/**
+ * @brief Compute the exact `k_nn` nearest neighbors in `index` of each
+ * query, writing their ids to a `k_nn x num_queries` array at `ids_uri` and
+ * their (squared L2) distances to one at `distances_uri`.
+ *
+ * @param checkpoint_uri URI of the checkpoint group, or empty to not
+ * checkpoint.  If the group exists, the run resumes from it; it must have
+ * been written for the same `k_nn` and numbers of queries and vectors.
+ * @param checkpoint_interval Number of database vectors scored between
+ * checkpoints, 0 for the whole database.
+ * @param max_checkpoints Stop after writing this many checkpoints (0 for no
+ * limit), so that a long run can be split across jobs.
+ * @return true if the ground truth was written, false if the run stopped
+ * at a checkpoint before reaching the end of the database.
+ */
+template <class groundtruth_id_type = uint64_t, class T, class id_type>
+bool blocked_groundtruth(
+    const tiledb::Context& ctx,
+    const flat_index<T, id_type>& index,
+    const auto& query,
+    size_t k_nn,
+    const std::string& ids_uri,
+    const std::string& distances_uri,
+    const std::string& checkpoint_uri = "",
+    size_t checkpoint_interval = 0,
+    size_t max_checkpoints = 0) {
+  scoped_timer _{tdb_func__};
+
+  using heap_type = typename flat_index<T, id_type>::heap_type;
+
+  size_t num_queries = query.num_cols();
+  size_t num_vectors = index.num_vectors();
+  std::vector<heap_type> min_scores(num_queries, heap_type(k_nn));
+
+  if (checkpoint_interval == 0) {
+    checkpoint_interval = std::max<size_t>(1, num_vectors);
+  }
+
+  int64_t slot = -1;
+  int64_t next_column = 0;
+
+  auto get_int = [&](tiledb::Group& group, const std::string& key) {
+    tiledb_datatype_t type;
+    uint32_t num;
+    const void* value = nullptr;
+    group.get_metadata(key, &type, &num, &value);
+    if (value == nullptr || type != TILEDB_INT64) {
+      throw std::runtime_error("Missing " + key + " in " + checkpoint_uri);
+    }
+    return *static_cast<const int64_t*>(value);
+  };
+
+  if (!checkpoint_uri.empty()) {
+    if (tiledb::Object::object(ctx, checkpoint_uri).type() ==
+        tiledb::Object::Type::Group) {
+      tiledb::Group group(ctx, checkpoint_uri, TILEDB_READ);
+      if (get_int(group, "k_nn") != static_cast<int64_t>(k_nn) ||
+          get_int(group, "num_queries") != static_cast<int64_t>(num_queries) ||
+          get_int(group, "num_vectors") != static_cast<int64_t>(num_vectors)) {
+        throw std::runtime_error(
+            "Checkpoint " + checkpoint_uri + " is for a different problem");
+      }
+      slot = get_int(group, "slot");
+      next_column = get_int(group, "next_column");
+      group.close();
+
+      if (slot >= 0) {
+        auto cols = tdbColMajorMatrix<uint64_t>(
+            ctx, checkpoint_uri + "/" + groundtruth_cols_name(slot));
+        cols.load();
+        auto distances = tdbColMajorMatrix<float>(
+            ctx, checkpoint_uri + "/" + groundtruth_distances_name(slot));
+        distances.load();
+        for (size_t j = 0; j < num_queries; ++j) {
+          for (size_t i = 0; i < k_nn; ++i) {
+            if (cols(i, j) != std::numeric_limits<uint64_t>::max()) {
+              min_scores[j].insert(distances(i, j), cols(i, j));
+            }
+          }
+        }
+      }
+    } else {
+      // Create both slots up front, so that checkpoints only overwrite
+      tiledb::Group::create(ctx, checkpoint_uri);
+      tiledb::Group group(ctx, checkpoint_uri, TILEDB_WRITE);
+      auto&& [cols, distances] = heaps_to_matrices(min_scores, k_nn);
+      for (size_t s = 0; s < 2; ++s) {
+        auto cols_uri = checkpoint_uri + "/" + groundtruth_cols_name(s);
+        auto distances_uri_s =
+            checkpoint_uri + "/" + groundtruth_distances_name(s);
+        write_matrix(ctx, cols, cols_uri);
+        write_matrix(ctx, distances, distances_uri_s);
+        group.add_member(cols_uri, false, groundtruth_cols_name(s));
+        group.add_member(
+            distances_uri_s, false, groundtruth_distances_name(s));
+      }
+      int64_t k = k_nn;
+      int64_t nq = num_queries;
+      int64_t nv = num_vectors;
+      group.put_metadata("k_nn", TILEDB_INT64, 1, &k);
+      group.put_metadata("num_queries", TILEDB_INT64, 1, &nq);
+      group.put_metadata("num_vectors", TILEDB_INT64, 1, &nv);
+      group.put_metadata("slot", TILEDB_INT64, 1, &slot);
+      group.put_metadata("next_column", TILEDB_INT64, 1, &next_column);
+      group.close();
+    }
+  }
+
+  size_t num_checkpoints = 0;
+  for (size_t first = next_column; first < num_vectors;
+       first += checkpoint_interval) {
+    auto last = std::min(first + checkpoint_interval, num_vectors);
+    index.accumulate(query, k_nn, first, last, min_scores);
+
+    if (checkpoint_uri.empty() || last == num_vectors) {
+      continue;
+    }
+    slot = (slot + 1) % 2;
+    auto&& [cols, distances] = heaps_to_matrices(min_scores, k_nn);
+    write_matrix(
+        ctx,
+        cols,
+        checkpoint_uri + "/" + groundtruth_cols_name(slot),
+        0,
+        false);
+    write_matrix(
+        ctx,
+        distances,
+        checkpoint_uri + "/" + groundtruth_distances_name(slot),
+        0,
+        false);
+
+    // Only now is the slot complete
+    next_column = last;
+    tiledb::Group group(ctx, checkpoint_uri, TILEDB_WRITE);
+    group.put_metadata("slot", TILEDB_INT64, 1, &slot);
+    group.put_metadata("next_column", TILEDB_INT64, 1, &next_column);
+    group.close();
+
+    if (max_checkpoints != 0 && ++num_checkpoints == max_checkpoints) {
+      return false;
+    }
+  }
+
+  auto&& [top_scores, top_ids] = index.top_k(min_scores, k_nn);
+  auto ids = ColMajorMatrix<groundtruth_id_type>(k_nn, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      ids(i, j) = static_cast<groundtruth_id_type>(top_ids(i, j));
+    }
+  }
+  write_matrix(ctx, ids, ids_uri);
+  write_matrix(ctx, top_scores, distances_uri);
+  return true;
+}
+
+}  // namespace detail::flat
+
+#endif  // TILEDB_FLAT_GROUNDTRUTH_H
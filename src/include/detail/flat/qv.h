@@ -33,7 +33,9 @@
 #ifndef TILEDB_FLAT_QV_H
 #define TILEDB_FLAT_QV_H
 
+#include <algorithm>
 #include <future>
+#include <limits>
 #include <numeric>
 #include <vector>
 
@@ -95,11 +97,16 @@ auto qv_query_nth(DB& db, const Q& q, int k, bool nth, unsigned int nthreads) {
 }
 
 /**
+ * @brief Query with a heap, skipping the columns of `db` that do not satisfy
+ * `is_live` (e.g., deleted vectors) before they are scored.  Queries with
+ * fewer than `k` live neighbors are padded with the maximum index.
+ *
  * @todo Use blocked / out-of-core to avoid memory blowup
  *
  */
 template <vector_database DB, class Q>
-auto qv_query_heap(DB& db, const Q& q, size_t k, unsigned nthreads) {
+auto qv_query_heap(
+    DB& db, const Q& q, size_t k, unsigned nthreads, auto&& is_live) {
   if constexpr (is_loadable_v<decltype(db)>) {
     db.load();
   }
@@ -127,23 +134,28 @@ auto qv_query_heap(DB& db, const Q& q, size_t k, unsigned nthreads) {
 
     if (start != stop) {
       futs.emplace_back(std::async(
-          std::launch::async, [k, start, stop, size_db, &q, &db, &top_k]() {
+          std::launch::async,
+          [k, start, stop, size_db, &q, &db, &top_k, &is_live]() {
             for (size_t j = start; j < stop; ++j) {
               fixed_min_pair_heap<float, size_t> min_scores(k);
-              size_t idx = 0;
 
               for (size_t i = 0; i < size_db; ++i) {
+                if (!is_live(i)) {
+                  continue;
+                }
                 auto score = L2(q[j], db[i]);
                 min_scores.insert(score, i);
               }
 
               // @todo use get_top_k_from_heap
               std::sort_heap(min_scores.begin(), min_scores.end());
-              std::transform(
+              auto last = std::transform(
                   min_scores.begin(),
                   min_scores.end(),
                   top_k[j].begin(),
                   ([](auto&& e) { return std::get<1>(e); }));
+              std::fill(
+                  last, top_k[j].end(), std::numeric_limits<size_t>::max());
             }
           }));
     }
@@ -156,6 +168,11 @@ auto qv_query_heap(DB& db, const Q& q, size_t k, unsigned nthreads) {
   return top_k;
 }
 
+template <vector_database DB, class Q>
+auto qv_query_heap(DB& db, const Q& q, size_t k, unsigned nthreads) {
+  return qv_query_heap(db, q, k, nthreads, [](size_t) { return true; });
+}
+
 template <class DB, class Q>
 auto qv_partition(const DB& db, const Q& q, unsigned nthreads) {
   scoped_timer _{tdb_func__};
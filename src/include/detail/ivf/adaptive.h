@@ -0,0 +1,191 @@
+/**
+ * @file   ivf/adaptive.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Adaptive probing of an ivf index: rather than scanning a fixed number of
+ * partitions for every query, each query scans its partitions in order of
+ * centroid distance and stops as soon as no further partition can hold a
+ * vector nearer than its current k-th nearest.
+ *
+ * The bound comes from the partition statistics (see `partition_stats.h`):
+ * no vector of a partition whose centroid is at distance `d` from the query
+ * is nearer than `d - radius`.  Partitions are visited in order of
+ * increasing `d`, so once `d - r` is at least the k-th distance, where `r`
+ * is the largest radius of the partitions left, the search is exact over
+ * the `max_nprobe` nearest partitions and can stop.  Partitions whose own
+ * bound (which also uses the range of their vectors' norms) rules them out
+ * are skipped.  Easy queries, whose neighbors are all in the
+ * nearest partition or two, stop early; hard ones use up to `max_nprobe`.
+ *
+ */
+
+#ifndef TILEDB_IVF_ADAPTIVE_H
+#define TILEDB_IVF_ADAPTIVE_H
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include "algorithm.h"
+#include "detail/ivf/partition_stats.h"
+#include "detail/ivf/qv.h"
+#include "detail/linalg/matrix.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+/**
+ * @brief Query an in-memory ivf index, probing at most `max_nprobe`
+ * partitions per query but stopping early once the partition radii show
+ * that no further partition can improve the query's top `k_nn`.
+ *
+ * @param stats Partition statistics of the index.
+ * @param num_probed If not null, set to the number of partitions scanned
+ * for each query.
+ * @param is_live Predicate on ids; vectors whose ids fail it (e.g., deleted
+ * ones) are skipped.  The bounds still hold, since the statistics cover a
+ * superset of the live vectors.
+ * @return Matrix whose column `j` holds the ids of the (approximate) `k_nn`
+ * nearest neighbors of query `j`, nearest first.
+ */
+auto adaptive_query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    const partition_stats& stats,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t max_nprobe,
+    size_t k_nn,
+    size_t nthreads,
+    std::vector<size_t>* num_probed,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__};
+
+  size_t num_parts = centroids.num_cols();
+  size_t num_queries = query.num_cols();
+  if (stats.num_partitions() != num_parts) {
+    throw std::runtime_error("Partition statistics do not match the index");
+  }
+  max_nprobe = std::min(max_nprobe, num_parts);
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      num_queries, fixed_min_pair_heap<float, size_t>(k_nn));
+  if (num_probed != nullptr) {
+    num_probed->assign(num_queries, 0);
+  }
+
+  std::vector<size_t> queries(num_queries);
+  std::iota(begin(queries), end(queries), 0);
+
+  stdx::execution::indexed_parallel_policy par{nthreads};
+  stdx::range_for_each(std::move(par), queries, [&](auto&& j, size_t, size_t) {
+    auto q_vec = query[j];
+    float query_norm = 0.0f;
+    for (auto x : q_vec) {
+      query_norm += static_cast<float>(x) * static_cast<float>(x);
+    }
+    query_norm = std::sqrt(query_norm);
+
+    // The nearest `max_nprobe` centroids, nearest first
+    std::vector<float> distances(num_parts);
+    for (size_t p = 0; p < num_parts; ++p) {
+      distances[p] = std::sqrt(L2(q_vec, centroids[p]));
+    }
+    std::vector<size_t> order(num_parts);
+    std::iota(begin(order), end(order), 0);
+    std::partial_sort(
+        begin(order),
+        begin(order) + max_nprobe,
+        end(order),
+        [&](size_t a, size_t b) { return distances[a] < distances[b]; });
+
+    // Largest radius of the partitions from the i-th on
+    std::vector<float> max_radius(max_nprobe + 1, 0.0f);
+    for (size_t i = max_nprobe; i-- > 0;) {
+      max_radius[i] = std::max(max_radius[i + 1], stats.radius(order[i]));
+    }
+
+    auto& heap = min_scores[j];
+    size_t probed = 0;
+    for (size_t i = 0; i < max_nprobe; ++i) {
+      auto p = order[i];
+      if (k_nn > 0 && size(heap) == k_nn) {
+        auto kth = std::get<0>(heap.front());
+        if (distances[p] - max_radius[i] >= std::sqrt(kth)) {
+          break;
+        }
+        if (stats.can_skip(p, distances[p], query_norm, kth)) {
+          continue;
+        }
+      }
+      for (size_t k = indices[p]; k < indices[p + 1]; ++k) {
+        if (is_live(shuffled_ids[k])) {
+          heap.insert(L2(q_vec, shuffled_db[k]), shuffled_ids[k]);
+        }
+      }
+      ++probed;
+    }
+    if (num_probed != nullptr) {
+      (*num_probed)[j] = probed;
+    }
+  });
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+auto adaptive_query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    const partition_stats& stats,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t max_nprobe,
+    size_t k_nn,
+    size_t nthreads,
+    std::vector<size_t>* num_probed = nullptr) {
+  return adaptive_query_infinite_ram(
+      shuffled_db,
+      centroids,
+      stats,
+      query,
+      indices,
+      shuffled_ids,
+      max_nprobe,
+      k_nn,
+      nthreads,
+      num_probed,
+      [](auto&&) { return true; });
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_ADAPTIVE_H
@@ -0,0 +1,406 @@
+/**
+ * @file   ivf/binary.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Binary (sign) codes used as a first-pass filter when scanning the
+ * partitions of an ivf index.
+ *
+ * Each vector is summarized by one bit per dimension: bit `i` is set when
+ * component `i` lies above the mean of that component over the whole
+ * dataset (the "center").  The bits are packed into
+ * `binary_code_words(dimension)` 64-bit words, stored as one column per
+ * vector in the same (partition) order as the vectors themselves.
+ *
+ * When a query is compared with a partition, the Hamming distances between
+ * its code and those of the partition's vectors are computed first (one
+ * popcount per word), and only the `num_survivors` vectors closest in
+ * Hamming distance are scored with the full L2 distance.  Since a popcount
+ * over d/64 words is much cheaper than an L2 distance over d components,
+ * this reduces the cost of scanning large partitions at some loss of
+ * recall, which is controlled by `num_survivors`.
+ *
+ */
+
+#ifndef TILEDB_IVF_BINARY_H
+#define TILEDB_IVF_BINARY_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "detail/ivf/partition.h"
+#include "detail/ivf/pq.h"
+#include "detail/linalg/matrix.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+/**
+ * @brief Number of 64-bit words in the binary code of a vector.
+ */
+inline size_t binary_code_words(size_t dimension) {
+  return (dimension + 63) / 64;
+}
+
+/**
+ * @brief Set the bits of `code` (`binary_code_words(size(v))` words) for
+ * the components of `v` that are above the corresponding component of
+ * `center`.
+ */
+template <class V>
+void binary_encode(
+    const V& v, const std::vector<float>& center, uint64_t* code) {
+  auto dimension = size(center);
+  std::fill(code, code + binary_code_words(dimension), uint64_t{0});
+  for (size_t i = 0; i < dimension; ++i) {
+    if (static_cast<float>(v[i]) > center[i]) {
+      code[i / 64] |= uint64_t{1} << (i % 64);
+    }
+  }
+}
+
+/**
+ * @brief Encode every column of `A`.
+ */
+template <class M>
+auto binary_encode(
+    const M& A, const std::vector<float>& center, size_t nthreads) {
+  auto words = binary_code_words(size(center));
+  ColMajorMatrix<uint64_t> codes(words, A.num_cols());
+
+  auto par = stdx::execution::indexed_parallel_policy{nthreads};
+  stdx::range_for_each(
+      std::move(par), A, [&](auto&& v, auto&& n = 0, auto&& j = 0) {
+        binary_encode(v, center, codes[j].data());
+      });
+  return codes;
+}
+
+/**
+ * @brief Add the columns of `A` to the running per-dimension sums in `sum`.
+ */
+template <class M>
+void binary_accumulate(const M& A, std::vector<double>& sum) {
+  for (size_t j = 0; j < A.num_cols(); ++j) {
+    for (size_t i = 0; i < A.num_rows(); ++i) {
+      sum[i] += A(i, j);
+    }
+  }
+}
+
+/**
+ * @brief Hamming distance between two codes of `words` words.
+ */
+inline size_t hamming(const uint64_t* a, const uint64_t* b, size_t words) {
+  size_t distance = 0;
+  for (size_t w = 0; w < words; ++w) {
+    distance += std::popcount(a[w] ^ b[w]);
+  }
+  return distance;
+}
+
+/**
+ * @brief The binary codes of the vectors of an index together with the
+ * center they were computed against.
+ */
+class binary_codes {
+  ColMajorMatrix<uint64_t> codes_;
+  std::vector<float> center_;
+
+ public:
+  binary_codes() = default;
+
+  binary_codes(ColMajorMatrix<uint64_t>&& codes, std::vector<float>&& center)
+      : codes_(std::move(codes))
+      , center_(std::move(center)) {
+    if (codes_.num_rows() != binary_code_words(center_.size())) {
+      throw std::runtime_error("Binary codes do not match their center");
+    }
+  }
+
+  /**
+   * @brief Read codes written by `save()`.
+   */
+  binary_codes(
+      const tiledb::Context& ctx,
+      const std::string& codes_uri,
+      const std::string& center_uri) {
+    auto codes = tdbColMajorMatrix<uint64_t>(ctx, codes_uri);
+    codes.load();
+    auto center = read_vector<float>(ctx, center_uri);
+    *this = binary_codes(
+        std::move(static_cast<ColMajorMatrix<uint64_t>&>(codes)),
+        std::move(center));
+  }
+
+  /**
+   * @brief Encode the columns of `A` against their mean.
+   */
+  template <class M>
+  static binary_codes encode(const M& A, size_t nthreads) {
+    std::vector<double> sum(A.num_rows(), 0.0);
+    binary_accumulate(A, sum);
+    std::vector<float> center(A.num_rows());
+    for (size_t i = 0; i < size(sum); ++i) {
+      center[i] = A.num_cols() == 0 ? 0.0f : sum[i] / A.num_cols();
+    }
+    auto codes = binary_encode(A, center, nthreads);
+    return binary_codes(std::move(codes), std::move(center));
+  }
+
+  void save(
+      const tiledb::Context& ctx,
+      const std::string& codes_uri,
+      const std::string& center_uri) {
+    write_matrix<uint64_t, stdx::layout_left, size_t>(ctx, codes_, codes_uri);
+    write_vector<float>(ctx, center_, center_uri);
+  }
+
+  bool empty() const {
+    return codes_.num_cols() == 0;
+  }
+
+  size_t num_vectors() const {
+    return codes_.num_cols();
+  }
+
+  const auto& codes() const {
+    return codes_;
+  }
+
+  const auto& center() const {
+    return center_;
+  }
+};
+
+/**
+ * @brief Search the partitions `[first_part, last_part)` of `shuffled_db`
+ * for the queries assigned to them, scoring with L2 only the
+ * `num_survivors` live vectors of each partition whose `codes` are nearest
+ * in Hamming distance to the query's code (`query_codes[j]`).  The other
+ * arguments are as for `apply_query`.
+ */
+auto binary_apply_query(
+    auto&& query,
+    auto&& query_codes,
+    auto&& shuffled_db,
+    auto&& codes,
+    auto&& new_indices,
+    auto&& active_queries,
+    auto&& ids,
+    auto&& active_partitions,
+    size_t k_nn,
+    size_t num_survivors,
+    size_t first_part,
+    size_t last_part,
+    auto&& is_live) {
+  auto num_queries = size(query);
+  auto words = codes.num_rows();
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      num_queries, fixed_min_pair_heap<float, size_t>(k_nn));
+
+  std::vector<std::tuple<size_t, size_t>> candidates;
+
+  for (size_t p = first_part; p < last_part; ++p) {
+    auto quartno = active_partitions[p];
+    auto start = new_indices[quartno];
+    auto stop = new_indices[quartno + 1];
+
+    for (auto j : active_queries[p]) {
+      auto q_code = query_codes[j].data();
+
+      candidates.clear();
+      for (size_t kp = start; kp < stop; ++kp) {
+        if (is_live(ids[kp])) {
+          candidates.emplace_back(hamming(q_code, codes[kp].data(), words), kp);
+        }
+      }
+      if (size(candidates) > num_survivors) {
+        std::nth_element(
+            begin(candidates),
+            begin(candidates) + num_survivors,
+            end(candidates));
+        candidates.resize(num_survivors);
+      }
+
+      auto q_vec = query[j];
+      for (auto&& [distance, kp] : candidates) {
+        min_scores[j].insert(L2(q_vec, shuffled_db[kp]), ids[kp]);
+      }
+    }
+  }
+  return min_scores;
+}
+
+/**
+ * @brief Query an in-memory ivf index using binary codes as a first-pass
+ * filter within each probed partition (see `binary_apply_query`).
+ *
+ * @param codes Binary codes of the vectors of `shuffled_db`, in the same
+ * order.
+ * @param num_survivors Number of vectors per partition and query that are
+ * scored with the full distance.
+ * @param is_live Predicate on ids; vectors whose ids fail it (e.g., deleted
+ * ones) are neither survivors nor results.
+ * @return Matrix whose column `j` holds the ids of the (approximate) `k_nn`
+ * nearest neighbors of query `j`, nearest first.
+ */
+auto binary_query_infinite_ram(
+    auto&& shuffled_db,
+    const binary_codes& codes,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    size_t num_survivors,
+    size_t nthreads,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__};
+
+  if (codes.num_vectors() != shuffled_db.num_cols() ||
+      size(codes.center()) != shuffled_db.num_rows()) {
+    throw std::runtime_error("Binary codes do not match the database");
+  }
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto query_codes = binary_encode(query, codes.center(), nthreads);
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      size(query), fixed_min_pair_heap<float, size_t>(k_nn));
+
+  pq_query_partitions(
+      size(active_partitions),
+      nthreads,
+      min_scores,
+      [&](size_t first_part, size_t last_part) {
+        return binary_apply_query(
+            query,
+            query_codes,
+            shuffled_db,
+            codes.codes(),
+            indices,
+            active_queries,
+            shuffled_ids,
+            active_partitions,
+            k_nn,
+            std::max(num_survivors, k_nn),
+            first_part,
+            last_part,
+            is_live);
+      });
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+auto binary_query_infinite_ram(
+    auto&& shuffled_db,
+    const binary_codes& codes,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    size_t num_survivors,
+    size_t nthreads) {
+  return binary_query_infinite_ram(
+      shuffled_db,
+      codes,
+      centroids,
+      query,
+      indices,
+      shuffled_ids,
+      nprobe,
+      k_nn,
+      num_survivors,
+      nthreads,
+      [](auto&&) { return true; });
+}
+
+/**
+ * @brief Compute the binary codes of the (partitioned) vectors in the array
+ * at `parts_uri`, reading at most `upper_bound` vectors at a time.
+ */
+template <class T>
+binary_codes build_binary_codes(
+    const tiledb::Context& ctx,
+    const std::string& parts_uri,
+    size_t upper_bound,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + " " + parts_uri};
+
+  // First pass: the per-dimension means
+  std::vector<double> sum;
+  size_t num_vectors = 0;
+  {
+    auto db = tdbColMajorMatrix<T>(ctx, parts_uri, upper_bound);
+    while (db.load()) {
+      sum.resize(db.num_rows(), 0.0);
+      binary_accumulate(db, sum);
+      num_vectors += db.num_cols();
+    }
+  }
+  if (num_vectors == 0) {
+    throw std::runtime_error("Cannot build binary codes of an empty array");
+  }
+  std::vector<float> center(size(sum));
+  for (size_t i = 0; i < size(sum); ++i) {
+    center[i] = static_cast<float>(sum[i] / num_vectors);
+  }
+
+  // Second pass: the codes
+  auto words = binary_code_words(size(center));
+  ColMajorMatrix<uint64_t> codes(words, num_vectors);
+  auto db = tdbColMajorMatrix<T>(ctx, parts_uri, upper_bound);
+  while (db.load()) {
+    auto block = binary_encode(db, center, nthreads);
+    std::copy(
+        block.data(),
+        block.data() + words * block.num_cols(),
+        codes.data() + words * db.col_offset());
+  }
+
+  return binary_codes(std::move(codes), std::move(center));
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_BINARY_H
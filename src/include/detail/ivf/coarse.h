@@ -0,0 +1,351 @@
+/**
+ * @file   ivf/coarse.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Second-level ivf over the centroids of an ivf index, used to find the
+ * partitions closest to a query without scoring every centroid.  The
+ * centroids (the "fine" centroids) are themselves grouped into coarse
+ * partitions.  A query is first compared with the coarse centroids, and
+ * then only with the fine centroids in its closest coarse partitions.  With
+ * about sqrt(nlist) coarse partitions this takes O(sqrt(nlist) * d) distance
+ * computations per query rather than O(nlist * d).
+ *
+ * Since the result is approximate, the partitions selected may differ from
+ * those found by `partition_ivf_index` over all of the centroids.  Searching
+ * more coarse partitions (see `set_nprobe`) trades speed for accuracy.
+ *
+ */
+
+#ifndef TDB_IVF_COARSE_H
+#define TDB_IVF_COARSE_H
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "detail/ivf/partition.h"
+#include "detail/ivf/qv.h"
+#include "detail/linalg/matrix.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+template <class T, class indices_type = uint64_t>
+class coarse_quantizer {
+  // The fine centroids of coarse partition `c` are the columns
+  // `members_[offsets_[c], offsets_[c+1])` of the fine centroid matrix
+  ColMajorMatrix<T> centroids_;
+  std::vector<indices_type> offsets_;
+  std::vector<indices_type> members_;
+
+  // Minimum number of coarse partitions searched per query
+  size_t nprobe_{16};
+
+ public:
+  coarse_quantizer() = default;
+
+  coarse_quantizer(
+      ColMajorMatrix<T>&& centroids,
+      std::vector<indices_type>&& offsets,
+      std::vector<indices_type>&& members)
+      : centroids_(std::move(centroids))
+      , offsets_(std::move(offsets))
+      , members_(std::move(members)) {
+    if (size(offsets_) != centroids_.num_cols() + 1 ||
+        offsets_.back() != size(members_)) {
+      throw std::runtime_error("Inconsistent coarse quantizer");
+    }
+  }
+
+  /**
+   * @brief Read a quantizer written by `save()`.
+   */
+  coarse_quantizer(
+      const tiledb::Context& ctx,
+      const std::string& centroids_uri,
+      const std::string& offsets_uri,
+      const std::string& members_uri) {
+    // Centroids are stored as float32, whatever the vector type
+    auto centroids = tdbColMajorMatrix<float>(ctx, centroids_uri);
+    centroids.load();
+    auto converted =
+        ColMajorMatrix<T>(centroids.num_rows(), centroids.num_cols());
+    std::copy(
+        centroids.data(),
+        centroids.data() + centroids.num_rows() * centroids.num_cols(),
+        converted.data());
+    auto offsets = read_vector<uint64_t>(ctx, offsets_uri);
+    auto members = read_vector<uint64_t>(ctx, members_uri);
+    *this = coarse_quantizer(
+        std::move(converted),
+        std::vector<indices_type>(begin(offsets), end(offsets)),
+        std::vector<indices_type>(begin(members), end(members)));
+  }
+
+  /**
+   * @brief Build a quantizer from coarse centroids and the coarse partition
+   * `labels[i]` of each fine centroid `i`.
+   */
+  static coarse_quantizer from_labels(
+      ColMajorMatrix<T>&& centroids, const std::vector<size_t>& labels) {
+    std::vector<indices_type> offsets(centroids.num_cols() + 1, 0);
+    for (auto c : labels) {
+      ++offsets[c + 1];
+    }
+    std::inclusive_scan(begin(offsets), end(offsets), begin(offsets));
+    std::vector<indices_type> members(size(labels));
+    auto fill = offsets;
+    for (size_t i = 0; i < size(labels); ++i) {
+      members[fill[labels[i]]++] = i;
+    }
+    return coarse_quantizer(
+        std::move(centroids), std::move(offsets), std::move(members));
+  }
+
+  /**
+   * @brief Write the quantizer to three new arrays, with the centroids as
+   * float32 and the offsets and members as uint64, as Python reads them.
+   */
+  void save(
+      const tiledb::Context& ctx,
+      const std::string& centroids_uri,
+      const std::string& offsets_uri,
+      const std::string& members_uri) const {
+    auto centroids =
+        ColMajorMatrix<float>(centroids_.num_rows(), centroids_.num_cols());
+    std::copy(
+        centroids_.data(),
+        centroids_.data() + centroids_.num_rows() * centroids_.num_cols(),
+        centroids.data());
+    write_matrix<float, stdx::layout_left, size_t>(
+        ctx, centroids, centroids_uri);
+    auto offsets = std::vector<uint64_t>(begin(offsets_), end(offsets_));
+    auto members = std::vector<uint64_t>(begin(members_), end(members_));
+    write_vector<uint64_t>(ctx, offsets, offsets_uri);
+    write_vector<uint64_t>(ctx, members, members_uri);
+  }
+
+  bool empty() const {
+    return centroids_.num_cols() == 0;
+  }
+
+  /**
+   * @brief Number of fine centroids the quantizer covers.
+   */
+  size_t num_fine() const {
+    return size(members_);
+  }
+
+  void set_nprobe(size_t nprobe) {
+    nprobe_ = std::max<size_t>(1, nprobe);
+  }
+
+  size_t nprobe() const {
+    return nprobe_;
+  }
+
+  auto& centroids() {
+    return centroids_;
+  }
+
+  auto& offsets() {
+    return offsets_;
+  }
+
+  auto& members() {
+    return members_;
+  }
+
+  const auto& centroids() const {
+    return centroids_;
+  }
+
+  const auto& offsets() const {
+    return offsets_;
+  }
+
+  const auto& members() const {
+    return members_;
+  }
+
+  /**
+   * @brief Find the (approximately) `nprobe` fine centroids closest to each
+   * query.  The coarse partitions are visited nearest first until at least
+   * `nprobe()` of them have been searched and they have yielded at least
+   * `nprobe` fine centroids.
+   *
+   * @return Matrix whose column `j` holds the ids of the fine centroids
+   * selected for query `j`, in no particular order.
+   */
+  auto search(
+      auto&& fine_centroids,
+      auto&& query,
+      size_t nprobe,
+      size_t nthreads) const {
+    scoped_timer _{tdb_func__};
+
+    nprobe = std::min(nprobe, num_fine());
+    size_t num_coarse = centroids_.num_cols();
+
+    ColMajorMatrix<size_t> top_centroids(nprobe, size(query));
+
+    auto par = stdx::execution::indexed_parallel_policy{nthreads};
+    stdx::range_for_each(
+        std::move(par), query, [&](auto&& q_vec, auto&& n = 0, auto&& j = 0) {
+          std::vector<float> scores(num_coarse);
+          for (size_t c = 0; c < num_coarse; ++c) {
+            scores[c] = L2(q_vec, centroids_[c]);
+          }
+          std::vector<size_t> order(num_coarse);
+          std::iota(begin(order), end(order), 0);
+          std::sort(begin(order), end(order), [&](auto a, auto b) {
+            return scores[a] < scores[b];
+          });
+
+          auto heap = fixed_min_pair_heap<float, size_t>(nprobe);
+          size_t visited = 0;
+          size_t candidates = 0;
+          for (auto c : order) {
+            if (visited >= nprobe_ && candidates >= nprobe) {
+              break;
+            }
+            for (auto m = offsets_[c]; m < offsets_[c + 1]; ++m) {
+              heap.insert(
+                  L2(q_vec, fine_centroids[members_[m]]), members_[m]);
+            }
+            candidates += offsets_[c + 1] - offsets_[c];
+            ++visited;
+          }
+          for (size_t i = 0; i < nprobe; ++i) {
+            top_centroids(i, j) = std::get<1>(heap[i]);
+          }
+        });
+
+    return top_centroids;
+  }
+};
+
+/**
+ * @brief Like `partition_ivf_index`, but selecting the partitions for each
+ * query with a coarse quantizer over `centroids` instead of comparing the
+ * query with all of them.
+ */
+template <class T, class indices_type>
+auto partition_ivf_index(
+    const coarse_quantizer<T, indices_type>& quantizer,
+    auto&& centroids,
+    auto&& query,
+    size_t nprobe,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + std::string{"_coarse"}};
+
+  auto top_centroids = quantizer.search(centroids, query, nprobe, nthreads);
+
+  return invert_top_centroids(top_centroids, size(query), nthreads);
+}
+
+/**
+ * @brief Like `query_infinite_ram`, but selecting the partitions to search
+ * with `quantizer`.  Vectors whose ids do not satisfy `is_live` are skipped.
+ */
+template <class T, class indices_type>
+auto coarse_query_infinite_ram(
+    auto&& shuffled_db,
+    const coarse_quantizer<T, indices_type>& quantizer,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    size_t nthreads,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__};
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(quantizer, centroids, query, nprobe, nthreads);
+  auto min_scores = query_infinite_ram_min_scores(
+      shuffled_db,
+      query,
+      indices,
+      shuffled_ids,
+      active_partitions,
+      active_queries,
+      k_nn,
+      nthreads,
+      is_live);
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+/**
+ * @brief Like `query_finite_ram`, but selecting the partitions to search
+ * with `quantizer`.  Vectors whose ids do not satisfy `is_live` are skipped.
+ */
+template <class T, class shuffled_ids_type, class U, class indices_type>
+auto coarse_query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    const coarse_quantizer<U, indices_type>& quantizer,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    size_t nthreads,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__ + " " + part_uri};
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(quantizer, centroids, query, nprobe, nthreads);
+  auto min_scores = query_finite_ram_min_scores<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      query,
+      indices,
+      id_uri,
+      active_partitions,
+      active_queries,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      is_live);
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+}  // namespace detail::ivf
+
+#endif  // TDB_IVF_COARSE_H
@@ -0,0 +1,515 @@
+/**
+ * @file   ivf/delta.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Support for incremental updates to an ivf index without rebuilding it.
+ *
+ * New vectors are assigned to the existing centroids and appended to a small
+ * per-partition "delta" store that sits alongside the main (shuffled)
+ * partitioned arrays.  Deletions are recorded as tombstones, i.e., ids that
+ * must be skipped when scanning the main arrays, kept in an `id_bitmap` (a
+ * compressed set, whose size depends on the number of deleted ids, not on
+ * how large they are) that the query kernels test each id against.  Adding
+ * a vector with an id that is already in the main arrays replaces it: the
+ * old vector is tombstoned and the new one goes in the delta store.
+ *
+ * The `query_finite_ram` and `query_infinite_ram` overloads here take an
+ * `ivf_delta` in addition to the usual arguments and search the delta
+ * partitions along with the corresponding main partitions, skipping
+ * tombstoned vectors.  Periodically (e.g., in a background thread, or when the
+ * delta grows beyond some fraction of the main arrays), `compact` folds the
+ * delta back into the main arrays, after which the delta can be cleared.
+ *
+ */
+
+#ifndef TILEDB_IVF_DELTA_H
+#define TILEDB_IVF_DELTA_H
+
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "algorithm.h"
+#include "detail/flat/qv.h"
+#include "detail/ivf/partition.h"
+#include "detail/ivf/qv.h"
+#include "linalg.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/id_bitmap.h"
+
+namespace detail::ivf {
+
+template <class T, class shuffled_ids_type>
+class ivf_delta {
+  size_t dimension_{0};
+
+  // Vectors added to each partition (stored contiguously, one vector after
+  // another) and their ids
+  std::vector<std::vector<T>> vectors_;
+  std::vector<std::vector<shuffled_ids_type>> ids_;
+
+  // Partition holding each id in the delta store
+  std::unordered_map<shuffled_ids_type, size_t> locations_;
+
+  // Ids of vectors in the main arrays that have been deleted or replaced
+  id_bitmap tombstones_;
+
+  // Add the scores of the vectors of partition `part` whose ids satisfy
+  // `is_live` to the heap `min_scores` of query `q_vec`
+  void scan(
+      const auto& q_vec, size_t part, auto& min_scores, auto&& is_live) const {
+    auto& part_ids = ids_[part];
+    auto vec = vectors_[part].data();
+    for (size_t i = 0; i < size(part_ids); ++i, vec += dimension_) {
+      if (!is_live(part_ids[i])) {
+        continue;
+      }
+      auto score = L2(q_vec, std::span<const T>(vec, dimension_));
+      min_scores.insert(score, part_ids[i]);
+    }
+  }
+
+ public:
+  using value_type = T;
+  using id_type = shuffled_ids_type;
+
+  ivf_delta() = default;
+
+  ivf_delta(size_t dimension, size_t num_partitions)
+      : dimension_(dimension)
+      , vectors_(num_partitions)
+      , ids_(num_partitions) {
+  }
+
+  /**
+   * @brief Add (or replace) vectors.  Each vector is assigned to its closest
+   * centroid and appended to that partition of the delta store.
+   *
+   * @param centroids Centroids of the main index.
+   * @param vectors Vectors to add, one per column.
+   * @param ids Ids of the vectors.
+   * @param in_main Whether an id is in the main arrays.  Only those ids are
+   * tombstoned, so adding new ids leaves the tombstones alone.
+   */
+  void add(
+      const auto& centroids,
+      const auto& vectors,
+      const std::vector<shuffled_ids_type>& ids,
+      size_t nthreads,
+      auto&& in_main) {
+    if (vectors.num_rows() != dimension_ ||
+        centroids.num_rows() != dimension_) {
+      throw std::runtime_error("Vector dimension does not match index");
+    }
+    if (centroids.num_cols() != size(vectors_)) {
+      throw std::runtime_error(
+          "Number of centroids does not match number of partitions");
+    }
+    if (vectors.num_cols() != size(ids)) {
+      throw std::runtime_error(
+          "Number of vectors does not match number of ids");
+    }
+
+    remove(ids, in_main);
+    auto parts = detail::flat::qv_partition(centroids, vectors, nthreads);
+    for (size_t i = 0; i < vectors.num_cols(); ++i) {
+      auto part = parts[i];
+      vectors_[part].insert(
+          end(vectors_[part]), begin(vectors[i]), end(vectors[i]));
+      ids_[part].push_back(ids[i]);
+      locations_[ids[i]] = part;
+    }
+  }
+
+  /**
+   * @brief Add (or replace) vectors, any of whose ids may be in the main
+   * arrays.
+   */
+  void add(
+      const auto& centroids,
+      const auto& vectors,
+      const std::vector<shuffled_ids_type>& ids,
+      size_t nthreads) {
+    add(centroids, vectors, ids, nthreads, [](auto&&) { return true; });
+  }
+
+  /**
+   * @brief Delete vectors by id, whether they are in the main arrays or in
+   * the delta store.  Ids for which `in_main` is false are not tombstoned.
+   */
+  void remove(const std::vector<shuffled_ids_type>& ids, auto&& in_main) {
+    for (auto&& id : ids) {
+      if (in_main(id)) {
+        tombstones_.set(id);
+      }
+
+      auto location = locations_.find(id);
+      if (location == end(locations_)) {
+        continue;
+      }
+      // Swap with the last vector of the partition and shrink it
+      auto part = location->second;
+      auto& part_ids = ids_[part];
+      auto& part_vectors = vectors_[part];
+      auto pos =
+          std::find(begin(part_ids), end(part_ids), id) - begin(part_ids);
+      auto last = size(part_ids) - 1;
+      if (static_cast<size_t>(pos) != last) {
+        part_ids[pos] = part_ids[last];
+        std::copy(
+            begin(part_vectors) + last * dimension_,
+            begin(part_vectors) + (last + 1) * dimension_,
+            begin(part_vectors) + pos * dimension_);
+      }
+      part_ids.pop_back();
+      part_vectors.resize(last * dimension_);
+      locations_.erase(location);
+    }
+  }
+
+  void remove(const std::vector<shuffled_ids_type>& ids) {
+    remove(ids, [](auto&&) { return true; });
+  }
+
+  /**
+   * @brief Whether a vector in the main arrays has been deleted (or replaced
+   * by a vector in the delta store).
+   */
+  bool is_deleted(shuffled_ids_type id) const {
+    return tombstones_.contains(id);
+  }
+
+  /**
+   * @brief Record the ids in `tombstones` (e.g., read from an index group)
+   * as deleted from the main arrays.
+   */
+  void add_tombstones(const id_bitmap& tombstones) {
+    tombstones.for_each([this](uint64_t id) { tombstones_.set(id); });
+  }
+
+  const id_bitmap& tombstones() const {
+    return tombstones_;
+  }
+
+  size_t num_partitions() const {
+    return size(vectors_);
+  }
+
+  size_t num_vectors() const {
+    return size(locations_);
+  }
+
+  size_t num_tombstones() const {
+    return tombstones_.count();
+  }
+
+  bool empty() const {
+    return locations_.empty() && tombstones_.empty();
+  }
+
+  /**
+   * @brief Drop the tombstones of ids for which `in_main` is false, e.g.,
+   * once the main arrays have been replaced by compacted ones.
+   */
+  void prune_tombstones(auto&& in_main) {
+    std::vector<uint64_t> stale;
+    tombstones_.for_each([&](uint64_t id) {
+      if (!in_main(id)) {
+        stale.push_back(id);
+      }
+    });
+    for (auto&& id : stale) {
+      tombstones_.reset(id);
+    }
+  }
+
+  void clear() {
+    for (size_t p = 0; p < size(vectors_); ++p) {
+      vectors_[p].clear();
+      ids_[p].clear();
+    }
+    locations_.clear();
+    tombstones_.clear();
+  }
+
+  /**
+   * @brief Search the delta partitions that each query probes, adding the
+   * results to the per-query heaps in `min_scores`.
+   *
+   * @param active_partitions Partitions probed by at least one query, as
+   * returned by `partition_ivf_index`.
+   * @param active_queries The queries probing each active partition.
+   */
+  void search(
+      const auto& query,
+      const auto& active_partitions,
+      const auto& active_queries,
+      auto& min_scores,
+      size_t nthreads) const {
+    search(
+        query,
+        active_partitions,
+        active_queries,
+        min_scores,
+        nthreads,
+        [](auto&&) { return true; });
+  }
+
+  /**
+   * @brief As `search()` above, but only scoring the vectors whose ids
+   * satisfy `is_live`.
+   */
+  void search(
+      const auto& query,
+      const auto& active_partitions,
+      const auto& active_queries,
+      auto& min_scores,
+      size_t nthreads,
+      auto&& is_live) const {
+    if (num_vectors() == 0) {
+      return;
+    }
+
+    // Invert the partition -> queries map so that each query's heap is
+    // updated by a single thread
+    std::vector<std::vector<size_t>> query_parts(size(query));
+    for (size_t p = 0; p < size(active_partitions); ++p) {
+      if (ids_[active_partitions[p]].empty()) {
+        continue;
+      }
+      for (auto&& j : active_queries[p]) {
+        query_parts[j].push_back(active_partitions[p]);
+      }
+    }
+
+    stdx::execution::indexed_parallel_policy par{nthreads};
+    stdx::range_for_each(
+        std::move(par), query_parts, [&](auto&& parts, size_t n, size_t j) {
+          auto q_vec = query[j];
+          for (auto&& part : parts) {
+            scan(q_vec, part, min_scores[j], is_live);
+          }
+        });
+  }
+
+  /**
+   * @brief As `search()` above, but scoring every delta vector for every
+   * query, as an exhaustive search does.
+   */
+  void search_all(
+      const auto& query,
+      auto& min_scores,
+      size_t nthreads,
+      auto&& is_live) const {
+    if (num_vectors() == 0) {
+      return;
+    }
+
+    std::vector<size_t> queries(query.num_cols());
+    std::iota(begin(queries), end(queries), 0);
+    stdx::execution::indexed_parallel_policy par{nthreads};
+    stdx::range_for_each(
+        std::move(par), queries, [&](auto&& j, size_t, size_t) {
+          auto q_vec = query[j];
+          for (size_t part = 0; part < size(ids_); ++part) {
+            scan(q_vec, part, min_scores[j], is_live);
+          }
+        });
+  }
+
+  /**
+   * @brief Fold the delta into in-memory main arrays: tombstoned vectors are
+   * dropped and the delta vectors are appended to their partitions.  The
+   * delta itself is not modified; call `clear()` once the compacted arrays
+   * have replaced the originals.
+   *
+   * @return Tuple of the new shuffled database, partition indices and
+   * shuffled ids.
+   */
+  template <class indices_type>
+  auto compact(
+      const auto& shuffled_db,
+      const std::vector<indices_type>& indices,
+      const std::vector<shuffled_ids_type>& shuffled_ids) const {
+    scoped_timer _{tdb_func__};
+
+    auto num_parts = size(indices) - 1;
+    if (num_parts != size(vectors_)) {
+      throw std::runtime_error(
+          "Number of partitions does not match delta partitions");
+    }
+
+    std::vector<indices_type> new_indices(num_parts + 1, 0);
+    for (size_t p = 0; p < num_parts; ++p) {
+      size_t live = 0;
+      for (auto i = indices[p]; i < indices[p + 1]; ++i) {
+        live += !is_deleted(shuffled_ids[i]);
+      }
+      new_indices[p + 1] = new_indices[p] + live + size(ids_[p]);
+    }
+
+    auto num_vectors = new_indices[num_parts];
+    auto new_db = ColMajorMatrix<T>(dimension_, num_vectors);
+    auto new_ids = std::vector<shuffled_ids_type>(num_vectors);
+
+    size_t out = 0;
+    for (size_t p = 0; p < num_parts; ++p) {
+      for (auto i = indices[p]; i < indices[p + 1]; ++i) {
+        if (is_deleted(shuffled_ids[i])) {
+          continue;
+        }
+        std::copy(
+            begin(shuffled_db[i]), end(shuffled_db[i]), begin(new_db[out]));
+        new_ids[out] = shuffled_ids[i];
+        ++out;
+      }
+      auto vec = vectors_[p].data();
+      for (size_t i = 0; i < size(ids_[p]); ++i, vec += dimension_) {
+        std::copy(vec, vec + dimension_, begin(new_db[out]));
+        new_ids[out] = ids_[p][i];
+        ++out;
+      }
+    }
+
+    return std::make_tuple(
+        std::move(new_db), std::move(new_indices), std::move(new_ids));
+  }
+
+  /**
+   * @brief Fold the delta into the main arrays stored in TileDB, writing the
+   * compacted arrays to new URIs (the partition sizes change, so the arrays
+   * cannot be updated in place).
+   */
+  template <class indices_type>
+  void compact(
+      const tiledb::Context& ctx,
+      const std::string& part_uri,
+      const std::string& index_uri,
+      const std::string& id_uri,
+      const std::string& new_part_uri,
+      const std::string& new_index_uri,
+      const std::string& new_id_uri) const {
+    auto shuffled_db = tdbColMajorMatrix<T>(ctx, part_uri);
+    shuffled_db.load();
+    auto indices = read_vector<indices_type>(ctx, index_uri);
+    auto shuffled_ids = read_vector<shuffled_ids_type>(ctx, id_uri);
+
+    auto&& [new_db, new_indices, new_ids] =
+        compact(shuffled_db, indices, shuffled_ids);
+
+    write_matrix(ctx, new_db, new_part_uri);
+    write_vector(ctx, new_indices, new_index_uri);
+    write_vector(ctx, new_ids, new_id_uri);
+  }
+};
+
+/**
+ * @brief Query an in-memory ivf index together with its delta store.
+ * Tombstoned vectors in `shuffled_db` are skipped and the delta partitions
+ * are searched along with the main ones.
+ */
+template <class T, class shuffled_ids_type>
+auto query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    const ivf_delta<T, shuffled_ids_type>& delta,
+    size_t nprobe,
+    size_t k_nn,
+    bool nth,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + std::string{"_in_ram_with_delta"}};
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_infinite_ram_min_scores(
+      shuffled_db,
+      query,
+      indices,
+      shuffled_ids,
+      active_partitions,
+      active_queries,
+      k_nn,
+      nthreads,
+      [&delta](auto&& id) { return !delta.is_deleted(id); });
+
+  delta.search(query, active_partitions, active_queries, min_scores, nthreads);
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+/**
+ * @brief Query an ivf index stored in TileDB together with its delta store,
+ * loading at most `upper_bound` vectors of the main arrays at a time.
+ */
+template <class T, class shuffled_ids_type>
+auto query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    const ivf_delta<T, shuffled_ids_type>& delta,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    bool nth,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + " " + part_uri};
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_finite_ram_min_scores<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      query,
+      indices,
+      id_uri,
+      active_partitions,
+      active_queries,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      [&delta](auto&& id) { return !delta.is_deleted(id); });
+
+  delta.search(query, active_partitions, active_queries, min_scores, nthreads);
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_DELTA_H
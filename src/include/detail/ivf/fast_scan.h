@@ -0,0 +1,327 @@
+/**
+ * @file   ivf/fast_scan.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Scanning kernel for ivf-pq partitions holding 4-bit PQ codes ("fast
+ * scan").  With 16 codewords per subspace, the distance table for one
+ * subspace is 16 entries, which, quantized to uint8, fits in a single SIMD
+ * register.  An in-register byte shuffle (`pshufb`) then looks up the
+ * distances of many vectors at once.
+ *
+ * The codes of a partition are stored in blocks of `fast_scan_block_size`
+ * (32) vectors.  For each subspace, a block holds 16 bytes: byte `i` packs
+ * the code of vector `i` in its low nibble and that of vector `i + 16` in
+ * its high nibble.  The subspaces are padded to an even number so that the
+ * AVX2 kernel can process two of them per 32-byte load.  Partitions are
+ * padded to a whole number of blocks; padding codes are 0 and are never
+ * reported.
+ *
+ * The quantized table holds, for each subspace, the distances less the
+ * subspace's minimum, scaled so that the largest fits in a byte.  Sums are
+ * accumulated in (saturating) 16-bit integers and converted back to
+ * approximate float distances before being compared across partitions.
+ *
+ */
+
+#ifndef TILEDB_IVF_FAST_SCAN_H
+#define TILEDB_IVF_FAST_SCAN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "detail/ivf/pq.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+constexpr size_t fast_scan_block_size = 32;
+constexpr size_t fast_scan_num_codewords = 16;
+
+/**
+ * @brief Number of subspaces stored per block (`num_subspaces` rounded up
+ * to an even number).
+ */
+inline size_t fast_scan_padded_subspaces(size_t num_subspaces) {
+  return (num_subspaces + 1) & ~size_t{1};
+}
+
+/**
+ * @brief Bytes per block of `fast_scan_block_size` vectors.
+ */
+inline size_t fast_scan_block_bytes(size_t num_subspaces) {
+  return fast_scan_padded_subspaces(num_subspaces) * 16;
+}
+
+/**
+ * @brief First block of each partition, given the partition index
+ * `indices` (in vectors).
+ */
+template <class indices_type>
+std::vector<indices_type> fast_scan_block_indices(
+    const std::vector<indices_type>& indices) {
+  std::vector<indices_type> blocks(size(indices), 0);
+  for (size_t p = 0; p + 1 < size(indices); ++p) {
+    auto n = indices[p + 1] - indices[p];
+    blocks[p + 1] = blocks[p] +
+                    (n + fast_scan_block_size - 1) / fast_scan_block_size;
+  }
+  return blocks;
+}
+
+/**
+ * @brief Pack the 4-bit codes of `n` vectors, `codes[i * num_subspaces + m]`
+ * being the code of vector `i` for subspace `m`, into
+ * `ceil(n / fast_scan_block_size)` blocks starting at `out`.
+ */
+inline void fast_scan_pack(
+    const uint8_t* codes, size_t n, size_t num_subspaces, uint8_t* out) {
+  auto block_bytes = fast_scan_block_bytes(num_subspaces);
+  for (size_t b = 0; b * fast_scan_block_size < n; ++b) {
+    auto block = out + b * block_bytes;
+    std::fill(block, block + block_bytes, 0);
+    for (size_t i = 0; i < fast_scan_block_size; ++i) {
+      auto v = b * fast_scan_block_size + i;
+      if (v >= n) {
+        break;
+      }
+      auto shift = i < 16 ? 0 : 4;
+      for (size_t m = 0; m < num_subspaces; ++m) {
+        block[m * 16 + i % 16] |= (codes[v * num_subspaces + m] & 0x0f)
+                                  << shift;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Quantize the float distance table `table` (16 entries per
+ * subspace) to `qtable` (16 bytes per padded subspace).  A sum `s` of
+ * quantized entries approximates the distance `bias + s * inv_scale`.
+ */
+inline void fast_scan_quantize_table(
+    const std::vector<float>& table,
+    size_t num_subspaces,
+    std::vector<uint8_t>& qtable,
+    float& bias,
+    float& inv_scale) {
+  qtable.assign(fast_scan_block_bytes(num_subspaces), 0);
+
+  bias = 0;
+  float max_range = 0;
+  std::vector<float> mins(num_subspaces);
+  for (size_t m = 0; m < num_subspaces; ++m) {
+    auto first = begin(table) + m * fast_scan_num_codewords;
+    auto [lo, hi] = std::minmax_element(first, first + fast_scan_num_codewords);
+    mins[m] = *lo;
+    bias += *lo;
+    max_range = std::max(max_range, *hi - *lo);
+  }
+
+  float scale = max_range > 0 ? 255.0f / max_range : 0.0f;
+  inv_scale = max_range > 0 ? max_range / 255.0f : 0.0f;
+  for (size_t m = 0; m < num_subspaces; ++m) {
+    for (size_t k = 0; k < fast_scan_num_codewords; ++k) {
+      auto q = std::nearbyint(
+          (table[m * fast_scan_num_codewords + k] - mins[m]) * scale);
+      qtable[m * 16 + k] = static_cast<uint8_t>(std::clamp(q, 0.0f, 255.0f));
+    }
+  }
+}
+
+/**
+ * @brief Sum the quantized distances of the 32 vectors of `block` into
+ * `sums`.
+ */
+inline void fast_scan_block(
+    const uint8_t* block,
+    const uint8_t* qtable,
+    size_t num_subspaces,
+    uint16_t* sums) {
+  auto padded = fast_scan_padded_subspaces(num_subspaces);
+#ifdef __AVX2__
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  // Vectors 0-7, 8-15, 16-23 and 24-31, for the even subspaces in the low
+  // lane and the odd ones in the high lane
+  __m256i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+  for (size_t m = 0; m < padded; m += 2) {
+    auto codes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + m * 16));
+    auto lut =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(qtable + m * 16));
+    auto lo = _mm256_and_si256(codes, mask);
+    auto hi = _mm256_and_si256(_mm256_srli_epi16(codes, 4), mask);
+    auto dlo = _mm256_shuffle_epi8(lut, lo);
+    auto dhi = _mm256_shuffle_epi8(lut, hi);
+    acc0 = _mm256_adds_epu16(acc0, _mm256_unpacklo_epi8(dlo, zero));
+    acc1 = _mm256_adds_epu16(acc1, _mm256_unpackhi_epi8(dlo, zero));
+    acc2 = _mm256_adds_epu16(acc2, _mm256_unpacklo_epi8(dhi, zero));
+    acc3 = _mm256_adds_epu16(acc3, _mm256_unpackhi_epi8(dhi, zero));
+  }
+  auto fold = [](__m256i acc) {
+    return _mm_adds_epu16(
+        _mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  };
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), fold(acc0));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 8), fold(acc1));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 16), fold(acc2));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + 24), fold(acc3));
+#else
+  for (size_t i = 0; i < fast_scan_block_size; ++i) {
+    sums[i] = 0;
+  }
+  for (size_t m = 0; m < padded; ++m) {
+    auto codes = block + m * 16;
+    auto lut = qtable + m * 16;
+    for (size_t i = 0; i < 16; ++i) {
+      auto lo = lut[codes[i] & 0x0f];
+      auto hi = lut[codes[i] >> 4];
+      sums[i] = std::min<uint32_t>(sums[i] + lo, 0xffff);
+      sums[i + 16] = std::min<uint32_t>(sums[i + 16] + hi, 0xffff);
+    }
+  }
+#endif
+}
+
+/**
+ * @brief Like `pq_apply_query`, for partitions of 4-bit codes packed into
+ * blocks (see above).  `codes` has one column per block, and partition `p`
+ * occupies the blocks `[block_indices[p], block_indices[p+1])`.
+ */
+auto fast_scan_apply_query(
+    auto&& query,
+    auto&& codes,
+    auto&& indices,
+    auto&& block_indices,
+    auto&& active_queries,
+    auto&& ids,
+    auto&& active_partitions,
+    auto&& centroids,
+    auto&& codebooks,
+    size_t num_subspaces,
+    size_t k_nn,
+    size_t first_part,
+    size_t last_part) {
+  auto num_queries = size(query);
+  auto dimension = centroids.num_rows();
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      num_queries, fixed_min_pair_heap<float, size_t>(k_nn));
+
+  std::vector<float> residual(dimension);
+  std::vector<float> table;
+  std::vector<uint8_t> qtable;
+  uint16_t sums[fast_scan_block_size];
+
+  for (size_t p = first_part; p < last_part; ++p) {
+    auto partno = active_partitions[p];
+    auto start = indices[partno];
+    auto stop = indices[partno + 1];
+    auto centroid = centroids[partno];
+
+    for (auto j : active_queries[p]) {
+      auto q_vec = query[j];
+      for (size_t i = 0; i < dimension; ++i) {
+        residual[i] = q_vec[i] - centroid[i];
+      }
+      pq_distance_table(residual, codebooks, num_subspaces, table);
+      float bias, inv_scale;
+      fast_scan_quantize_table(table, num_subspaces, qtable, bias, inv_scale);
+
+      for (auto b = block_indices[partno]; b < block_indices[partno + 1];
+           ++b) {
+        fast_scan_block(codes[b].data(), qtable.data(), num_subspaces, sums);
+        auto first = start + (b - block_indices[partno]) * fast_scan_block_size;
+        auto n = std::min<size_t>(fast_scan_block_size, stop - first);
+        for (size_t i = 0; i < n; ++i) {
+          min_scores[j].insert(bias + sums[i] * inv_scale, ids[first + i]);
+        }
+      }
+    }
+  }
+  return min_scores;
+}
+
+/**
+ * @brief Query an in-memory ivf-pq index with 4-bit codes.
+ */
+auto fast_scan_query_infinite_ram(
+    auto&& codes,
+    auto&& centroids,
+    auto&& codebooks,
+    auto&& query,
+    auto&& indices,
+    auto&& block_indices,
+    auto&& shuffled_ids,
+    size_t num_subspaces,
+    size_t nprobe,
+    size_t k_nn,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__};
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      size(query), fixed_min_pair_heap<float, size_t>(k_nn));
+
+  pq_query_partitions(
+      size(active_partitions),
+      nthreads,
+      min_scores,
+      [&](size_t first_part, size_t last_part) {
+        return fast_scan_apply_query(
+            query,
+            codes,
+            indices,
+            block_indices,
+            active_queries,
+            shuffled_ids,
+            active_partitions,
+            centroids,
+            codebooks,
+            num_subspaces,
+            k_nn,
+            first_part,
+            last_part);
+      });
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_FAST_SCAN_H
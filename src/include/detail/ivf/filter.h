@@ -0,0 +1,311 @@
+/**
+ * @file   ivf/filter.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Filtered search: the nearest neighbors of each query among the vectors
+ * whose ids pass a filter, e.g., an `id_bitmap` of the ids whose metadata
+ * matches a predicate.
+ *
+ * The filter is tested inside the partition scan, before a vector's
+ * distance is computed, rather than by over-fetching and discarding
+ * results, which loses recall when few vectors pass.  When so few vectors
+ * pass that scoring all of them costs no more than scanning the probed
+ * partitions, i.e. when
+ *
+ *   num_passing * nlist <= nprobe * num_vectors,
+ *
+ * the passing vectors are searched exhaustively instead, which is exact.
+ *
+ */
+
+#ifndef TILEDB_IVF_FILTER_H
+#define TILEDB_IVF_FILTER_H
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "algorithm.h"
+#include "detail/ivf/partition.h"
+#include "detail/ivf/qv.h"
+#include "detail/ivf/rerank.h"
+#include "detail/linalg/matrix.h"
+#include "detail/linalg/tdb_io.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/id_bitmap.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+/**
+ * @brief The set of ids `i` for which `pred(values[i])` is true, where
+ * `values` is the vector in the (one-dimensional) TileDB array at `uri`
+ * holding a metadata value for each id.
+ */
+template <class V>
+id_bitmap make_id_filter(
+    const tiledb::Context& ctx, const std::string& uri, auto&& pred) {
+  scoped_timer _{tdb_func__ + " " + uri};
+
+  auto values = read_vector<V>(ctx, uri);
+  auto filter = id_bitmap{};
+  for (size_t i = 0; i < size(values); ++i) {
+    if (pred(values[i])) {
+      filter.set(i);
+    }
+  }
+  return filter;
+}
+
+/**
+ * @brief Positions in `shuffled_ids` of the ids that pass `filter`.
+ */
+std::vector<uint64_t> filtered_positions(
+    const auto& shuffled_ids, auto&& filter) {
+  std::vector<uint64_t> positions;
+  for (size_t i = 0; i < size(shuffled_ids); ++i) {
+    if (filter(shuffled_ids[i])) {
+      positions.push_back(i);
+    }
+  }
+  return positions;
+}
+
+/**
+ * @brief Whether `num_passing` vectors are few enough to search
+ * exhaustively rather than by probing `nprobe` of `nlist` partitions of
+ * `num_vectors` vectors.
+ */
+inline bool use_filtered_brute_force(
+    size_t num_passing, size_t num_vectors, size_t nprobe, size_t nlist) {
+  return num_passing * nlist <= nprobe * num_vectors;
+}
+
+/**
+ * @brief Add the scores of every query against the columns `positions` of
+ * `db`, whose ids are `ids`, to the per-query heaps `min_scores`.
+ */
+void add_brute_force_scores(
+    const auto& db,
+    const auto& ids,
+    const std::vector<uint64_t>& positions,
+    const auto& query,
+    auto& min_scores,
+    size_t nthreads) {
+  std::vector<size_t> queries(query.num_cols());
+  std::iota(begin(queries), end(queries), 0);
+  stdx::execution::indexed_parallel_policy par{nthreads};
+  stdx::range_for_each(std::move(par), queries, [&](auto&& j, size_t, size_t) {
+    auto q_vec = query[j];
+    for (auto p : positions) {
+      min_scores[j].insert(L2(q_vec, db[p]), ids[p]);
+    }
+  });
+}
+
+/**
+ * @brief Score every query against the columns `positions` of `db`, whose
+ * ids are `ids`, returning a heap of the `k_nn` best (score, id) pairs for
+ * each query.
+ */
+auto brute_force_min_scores(
+    const auto& db,
+    const auto& ids,
+    const std::vector<uint64_t>& positions,
+    const auto& query,
+    size_t k_nn,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__};
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      query.num_cols(), fixed_min_pair_heap<float, size_t>(k_nn));
+  add_brute_force_scores(db, ids, positions, query, min_scores, nthreads);
+  return min_scores;
+}
+
+/**
+ * @brief Query an in-memory ivf index for the `k_nn` nearest neighbors of
+ * each query among the vectors whose ids pass `filter` (an `id_bitmap` or
+ * any predicate on ids), probing `nprobe` partitions unless few enough
+ * vectors pass to search them all.
+ */
+auto filtered_query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    auto&& filter,
+    size_t nprobe,
+    size_t k_nn,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__};
+
+  auto positions = filtered_positions(shuffled_ids, filter);
+  if (use_filtered_brute_force(
+          size(positions),
+          shuffled_db.num_cols(),
+          nprobe,
+          centroids.num_cols())) {
+    auto min_scores = brute_force_min_scores(
+        shuffled_db, shuffled_ids, positions, query, k_nn, nthreads);
+    return get_top_k_ids(min_scores, k_nn);
+  }
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_infinite_ram_min_scores(
+      shuffled_db,
+      query,
+      indices,
+      shuffled_ids,
+      active_partitions,
+      active_queries,
+      k_nn,
+      nthreads,
+      filter);
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+/**
+ * @brief Query an ivf index stored in TileDB, as `filtered_query_infinite_ram`
+ * does, reading at most `upper_bound` vectors (or ids) at a time.
+ *
+ * The ids are read a run of partitions at a time, stopping as soon as too
+ * many pass for an exhaustive search to pay.  Otherwise the passing vectors
+ * are searched exhaustively by reading just their columns of the parts array
+ * (coalesced into ranges, see `fetch_columns`), in chunks of at most
+ * `upper_bound` columns.
+ */
+template <typename T, class shuffled_ids_type>
+auto filtered_query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    auto&& filter,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + " " + part_uri};
+
+  auto nlist = centroids.num_cols();
+  auto num_vectors = indices[nlist];
+
+  // Positions and ids of the vectors that pass
+  std::vector<uint64_t> positions;
+  std::vector<shuffled_ids_type> passing_ids;
+  bool brute_force = true;
+  for (size_t first = 0; first < nlist && brute_force;) {
+    auto last = first + 1;
+    while (last < nlist &&
+           (upper_bound == 0 ||
+            indices[last + 1] - indices[first] <= upper_bound)) {
+      ++last;
+    }
+    auto start = indices[first];
+    auto ids =
+        read_vector<shuffled_ids_type>(ctx, id_uri, start, indices[last]);
+    for (size_t i = 0; i < size(ids); ++i) {
+      if (filter(ids[i])) {
+        positions.push_back(start + i);
+        passing_ids.push_back(ids[i]);
+      }
+    }
+    brute_force =
+        use_filtered_brute_force(size(positions), num_vectors, nprobe, nlist);
+    first = last;
+  }
+
+  if (brute_force) {
+    const size_t max_gap = 16;
+    auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+        query.num_cols(), fixed_min_pair_heap<float, size_t>(k_nn));
+    for (size_t first = 0; first < size(positions);) {
+      // Extend the chunk while the columns read (including those between
+      // positions coalesced into one range) stay within the upper bound
+      size_t last = first + 1;
+      for (size_t num_cols = 1; last < size(positions); ++last) {
+        auto gap = positions[last] - positions[last - 1];
+        num_cols += gap - 1 <= max_gap ? gap : 1;
+        if (upper_bound != 0 && num_cols > upper_bound) {
+          break;
+        }
+      }
+      auto chunk = std::vector<uint64_t>(
+          begin(positions) + first, begin(positions) + last);
+      auto&& [vectors, fetched] =
+          fetch_columns<T>(ctx, part_uri, chunk, max_gap, nthreads);
+
+      // The ranges read may include columns that do not pass
+      std::vector<uint64_t> columns;
+      std::vector<shuffled_ids_type> fetched_ids(size(fetched));
+      for (size_t c = 0, m = first; c < size(fetched) && m < last; ++c) {
+        if (fetched[c] == positions[m]) {
+          fetched_ids[c] = passing_ids[m++];
+          columns.push_back(c);
+        }
+      }
+      add_brute_force_scores(
+          vectors, fetched_ids, columns, query, min_scores, nthreads);
+      first = last;
+    }
+    return get_top_k_ids(min_scores, k_nn);
+  }
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_finite_ram_min_scores<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      query,
+      indices,
+      id_uri,
+      active_partitions,
+      active_queries,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      filter);
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_FILTER_H
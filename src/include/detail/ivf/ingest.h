@@ -0,0 +1,565 @@
+/**
+ * @file   ivf/ingest.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Single-process ingestion of a TileDB array of vectors into an ivf index:
+ * read -> train -> assign -> shuffle -> write.  This replaces the chain of
+ * partial writes and consolidation used by the distributed ingestion, which
+ * is unnecessary when everything runs on one machine.
+ *
+ */
+
+#ifndef TILEDB_IVF_INGEST_H
+#define TILEDB_IVF_INGEST_H
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <tiledb/tiledb>
+#include <vector>
+
+#include "defs.h"
+
+#include "detail/flat/qv.h"
+#include "detail/linalg/mmap_matrix.h"
+#include "detail/linalg/sq8.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "ivf_index.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+/**
+ * A uniquely named directory for the intermediate files of an ingestion,
+ * removed along with its contents when it goes out of scope.
+ */
+class spill_directory {
+  std::filesystem::path path_;
+
+ public:
+  explicit spill_directory(const std::string& parent) {
+    auto base = parent.empty() ? std::filesystem::temp_directory_path() :
+                                 std::filesystem::path(parent);
+    std::random_device rd;
+    std::mt19937_64 gen{rd()};
+    do {
+      path_ = base / ("ivf_ingest_" + std::to_string(gen()));
+    } while (!std::filesystem::create_directories(path_));
+  }
+
+  spill_directory(const spill_directory&) = delete;
+  spill_directory& operator=(const spill_directory&) = delete;
+
+  ~spill_directory() noexcept {
+    std::error_code ec;
+    std::filesystem::remove_all(path_, ec);
+  }
+
+  const std::filesystem::path& path() const {
+    return path_;
+  }
+};
+
+/**
+ * @brief Build an ivf index from the vectors supplied by `make_source`,
+ * writing the centroids, partition index, shuffled ids and shuffled vectors
+ * into existing arrays (e.g., the ones created by Python ingestion).
+ * `make_source` must return a new (unloaded) blocked matrix over the source
+ * vectors each time it is called; the source is read several times.
+ *
+ * At most one block of source vectors is resident at a time:
+ * - Training uses a uniform random sample of `training_sample_size`
+ *   vectors, drawn by reservoir sampling over one pass of the source.  If
+ *   the sample fits in one block, kmeans is run on it in memory, otherwise
+ *   the sampled vectors are spilled to a local file which mini-batch kmeans
+ *   streams.
+ * - One pass over the source assigns every vector to its nearest centroid.
+ *   Only the assignments (four bytes per vector) are kept.
+ * - The partitions are then grouped into consecutive ranges holding at most
+ *   a block of vectors (a single partition larger than that forms a range by
+ *   itself).  One more pass over the source appends each vector (and its id)
+ *   to a spill file for its range.  Each range's file is then read back, its
+ *   vectors scattered straight into their final position in a buffer, and
+ *   the buffer written to the output with a single contiguous write.  When
+ *   the whole source fits in one block it is only read once and nothing is
+ *   spilled.
+ *
+ * The ids of the vectors are their column numbers in the source.
+ *
+ * @param num_vectors Number of source vectors to ingest (0 means all).
+ * @param nlist Number of partitions.  Ignored if `train` is false, in which
+ * case the centroids are read from `centroids_uri`.
+ * @param training_sample_size Number of vectors to train with (0 means all).
+ * @param sq8_uri If not empty, the shuffled vectors are written as SQ8
+ * codes (see `sq8.h`), so `parts_uri` must hold uint8.  The codec, fitted to
+ * the range of the ingested vectors during the assignment pass, is written
+ * to a new array at `sq8_uri`, and the centroids are written in code space.
+ * @param spill_dir Local directory under which the intermediate files are
+ * written (empty means the system temporary directory).  They take about as
+ * much space as the ingested vectors.
+ * @param max_partition_factor If nonzero, the partitions are balanced: an
+ * in-memory training sample is clustered with balanced kmeans, and each
+ * block of vectors is assigned with `balanced_partition`, so that no
+ * partition receives more than this multiple of its share of the block.
+ * Small partitions are not merged away, as they may fill up with the
+ * vectors outside the sample.
+ * @param coarse_uri If not empty and `nlist` is at least `coarse_min_nlist`,
+ * a coarse quantizer over the centroids (see `coarse.h`) is written to new
+ * arrays at `coarse_uri` followed by `_centroids`, `_offsets` and
+ * `_members`.
+ * @return The number of vectors ingested.
+ */
+template <
+    class T,
+    class ids_type = uint64_t,
+    class indices_type = uint64_t,
+    class centroids_type = float,
+    class SourceFactory>
+  requires std::invocable<SourceFactory>
+size_t ivf_ingest(
+    const tiledb::Context& ctx,
+    SourceFactory&& make_source,
+    const std::string& centroids_uri,
+    const std::string& index_uri,
+    const std::string& ids_uri,
+    const std::string& parts_uri,
+    size_t num_vectors,
+    size_t nlist,
+    size_t training_sample_size,
+    size_t max_iter,
+    double tol,
+    size_t nthreads,
+    bool train = true,
+    const std::string& sq8_uri = "",
+    const std::string& spill_dir = "",
+    double max_partition_factor = 0.0,
+    const std::string& coarse_uri = "",
+    size_t coarse_min_nlist = 16384) {
+  scoped_timer _{tdb_func__};
+
+  if (nthreads == 0) {
+    nthreads = std::thread::hardware_concurrency();
+  }
+  if (num_vectors == 0) {
+    num_vectors = std::numeric_limits<size_t>::max();
+  }
+
+  auto db = make_source();
+  if (!db.load()) {
+    throw std::runtime_error("Source is empty");
+  }
+  auto dimension = db.num_rows();
+  auto block_size = db.num_cols();
+
+  // Number of columns of the currently loaded block that are to be ingested
+  auto block_cols = [num_vectors](const auto& A) {
+    return std::min<size_t>(A.num_cols(), num_vectors - A.col_offset());
+  };
+
+  // Created on first use, as nothing is spilled when the source is resident
+  std::optional<spill_directory> spill;
+  auto spill_path = [&](const std::string& name) {
+    if (!spill) {
+      spill.emplace(spill_dir);
+    }
+    return spill->path() / name;
+  };
+
+  /*
+   * Train (or read) the centroids
+   */
+  ColMajorMatrix<centroids_type> supplied_centroids;
+  if (!train) {
+    auto tdb_centroids = tdbColMajorMatrix<centroids_type>(ctx, centroids_uri);
+    tdb_centroids.load();
+    supplied_centroids =
+        std::move(static_cast<ColMajorMatrix<centroids_type>&>(tdb_centroids));
+    nlist = supplied_centroids.num_cols();
+  }
+
+  bool balanced = max_partition_factor != 0.0;
+  auto index = kmeans_index<centroids_type, ids_type, indices_type>(
+      dimension, nlist, max_iter, tol, nthreads);
+  if (balanced) {
+    index.set_partition_size_limits(max_partition_factor, 0.0);
+  }
+  if (train) {
+    if (training_sample_size == 0 || training_sample_size >= num_vectors) {
+      index.train_mini_batch(
+          make_source,
+          std::max<size_t>(10'000, nlist),
+          num_vectors == std::numeric_limits<size_t>::max() ? 0 : num_vectors);
+    } else {
+      // Choose the sample by reservoir sampling over the column numbers,
+      // continuing through `db`, so that a resident source is read once
+      std::random_device rd;
+      std::mt19937_64 gen{rd()};
+      std::vector<size_t> sample_ids;
+      size_t num_seen = 0;
+      do {
+        auto n = block_cols(db);
+        for (size_t i = 0; i < n; ++i, ++num_seen) {
+          if (num_seen < training_sample_size) {
+            sample_ids.push_back(num_seen);
+          } else {
+            auto j =
+                std::uniform_int_distribution<size_t>(0, num_seen)(gen);
+            if (j < training_sample_size) {
+              sample_ids[j] = num_seen;
+            }
+          }
+        }
+      } while (db.col_offset() + db.num_cols() < num_vectors && db.load());
+      std::sort(begin(sample_ids), end(sample_ids));
+
+      // Call `f(j, v)` for the j-th sampled vector `v`, in column order
+      auto for_each_sampled = [&](auto&& f) {
+        auto gather = [&](const auto& block, size_t& next) {
+          auto block_end = block.col_offset() + block_cols(block);
+          for (; next < size(sample_ids) && sample_ids[next] < block_end;
+               ++next) {
+            f(next, block[sample_ids[next] - block.col_offset()]);
+          }
+        };
+        size_t next = 0;
+        if (db.col_offset() == 0) {
+          gather(db, next);
+        } else {
+          auto source = make_source();
+          while (next < size(sample_ids) && source.load()) {
+            gather(source, next);
+          }
+        }
+      };
+
+      if (size(sample_ids) <= block_size) {
+        auto sample =
+            ColMajorMatrix<centroids_type>(dimension, size(sample_ids));
+        for_each_sampled([&sample](size_t j, const auto& v) {
+          std::copy(begin(v), end(v), begin(sample[j]));
+        });
+        index.train(
+            sample,
+            balanced ? kmeans_algorithm::balanced : kmeans_algorithm::lloyd);
+      } else {
+        auto path = spill_path("sample.f32bin").string();
+        {
+          std::ofstream out(path, std::ios::binary);
+          uint32_t header[2] = {
+              static_cast<uint32_t>(size(sample_ids)),
+              static_cast<uint32_t>(dimension)};
+          out.write(reinterpret_cast<const char*>(header), sizeof(header));
+          std::vector<float> buffer(dimension);
+          for_each_sampled([&out, &buffer](size_t, const auto& v) {
+            std::copy(begin(v), end(v), begin(buffer));
+            out.write(
+                reinterpret_cast<const char*>(buffer.data()),
+                buffer.size() * sizeof(float));
+          });
+          if (!out) {
+            throw std::runtime_error("Cannot write " + path);
+          }
+        }
+        index.train_mini_batch(
+            [&]() {
+              return mmapColMajorMatrix<centroids_type>(path, block_size);
+            },
+            std::max<size_t>(10'000, nlist));
+        std::filesystem::remove(path);
+      }
+    }
+    write_matrix<centroids_type, stdx::layout_left, size_t>(
+        ctx, index.get_centroids(), centroids_uri, 0, false);
+  } else {
+    index.get_centroids() = std::move(supplied_centroids);
+  }
+  // Mini-batch training is not balanced, but the assignment still is
+  index.set_balanced(balanced);
+  const auto& centroids = index.get_centroids();
+  if (centroids.num_rows() != dimension) {
+    throw std::runtime_error(
+        "Centroid dimension does not match source vector dimension");
+  }
+  if (nlist > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Too many partitions");
+  }
+
+  /*
+   * Assign every vector to a partition.  Unless sampling has moved past it,
+   * the first block is still resident.
+   */
+  bool sq8 = !sq8_uri.empty();
+  auto codec = sq8_codec(sq8 ? dimension : 0);
+
+  std::vector<uint32_t> labels;
+  auto assign = [&](const auto& block) {
+    auto n = block_cols(block);
+    auto parts = index.partition(block);
+    labels.insert(end(labels), begin(parts), begin(parts) + n);
+    if (sq8) {
+      codec.fit(block, n);
+    }
+  };
+  if (db.col_offset() == 0) {
+    do {
+      assign(db);
+    } while (db.col_offset() + db.num_cols() < num_vectors && db.load());
+  } else {
+    auto source = make_source();
+    while (source.load() && source.col_offset() < num_vectors) {
+      assign(source);
+    }
+  }
+  num_vectors = size(labels);
+  bool resident = num_vectors <= block_size;
+
+  if (sq8) {
+    write_matrix<float, stdx::layout_left, size_t>(
+        ctx, codec.params(), sq8_uri);
+    write_matrix<float, stdx::layout_left, size_t>(
+        ctx, codec.transform(centroids), centroids_uri, 0, false);
+  }
+
+  // The quantizer is over the centroids as written, i.e., in code space for
+  // SQ8, where the queries are mapped too
+  if (!coarse_uri.empty() && nlist >= coarse_min_nlist) {
+    if (sq8) {
+      index.get_centroids() = codec.transform(centroids);
+    }
+    index.build_coarse_quantizer();
+    index.get_coarse_quantizer().save(
+        ctx,
+        coarse_uri + "_centroids",
+        coarse_uri + "_offsets",
+        coarse_uri + "_members");
+  }
+
+  std::vector<indices_type> indices(nlist + 1, 0);
+  for (auto p : labels) {
+    ++indices[p + 1];
+  }
+  std::inclusive_scan(begin(indices), end(indices), begin(indices));
+  write_vector<indices_type>(ctx, indices, index_uri, 0, false);
+
+  /*
+   * Shuffle the vectors into partition order, one range of partitions at a
+   * time.
+   */
+  std::vector<size_t> range_starts{0};
+  std::vector<uint32_t> range_of(nlist);
+  for (size_t p = 0, count = 0; p < nlist; ++p) {
+    auto degree = indices[p + 1] - indices[p];
+    if (count != 0 && count + degree > block_size) {
+      range_starts.push_back(p);
+      count = 0;
+    }
+    count += degree;
+    range_of[p] = size(range_starts) - 1;
+  }
+  range_starts.push_back(nlist);
+  auto num_ranges = size(range_starts) - 1;
+  auto range_name = [](size_t r) { return "range_" + std::to_string(r); };
+
+  // Unless the source is resident, spill every vector, preceded by its id,
+  // to the file of its range, in one pass over the source
+  if (!resident) {
+    std::vector<std::vector<size_t>> members(num_ranges);
+    auto source = make_source();
+    while (source.load() && source.col_offset() < num_vectors) {
+      auto block_offset = source.col_offset();
+      auto n = block_cols(source);
+      for (auto& m : members) {
+        m.clear();
+      }
+      for (size_t i = 0; i < n; ++i) {
+        members[range_of[labels[block_offset + i]]].push_back(i);
+      }
+      for (size_t r = 0; r < num_ranges; ++r) {
+        if (empty(members[r])) {
+          continue;
+        }
+        auto path = spill_path(range_name(r)).string();
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        for (auto i : members[r]) {
+          uint64_t id = block_offset + i;
+          out.write(reinterpret_cast<const char*>(&id), sizeof(id));
+          out.write(
+              reinterpret_cast<const char*>(source[i].data()),
+              dimension * sizeof(T));
+        }
+        if (!out) {
+          throw std::runtime_error("Cannot write " + path);
+        }
+      }
+    }
+  }
+
+  for (size_t r = 0; r < num_ranges; ++r) {
+    auto first_part = range_starts[r];
+    auto last_part = range_starts[r + 1];
+    auto range_begin = indices[first_part];
+    auto range_size = indices[last_part] - range_begin;
+    if (range_size == 0) {
+      continue;
+    }
+
+    // Only one of these is used, depending on whether the vectors are
+    // encoded
+    auto shuffled_db = ColMajorMatrix<T>(dimension, sq8 ? 0 : range_size);
+    auto shuffled_codes =
+        ColMajorMatrix<uint8_t>(dimension, sq8 ? range_size : 0);
+    auto shuffled_ids = std::vector<ids_type>(range_size);
+
+    // Next free position (within the range) of each partition in the range
+    std::vector<size_t> cursors(last_part - first_part);
+    for (size_t p = first_part; p < last_part; ++p) {
+      cursors[p - first_part] = indices[p] - range_begin;
+    }
+
+    // Vectors are visited in source order, so they stay in source order
+    // within each partition
+    auto place = [&](size_t id, const auto& v) {
+      auto& cursor = cursors[labels[id] - first_part];
+      if (sq8) {
+        codec.encode(v, shuffled_codes[cursor]);
+      } else {
+        std::copy(begin(v), end(v), begin(shuffled_db[cursor]));
+      }
+      shuffled_ids[cursor] = id;
+      ++cursor;
+    };
+
+    if (resident) {
+      for (size_t i = 0; i < num_vectors; ++i) {
+        if (range_of[labels[i]] == r) {
+          place(i, db[i]);
+        }
+      }
+    } else {
+      auto path = spill_path(range_name(r)).string();
+      {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<T> v(dimension);
+        for (size_t m = 0; m < range_size; ++m) {
+          uint64_t id;
+          in.read(reinterpret_cast<char*>(&id), sizeof(id));
+          in.read(reinterpret_cast<char*>(v.data()), dimension * sizeof(T));
+          if (!in) {
+            throw std::runtime_error("Cannot read " + path);
+          }
+          place(id, v);
+        }
+      }
+      std::filesystem::remove(path);
+    }
+
+    if (sq8) {
+      write_matrix<uint8_t, stdx::layout_left, size_t>(
+          ctx, shuffled_codes, parts_uri, range_begin, false);
+    } else {
+      write_matrix<T, stdx::layout_left, size_t>(
+          ctx, shuffled_db, parts_uri, range_begin, false);
+    }
+    write_vector<ids_type>(ctx, shuffled_ids, ids_uri, range_begin, false);
+  }
+
+  return num_vectors;
+}
+
+/**
+ * @brief Build an ivf index from the vectors at `source_uri`, which is either
+ * a TileDB array or a local file in one of the benchmark formats (as
+ * determined by its extension; see `is_vecs_file`), read at most
+ * `upper_bound` vectors at a time.
+ */
+template <
+    class T,
+    class ids_type = uint64_t,
+    class indices_type = uint64_t,
+    class centroids_type = float>
+size_t ivf_ingest(
+    const tiledb::Context& ctx,
+    const std::string& source_uri,
+    const std::string& centroids_uri,
+    const std::string& index_uri,
+    const std::string& ids_uri,
+    const std::string& parts_uri,
+    size_t num_vectors,
+    size_t nlist,
+    size_t training_sample_size,
+    size_t max_iter,
+    double tol,
+    size_t upper_bound,
+    size_t nthreads,
+    bool train = true,
+    const std::string& sq8_uri = "",
+    const std::string& spill_dir = "",
+    double max_partition_factor = 0.0,
+    const std::string& coarse_uri = "",
+    size_t coarse_min_nlist = 16384) {
+  auto ingest = [&](auto&& make_source) {
+    return ivf_ingest<T, ids_type, indices_type, centroids_type>(
+        ctx,
+        make_source,
+        centroids_uri,
+        index_uri,
+        ids_uri,
+        parts_uri,
+        num_vectors,
+        nlist,
+        training_sample_size,
+        max_iter,
+        tol,
+        nthreads,
+        train,
+        sq8_uri,
+        spill_dir,
+        max_partition_factor,
+        coarse_uri,
+        coarse_min_nlist);
+  };
+  if (is_vecs_file(source_uri)) {
+    return ingest(
+        [&]() { return mmapColMajorMatrix<T>(source_uri, upper_bound); });
+  }
+  return ingest(
+      [&]() { return tdbColMajorMatrix<T>(ctx, source_uri, upper_bound); });
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_INGEST_H
@@ -32,14 +32,282 @@
 #ifndef TDB_IVF_PARTITION_H
 #define TDB_IVF_PARTITION_H
 
-#include <map>
-#include <set>
+#include <algorithm>
+#include <span>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 #include "detail/flat/qv.h"
+#include "detail/linalg/choose_blas.h"
+#include "utils/fixed_min_queues.h"
 
 namespace detail::ivf {
 
+/**
+ * @brief The queries probing each active partition, stored as two flat
+ * arrays (compressed sparse rows): the queries of active partition `i` are
+ * `queries()[offsets()[i], offsets()[i+1])`.  `operator[]` returns them as a
+ * span, so this can be used in place of a vector of vectors.
+ */
+template <class parts_type>
+class partition_queries {
+  std::vector<size_t> offsets_{0};
+  std::vector<parts_type> queries_;
+
+ public:
+  using value_type = std::span<const parts_type>;
+
+  partition_queries() = default;
+
+  partition_queries(
+      std::vector<size_t>&& offsets, std::vector<parts_type>&& queries)
+      : offsets_(std::move(offsets))
+      , queries_(std::move(queries)) {
+  }
+
+  size_t size() const {
+    return offsets_.size() - 1;
+  }
+
+  std::span<const parts_type> operator[](size_t i) const {
+    return {queries_.data() + offsets_[i], offsets_[i + 1] - offsets_[i]};
+  }
+
+  const auto& offsets() const {
+    return offsets_;
+  }
+
+  const auto& queries() const {
+    return queries_;
+  }
+
+  bool operator==(const partition_queries&) const = default;
+};
+
+/**
+ * @brief Given the ids of the centroids closest to each query (column `j` of
+ * `top_centroids` holds those of query `j`), compute the active partitions,
+ * i.e., those probed by at least one query, in sorted order, together with
+ * the queries probing each of them (in increasing order).
+ *
+ * This is a counting sort of the (centroid, query) pairs.  The queries are
+ * split into chunks, one per thread, and each thread counts and then
+ * scatters the pairs of its chunk.  The number of threads is limited so that
+ * the per-thread counts take no more space than the pairs themselves.
+ */
+auto invert_top_centroids(
+    auto&& top_centroids, size_t num_queries, size_t nthreads) {
+  scoped_timer _{tdb_func__};
+
+  using parts_type =
+      typename std::remove_cvref_t<decltype(top_centroids)>::value_type;
+
+  size_t nprobe = top_centroids.num_rows();
+  size_t num_entries = nprobe * num_queries;
+
+  size_t num_parts = 0;
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t p = 0; p < nprobe; ++p) {
+      num_parts = std::max<size_t>(num_parts, top_centroids(p, j) + 1);
+    }
+  }
+
+  nthreads = std::clamp<size_t>(
+      std::min(nthreads, num_entries / std::max<size_t>(num_parts, 1)),
+      1,
+      std::max<size_t>(num_queries, 1));
+  size_t chunk_size =
+      (num_queries + nthreads - 1) / std::max<size_t>(nthreads, 1);
+
+  // counts[n][c] is the number of queries in chunk `n` probing centroid `c`,
+  // which becomes the position of the first of them in `queries`
+  std::vector<std::vector<size_t>> counts(
+      nthreads, std::vector<size_t>(num_parts, 0));
+
+  {
+    auto par = stdx::execution::indexed_parallel_policy{nthreads};
+    stdx::range_for_each(
+        std::move(par), counts, [&](auto&& count, size_t n, size_t t) {
+          size_t j_end = std::min((t + 1) * chunk_size, num_queries);
+          for (size_t j = t * chunk_size; j < j_end; ++j) {
+            for (size_t p = 0; p < nprobe; ++p) {
+              ++count[top_centroids(p, j)];
+            }
+          }
+        });
+  }
+
+  auto active_partitions = std::vector<parts_type>{};
+  auto offsets = std::vector<size_t>{0};
+  size_t total = 0;
+  for (size_t c = 0; c < num_parts; ++c) {
+    size_t start = total;
+    for (size_t t = 0; t < nthreads; ++t) {
+      auto count = counts[t][c];
+      counts[t][c] = total;
+      total += count;
+    }
+    if (total != start) {
+      active_partitions.push_back(c);
+      offsets.push_back(total);
+    }
+  }
+
+  auto queries = std::vector<parts_type>(num_entries);
+  {
+    auto par = stdx::execution::indexed_parallel_policy{nthreads};
+    stdx::range_for_each(
+        std::move(par), counts, [&](auto&& cursor, size_t n, size_t t) {
+          size_t j_end = std::min((t + 1) * chunk_size, num_queries);
+          for (size_t j = t * chunk_size; j < j_end; ++j) {
+            for (size_t p = 0; p < nprobe; ++p) {
+              queries[cursor[top_centroids(p, j)]++] = j;
+            }
+          }
+        });
+  }
+
+  return std::make_tuple(
+      std::move(active_partitions),
+      partition_queries<parts_type>(std::move(offsets), std::move(queries)));
+}
+
+/**
+ * Number of queries from which `partition_ivf_index` scores the centroids
+ * with `gemm_top_centroids` rather than one query at a time.
+ */
+constexpr size_t gemm_partition_min_queries = 32;
+
+/**
+ * @brief Find the `nprobe` centroids closest to each query, computing the
+ * distances for a block of queries at a time as a matrix product.  This uses
+ * (q - c) * (q - c) = q * q + c * c - 2 * q * c, where the q * q term is the
+ * same for every centroid and so can be dropped for ranking.  The -2 * q * c
+ * block is computed with sgemm when BLAS is enabled, and otherwise with a
+ * loop over tiles of centroids that stay in cache while a group of queries
+ * is scored against them.  The top `nprobe` of each query are selected as
+ * soon as its block has been computed, adding the c * c term on the fly.
+ *
+ * @return Matrix whose column `j` holds the ids of the centroids selected for
+ * query `j`, in no particular order.
+ */
+auto gemm_top_centroids(
+    auto&& centroids, auto&& query, size_t nprobe, size_t nthreads) {
+  scoped_timer _{tdb_func__};
+
+  size_t dimension = centroids.num_rows();
+  size_t nlist = centroids.num_cols();
+  size_t num_queries = size(query);
+  nprobe = std::min(nprobe, nlist);
+
+  // Bound the scores for a block of queries to about 64 MB
+  size_t block_size = std::clamp<size_t>(
+      (size_t{1} << 24) / std::max<size_t>(nlist, 1), 1, num_queries);
+
+  std::vector<float> norms(nlist);
+  for (size_t c = 0; c < nlist; ++c) {
+    float norm = 0;
+    for (size_t k = 0; k < dimension; ++k) {
+      float x = centroids(k, c);
+      norm += x * x;
+    }
+    norms[c] = norm;
+  }
+
+#if defined(TILEDB_VS_ENABLE_BLAS)
+  auto centroids_f = ColMajorMatrix<float>(dimension, nlist);
+  std::copy(
+      centroids.data(),
+      centroids.data() + dimension * nlist,
+      centroids_f.data());
+  auto query_f = ColMajorMatrix<float>(dimension, block_size);
+#else
+  // Centroids transposed, so that the inner loop runs over centroids
+  std::vector<float> centroids_t(dimension * nlist);
+  for (size_t c = 0; c < nlist; ++c) {
+    for (size_t k = 0; k < dimension; ++k) {
+      centroids_t[k * nlist + c] = centroids(k, c);
+    }
+  }
+  constexpr size_t tile_cols = 512;
+  constexpr size_t group_size = 16;
+  std::vector<size_t> groups((block_size + group_size - 1) / group_size);
+#endif
+
+  ColMajorMatrix<float> scores(nlist, block_size);
+  ColMajorMatrix<size_t> top_centroids(nprobe, num_queries);
+
+  for (size_t q_begin = 0; q_begin < num_queries; q_begin += block_size) {
+    size_t q_end = std::min(q_begin + block_size, num_queries);
+    size_t num_block = q_end - q_begin;
+
+#if defined(TILEDB_VS_ENABLE_BLAS)
+    for (size_t j = 0; j < num_block; ++j) {
+      std::copy(
+          begin(query[q_begin + j]),
+          end(query[q_begin + j]),
+          begin(query_f[j]));
+    }
+    cblas_sgemm(
+        CblasColMajor,
+        CblasTrans,
+        CblasNoTrans,
+        nlist,
+        num_block,
+        dimension,
+        -2.0,
+        centroids_f.data(),
+        dimension,
+        query_f.data(),
+        dimension,
+        0.0,
+        scores.data(),
+        nlist);
+#else
+    auto par = stdx::execution::indexed_parallel_policy{nthreads};
+    stdx::range_for_each(
+        std::move(par), groups, [&](auto&&, size_t n, size_t g) {
+          size_t j_begin = g * group_size;
+          size_t j_end = std::min(j_begin + group_size, num_block);
+          for (size_t c_begin = 0; c_begin < nlist; c_begin += tile_cols) {
+            size_t c_end = std::min(c_begin + tile_cols, nlist);
+            for (size_t j = j_begin; j < j_end; ++j) {
+              auto q_vec = query[q_begin + j];
+              float* out = scores.data() + j * nlist;
+              std::fill(out + c_begin, out + c_end, 0.0f);
+              for (size_t k = 0; k < dimension; ++k) {
+                float b = -2.0f * q_vec[k];
+                const float* a = centroids_t.data() + k * nlist;
+                for (size_t c = c_begin; c < c_end; ++c) {
+                  out[c] += a[c] * b;
+                }
+              }
+            }
+          }
+        });
+#endif
+
+    auto select = stdx::execution::indexed_parallel_policy{nthreads};
+    stdx::range_for_each(
+        std::move(select),
+        scores,
+        [&](auto&& score_vec, size_t n, size_t j) {
+          if (j >= num_block) {
+            return;
+          }
+          auto heap = fixed_min_pair_heap<float, size_t>(nprobe);
+          for (size_t c = 0; c < nlist; ++c) {
+            heap.insert(score_vec[c] + norms[c], c);
+          }
+          for (size_t i = 0; i < nprobe; ++i) {
+            top_centroids(i, q_begin + j) = std::get<1>(heap[i]);
+          }
+        });
+  }
+
+  return top_centroids;
+}
+
 /**
  * In order to execute a query in distributed fashion, we perform a
  * preprocessing step on a single node to determine the total set of
@@ -56,61 +324,17 @@ auto partition_ivf_index(
     auto&& centroids, auto&& query, size_t nprobe, size_t nthreads) {
   scoped_timer _{tdb_func__};
 
-  size_t dimension = centroids.num_rows();
-  size_t num_queries = size(query);
-
   // get closest centroid for each query vector
+  if (size(query) >= gemm_partition_min_queries) {
+    return invert_top_centroids(
+        gemm_top_centroids(centroids, query, nprobe, nthreads),
+        size(query),
+        nthreads);
+  }
   auto top_centroids =
       detail::flat::qv_query_nth(centroids, query, nprobe, false, nthreads);
 
-  using parts_type = typename decltype(top_centroids)::value_type;
-
-  /*
-   * `top_centroids` maps from rank X query index to the centroid *index*.
-   *
-   * To process centroids (partitions) in order, we need to map from `centroid`
-   * to the set of queries having that centroid.
-   *
-   * We also need to know the "active" centroids, i.e., the ones having at
-   * least one query.
-   */
-  auto centroid_query = std::multimap<parts_type, size_t>{};
-  auto active_centroids = std::set<parts_type>{};
-  for (size_t j = 0; j < num_queries; ++j) {
-    for (size_t p = 0; p < nprobe; ++p) {
-      auto tmp = top_centroids(p, j);
-      centroid_query.emplace(top_centroids(p, j), j);
-      active_centroids.emplace(top_centroids(p, j));
-    }
-  }
-
-  /*
-   * From the active centroids we can compute the active partitions, i.e.,
-   * the partitions that have at least one query.  Note that since the
-   * active centroids were stored by index in a set, the active partitions
-   * will be stored in sorted order.
-   */
-  auto active_partitions =
-      std::vector<parts_type>(begin(active_centroids), end(active_centroids));
-
-  /*
-   * Get the query vectors associated with each partition.  We store the
-   * index of the query vectors in the original query matrix.  We are
-   * basically creating a partitionable version of the centroid_query map.
-   */
-  std::vector<std::vector<parts_type>> part_queries(size(active_partitions));
-
-  for (size_t partno = 0; partno < size(active_partitions); ++partno) {
-    auto active_part = active_partitions[partno];
-    auto num_part_queries = centroid_query.count(active_part);
-    part_queries[partno].reserve(num_part_queries);
-    auto range = centroid_query.equal_range(active_part);
-    for (auto i = range.first; i != range.second; ++i) {
-      part_queries[partno].emplace_back(i->second);
-    }
-  }
-
-  return std::make_tuple(std::move(active_partitions), std::move(part_queries));
+  return invert_top_centroids(top_centroids, size(query), nthreads);
 }
 }  // namespace detail::ivf
 
@@ -0,0 +1,423 @@
+/**
+ * @file   ivf/partition_stats.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Per-partition statistics of an ivf index, used to skip partitions that
+ * cannot hold any of a query's nearest neighbors.
+ *
+ * For each partition we keep its radius (the largest distance from its
+ * centroid to one of its vectors), the number of vectors, and the smallest
+ * and largest norms of its vectors.  By the triangle inequality no vector
+ * of partition `p` is nearer to a query `q` than
+ *
+ *   max(d(q, c_p) - radius_p, |q| - max_norm_p, min_norm_p - |q|)
+ *
+ * so once a query has `k` results, a probed partition whose bound is at
+ * least the query's k-th distance can be skipped without changing the
+ * results.  The bound costs one distance to the centroid, far less than
+ * scanning the partition.
+ *
+ * The statistics are stored as a `4 x nlist` float64 array whose rows are
+ * the radius, count, smallest norm and largest norm of each partition.
+ *
+ */
+
+#ifndef TILEDB_IVF_PARTITION_STATS_H
+#define TILEDB_IVF_PARTITION_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "algorithm.h"
+#include "detail/ivf/partition.h"
+#include "detail/ivf/qv.h"
+#include "detail/linalg/matrix.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+class partition_stats {
+  std::vector<float> radii_;
+  std::vector<uint64_t> counts_;
+  std::vector<float> min_norms_;
+  std::vector<float> max_norms_;
+
+  // Bounds are computed from rounded distances, so a partition is only
+  // skipped when its bound exceeds the k-th score by this relative margin
+  static constexpr float slack_ = 1e-5f;
+
+ public:
+  partition_stats() = default;
+
+  explicit partition_stats(size_t num_parts)
+      : radii_(num_parts, 0.0f)
+      , counts_(num_parts, 0)
+      , min_norms_(num_parts, std::numeric_limits<float>::max())
+      , max_norms_(num_parts, 0.0f) {
+  }
+
+  /**
+   * @brief Read statistics written by `save()`.
+   */
+  partition_stats(const tiledb::Context& ctx, const std::string& uri) {
+    auto stats = tdbColMajorMatrix<double>(ctx, uri);
+    stats.load();
+    if (stats.num_rows() != 4) {
+      throw std::runtime_error("Invalid partition statistics in " + uri);
+    }
+    auto num_parts = stats.num_cols();
+    *this = partition_stats(num_parts);
+    for (size_t p = 0; p < num_parts; ++p) {
+      radii_[p] = stats(0, p);
+      counts_[p] = stats(1, p);
+      min_norms_[p] = stats(2, p);
+      max_norms_[p] = stats(3, p);
+    }
+  }
+
+  /**
+   * @brief Add the vectors of `block`, which are the (partitioned) vectors
+   * from column `first_col` of the index, to the statistics of their
+   * partitions.  A partition may span several blocks.
+   */
+  void accumulate(
+      const auto& block,
+      size_t first_col,
+      const auto& centroids,
+      const auto& indices,
+      size_t nthreads) {
+    size_t last_col = first_col + block.num_cols();
+    auto first_part = static_cast<size_t>(
+        std::upper_bound(begin(indices), end(indices), first_col) -
+        begin(indices) - 1);
+    std::vector<size_t> parts;
+    for (size_t p = first_part;
+         p < num_partitions() && indices[p] < last_col;
+         ++p) {
+      parts.push_back(p);
+    }
+
+    stdx::execution::indexed_parallel_policy par{nthreads};
+    stdx::range_for_each(std::move(par), parts, [&](auto&& p, size_t, size_t) {
+      auto start = std::max<size_t>(indices[p], first_col);
+      auto stop = std::min<size_t>(indices[p + 1], last_col);
+      float max_score = radii_[p] * radii_[p];
+      for (size_t i = start; i < stop; ++i) {
+        auto v = block[i - first_col];
+        max_score = std::max(max_score, L2(centroids[p], v));
+        float norm = 0.0f;
+        for (size_t k = 0; k < size(v); ++k) {
+          norm += static_cast<float>(v[k]) * static_cast<float>(v[k]);
+        }
+        norm = std::sqrt(norm);
+        min_norms_[p] = std::min(min_norms_[p], norm);
+        max_norms_[p] = std::max(max_norms_[p], norm);
+      }
+      radii_[p] = std::sqrt(max_score);
+      counts_[p] += stop - start;
+    });
+  }
+
+  /**
+   * @brief Compute the statistics of an in-memory partitioned database.
+   */
+  static partition_stats compute(
+      const auto& shuffled_db,
+      const auto& centroids,
+      const auto& indices,
+      size_t nthreads) {
+    scoped_timer _{tdb_func__};
+
+    if (size(indices) != centroids.num_cols() + 1) {
+      throw std::runtime_error("Partition indices do not match the centroids");
+    }
+    auto stats = partition_stats(centroids.num_cols());
+    stats.accumulate(shuffled_db, 0, centroids, indices, nthreads);
+    return stats;
+  }
+
+  void save(const tiledb::Context& ctx, const std::string& uri) const {
+    auto stats = ColMajorMatrix<double>(4, num_partitions());
+    for (size_t p = 0; p < num_partitions(); ++p) {
+      stats(0, p) = radii_[p];
+      stats(1, p) = counts_[p];
+      stats(2, p) = counts_[p] == 0 ? 0.0 : min_norms_[p];
+      stats(3, p) = max_norms_[p];
+    }
+    write_matrix<double, stdx::layout_left, size_t>(ctx, stats, uri);
+  }
+
+  /**
+   * @brief Lower bound on the (not squared) distance from a query to the
+   * vectors of partition `p`, given the distance from the query to the
+   * partition's centroid and the norm of the query.  Infinite for an empty
+   * partition.
+   */
+  float lower_bound(
+      size_t p, float centroid_distance, float query_norm) const {
+    if (counts_[p] == 0) {
+      return std::numeric_limits<float>::infinity();
+    }
+    return std::max(
+        {0.0f,
+         centroid_distance - radii_[p],
+         query_norm - max_norms_[p],
+         min_norms_[p] - query_norm});
+  }
+
+  /**
+   * @brief Whether no vector of partition `p` can score below `kth` (a
+   * squared distance) against the query, as for `lower_bound()`.
+   */
+  bool can_skip(
+      size_t p, float centroid_distance, float query_norm, float kth) const {
+    auto bound = lower_bound(p, centroid_distance, query_norm);
+    return bound * bound > kth * (1.0f + slack_);
+  }
+
+  /**
+   * @brief A `prune` function for `apply_query`, skipping the partitions
+   * that `can_skip()` rules out for the queries in `query`.
+   */
+  auto pruner(const auto& centroids, const auto& query) const {
+    std::vector<float> query_norms(query.num_cols());
+    for (size_t j = 0; j < query.num_cols(); ++j) {
+      float norm = 0.0f;
+      for (auto x : query[j]) {
+        norm += static_cast<float>(x) * static_cast<float>(x);
+      }
+      query_norms[j] = std::sqrt(norm);
+    }
+    return [this, &centroids, &query, norms = std::move(query_norms)](
+               auto&& p, auto&& j, float kth) {
+      auto distance = std::sqrt(L2(query[j], centroids[p]));
+      return can_skip(p, distance, norms[j], kth);
+    };
+  }
+
+  bool empty() const {
+    return radii_.empty();
+  }
+
+  size_t num_partitions() const {
+    return radii_.size();
+  }
+
+  float radius(size_t p) const {
+    return radii_[p];
+  }
+
+  uint64_t count(size_t p) const {
+    return counts_[p];
+  }
+
+  float min_norm(size_t p) const {
+    return min_norms_[p];
+  }
+
+  float max_norm(size_t p) const {
+    return max_norms_[p];
+  }
+};
+
+/**
+ * @brief Compute the statistics of the partitioned vectors in the array at
+ * `parts_uri`, reading at most `upper_bound` vectors at a time.
+ */
+template <class T>
+partition_stats build_partition_stats(
+    const tiledb::Context& ctx,
+    const std::string& parts_uri,
+    const auto& centroids,
+    const auto& indices,
+    size_t upper_bound,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + " " + parts_uri};
+
+  if (size(indices) != centroids.num_cols() + 1) {
+    throw std::runtime_error("Partition indices do not match the centroids");
+  }
+  auto stats = partition_stats(centroids.num_cols());
+  auto db = tdbColMajorMatrix<T>(ctx, parts_uri, upper_bound);
+  while (db.load()) {
+    stats.accumulate(db, db.col_offset(), centroids, indices, nthreads);
+  }
+  return stats;
+}
+
+/**
+ * @brief Query an in-memory ivf index as `query_infinite_ram` does, but skip
+ * the probed partitions that `stats` shows cannot improve a query's top
+ * `k_nn`.  The results are the same.  Vectors whose ids fail `is_live`
+ * (e.g., deleted ones) are skipped; the statistics still cover them, so
+ * the bounds remain valid, if looser.
+ */
+auto pruned_query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    const partition_stats& stats,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    size_t nthreads,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__};
+
+  if (stats.num_partitions() != centroids.num_cols()) {
+    throw std::runtime_error("Partition statistics do not match the index");
+  }
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_infinite_ram_min_scores(
+      shuffled_db,
+      query,
+      indices,
+      shuffled_ids,
+      active_partitions,
+      active_queries,
+      k_nn,
+      nthreads,
+      is_live,
+      stats.pruner(centroids, query));
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+auto pruned_query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    const partition_stats& stats,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    size_t nthreads) {
+  return pruned_query_infinite_ram(
+      shuffled_db,
+      centroids,
+      stats,
+      query,
+      indices,
+      shuffled_ids,
+      nprobe,
+      k_nn,
+      nthreads,
+      [](auto&&) { return true; });
+}
+
+/**
+ * @brief Query an ivf index stored in TileDB as `query_finite_ram` does, but
+ * skip the probed partitions that `stats` shows cannot improve a query's
+ * top `k_nn`.  Partitions are still read if any query probes them.
+ * Vectors whose ids fail `is_live` are skipped.
+ */
+template <typename T, class shuffled_ids_type>
+auto pruned_query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    auto&& centroids,
+    const partition_stats& stats,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    size_t nthreads,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__ + " " + part_uri};
+
+  if (stats.num_partitions() != centroids.num_cols()) {
+    throw std::runtime_error("Partition statistics do not match the index");
+  }
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_finite_ram_min_scores<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      query,
+      indices,
+      id_uri,
+      active_partitions,
+      active_queries,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      is_live,
+      stats.pruner(centroids, query));
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+template <typename T, class shuffled_ids_type>
+auto pruned_query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    auto&& centroids,
+    const partition_stats& stats,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    size_t nthreads) {
+  return pruned_query_finite_ram<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      centroids,
+      stats,
+      query,
+      indices,
+      id_uri,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      [](auto&&) { return true; });
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_PARTITION_STATS_H
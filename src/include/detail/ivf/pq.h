@@ -0,0 +1,340 @@
+/**
+ * @file   ivf/pq.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Query kernels for ivf indexes whose partitions hold product-quantization
+ * (PQ) codes rather than vectors.
+ *
+ * The vector dimensions are split into `num_subspaces` contiguous subspaces
+ * (see `pq_subspace_begin`).  Each vector is stored as the residual to its
+ * partition's centroid, encoded as one byte per subspace: the index of the
+ * nearest of `pq_num_codewords` codewords for that subspace.  The codebooks
+ * are stored as a single `dimension x pq_num_codewords` matrix whose column
+ * `k` is the concatenation of codeword `k` of every subspace.
+ *
+ * The distance between a query and an encoded vector is computed
+ * asymmetrically (ADC): for each query and each partition it probes, a
+ * table of the distances from the query's residual to every codeword of
+ * every subspace is computed once, after which scoring a vector is one table
+ * lookup per subspace.
+ *
+ */
+
+#ifndef TILEDB_IVF_PQ_H
+#define TILEDB_IVF_PQ_H
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "concepts.h"
+#include "detail/ivf/partition.h"
+#include "detail/ivf/qv.h"
+#include "detail/linalg/tdb_partitioned_matrix.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+// Codes are one byte
+constexpr size_t pq_num_codewords = 256;
+
+/**
+ * @brief First dimension of subspace `m`.  Subspace `m` covers dimensions
+ * `[pq_subspace_begin(m), pq_subspace_begin(m+1))`; the dimension need not
+ * be a multiple of `num_subspaces`.
+ */
+inline size_t pq_subspace_begin(
+    size_t m, size_t dimension, size_t num_subspaces) {
+  return m * dimension / num_subspaces;
+}
+
+/**
+ * @brief Compute the distances from `residual` to every codeword of every
+ * subspace: `table[m * num_codewords + k]` is the distance to codeword `k`
+ * of subspace `m`, where `num_codewords` is the number of columns of
+ * `codebooks`.
+ */
+template <class V>
+void pq_distance_table(
+    const V& residual,
+    const auto& codebooks,
+    size_t num_subspaces,
+    std::vector<float>& table) {
+  size_t dimension = codebooks.num_rows();
+  size_t num_codewords = codebooks.num_cols();
+  table.resize(num_subspaces * num_codewords);
+  for (size_t m = 0; m < num_subspaces; ++m) {
+    auto b = pq_subspace_begin(m, dimension, num_subspaces);
+    auto e = pq_subspace_begin(m + 1, dimension, num_subspaces);
+    for (size_t k = 0; k < num_codewords; ++k) {
+      auto codeword = codebooks[k];
+      float sum = 0;
+      for (size_t i = b; i < e; ++i) {
+        float diff = residual[i] - codeword[i];
+        sum += diff * diff;
+      }
+      table[m * num_codewords + k] = sum;
+    }
+  }
+}
+
+/**
+ * @brief Search the partitions `[first_part, last_part)` of `codes` for the
+ * queries assigned to them.  The arguments are as for `apply_query`, except
+ * that `codes` holds PQ codes and the centroids and codebooks are needed to
+ * build the distance tables.  `codes` may be an in-memory matrix holding
+ * every partition or a `tdbPartitionedMatrix` holding the loaded ones.
+ */
+auto pq_apply_query(
+    auto&& query,
+    auto&& codes,
+    auto&& new_indices,
+    auto&& active_queries,
+    auto&& ids,
+    auto&& active_partitions,
+    auto&& centroids,
+    auto&& codebooks,
+    size_t k_nn,
+    size_t first_part,
+    size_t last_part) {
+  auto num_queries = size(query);
+  auto num_subspaces = codes.num_rows();
+  auto num_codewords = codebooks.num_cols();
+  auto dimension = centroids.num_rows();
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      num_queries, fixed_min_pair_heap<float, size_t>(k_nn));
+
+  size_t part_offset = 0;
+  size_t col_offset = 0;
+  if constexpr (has_num_col_parts<decltype(codes)>) {
+    part_offset = codes.col_part_offset();
+    col_offset = codes.col_offset();
+  }
+
+  std::vector<float> residual(dimension);
+  std::vector<float> table;
+
+  for (size_t p = first_part; p < last_part; ++p) {
+    auto partno = p + part_offset;
+
+    auto quartno = partno;
+    if constexpr (!has_num_col_parts<decltype(codes)>) {
+      quartno = active_partitions[partno];
+    }
+
+    auto start = new_indices[quartno] - col_offset;
+    auto stop = new_indices[quartno + 1] - col_offset;
+    auto centroid = centroids[active_partitions[partno]];
+
+    for (auto j : active_queries[partno]) {
+      auto q_vec = query[j];
+      for (size_t i = 0; i < dimension; ++i) {
+        residual[i] = q_vec[i] - centroid[i];
+      }
+      pq_distance_table(residual, codebooks, num_subspaces, table);
+
+      for (size_t kp = start; kp < stop; ++kp) {
+        auto code = codes[kp];
+        float score = 0;
+        for (size_t m = 0; m < num_subspaces; ++m) {
+          score += table[m * num_codewords + code[m]];
+        }
+        min_scores[j].insert(score, ids[kp]);
+      }
+    }
+  }
+  return min_scores;
+}
+
+/**
+ * @brief Split the partitions `[0, num_parts)` among `nthreads` threads,
+ * each calling `apply(first_part, last_part)` (e.g., `pq_apply_query`), and
+ * merge the heaps they return into `min_scores`.
+ */
+template <class Function>
+void pq_query_partitions(
+    size_t num_parts,
+    size_t nthreads,
+    std::vector<fixed_min_pair_heap<float, size_t>>& min_scores,
+    Function&& apply) {
+  size_t parts_per_thread = (num_parts + nthreads - 1) / nthreads;
+
+  std::vector<std::future<
+      std::vector<fixed_min_pair_heap<float, size_t>>>>
+      futs;
+  futs.reserve(nthreads);
+
+  for (size_t n = 0; n < nthreads; ++n) {
+    auto first_part = std::min<size_t>(n * parts_per_thread, num_parts);
+    auto last_part = std::min<size_t>((n + 1) * parts_per_thread, num_parts);
+
+    if (first_part != last_part) {
+      futs.emplace_back(std::async(
+          std::launch::async,
+          [&apply, first_part, last_part]() {
+            return apply(first_part, last_part);
+          }));
+    }
+  }
+
+  for (size_t n = 0; n < size(futs); ++n) {
+    auto min_n = futs[n].get();
+    for (size_t j = 0; j < size(min_scores); ++j) {
+      for (auto&& e : min_n[j]) {
+        min_scores[j].insert(std::get<0>(e), std::get<1>(e));
+      }
+    }
+  }
+}
+
+/**
+ * @brief Query an in-memory ivf-pq index.
+ *
+ * @param codes PQ codes of the vectors, in partition order (one column per
+ * vector).
+ * @param centroids Partition centroids.
+ * @param codebooks PQ codebooks.
+ * @return Matrix whose column `j` holds the ids of the (approximate) `k_nn`
+ * nearest neighbors of query `j`, nearest first.
+ */
+auto pq_query_infinite_ram(
+    auto&& codes,
+    auto&& centroids,
+    auto&& codebooks,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__};
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      size(query), fixed_min_pair_heap<float, size_t>(k_nn));
+
+  pq_query_partitions(
+      size(active_partitions),
+      nthreads,
+      min_scores,
+      [&](size_t first_part, size_t last_part) {
+        return pq_apply_query(
+            query,
+            codes,
+            indices,
+            active_queries,
+            shuffled_ids,
+            active_partitions,
+            centroids,
+            codebooks,
+            k_nn,
+            first_part,
+            last_part);
+      });
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+/**
+ * @brief Query an ivf-pq index stored in TileDB, reading only the codes of
+ * the partitions that are probed, at most `upper_bound` vectors at a time.
+ */
+template <class shuffled_ids_type>
+auto pq_query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& codes_uri,
+    auto&& centroids,
+    auto&& codebooks,
+    auto&& query,
+    auto&& indices,
+    const std::string& ids_uri,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + " " + codes_uri};
+
+  using indices_type =
+      typename std::remove_reference_t<decltype(indices)>::value_type;
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  using parts_type =
+      typename std::remove_reference_t<decltype(active_partitions)>::value_type;
+
+  auto codes = tdbColMajorPartitionedMatrix<
+      uint8_t,
+      shuffled_ids_type,
+      indices_type,
+      parts_type>(
+      ctx, codes_uri, indices, active_partitions, ids_uri, upper_bound);
+
+  std::vector<parts_type> new_indices(size(active_partitions) + 1);
+  new_indices[0] = 0;
+  for (size_t i = 0; i < size(active_partitions); ++i) {
+    new_indices[i + 1] = new_indices[i] + indices[active_partitions[i] + 1] -
+                         indices[active_partitions[i]];
+  }
+
+  auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
+      size(query), fixed_min_pair_heap<float, size_t>(k_nn));
+
+  while (codes.load()) {
+    pq_query_partitions(
+        codes.num_col_parts(),
+        nthreads,
+        min_scores,
+        [&](size_t first_part, size_t last_part) {
+          return pq_apply_query(
+              query,
+              codes,
+              new_indices,
+              active_queries,
+              codes.ids(),
+              active_partitions,
+              centroids,
+              codebooks,
+              k_nn,
+              first_part,
+              last_part);
+        });
+  }
+
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_PQ_H
@@ -319,6 +319,10 @@ auto nuv_query_heap_infinite_ram(
 
 // OG version
 // @todo We should still order the queries so partitions are searched in order
+/**
+ * Vectors whose ids do not satisfy `is_live` (e.g., deleted vectors) are
+ * skipped before they are scored.
+ */
 auto qv_query_heap_infinite_ram(
     auto&& shuffled_db,
     auto&& centroids,
@@ -328,7 +332,8 @@ auto qv_query_heap_infinite_ram(
     size_t nprobe,
     size_t k_nn,
     bool nth,
-    size_t nthreads) {
+    size_t nthreads,
+    auto&& is_live) {
   scoped_timer _{"Total time " + tdb_func__};
 
   assert(shuffled_db.num_cols() == shuffled_ids.size());
@@ -366,6 +371,9 @@ auto qv_query_heap_infinite_ram(
             size_t stop = indices[top_centroids(p, j) + 1];
 
             for (size_t i = start; i < stop; ++i) {
+              if (!is_live(shuffled_ids[i])) {
+                continue;
+              }
               auto score = L2(q_vec /*q[j]*/, shuffled_db[i]);
               min_scores[j].insert(score, shuffled_ids[i]);
             }
@@ -391,6 +399,29 @@ auto qv_query_heap_infinite_ram(
   return top_k;
 }
 
+auto qv_query_heap_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    auto&& q,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    bool nth,
+    size_t nthreads) {
+  return qv_query_heap_infinite_ram(
+      shuffled_db,
+      centroids,
+      q,
+      indices,
+      shuffled_ids,
+      nprobe,
+      k_nn,
+      nth,
+      nthreads,
+      [](auto&&) { return true; });
+}
+
 /**
  * Forward declaration
  */
@@ -698,7 +729,8 @@ auto nuv_query_heap_finite_ram(
 }
 
 /**
- * OG version of the query function.
+ * OG version of the query function.  Vectors whose ids do not satisfy
+ * `is_live` (e.g., deleted vectors) are skipped before they are scored.
  */
 template <typename T, class shuffled_ids_type>
 auto qv_query_heap_finite_ram(
@@ -712,7 +744,8 @@ auto qv_query_heap_finite_ram(
     size_t k_nn,
     size_t upper_bound,
     bool nth,
-    size_t nthreads) {
+    size_t nthreads,
+    auto&& is_live) {
   scoped_timer _{tdb_func__};
 
   using indices_type =
@@ -822,6 +855,7 @@ auto qv_query_heap_finite_ram(
              &new_indices,
              &centroid_query,
              &active_partitions,
+             &is_live,
              n,
              first_part,
              last_part]() {
@@ -847,6 +881,9 @@ auto qv_query_heap_finite_ram(
                   // @todo shift start / stop back by the offset
                   for (size_t k = start; k < stop; ++k) {
                     auto kp = k - shuffled_db.col_offset();
+                    if (!is_live(shuffled_db.ids()[kp])) {
+                      continue;
+                    }
                     auto score = L2(q_vec, shuffled_db[kp]);
 
                     // @todo any performance with apparent extra indirection?
@@ -893,6 +930,34 @@ auto qv_query_heap_finite_ram(
   return top_k;
 }
 
+template <typename T, class shuffled_ids_type>
+auto qv_query_heap_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    bool nth,
+    size_t nthreads) {
+  return qv_query_heap_finite_ram<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      centroids,
+      query,
+      indices,
+      id_uri,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nth,
+      nthreads,
+      [](auto&&) { return true; });
+}
+
 // @todo We should still order the queries so partitions are searched in order
 auto nuv_query_heap_infinite_ram_reg_blocked(
     auto&& shuffled_db,
@@ -964,7 +1029,7 @@ auto nuv_query_heap_infinite_ram_reg_blocked(
                 auto q_vec_0 = query[j0];
                 auto q_vec_1 = query[j1];
 
-                auto kstop = std::min<size_t>(stop, 2 * (stop / 2));
+                auto kstop = start + 2 * ((stop - start) / 2);
                 for (size_t kp = start; kp < kstop; kp += 2) {
                   auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
                   auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
@@ -995,7 +1060,7 @@ auto nuv_query_heap_infinite_ram_reg_blocked(
                 auto j0 = j[0];
                 auto q_vec_0 = query[j0];
 
-                auto kstop = std::min<size_t>(stop, 2 * (stop / 2));
+                auto kstop = start + 2 * ((stop - start) / 2);
                 for (size_t kp = start; kp < kstop; kp += 2) {
                   auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
                   auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
@@ -1181,7 +1246,7 @@ auto nuv_query_heap_finite_ram_reg_blocked(
                   auto q_vec_0 = query[j0];
                   auto q_vec_1 = query[j1];
 
-                  auto kstop = std::min<size_t>(stop, 2 * (stop / 2));
+                  auto kstop = start + 2 * ((stop - start) / 2);
                   for (size_t kp = start; kp < kstop; kp += 2) {
                     auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
                     auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
@@ -1218,7 +1283,7 @@ auto nuv_query_heap_finite_ram_reg_blocked(
                   auto j0 = j[0];
                   auto q_vec_0 = query[j0];
 
-                  auto kstop = std::min<size_t>(stop, 2 * (stop / 2));
+                  auto kstop = start + 2 * ((stop - start) / 2);
                   for (size_t kp = start; kp < kstop; kp += 2) {
                     auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
                     auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
@@ -1306,6 +1371,18 @@ auto nuv_query_heap_infinite_ram_reg_blocked(
       nthreads);
 }
 
+/**
+ * @brief Search the partitions `[first_part, last_part)` of `shuffled_db`
+ * for the queries assigned to them, skipping any vector whose id does not
+ * satisfy `is_live` (e.g., vectors that have been deleted, or that do not
+ * pass a filter).  `is_live` is tested before the distance is computed.
+ *
+ * A query whose heap is full skips a partition when `prune(partition, j,
+ * kth)` is true, where `partition` is the (original) partition number, `j`
+ * the query and `kth` the largest score in its heap, e.g., when the
+ * partition statistics show that no vector of the partition can score
+ * below `kth` (see `partition_stats.h`).
+ */
 auto apply_query(
     auto&& query,
     auto&& shuffled_db,
@@ -1315,13 +1392,19 @@ auto apply_query(
     auto&& active_partitions,
     size_t k_nn,
     size_t first_part,
-    size_t last_part) {
+    size_t last_part,
+    auto&& is_live,
+    auto&& prune) {
   //  print_types(query, shuffled_db, new_indices, active_queries);
 
   auto num_queries = size(query);
   auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
       num_queries, fixed_min_pair_heap<float, size_t>(k_nn));
 
+  using query_type =
+      std::remove_cvref_t<decltype(*active_queries[0].begin())>;
+  std::vector<query_type> unpruned;
+
   size_t part_offset = 0;
   size_t col_offset = 0;
   if constexpr (has_num_col_parts<decltype(shuffled_db)>) {
@@ -1341,90 +1424,190 @@ auto apply_query(
     auto start = new_indices[quartno] - col_offset;
     auto stop = new_indices[quartno + 1] - col_offset;
 
-    auto len = 2 * (size(active_queries[partno]) / 2);
-    auto end = active_queries[partno].begin() + len;
-    for (auto j = active_queries[partno].begin(); j != end; j += 2) {
+    unpruned.clear();
+    for (auto j : active_queries[partno]) {
+      auto& heap = min_scores[j];
+      if (k_nn == 0 || size(heap) < k_nn ||
+          !prune(active_partitions[partno], j, std::get<0>(heap.front()))) {
+        unpruned.push_back(j);
+      }
+    }
+
+    auto len = 2 * (size(unpruned) / 2);
+    auto end = unpruned.begin() + len;
+    for (auto j = unpruned.begin(); j != end; j += 2) {
       auto j0 = j[0];
       auto j1 = j[1];
       auto q_vec_0 = query[j0];
       auto q_vec_1 = query[j1];
 
-      auto kstop = std::min<size_t>(stop, 2 * (stop / 2));
+      auto kstop = start + 2 * ((stop - start) / 2);
       for (size_t kp = start; kp < kstop; kp += 2) {
-        auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
-        auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
-        auto score_10 = L2(q_vec_1, shuffled_db[kp + 0]);
-        auto score_11 = L2(q_vec_1, shuffled_db[kp + 1]);
-
-        min_scores[j0].insert(score_00, ids[kp + 0]);
-        min_scores[j0].insert(score_01, ids[kp + 1]);
-        min_scores[j1].insert(score_10, ids[kp + 0]);
-        min_scores[j1].insert(score_11, ids[kp + 1]);
+        // Test the ids first, so that filtered out vectors are not scored
+        bool live_0 = is_live(ids[kp + 0]);
+        bool live_1 = is_live(ids[kp + 1]);
+
+        if (live_0 && live_1) {
+          auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
+          auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
+          auto score_10 = L2(q_vec_1, shuffled_db[kp + 0]);
+          auto score_11 = L2(q_vec_1, shuffled_db[kp + 1]);
+
+          min_scores[j0].insert(score_00, ids[kp + 0]);
+          min_scores[j1].insert(score_10, ids[kp + 0]);
+          min_scores[j0].insert(score_01, ids[kp + 1]);
+          min_scores[j1].insert(score_11, ids[kp + 1]);
+        } else if (live_0 || live_1) {
+          auto kl = live_0 ? kp + 0 : kp + 1;
+          min_scores[j0].insert(L2(q_vec_0, shuffled_db[kl]), ids[kl]);
+          min_scores[j1].insert(L2(q_vec_1, shuffled_db[kl]), ids[kl]);
+        }
       }
 
       /*
        * Cleanup the last iteration(s) of k
        */
       for (size_t kp = kstop; kp < stop; ++kp) {
-        auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
-        auto score_10 = L2(q_vec_1, shuffled_db[kp + 0]);
-        min_scores[j0].insert(score_00, ids[kp + 0]);
-        min_scores[j1].insert(score_10, ids[kp + 0]);
+        if (is_live(ids[kp + 0])) {
+          auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
+          auto score_10 = L2(q_vec_1, shuffled_db[kp + 0]);
+          min_scores[j0].insert(score_00, ids[kp + 0]);
+          min_scores[j1].insert(score_10, ids[kp + 0]);
+        }
       }
     }
 
     /*
      * Cleanup the last iteration(s) of j
      */
-    for (auto j = end; j < active_queries[partno].end(); ++j) {
+    for (auto j = end; j < unpruned.end(); ++j) {
       auto j0 = j[0];
       auto q_vec_0 = query[j0];
 
-      auto kstop = std::min<size_t>(stop, 2 * (stop / 2));
+      auto kstop = start + 2 * ((stop - start) / 2);
       for (size_t kp = start; kp < kstop; kp += 2) {
-        auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
-        auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
-
-        min_scores[j0].insert(score_00, ids[kp + 0]);
-        min_scores[j0].insert(score_01, ids[kp + 1]);
+        if (is_live(ids[kp + 0])) {
+          auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
+          min_scores[j0].insert(score_00, ids[kp + 0]);
+        }
+        if (is_live(ids[kp + 1])) {
+          auto score_01 = L2(q_vec_0, shuffled_db[kp + 1]);
+          min_scores[j0].insert(score_01, ids[kp + 1]);
+        }
       }
       for (size_t kp = kstop; kp < stop; ++kp) {
-        auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
-        min_scores[j0].insert(score_00, ids[kp + 0]);
+        if (is_live(ids[kp + 0])) {
+          auto score_00 = L2(q_vec_0, shuffled_db[kp + 0]);
+          min_scores[j0].insert(score_00, ids[kp + 0]);
+        }
       }
     }
   }
   return min_scores;
 }
 
+auto apply_query(
+    auto&& query,
+    auto&& shuffled_db,
+    auto&& new_indices,
+    auto&& active_queries,
+    auto&& ids,
+    auto&& active_partitions,
+    size_t k_nn,
+    size_t first_part,
+    size_t last_part,
+    auto&& is_live) {
+  return apply_query(
+      query,
+      shuffled_db,
+      new_indices,
+      active_queries,
+      ids,
+      active_partitions,
+      k_nn,
+      first_part,
+      last_part,
+      is_live,
+      [](auto&&, auto&&, auto&&) { return false; });
+}
+
+auto apply_query(
+    auto&& query,
+    auto&& shuffled_db,
+    auto&& new_indices,
+    auto&& active_queries,
+    auto&& ids,
+    auto&& active_partitions,
+    size_t k_nn,
+    size_t first_part,
+    size_t last_part) {
+  return apply_query(
+      query,
+      shuffled_db,
+      new_indices,
+      active_queries,
+      ids,
+      active_partitions,
+      k_nn,
+      first_part,
+      last_part,
+      [](auto&&) { return true; });
+}
+
+/**
+ * @brief Extract the ids from a vector of per-query heaps of (score, id)
+ * pairs, in order of increasing score.  Queries with fewer than `k_nn`
+ * results are padded with `std::numeric_limits<size_t>::max()`.
+ */
+auto get_top_k_ids(auto&& min_scores, size_t k_nn) {
+  auto num_queries = size(min_scores);
+  ColMajorMatrix<size_t> top_k(k_nn, num_queries);
+
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::sort(
+        min_scores[j].begin(), min_scores[j].end(), [](auto&& a, auto&& b) {
+          return std::get<0>(a) < std::get<0>(b);
+        });
+    auto last = std::transform(
+        min_scores[j].begin(),
+        min_scores[j].end(),
+        top_k[j].begin(),
+        ([](auto&& e) { return std::get<1>(e); }));
+    std::fill(last, top_k[j].end(), std::numeric_limits<size_t>::max());
+  }
+
+  return top_k;
+}
+
+/**
+ * @brief Search the active partitions of the partitioned array at `part_uri`,
+ * loading at most `upper_bound` vectors at a time, and return a heap of the
+ * `k_nn` best (score, id) pairs for each query.  Vectors whose ids do not
+ * satisfy `is_live` are skipped, as are the partitions that `prune` rules
+ * out for a query (see `apply_query`).
+ */
 template <typename T, class shuffled_ids_type>
-auto query_finite_ram(
+auto query_finite_ram_min_scores(
     tiledb::Context& ctx,
     const std::string& part_uri,
-    auto&& centroids,
     auto&& query,
     auto&& indices,
     const std::string& id_uri,
+    auto&& active_partitions,
+    auto&& active_queries,
     size_t nprobe,
     size_t k_nn,
     size_t upper_bound,
-    bool nth,
     size_t nthreads,
-    size_t min_parts_per_thread = 0) {
-  scoped_timer _{tdb_func__ + " " + part_uri};
-
-  // Check that the size of the indices vector is correct
-  assert(size(indices) == centroids.num_cols() + 1);
-
+    auto&& is_live,
+    auto&& prune) {
   using indices_type =
       typename std::remove_reference_t<decltype(indices)>::value_type;
 
   auto num_queries = size(query);
 
-  auto&& [active_partitions, active_queries] =
-      partition_ivf_index(centroids, query, nprobe, nthreads);
-
-  using parts_type = typename decltype(active_partitions)::value_type;
+  using parts_type =
+      typename std::remove_reference_t<decltype(active_partitions)>::value_type;
 
   auto shuffled_db = tdbColMajorPartitionedMatrix<
       T,
@@ -1487,8 +1670,10 @@ auto query_finite_ram(
               [&query,
                &shuffled_db,
                &new_indices,
-               &active_queries = active_queries,
-               &active_partitions = active_partitions,
+               &active_queries,
+               &active_partitions,
+               &is_live,
+               &prune,
                k_nn,
                first_part,
                last_part]() {
@@ -1501,7 +1686,9 @@ auto query_finite_ram(
                     active_partitions,
                     k_nn,
                     first_part,
-                    last_part);
+                    last_part,
+                    is_live,
+                    prune);
               }));
         }
       }
@@ -1520,52 +1707,97 @@ auto query_finite_ram(
     _i.stop();
   }
 
-  scoped_timer ___{tdb_func__ + std::string{"_top_k"}};
-
-  ColMajorMatrix<size_t> top_k(k_nn, num_queries);
-
-  // get_top_k_from_heap(min_scores, top_k);
-
-  // @todo get_top_k_from_heap
-  for (size_t j = 0; j < num_queries; ++j) {
-    sort_heap(min_scores[j].begin(), min_scores[j].end());
-    std::transform(
-        min_scores[j].begin(),
-        min_scores[j].end(),
-        top_k[j].begin(),
-        ([](auto&& e) { return std::get<1>(e); }));
-  }
+  return min_scores;
+}
 
-  return top_k;
+template <typename T, class shuffled_ids_type>
+auto query_finite_ram_min_scores(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
+    auto&& query,
+    auto&& indices,
+    const std::string& id_uri,
+    auto&& active_partitions,
+    auto&& active_queries,
+    size_t nprobe,
+    size_t k_nn,
+    size_t upper_bound,
+    size_t nthreads,
+    auto&& is_live) {
+  return query_finite_ram_min_scores<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      query,
+      indices,
+      id_uri,
+      active_partitions,
+      active_queries,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      is_live,
+      [](auto&&, auto&&, auto&&) { return false; });
 }
 
-auto query_infinite_ram(
-    auto&& shuffled_db,
+template <typename T, class shuffled_ids_type>
+auto query_finite_ram(
+    tiledb::Context& ctx,
+    const std::string& part_uri,
     auto&& centroids,
     auto&& query,
     auto&& indices,
-    auto&& shuffled_ids,
+    const std::string& id_uri,
     size_t nprobe,
     size_t k_nn,
+    size_t upper_bound,
     bool nth,
-    size_t nthreads) {
-  scoped_timer _{tdb_func__ + std::string{"_in_ram"}};
-
-  assert(shuffled_db.num_cols() == shuffled_ids.size());
+    size_t nthreads,
+    size_t min_parts_per_thread = 0) {
+  scoped_timer _{tdb_func__ + " " + part_uri};
 
-  // Check that the indices vector is the right size
+  // Check that the size of the indices vector is correct
   assert(size(indices) == centroids.num_cols() + 1);
 
-  auto num_queries = size(query);
-
-  // @todo Maybe we don't want to do new_indices in partition_ivf_index after
-  //  all since they aren't used in this function
   auto&& [active_partitions, active_queries] =
       partition_ivf_index(centroids, query, nprobe, nthreads);
 
-  using parts_type = typename decltype(active_partitions)::value_type;
+  auto min_scores = query_finite_ram_min_scores<T, shuffled_ids_type>(
+      ctx,
+      part_uri,
+      query,
+      indices,
+      id_uri,
+      active_partitions,
+      active_queries,
+      nprobe,
+      k_nn,
+      upper_bound,
+      nthreads,
+      [](auto&&) { return true; });
 
-  std::vector<parts_type> new_indices(size(active_partitions) + 1);
+  scoped_timer ___{tdb_func__ + std::string{"_top_k"}};
+  return get_top_k_ids(min_scores, k_nn);
+}
+
+/**
+ * @brief Search the active partitions of an in-memory partitioned database
+ * and return a heap of the `k_nn` best (score, id) pairs for each query.
+ * Vectors whose ids do not satisfy `is_live` are skipped, as are the
+ * partitions that `prune` rules out for a query (see `apply_query`).
+ */
+auto query_infinite_ram_min_scores(
+    auto&& shuffled_db,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    auto&& active_partitions,
+    auto&& active_queries,
+    size_t k_nn,
+    size_t nthreads,
+    auto&& is_live,
+    auto&& prune) {
+  auto num_queries = size(query);
 
   auto min_scores = std::vector<fixed_min_pair_heap<float, size_t>>(
       num_queries, fixed_min_pair_heap<float, size_t>(k_nn));
@@ -1587,9 +1819,11 @@ auto query_infinite_ram(
           [&query,
            &shuffled_db,
            &indices,
-           &active_queries = active_queries,
-           &active_partitions = active_partitions,
+           &active_queries,
+           &active_partitions,
            &shuffled_ids,
+           &is_live,
+           &prune,
            k_nn,
            first_part,
            last_part]() {
@@ -1602,7 +1836,9 @@ auto query_infinite_ram(
                 active_partitions,
                 k_nn,
                 first_part,
-                last_part);
+                last_part,
+                is_live,
+                prune);
           }));
     }
   }
@@ -1618,21 +1854,65 @@ auto query_infinite_ram(
     }
   }
 
-  scoped_timer ___{tdb_func__ + std::string{"_top_k"}};
+  return min_scores;
+}
 
-  ColMajorMatrix<size_t> top_k(k_nn, num_queries);
+auto query_infinite_ram_min_scores(
+    auto&& shuffled_db,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    auto&& active_partitions,
+    auto&& active_queries,
+    size_t k_nn,
+    size_t nthreads,
+    auto&& is_live) {
+  return query_infinite_ram_min_scores(
+      shuffled_db,
+      query,
+      indices,
+      shuffled_ids,
+      active_partitions,
+      active_queries,
+      k_nn,
+      nthreads,
+      is_live,
+      [](auto&&, auto&&, auto&&) { return false; });
+}
 
-  // @todo get_top_k_from_heap
-  for (size_t j = 0; j < num_queries; ++j) {
-    sort_heap(min_scores[j].begin(), min_scores[j].end());
-    std::transform(
-        min_scores[j].begin(),
-        min_scores[j].end(),
-        top_k[j].begin(),
-        ([](auto&& e) { return std::get<1>(e); }));
-  }
+auto query_infinite_ram(
+    auto&& shuffled_db,
+    auto&& centroids,
+    auto&& query,
+    auto&& indices,
+    auto&& shuffled_ids,
+    size_t nprobe,
+    size_t k_nn,
+    bool nth,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + std::string{"_in_ram"}};
 
-  return top_k;
+  assert(shuffled_db.num_cols() == shuffled_ids.size());
+
+  // Check that the indices vector is the right size
+  assert(size(indices) == centroids.num_cols() + 1);
+
+  auto&& [active_partitions, active_queries] =
+      partition_ivf_index(centroids, query, nprobe, nthreads);
+
+  auto min_scores = query_infinite_ram_min_scores(
+      shuffled_db,
+      query,
+      indices,
+      shuffled_ids,
+      active_partitions,
+      active_queries,
+      k_nn,
+      nthreads,
+      [](auto&&) { return true; });
+
+  scoped_timer ___{tdb_func__ + std::string{"_top_k"}};
+  return get_top_k_ids(min_scores, k_nn);
 }
 
 template <typename T, class shuffled_ids_type>
@@ -0,0 +1,361 @@
+/**
+ * @file   ivf/rerank.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Exact re-ranking of externally supplied candidates (e.g., the merged
+ * results of several retrieval systems) against the vectors of an ivf
+ * index stored in TileDB.
+ *
+ * The shuffled ids array maps storage positions to ids.  Fetching vectors
+ * by id needs the inverse, which `id_position_map` provides (and persists)
+ * as the ids in increasing order together with their positions.  The
+ * positions of all of the candidates of a batch of queries are sorted,
+ * deduplicated and coalesced into column ranges of the parts array, allowing
+ * small gaps, and the ranges are read by several threads in parallel.
+ *
+ */
+
+#ifndef TILEDB_IVF_RERANK_H
+#define TILEDB_IVF_RERANK_H
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "defs.h"
+#include "detail/linalg/matrix.h"
+#include "detail/linalg/tdb_helpers.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+namespace detail::ivf {
+
+template <class id_type = uint64_t>
+class id_position_map {
+  std::vector<id_type> ids_;
+  std::vector<uint64_t> positions_;
+
+ public:
+  static constexpr uint64_t npos = std::numeric_limits<uint64_t>::max();
+
+  id_position_map() = default;
+
+  /**
+   * @brief Build the map from the shuffled ids, `shuffled_ids[p]` being the
+   * id of the vector at position `p`.
+   */
+  explicit id_position_map(const auto& shuffled_ids)
+      : ids_(shuffled_ids.size())
+      , positions_(shuffled_ids.size()) {
+    std::iota(begin(positions_), end(positions_), 0);
+    std::sort(begin(positions_), end(positions_), [&](auto a, auto b) {
+      return shuffled_ids[a] < shuffled_ids[b];
+    });
+    for (size_t i = 0; i < positions_.size(); ++i) {
+      ids_[i] = shuffled_ids[positions_[i]];
+    }
+  }
+
+  /**
+   * @brief Read a map written by `save()`.
+   */
+  id_position_map(const tiledb::Context& ctx, const std::string& uri) {
+    auto pairs = tdbColMajorMatrix<uint64_t>(ctx, uri);
+    pairs.load();
+    ids_.resize(pairs.num_cols());
+    positions_.resize(pairs.num_cols());
+    for (size_t i = 0; i < pairs.num_cols(); ++i) {
+      ids_[i] = pairs(0, i);
+      positions_[i] = pairs(1, i);
+    }
+  }
+
+  /**
+   * @brief Write the map to a new array at `uri`, as a 2 x N matrix of
+   * (id, position) pairs in increasing order of id.
+   */
+  void save(const tiledb::Context& ctx, const std::string& uri) const {
+    auto pairs = ColMajorMatrix<uint64_t>(2, ids_.size());
+    for (size_t i = 0; i < ids_.size(); ++i) {
+      pairs(0, i) = ids_[i];
+      pairs(1, i) = positions_[i];
+    }
+    write_matrix<uint64_t, stdx::layout_left, size_t>(ctx, pairs, uri);
+  }
+
+  /**
+   * @brief Position of the vector with id `id`, or `npos` if there is none.
+   */
+  uint64_t find(id_type id) const {
+    auto it = std::lower_bound(begin(ids_), end(ids_), id);
+    if (it == end(ids_) || *it != id) {
+      return npos;
+    }
+    return positions_[it - begin(ids_)];
+  }
+
+  size_t size() const {
+    return ids_.size();
+  }
+};
+
+/**
+ * @brief Read the columns of the parts array at `parts_uri` covering the
+ * (sorted, distinct) `positions`.  Positions less than `max_gap` apart are
+ * read with a single range, so the result may hold extra columns.
+ *
+ * @return The columns read, and the position of each of them.
+ */
+template <class T>
+auto fetch_columns(
+    const tiledb::Context& ctx,
+    const std::string& parts_uri,
+    const std::vector<uint64_t>& positions,
+    size_t max_gap,
+    size_t nthreads) {
+  scoped_timer _{tdb_func__ + " " + parts_uri};
+
+  std::vector<std::tuple<uint64_t, uint64_t>> ranges;
+  for (auto p : positions) {
+    if (!ranges.empty() && p - std::get<1>(ranges.back()) <= max_gap) {
+      std::get<1>(ranges.back()) = p + 1;
+    } else {
+      ranges.emplace_back(p, p + 1);
+    }
+  }
+
+  // First column of each range in the result
+  std::vector<size_t> range_cols(size(ranges) + 1, 0);
+  for (size_t r = 0; r < size(ranges); ++r) {
+    range_cols[r + 1] =
+        range_cols[r] + std::get<1>(ranges[r]) - std::get<0>(ranges[r]);
+  }
+  auto num_cols = range_cols.back();
+
+  std::vector<uint64_t> fetched(num_cols);
+  for (size_t r = 0; r < size(ranges); ++r) {
+    std::iota(
+        begin(fetched) + range_cols[r],
+        begin(fetched) + range_cols[r + 1],
+        std::get<0>(ranges[r]));
+  }
+
+  auto schema = tiledb::ArraySchema(ctx, parts_uri);
+  auto row_domain = schema.domain().dimension(0).template domain<int>();
+  size_t dimension = row_domain.second - row_domain.first + 1;
+  std::string attr_name = schema.attribute(0).name();
+
+  auto vectors = ColMajorMatrix<T>(dimension, num_cols);
+  if (num_cols == 0) {
+    return std::make_tuple(std::move(vectors), std::move(fetched));
+  }
+
+  // Give each thread a run of consecutive ranges holding about the same
+  // number of columns, and have it read them with one query
+  nthreads = std::max<size_t>(1, std::min(nthreads, size(ranges)));
+  std::vector<size_t> first_range(nthreads + 1, size(ranges));
+  first_range[0] = 0;
+  for (size_t n = 1, r = 0; n < nthreads; ++n) {
+    while (r < size(ranges) && range_cols[r] < n * num_cols / nthreads) {
+      ++r;
+    }
+    first_range[n] = r;
+  }
+
+  std::vector<std::future<void>> futs;
+  futs.reserve(nthreads);
+  for (size_t n = 0; n < nthreads; ++n) {
+    auto first = first_range[n];
+    auto last = std::max(first, first_range[n + 1]);
+    if (first == last) {
+      continue;
+    }
+    futs.emplace_back(std::async(std::launch::async, [&, first, last]() {
+      auto array = tiledb_helpers::open_array(
+          tdb_func__, ctx, parts_uri, TILEDB_READ);
+      tiledb::Subarray subarray(ctx, array);
+      subarray.add_range(0, row_domain.first, row_domain.second);
+      for (size_t r = first; r < last; ++r) {
+        subarray.add_range(
+            1,
+            (int)std::get<0>(ranges[r]),
+            (int)std::get<1>(ranges[r]) - 1);
+      }
+      auto count = (range_cols[last] - range_cols[first]) * dimension;
+      tiledb::Query query(ctx, array);
+      query.set_subarray(subarray)
+          .set_layout(schema.cell_order())
+          .set_data_buffer(
+              attr_name, vectors[range_cols[first]].data(), count);
+      tiledb_helpers::submit_query(tdb_func__, parts_uri, query);
+      if (tiledb::Query::Status::COMPLETE != query.query_status()) {
+        throw std::runtime_error("Incomplete read of " + parts_uri);
+      }
+      array.close();
+    }));
+  }
+  for (auto&& f : futs) {
+    f.get();
+  }
+
+  return std::make_tuple(std::move(vectors), std::move(fetched));
+}
+
+/**
+ * @brief Find the `k_nn` nearest of the candidates of each query, by exact
+ * distance to the vectors stored in the parts array at `parts_uri`.
+ *
+ * @param map Map from ids to positions in the parts array.
+ * @param candidates `candidates[j]` is the range of candidate ids of query
+ * `j`.  Ids not in the index are ignored, as are repeated ids.
+ * @param max_gap Largest gap (in vectors) between two candidates that are
+ * read with a single range.
+ * @param is_live Candidates whose ids do not satisfy it, e.g., the deleted
+ * ones, are ignored.
+ * @return Matrices of the distances and ids of the nearest candidates of
+ * each query, nearest first.  Queries with fewer than `k_nn` candidates are
+ * padded with the maximum float and id.
+ */
+template <class T, class id_type>
+auto rerank(
+    const tiledb::Context& ctx,
+    const std::string& parts_uri,
+    const id_position_map<id_type>& map,
+    const auto& query,
+    const auto& candidates,
+    size_t k_nn,
+    size_t nthreads,
+    size_t max_gap,
+    auto&& is_live) {
+  scoped_timer _{tdb_func__};
+
+  // Position of a candidate, or `npos` if it is not in the index or not live
+  auto live_position = [&map, &is_live](auto id) {
+    return is_live(id) ? map.find(id) : map.npos;
+  };
+
+  auto num_queries = query.num_cols();
+  if (size(candidates) != num_queries) {
+    throw std::runtime_error("Number of candidate lists != number of queries");
+  }
+
+  std::vector<uint64_t> positions;
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (auto id : candidates[j]) {
+      auto p = live_position(id);
+      if (p != map.npos) {
+        positions.push_back(p);
+      }
+    }
+  }
+  std::sort(begin(positions), end(positions));
+  positions.erase(
+      std::unique(begin(positions), end(positions)), end(positions));
+
+  auto&& [vectors, fetched] =
+      fetch_columns<T>(ctx, parts_uri, positions, max_gap, nthreads);
+
+  auto top_scores = ColMajorMatrix<float>(k_nn, num_queries);
+  auto top_ids = ColMajorMatrix<size_t>(k_nn, num_queries);
+
+  std::vector<size_t> queries(num_queries);
+  std::iota(begin(queries), end(queries), 0);
+  stdx::execution::indexed_parallel_policy par{nthreads};
+  stdx::range_for_each(std::move(par), queries, [&](auto&& j, size_t, size_t) {
+    auto heap = fixed_min_pair_heap<float, size_t>(k_nn);
+    // (position, id) of the candidates, without repeats
+    std::vector<std::tuple<uint64_t, size_t>> seen;
+    for (auto id : candidates[j]) {
+      auto p = live_position(id);
+      if (p != map.npos) {
+        seen.emplace_back(p, id);
+      }
+    }
+    std::sort(begin(seen), end(seen));
+    seen.erase(std::unique(begin(seen), end(seen)), end(seen));
+
+    auto q = query[j];
+    for (auto&& [p, id] : seen) {
+      auto col = std::lower_bound(begin(fetched), end(fetched), p) -
+                 begin(fetched);
+      heap.insert(L2(q, vectors[col]), id);
+    }
+
+    std::sort(begin(heap), end(heap), [](auto&& a, auto&& b) {
+      return std::get<0>(a) < std::get<0>(b);
+    });
+    for (size_t i = 0; i < k_nn; ++i) {
+      if (i < size(heap)) {
+        top_scores(i, j) = std::get<0>(heap[i]);
+        top_ids(i, j) = std::get<1>(heap[i]);
+      } else {
+        top_scores(i, j) = std::numeric_limits<float>::max();
+        top_ids(i, j) = std::numeric_limits<size_t>::max();
+      }
+    }
+  });
+
+  return std::make_tuple(std::move(top_scores), std::move(top_ids));
+}
+
+/**
+ * @brief As `rerank()` above, with every candidate live.
+ */
+template <class T, class id_type>
+auto rerank(
+    const tiledb::Context& ctx,
+    const std::string& parts_uri,
+    const id_position_map<id_type>& map,
+    const auto& query,
+    const auto& candidates,
+    size_t k_nn,
+    size_t nthreads,
+    size_t max_gap = 16) {
+  return rerank<T>(
+      ctx,
+      parts_uri,
+      map,
+      query,
+      candidates,
+      k_nn,
+      nthreads,
+      max_gap,
+      [](auto&&) { return true; });
+}
+
+}  // namespace detail::ivf
+
+#endif  // TILEDB_IVF_RERANK_H
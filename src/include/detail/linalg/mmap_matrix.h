@@ -0,0 +1,380 @@
+/**
+ * @file   mmap_matrix.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Class that provides a blocked matrix interface to a local file in one of
+ * the standard benchmark formats, read through a memory mapping:
+ *
+ * - fvecs / ivecs / bvecs: every vector is preceded by its dimension as a
+ *   4-byte int, followed by the elements (float, int32 or uint8).
+ * - u8bin / f32bin (a.k.a. fbin): the number of vectors and the dimension as
+ *   4-byte ints, followed by all of the elements (uint8 or float).
+ *
+ * Either way the vectors are stored contiguously, so they map directly onto
+ * the columns of a column-major matrix.  The interface is the same as that
+ * of `tdbBlockedMatrix`: `load()` brings the next block of (at most
+ * `upper_bound`) vectors into memory, converting the elements to `T` if
+ * necessary, and `col_offset()` gives the index of the first vector of the
+ * block.  Pages of the mapping that have been consumed are released as the
+ * blocks advance, so memory use stays bounded for files larger than RAM.
+ *
+ */
+
+#ifndef TDB_MMAP_MATRIX_H
+#define TDB_MMAP_MATRIX_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "detail/linalg/linalg_defs.h"
+#include "detail/linalg/matrix.h"
+#include "utils/logging.h"
+#include "utils/timer.h"
+
+enum class vecs_format { fvecs, ivecs, bvecs, u8bin, f32bin };
+
+/**
+ * Determine the format of a benchmark file from its extension.  Throws if
+ * the extension is not recognized.
+ */
+inline vecs_format vecs_format_from_path(const std::string& path) {
+  auto ext = std::filesystem::path(path).extension().string();
+  if (ext == ".fvecs") {
+    return vecs_format::fvecs;
+  } else if (ext == ".ivecs") {
+    return vecs_format::ivecs;
+  } else if (ext == ".bvecs") {
+    return vecs_format::bvecs;
+  } else if (ext == ".u8bin") {
+    return vecs_format::u8bin;
+  } else if (ext == ".f32bin" || ext == ".fbin") {
+    return vecs_format::f32bin;
+  }
+  throw std::runtime_error("Unrecognized vector file format: " + path);
+}
+
+/**
+ * Whether `path` names a local file in one of the benchmark formats (as
+ * opposed to, e.g., a TileDB array).
+ */
+inline bool is_vecs_file(const std::string& path) {
+  if (path.find("://") != std::string::npos) {
+    return false;
+  }
+  try {
+    vecs_format_from_path(path);
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+  return true;
+}
+
+template <class T, class I = size_t>
+class mmapBlockedMatrix : public Matrix<T, stdx::layout_left, I> {
+  using Base = Matrix<T, stdx::layout_left, I>;
+
+ public:
+  using value_type = typename Base::value_type;
+  using index_type = typename Base::index_type;
+  using size_type = typename Base::size_type;
+
+ private:
+  std::string path_;
+  vecs_format format_;
+
+  int fd_{-1};
+  void* map_{MAP_FAILED};
+  size_t map_size_{0};
+
+  // Bytes preceding the first vector, bytes preceding each vector, and
+  // bytes per element
+  size_t file_header_{0};
+  size_t vector_header_{0};
+  size_t element_size_{0};
+
+  size_t num_array_rows_{0};
+  size_t num_array_cols_{0};
+
+  index_type col_offset_{0};
+  index_type next_col_{0};
+  index_type blocksize_{0};
+
+  // Bytes at the start of the mapping already released back to the OS
+  size_t released_{0};
+
+  size_t vector_stride() const {
+    return vector_header_ + num_array_rows_ * element_size_;
+  }
+
+  const std::byte* vector_data(size_t j) const {
+    return static_cast<const std::byte*>(map_) + file_header_ +
+           j * vector_stride() + vector_header_;
+  }
+
+  template <class U>
+  void copy_block() {
+    auto dimension = num_array_rows_;
+    for (size_t j = 0; j < Base::num_cols_; ++j) {
+      auto src = vector_data(col_offset_ + j);
+      if (vector_header_ != 0) {
+        int32_t d;
+        std::memcpy(&d, src - vector_header_, sizeof(d));
+        if ((size_t)d != dimension) {
+          throw std::runtime_error(
+              "Inconsistent vector dimension in " + path_);
+        }
+      }
+      auto column = (*this)[j];
+      if constexpr (std::is_same_v<U, T>) {
+        std::memcpy(column.data(), src, dimension * sizeof(T));
+      } else {
+        for (size_t i = 0; i < dimension; ++i) {
+          U u;
+          std::memcpy(&u, src + i * sizeof(U), sizeof(U));
+          column[i] = static_cast<T>(u);
+        }
+      }
+    }
+  }
+
+  void unmap() noexcept {
+    if (map_ != MAP_FAILED) {
+      munmap(map_, map_size_);
+      map_ = MAP_FAILED;
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  /**
+   * Let the OS drop the pages holding vectors before `col`.
+   */
+  void release_before(size_t col) {
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    auto end = (file_header_ + col * vector_stride()) / page_size * page_size;
+    if (end > released_) {
+      madvise(
+          static_cast<std::byte*>(map_) + released_,
+          end - released_,
+          MADV_DONTNEED);
+      released_ = end;
+    }
+  }
+
+ public:
+  /**
+   * @brief Map the file at `path`.  No vectors are read until `load()` is
+   * called.
+   *
+   * @param path Path of a local file.
+   * @param format Format of the file.
+   * @param upper_bound The maximum number of vectors to hold in memory at a
+   * time (0 means all of them).
+   */
+  mmapBlockedMatrix(
+      const std::string& path, vecs_format format, size_t upper_bound = 0)
+      : path_{path}
+      , format_{format} {
+    scoped_timer _{tdb_func__ + " " + path};
+
+    switch (format_) {
+      case vecs_format::fvecs:
+      case vecs_format::ivecs:
+        vector_header_ = 4;
+        element_size_ = 4;
+        break;
+      case vecs_format::bvecs:
+        vector_header_ = 4;
+        element_size_ = 1;
+        break;
+      case vecs_format::u8bin:
+        file_header_ = 8;
+        element_size_ = 1;
+        break;
+      case vecs_format::f32bin:
+        file_header_ = 8;
+        element_size_ = 4;
+        break;
+    }
+
+    fd_ = open(path_.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      throw std::runtime_error("Cannot open " + path_);
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      close(fd_);
+      throw std::runtime_error("Cannot stat " + path_);
+    }
+    map_size_ = st.st_size;
+
+    if (map_size_ != 0) {
+      map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (map_ == MAP_FAILED) {
+        close(fd_);
+        throw std::runtime_error("Cannot map " + path_);
+      }
+      madvise(map_, map_size_, MADV_SEQUENTIAL);
+    }
+
+    if (file_header_ != 0) {
+      if (map_size_ < file_header_) {
+        unmap();
+        throw std::runtime_error("Truncated header in " + path_);
+      }
+      uint32_t header[2];
+      std::memcpy(header, map_, sizeof(header));
+      num_array_cols_ = header[0];
+      num_array_rows_ = header[1];
+      if (map_size_ < file_header_ + num_array_cols_ * vector_stride()) {
+        unmap();
+        throw std::runtime_error("Truncated data in " + path_);
+      }
+    } else if (map_size_ != 0) {
+      int32_t d;
+      std::memcpy(&d, map_, sizeof(d));
+      num_array_rows_ = d;
+      if (d <= 0 || map_size_ % vector_stride() != 0) {
+        unmap();
+        throw std::runtime_error(
+            "File size does not match vector dimension in " + path_);
+      }
+      num_array_cols_ = map_size_ / vector_stride();
+    }
+
+    if (upper_bound == 0 || upper_bound > num_array_cols_) {
+      blocksize_ = num_array_cols_;
+    } else {
+      blocksize_ = upper_bound;
+    }
+
+#ifndef __APPLE__
+    auto data_ =
+        std::make_unique_for_overwrite<T[]>(num_array_rows_ * blocksize_);
+#else
+    auto data_ = std::unique_ptr<T[]>(new T[num_array_rows_ * blocksize_]);
+#endif
+
+    Base::operator=(Base{std::move(data_), num_array_rows_, blocksize_});
+  }
+
+  explicit mmapBlockedMatrix(const std::string& path, size_t upper_bound = 0)
+      : mmapBlockedMatrix(path, vecs_format_from_path(path), upper_bound) {
+  }
+
+  mmapBlockedMatrix(const mmapBlockedMatrix&) = delete;
+  mmapBlockedMatrix& operator=(const mmapBlockedMatrix&) = delete;
+
+  ~mmapBlockedMatrix() noexcept {
+    unmap();
+  }
+
+  /**
+   * @brief Bring the next block of vectors into memory.
+   * @return false if there are no more vectors.
+   */
+  bool load() {
+    scoped_timer _{tdb_func__ + " " + path_};
+
+    auto num_end_elts =
+        std::min<size_t>(blocksize_, num_array_cols_ - next_col_);
+    if (num_end_elts == 0) {
+      return false;
+    }
+    release_before(next_col_);
+
+    col_offset_ = next_col_;
+    next_col_ += num_end_elts;
+
+    // The last block may be short, so only expose the columns actually read
+    Base::num_cols_ = num_end_elts;
+
+    switch (format_) {
+      case vecs_format::fvecs:
+      case vecs_format::f32bin:
+        copy_block<float>();
+        break;
+      case vecs_format::ivecs:
+        copy_block<int32_t>();
+        break;
+      case vecs_format::bvecs:
+      case vecs_format::u8bin:
+        copy_block<uint8_t>();
+        break;
+    }
+    _memory_data.insert_entry(
+        tdb_func__, num_end_elts * num_array_rows_ * sizeof(T));
+
+    return true;
+  }
+
+  index_type col_offset() const {
+    return col_offset_;
+  }
+
+  size_t num_array_rows() const {
+    return num_array_rows_;
+  }
+
+  size_t num_array_cols() const {
+    return num_array_cols_;
+  }
+};
+
+/**
+ * Like `mmapBlockedMatrix`, but loads its first (or only) block on
+ * construction.
+ */
+template <class T, class I = size_t>
+class mmapPreLoadMatrix : public mmapBlockedMatrix<T, I> {
+  using Base = mmapBlockedMatrix<T, I>;
+
+ public:
+  explicit mmapPreLoadMatrix(const std::string& path, size_t upper_bound = 0)
+      : Base(path, upper_bound) {
+    Base::load();
+  }
+};
+
+/**
+ * Convenience class for column-major matrices.
+ */
+template <class T, class I = size_t>
+using mmapColMajorMatrix = mmapBlockedMatrix<T, I>;
+
+#endif  // TDB_MMAP_MATRIX_H
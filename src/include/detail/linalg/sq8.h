@@ -0,0 +1,190 @@
+/**
+ * @file   sq8.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Scalar quantization of float vectors to one byte per element (SQ8).
+ *
+ * Element `i` of a vector is encoded as
+ *   `round((x[i] - min[i]) / step)`, clamped to [0, 255],
+ * where `min` is the per-dimension minimum of the data and `step` is the
+ * largest per-dimension range divided by 255.  The step is shared by all
+ * dimensions so that the map from vectors to codes is a translation
+ * followed by a uniform scaling: the squared L2 distance between two
+ * vectors is `step^2` times that between their images.  Queries (and
+ * centroids) are therefore not quantized but just mapped into code space
+ * with `transform()`, after which the existing float x uint8 kernels and
+ * uint8 partitioned readers rank the encoded vectors correctly, without
+ * decoding them.
+ *
+ */
+
+#ifndef TDB_SQ8_H
+#define TDB_SQ8_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "detail/linalg/matrix.h"
+
+class sq8_codec {
+  std::vector<float> min_;
+  std::vector<float> max_;
+  float step_{1.0f};
+
+  void update_step() {
+    float range = 0;
+    for (size_t i = 0; i < size(min_); ++i) {
+      range = std::max(range, max_[i] - min_[i]);
+    }
+    step_ = range > 0 ? range / 255.0f : 1.0f;
+  }
+
+ public:
+  sq8_codec() = default;
+
+  explicit sq8_codec(size_t dimension)
+      : min_(dimension, std::numeric_limits<float>::max())
+      , max_(dimension, std::numeric_limits<float>::lowest()) {
+  }
+
+  /**
+   * @brief Rebuild a codec from the matrix returned by `params()`.
+   */
+  explicit sq8_codec(const ColMajorMatrix<float>& params)
+      : min_(params.num_rows())
+      , max_(params.num_rows()) {
+    if (params.num_cols() != 2) {
+      throw std::runtime_error("SQ8 parameters must have two columns");
+    }
+    for (size_t i = 0; i < params.num_rows(); ++i) {
+      min_[i] = params(i, 0);
+      max_[i] = params(i, 1);
+    }
+    update_step();
+  }
+
+  /**
+   * @brief Widen the per-dimension ranges to include the first `n` vectors
+   * of `A`.
+   */
+  void fit(const auto& A, size_t n) {
+    if (A.num_rows() != size(min_)) {
+      throw std::runtime_error("Dimension mismatch in SQ8 codec");
+    }
+    for (size_t j = 0; j < n; ++j) {
+      auto a = A[j];
+      for (size_t i = 0; i < size(min_); ++i) {
+        float x = a[i];
+        min_[i] = std::min(min_[i], x);
+        max_[i] = std::max(max_[i], x);
+      }
+    }
+    update_step();
+  }
+
+  void fit(const auto& A) {
+    fit(A, A.num_cols());
+  }
+
+  /**
+   * @brief Encode the vector `v` into `codes`.
+   */
+  template <class V, class W>
+  void encode(const V& v, W&& codes) const {
+    auto inv_step = 1.0f / step_;
+    for (size_t i = 0; i < size(min_); ++i) {
+      auto q = std::nearbyint((v[i] - min_[i]) * inv_step);
+      codes[i] = static_cast<uint8_t>(std::clamp(q, 0.0f, 255.0f));
+    }
+  }
+
+  auto encode(const auto& A) const {
+    auto codes = ColMajorMatrix<uint8_t>(A.num_rows(), A.num_cols());
+    for (size_t j = 0; j < A.num_cols(); ++j) {
+      encode(A[j], codes[j]);
+    }
+    return codes;
+  }
+
+  /**
+   * @brief Map the vectors of `A` into code space without rounding, e.g.,
+   * to query encoded vectors.
+   */
+  auto transform(const auto& A) const {
+    auto inv_step = 1.0f / step_;
+    auto B = ColMajorMatrix<float>(A.num_rows(), A.num_cols());
+    for (size_t j = 0; j < A.num_cols(); ++j) {
+      auto a = A[j];
+      for (size_t i = 0; i < size(min_); ++i) {
+        B(i, j) = (a[i] - min_[i]) * inv_step;
+      }
+    }
+    return B;
+  }
+
+  auto decode(const auto& codes) const {
+    auto A = ColMajorMatrix<float>(codes.num_rows(), codes.num_cols());
+    for (size_t j = 0; j < codes.num_cols(); ++j) {
+      for (size_t i = 0; i < size(min_); ++i) {
+        A(i, j) = min_[i] + codes(i, j) * step_;
+      }
+    }
+    return A;
+  }
+
+  /**
+   * @brief The per-dimension minima (column 0) and maxima (column 1), from
+   * which the codec can be rebuilt.
+   */
+  auto params() const {
+    auto params = ColMajorMatrix<float>(size(min_), 2);
+    for (size_t i = 0; i < size(min_); ++i) {
+      params(i, 0) = min_[i];
+      params(i, 1) = max_[i];
+    }
+    return params;
+  }
+
+  size_t dimension() const {
+    return size(min_);
+  }
+
+  /**
+   * @brief Squared L2 distances in code space are those between the
+   * original vectors divided by `step()^2`.
+   */
+  float step() const {
+    return step_;
+  }
+};
+
+#endif  // TDB_SQ8_H
@@ -32,11 +32,16 @@
 #ifndef TILEDB_TDB_IO_H
 #define TILEDB_TDB_IO_H
 
+#include <algorithm>
+#include <limits>
 #include <numeric>
 #include <vector>
 
 #include <tiledb/tiledb>
 #include "detail/linalg/matrix.h"
+#include "detail/linalg/mmap_matrix.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "utils/id_bitmap.h"
 #include "utils/logging.h"
 #include "utils/timer.h"
 
@@ -106,13 +111,17 @@ void write_matrix(
   tiledb::Subarray subarray(ctx, array);
   subarray.set_subarray(subarray_vals);
 
+  // Arrays created elsewhere (e.g., the centroids array created by Python
+  // ingestion) may not name their attribute "values"
+  std::string attr_name = array.schema().attribute(0).name();
+
   tiledb::Query query(ctx, array);
   auto order = std::is_same_v<LayoutPolicy, stdx::layout_right> ?
                    TILEDB_ROW_MAJOR :
                    TILEDB_COL_MAJOR;
   query.set_layout(order)
       .set_data_buffer(
-          "values", &A(0, 0), (uint64_t)A.num_rows() * (uint64_t)A.num_cols())
+          attr_name, &A(0, 0), (uint64_t)A.num_rows() * (uint64_t)A.num_cols())
       .set_subarray(subarray);
   tiledb_helpers::submit_query(tdb_func__, uri, query);
 
@@ -174,9 +183,11 @@ void write_vector(
   tiledb::Subarray subarray(ctx, array);
   subarray.set_subarray(subarray_vals);
 
+  std::string attr_name = array.schema().attribute(0).name();
+
   tiledb::Query query(ctx, array);
   query.set_layout(TILEDB_ROW_MAJOR)
-      .set_data_buffer("values", v)
+      .set_data_buffer(attr_name, v)
       .set_subarray(subarray);
 
   query.submit();
@@ -239,6 +250,251 @@ std::vector<T> read_vector(const tiledb::Context& ctx, const std::string& uri) {
   return data_;
 }
 
+/**
+ * Read elements [start, stop) of the TileDB vector at `uri`.
+ */
+template <class T>
+std::vector<T> read_vector(
+    const tiledb::Context& ctx,
+    const std::string& uri,
+    size_t start,
+    size_t stop) {
+  scoped_timer _{tdb_func__ + " " + std::string{uri}};
+
+  if (global_debug) {
+    std::cerr << "# Reading std::vector: " << uri << " [" << start << ", "
+              << stop << ")" << std::endl;
+  }
+
+  std::vector<T> data_(stop - start);
+  if (start == stop) {
+    return data_;
+  }
+
+  tiledb::Array array_ =
+      tiledb_helpers::open_array(tdb_func__, ctx, uri, TILEDB_READ);
+  std::string attr_name = array_.schema().attribute(0).name();
+
+  std::vector<int32_t> subarray_vals = {(int32_t)start, (int32_t)stop - 1};
+  tiledb::Subarray subarray(ctx, array_);
+  subarray.set_subarray(subarray_vals);
+
+  tiledb::Query query(ctx, array_);
+  query.set_subarray(subarray).set_data_buffer(
+      attr_name, data_.data(), size(data_));
+  tiledb_helpers::submit_query(tdb_func__, uri, query);
+  _memory_data.insert_entry(tdb_func__, size(data_) * sizeof(T));
+
+  array_.close();
+  assert(tiledb::Query::Status::COMPLETE == query.query_status());
+
+  return data_;
+}
+
+/**
+ * The tombstone arrays written by `write_id_bitmap()` hold a list of ids
+ * rather than a bitmap, so that they grow with the number of ids, not with
+ * the largest of them.  The array is created with room for this many ids;
+ * its "count" metadata records how many of them have been written.
+ */
+constexpr int32_t id_bitmap_tile_extent = 1 << 16;
+constexpr int32_t max_id_bitmap_count =
+    (std::numeric_limits<int32_t>::max() / id_bitmap_tile_extent) *
+    id_bitmap_tile_extent;
+
+/**
+ * Write `ids` to positions `[start, start + size(ids))` of the id array at
+ * `uri` and record `start + size(ids)` as its count.
+ */
+inline void write_id_bitmap_ids(
+    const tiledb::Context& ctx,
+    std::vector<uint64_t>& ids,
+    const std::string& uri,
+    size_t start) {
+  scoped_timer _{tdb_func__ + " " + std::string{uri}};
+
+  uint64_t count = start + size(ids);
+  if (count > static_cast<uint64_t>(max_id_bitmap_count)) {
+    throw std::runtime_error(
+        "Too many ids for the array at " + uri + ": " + std::to_string(count));
+  }
+
+  tiledb::Array array =
+      tiledb_helpers::open_array(tdb_func__, ctx, uri, TILEDB_WRITE);
+  if (!ids.empty()) {
+    std::vector<int32_t> subarray_vals{(int32_t)start, (int32_t)count - 1};
+    tiledb::Subarray subarray(ctx, array);
+    subarray.set_subarray(subarray_vals);
+
+    std::string attr_name = array.schema().attribute(0).name();
+    tiledb::Query query(ctx, array);
+    query.set_layout(TILEDB_ROW_MAJOR)
+        .set_data_buffer(attr_name, ids)
+        .set_subarray(subarray);
+    tiledb_helpers::submit_query(tdb_func__, uri, query);
+    assert(tiledb::Query::Status::COMPLETE == query.query_status());
+  }
+  array.put_metadata("count", TILEDB_UINT64, 1, &count);
+  array.close();
+}
+
+/**
+ * Write the ids in an id_bitmap to a new TileDB array, in increasing order.
+ * More ids can be appended later with `update_id_bitmap()`.
+ */
+inline void write_id_bitmap(
+    const tiledb::Context& ctx,
+    const id_bitmap& bitmap,
+    const std::string& uri) {
+  if (global_debug) {
+    std::cerr << "# Writing id_bitmap: " << uri << std::endl;
+  }
+
+  tiledb::Domain domain(ctx);
+  domain.add_dimension(tiledb::Dimension::create<int32_t>(
+      ctx, "rows", {{0, max_id_bitmap_count - 1}}, id_bitmap_tile_extent));
+
+  tiledb::ArraySchema schema(ctx, TILEDB_DENSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+  schema.add_attribute(tiledb::Attribute::create<uint64_t>(ctx, "values"));
+  tiledb::Array::create(uri, schema);
+
+  auto ids = bitmap.ids();
+  write_id_bitmap_ids(ctx, ids, uri, 0);
+}
+
+/**
+ * Add `ids` to `bitmap`, which was written to the array at `uri`, and
+ * append the ones that were not already in it to the array.
+ *
+ * @return The number of ids that were not already in the bitmap.
+ */
+template <class I>
+size_t update_id_bitmap(
+    const tiledb::Context& ctx,
+    id_bitmap& bitmap,
+    const std::vector<I>& ids,
+    const std::string& uri) {
+  auto count = bitmap.count();
+  std::vector<uint64_t> added;
+  for (auto id : ids) {
+    if (bitmap.set(id)) {
+      added.push_back(id);
+    }
+  }
+  if (!added.empty()) {
+    write_id_bitmap_ids(ctx, added, uri, count);
+  }
+  return size(added);
+}
+
+/**
+ * Read an id_bitmap written by `write_id_bitmap()`.
+ */
+inline id_bitmap read_id_bitmap(
+    const tiledb::Context& ctx, const std::string& uri) {
+  uint64_t count = 0;
+  {
+    tiledb::Array array =
+        tiledb_helpers::open_array(tdb_func__, ctx, uri, TILEDB_READ);
+    tiledb_datatype_t type;
+    uint32_t num;
+    const void* value = nullptr;
+    array.get_metadata("count", &type, &num, &value);
+    if (value != nullptr) {
+      if (type != TILEDB_UINT64 || num != 1) {
+        throw std::runtime_error("Metadata count of " + uri + " is invalid");
+      }
+      count = *static_cast<const uint64_t*>(value);
+    }
+    array.close();
+  }
+  return id_bitmap::from_ids(read_vector<uint64_t>(ctx, uri, 0, count));
+}
+
+/**
+ * Name of the numpy dtype corresponding to `T`, as stored in the "dtype"
+ * metadata of an index group.
+ */
+template <class T>
+std::string dtype_name() {
+  if constexpr (std::is_same_v<T, float>) {
+    return "float32";
+  } else if constexpr (std::is_same_v<T, uint8_t>) {
+    return "uint8";
+  } else if constexpr (std::is_same_v<T, int8_t>) {
+    return "int8";
+  } else if constexpr (std::is_same_v<T, double>) {
+    return "float64";
+  } else {
+    static_assert(std::is_same_v<T, float>, "Unsupported vector type");
+  }
+}
+
+/**
+ * Read the string metadata `key` of `group`, or `default_value` if it is not
+ * set.
+ */
+inline std::string get_string_metadata(
+    tiledb::Group& group,
+    const std::string& key,
+    const std::string& default_value) {
+  tiledb_datatype_t type;
+  uint32_t num;
+  const void* value = nullptr;
+  group.get_metadata(key, &type, &num, &value);
+  if (value == nullptr) {
+    return default_value;
+  }
+  if (type != TILEDB_STRING_UTF8 && type != TILEDB_STRING_ASCII &&
+      type != TILEDB_CHAR) {
+    throw std::runtime_error("Metadata " + key + " is not a string");
+  }
+  return std::string(static_cast<const char*>(value), num);
+}
+
+inline void put_string_metadata(
+    tiledb::Group& group, const std::string& key, const std::string& value) {
+  group.put_metadata(
+      key, TILEDB_STRING_UTF8, (uint32_t)value.size(), value.c_str());
+}
+
+/**
+ * URI of the member of `group` named `name`, or empty if there is none.
+ * Members are resolved through the group rather than by appending `name` to
+ * its URI, so relative and remote (tiledb://) members work.
+ */
+inline std::string member_uri(
+    const tiledb::Group& group, const std::string& name) {
+  for (uint64_t i = 0; i < group.member_count(); ++i) {
+    auto member = group.member(i);
+    if (member.name() == name) {
+      return member.uri();
+    }
+  }
+  return {};
+}
+
+/**
+ * Read the first `num_vectors` vectors (0 means all) into a column-major
+ * Matrix, from either a TileDB array or a local file in one of the benchmark
+ * formats (fvecs, etc).
+ */
+template <class T>
+ColMajorMatrix<T> read_matrix(
+    const tiledb::Context& ctx,
+    const std::string& uri,
+    size_t num_vectors = 0) {
+  if (is_vecs_file(uri)) {
+    auto A = mmapColMajorMatrix<T>(uri, num_vectors);
+    A.load();
+    return std::move(static_cast<ColMajorMatrix<T>&>(A));
+  }
+  auto A = tdbColMajorMatrix<T>(ctx, uri, num_vectors);
+  A.load();
+  return std::move(static_cast<ColMajorMatrix<T>&>(A));
+}
+
 template <class T>
 auto sizes_to_indices(const std::vector<T>& sizes) {
   std::vector<T> indices(size(sizes) + 1);
@@ -217,6 +217,9 @@ class tdbBlockedMatrix : public Matrix<T, LayoutPolicy, I> {
       return false;
     }
 
+    // The last block may be short, so only expose the columns actually read
+    Base::num_cols_ = num_cols_;
+
     assert(std::get<1>(col_view_) <= num_array_cols_);
 
     // Create a subarray for the next block of columns
@@ -246,6 +249,14 @@ class tdbBlockedMatrix : public Matrix<T, LayoutPolicy, I> {
     return col_offset_;
   }
 
+  size_t num_array_rows() const {
+    return num_array_rows_;
+  }
+
+  size_t num_array_cols() const {
+    return num_array_cols_;
+  }
+
   /**
    * @brief General constructor.  Read a view of the array, delimited by the
    * given row and column indices.
@@ -27,28 +27,498 @@
  *
  * @section DESCRIPTION
  *
- * Header-only library of class that implements a flat index.
+ * Header-only library of class that implements a flat index, i.e., exact
+ * (brute-force) search over every vector of a database.
+ *
+ * The database is either a matrix in memory or a TileDB array.  An array is
+ * read in blocks of columns no larger than the memory budget allows, and
+ * the next block is read while the current one is scored, so at most two
+ * blocks are resident at a time.  The top k of each query are accumulated
+ * in heaps across blocks.
+ *
+ * Each block is scored with the kernel that suits the batch of queries:
+ * - gemm (when built with BLAS) for large batches, scoring the block with
+ *   matrix products over tiles of vectors and queries, each folded into the
+ *   heaps before the next is scored; for non-float vectors the block must
+ *   first be converted, so a larger batch is needed to pay for it
+ * - qv (queries split among threads) when there are at least as many
+ *   queries as threads
+ * - vq (database vectors split among threads) for small batches, where
+ *   splitting the queries would leave threads idle
  *
  * The basic use case is:
- * - Create an instance of the index
- * - Call train() to build the index (nullop for flat index)
- * - OR Call load() to load the index from TileDB arrays
- * - Call add() to add vectors to the index (alt. add with ids)
- * - Call search() to query the index, returning the ids of the nearest vectors,
- *   and optionally the distances.
- * - Compute the recall of the search results.
- *
- * - Call save() to save the index to disk
- * - Call reset() to clear the index
- *
- * In general, we will neither be able to have the entire index in memory,
- * nor the original vectors.  Thus, we either construct the index from
- * URIs (and the index uses out-of-core data structures), or we construct
- * the requisite data structures and pass them to the index, again using
- * out-of-core data structures as necessary.
+ * - Create an instance of the index from a matrix or an array URI
+ * - Call search() to query the index, returning the distances and the ids
+ *   of the nearest vectors
+ *
+ * A search may also be split into ranges of database columns with
+ * accumulate(), followed by top_k(), e.g., to checkpoint a long search (see
+ * detail/flat/groundtruth.h).
+ *
+ * Vectors are deleted by setting their ids in a bitmap of tombstones (see
+ * remove() and set_deleted()), which every kernel tests before scoring a
+ * column, so deleting does not rewrite the database.
+ */
+
+#ifndef TILEDB_FLAT_INDEX_H
+#define TILEDB_FLAT_INDEX_H
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "defs.h"
+
+#include "algorithm.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "linalg.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/id_bitmap.h"
+#include "utils/timer.h"
+
+#if defined(TILEDB_VS_ENABLE_BLAS)
+#include "scoring.h"
+#endif
+
+/**
+ * Kernels for scoring a block of database vectors against a batch of
+ * queries.
  */
+enum class flat_kernel { automatic, qv, vq, gemm };
+
+template <class T, class id_type = uint64_t>
+class flat_index {
+ public:
+  // Heap of the (score, column) pairs of the nearest vectors to a query
+  using heap_type = fixed_min_pair_heap<float, size_t>;
+
+ private:
+  size_t dimension_{0};
+  size_t num_vectors_{0};
+  size_t memory_budget_{0};
+  size_t nthreads_{std::thread::hardware_concurrency()};
+  flat_kernel kernel_{flat_kernel::automatic};
+
+  // Smallest batch of float queries scored with gemm; non-float databases
+  // need four times as many
+  size_t gemm_threshold_{32};
+
+  // The gemm kernel scores tiles of at most `gemm_tile_cols_` database
+  // vectors by `query_block_` queries, folding each tile into the heaps
+  // before scoring the next, so that the scores are never all formed
+  size_t query_block_{1024};
+  size_t gemm_tile_cols_{16384};
+
+  // Database held in memory, or the array holding it
+  ColMajorMatrix<T> db_;
+  tiledb::Context ctx_;
+  std::string db_uri_;
+
+  // Ids of the database vectors; if empty, the ids are the column numbers
+  std::vector<id_type> ids_;
+
+  // Ids of the deleted vectors
+  id_bitmap deleted_;
+
+  /**
+   * @brief Whether database column `col` has not been deleted.
+   */
+  bool is_live(size_t col) const {
+    return !deleted_.contains(ids_.empty() ? col : ids_[col]);
+  }
+
+  /**
+   * @brief The kernel to score a block with, for `num_queries` queries.
+   */
+  flat_kernel choose_kernel(size_t num_queries) const {
+    if (kernel_ != flat_kernel::automatic) {
+#if !defined(TILEDB_VS_ENABLE_BLAS)
+      if (kernel_ == flat_kernel::gemm) {
+        throw std::runtime_error("gemm kernel requires BLAS");
+      }
+#endif
+      return kernel_;
+    }
+#if defined(TILEDB_VS_ENABLE_BLAS)
+    auto threshold =
+        std::is_same_v<T, float> ? gemm_threshold_ : 4 * gemm_threshold_;
+    if (num_queries >= threshold) {
+      return flat_kernel::gemm;
+    }
+#endif
+    return num_queries >= nthreads_ ? flat_kernel::qv : flat_kernel::vq;
+  }
+
+  /**
+   * @brief Score the columns `[first, last)` of `block`, which are the
+   * columns from `offset + first` of the database, against every query,
+   * adding them to `min_scores` (with their database column numbers),
+   * which keep the `k_nn` nearest.
+   */
+  void score_block(
+      const ColMajorMatrix<T>& block,
+      size_t first,
+      size_t last,
+      size_t offset,
+      const auto& query,
+      size_t k_nn,
+      std::vector<heap_type>& min_scores) const {
+    size_t num_queries = query.num_cols();
+    size_t num_cols = last - first;
+    auto kernel = choose_kernel(num_queries);
+
+#if defined(TILEDB_VS_ENABLE_BLAS)
+    if (kernel == flat_kernel::gemm) {
+      // Copy (converting if need be) the queries once, a tile at a time
+      std::vector<ColMajorMatrix<float>> query_tiles;
+      for (size_t j0 = 0; j0 < num_queries; j0 += query_block_) {
+        auto j1 = std::min(j0 + query_block_, num_queries);
+        auto& tile = query_tiles.emplace_back(dimension_, j1 - j0);
+        for (size_t j = j0; j < j1; ++j) {
+          std::copy(
+              std::begin(query[j]),
+              std::end(query[j]),
+              std::begin(tile[j - j0]));
+        }
+      }
+
+      for (size_t i0 = first; i0 < last; i0 += gemm_tile_cols_) {
+        auto i1 = std::min(i0 + gemm_tile_cols_, last);
+        auto db_tile = ColMajorMatrix<float>(dimension_, i1 - i0);
+        std::copy(
+            block[i0].data(),
+            block[i0].data() + dimension_ * (i1 - i0),
+            db_tile.data());
+
+        for (size_t t = 0, j0 = 0; t < size(query_tiles);
+             ++t, j0 += query_block_) {
+          auto& q_tile = query_tiles[t];
+          auto scores = ColMajorMatrix<float>(i1 - i0, q_tile.num_cols());
+          gemm_scores(db_tile, q_tile, scores, nthreads_);
+          std::vector<size_t> queries(q_tile.num_cols());
+          std::iota(std::begin(queries), std::end(queries), 0);
+          stdx::execution::indexed_parallel_policy par{nthreads_};
+          stdx::range_for_each(
+              std::move(par), queries, [&](auto&& j, size_t, size_t) {
+                for (size_t i = 0; i < i1 - i0; ++i) {
+                  if (is_live(offset + i0 + i)) {
+                    min_scores[j0 + j].insert(scores(i, j), offset + i0 + i);
+                  }
+                }
+              });
+        }
+      }
+      return;
+    }
+#endif
+
+    if (kernel == flat_kernel::qv) {
+      std::vector<size_t> queries(num_queries);
+      std::iota(std::begin(queries), std::end(queries), 0);
+      stdx::execution::indexed_parallel_policy par{nthreads_};
+      stdx::range_for_each(
+          std::move(par), queries, [&](auto&& j, size_t, size_t) {
+            auto q_vec = query[j];
+            for (size_t i = first; i < last; ++i) {
+              if (is_live(offset + i)) {
+                min_scores[j].insert(L2(q_vec, block[i]), offset + i);
+              }
+            }
+          });
+      return;
+    }
+
+    // Each thread scores a range of columns against every query into its
+    // own heaps, which are then merged
+    size_t nthreads = std::max<size_t>(1, std::min(nthreads_, num_cols));
+    size_t per_thread = (num_cols + nthreads - 1) / nthreads;
+    std::vector<std::future<std::vector<heap_type>>> futs;
+    futs.reserve(nthreads);
+    for (size_t n = 0; n < nthreads; ++n) {
+      auto start = std::min(first + n * per_thread, last);
+      auto stop = std::min(first + (n + 1) * per_thread, last);
+      if (start == stop) {
+        continue;
+      }
+      futs.emplace_back(std::async(std::launch::async, [&, start, stop]() {
+        std::vector<heap_type> local(num_queries, heap_type(k_nn));
+        for (size_t i = start; i < stop; ++i) {
+          if (!is_live(offset + i)) {
+            continue;
+          }
+          auto db_vec = block[i];
+          for (size_t j = 0; j < num_queries; ++j) {
+            local[j].insert(L2(query[j], db_vec), offset + i);
+          }
+        }
+        return local;
+      }));
+    }
+    for (auto&& f : futs) {
+      auto local = f.get();
+      for (size_t j = 0; j < num_queries; ++j) {
+        for (auto&& [score, i] : local[j]) {
+          min_scores[j].insert(score, i);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Read the columns `[first, last)` of the database array.
+   */
+  ColMajorMatrix<T> read_block(size_t first, size_t last) const {
+    auto block = tdbColMajorMatrix<T>(ctx_, db_uri_, 0, 0, first, last);
+    return std::move(static_cast<ColMajorMatrix<T>&>(block));
+  }
+
+ public:
+  /**
+   * @brief Create an index over the columns of `db`, held in memory.
+   *
+   * @param ids Ids of the columns of `db`; if empty, the ids are the column
+   * numbers.
+   * @param nthreads Number of threads, 0 to use all cores.
+   */
+  flat_index(
+      ColMajorMatrix<T>&& db,
+      std::vector<id_type> ids = {},
+      size_t nthreads = 0)
+      : dimension_(db.num_rows())
+      , num_vectors_(db.num_cols())
+      , nthreads_(
+            nthreads == 0 ? std::thread::hardware_concurrency() : nthreads)
+      , db_(std::move(db))
+      , ids_(std::move(ids)) {
+    if (!ids_.empty() && size(ids_) != num_vectors_) {
+      throw std::runtime_error(
+          "Number of ids does not match number of vectors");
+    }
+  }
+
+  /**
+   * @brief Create an index over the vectors of the TileDB array at `uri`,
+   * which is read each time the index is searched.
+   *
+   * @param ids_uri URI of a vector of the ids of the columns of the array,
+   * or empty if the ids are the column numbers.
+   * @param memory_budget Largest number of bytes of vectors held in memory
+   * at a time, 0 to read the whole array at once.  A search holds two
+   * blocks of columns, each at most half of the budget.
+   * @param nthreads Number of threads, 0 to use all cores.
+   */
+  flat_index(
+      const tiledb::Context& ctx,
+      const std::string& uri,
+      const std::string& ids_uri = "",
+      size_t memory_budget = 0,
+      size_t nthreads = 0)
+      : memory_budget_(memory_budget)
+      , nthreads_(
+            nthreads == 0 ? std::thread::hardware_concurrency() : nthreads)
+      , ctx_(ctx)
+      , db_uri_(uri) {
+    auto schema = tiledb::ArraySchema(ctx, uri);
+    auto rows = schema.domain().dimension(0).template domain<int>();
+    auto cols = schema.domain().dimension(1).template domain<int>();
+    dimension_ = rows.second - rows.first + 1;
+    num_vectors_ = cols.second - cols.first + 1;
+    if (schema.attribute(0).type() !=
+        tiledb::impl::type_to_tiledb<T>::tiledb_type) {
+      throw std::runtime_error("Attribute type mismatch in " + uri);
+    }
+    if (!ids_uri.empty()) {
+      auto ids = read_vector<uint64_t>(ctx, ids_uri);
+      if (size(ids) != num_vectors_) {
+        throw std::runtime_error(
+            "Number of ids does not match number of vectors");
+      }
+      ids_ = std::vector<id_type>(std::begin(ids), std::end(ids));
+    }
+  }
+
+  /**
+   * @brief Score the database columns `[first, last)` against every query,
+   * adding them to `min_scores` (one heap of size `k_nn` per query, holding
+   * column numbers).  Searching a database a range at a time gives the same
+   * result as searching it at once, so a long search can be split up.
+   */
+  void accumulate(
+      const auto& query,
+      size_t k_nn,
+      size_t first,
+      size_t last,
+      std::vector<heap_type>& min_scores) const {
+    scoped_timer _{tdb_func__};
+
+    if (query.num_rows() != dimension_) {
+      throw std::runtime_error("Query dimension does not match the index");
+    }
+    if (size(min_scores) != query.num_cols()) {
+      throw std::runtime_error("Number of heaps does not match the queries");
+    }
+    last = std::min(last, num_vectors_);
+    if (first >= last) {
+      return;
+    }
+
+    if (db_uri_.empty()) {
+      score_block(db_, first, last, 0, query, k_nn, min_scores);
+      return;
+    }
+
+    size_t block_cols = last - first;
+    if (memory_budget_ != 0) {
+      block_cols = std::clamp<size_t>(
+          memory_budget_ / (2 * dimension_ * sizeof(T)), 1, last - first);
+    }
+
+    // Read the next block while scoring the current one
+    auto next = std::async(
+        std::launch::async, [this, first, last, block_cols]() {
+          return read_block(first, std::min(first + block_cols, last));
+        });
+    for (size_t start = first; start < last; start += block_cols) {
+      auto block = next.get();
+      auto following = start + block_cols;
+      if (following < last) {
+        auto stop = std::min(following + block_cols, last);
+        next = std::async(std::launch::async, [this, following, stop]() {
+          return read_block(following, stop);
+        });
+      }
+      score_block(
+          block, 0, block.num_cols(), start, query, k_nn, min_scores);
+    }
+  }
+
+  /**
+   * @brief Sort `min_scores` (as filled by `accumulate()`) and copy them to
+   * matrices of the distances and the ids of the `k_nn` nearest vectors of
+   * each query, padded with the maximum float and id.
+   */
+  auto top_k(std::vector<heap_type>& min_scores, size_t k_nn) const {
+    size_t num_queries = size(min_scores);
+    auto top_scores = ColMajorMatrix<float>(k_nn, num_queries);
+    auto top_ids = ColMajorMatrix<size_t>(k_nn, num_queries);
+    for (size_t j = 0; j < num_queries; ++j) {
+      auto& heap = min_scores[j];
+      std::sort(std::begin(heap), std::end(heap));
+      for (size_t i = 0; i < k_nn; ++i) {
+        if (i < size(heap)) {
+          auto [score, col] = heap[i];
+          top_scores(i, j) = score;
+          top_ids(i, j) = ids_.empty() ? col : ids_[col];
+        } else {
+          top_scores(i, j) = std::numeric_limits<float>::max();
+          top_ids(i, j) = std::numeric_limits<size_t>::max();
+        }
+      }
+    }
+    return std::make_tuple(std::move(top_scores), std::move(top_ids));
+  }
+
+  /**
+   * @brief Find the `k_nn` nearest neighbors of each query.
+   *
+   * @return Matrices of the (squared L2) distances and the ids of the
+   * neighbors of each query, nearest first.  Columns are padded with the
+   * maximum float and id if the database holds fewer than `k_nn` vectors.
+   */
+  auto search(const auto& query, size_t k_nn) const {
+    scoped_timer _{tdb_func__};
+
+    std::vector<heap_type> min_scores(query.num_cols(), heap_type(k_nn));
+    accumulate(query, k_nn, 0, num_vectors_, min_scores);
+    return top_k(min_scores, k_nn);
+  }
+
+  /**
+   * @brief Delete the vectors with the given ids, which are then skipped by
+   * every search.  Ids not in the index are ignored.
+   */
+  void remove(const std::vector<id_type>& ids) {
+    if (ids_.empty()) {
+      for (auto id : ids) {
+        if (id < num_vectors_) {
+          deleted_.set(id);
+        }
+      }
+      return;
+    }
+
+    // Only ids of the index are set, so the bitmap never grows past them
+    auto sorted_ids = ids;
+    std::sort(begin(sorted_ids), end(sorted_ids));
+    for (auto id : ids_) {
+      if (std::binary_search(begin(sorted_ids), end(sorted_ids), id)) {
+        deleted_.set(id);
+      }
+    }
+  }
+
+  /**
+   * @brief Replace the deleted ids, e.g., with a bitmap read with
+   * `read_id_bitmap()`.
+   */
+  void set_deleted(id_bitmap deleted) {
+    deleted_ = std::move(deleted);
+  }
+
+  const id_bitmap& deleted() const {
+    return deleted_;
+  }
+
+  /**
+   * @brief Score blocks with `kernel` rather than choosing one by the
+   * number of queries.
+   */
+  void set_kernel(flat_kernel kernel) {
+    kernel_ = kernel;
+  }
+
+  flat_kernel kernel() const {
+    return kernel_;
+  }
+
+  /**
+   * @brief Set the number of queries scored by each gemm.
+   */
+  void set_query_block(size_t query_block) {
+    query_block_ = std::max<size_t>(1, query_block);
+  }
+
+  size_t query_block() const {
+    return query_block_;
+  }
+
+  void set_memory_budget(size_t memory_budget) {
+    memory_budget_ = memory_budget;
+  }
+
+  size_t memory_budget() const {
+    return memory_budget_;
+  }
+
+  void set_nthreads(size_t nthreads) {
+    nthreads_ = nthreads == 0 ? std::thread::hardware_concurrency() : nthreads;
+  }
+
+  size_t dimension() const {
+    return dimension_;
+  }
 
-#ifndef TILEDB_IVF_INDEX_H
-#define TILEDB_IVF_INDEX_H
+  size_t num_vectors() const {
+    return num_vectors_;
+  }
+};
 
-#endif TILEDB_IVF_INDEX_H
+#endif  // TILEDB_FLAT_INDEX_H
@@ -0,0 +1,698 @@
+/**
+ * @file   hnsw_index.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Header-only HNSW (hierarchical navigable small world) graph index, held
+ * in memory.
+ *
+ * Every vector is a node of a proximity graph.  Each node is assigned a
+ * level, drawn from an exponential distribution, and appears in the graph
+ * of every layer up to its level; the layers thin out exponentially
+ * towards the top.  A search descends greedily from the entry point (the
+ * node with the highest level) through the upper layers, and then runs a
+ * best-first beam search of width `ef_search` in the bottom layer.
+ *
+ * Nodes are inserted in parallel.  Each node's adjacency lists are guarded
+ * by their own mutex; the entry point is guarded by another, which is held
+ * for the whole insertion of a node whose level is above the current top.
+ * Neighbors are chosen with the diversity heuristic of the HNSW paper,
+ * keeping at most `M` neighbors per node in the upper layers and `2 * M`
+ * in the bottom one.
+ *
+ * The basic use case is:
+ * - Create an instance of the index
+ * - Call add() to build the graph over a set of vectors
+ * - Call search() to query the index, returning the ids of the
+ *   (approximate) nearest vectors.  set_ef_search() trades speed for recall.
+ * - Call save() to write the index to a TileDB group, and load() to open it
+ *   again.
+ */
+
+#ifndef TILEDB_HNSW_INDEX_H
+#define TILEDB_HNSW_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "defs.h"
+
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "linalg.h"
+#include "utils/timer.h"
+
+template <class T, class id_type = uint64_t>
+class hnsw_index {
+  using node_type = uint32_t;
+  using scored_node = std::tuple<float, node_type>;
+
+  size_t dimension_{0};
+  size_t M_{16};
+  size_t ef_construction_{200};
+  size_t ef_search_{64};
+  size_t nthreads_{std::thread::hardware_concurrency()};
+  std::mt19937 gen_{1234};
+
+  ColMajorMatrix<T> vectors_;
+  std::vector<id_type> ids_;
+  std::vector<uint32_t> levels_;
+
+  // neighbors_[i][l] holds the neighbors of node `i` in layer `l`, for `l`
+  // up to `levels_[i]`, guarded by locks_[i]
+  std::vector<std::vector<std::vector<node_type>>> neighbors_;
+  std::unique_ptr<std::mutex[]> locks_;
+
+  // Guards `entry_point_` and `max_level_` during add()
+  std::mutex entry_lock_;
+  node_type entry_point_{0};
+  int max_level_{-1};
+
+  static constexpr const char* vectors_name = "hnsw_vectors";
+  static constexpr const char* ids_name = "hnsw_ids";
+  static constexpr const char* levels_name = "hnsw_levels";
+  static constexpr const char* offsets_name = "hnsw_offsets";
+  static constexpr const char* neighbors_name = "hnsw_neighbors";
+
+  /**
+   * @brief Nodes already reached by a search.  Marking a node costs one
+   * store, and clearing the whole set is a counter increment.
+   */
+  class visited_set {
+    std::vector<uint32_t> marks_;
+    uint32_t epoch_{0};
+
+   public:
+    void reset(size_t num_nodes) {
+      if (size(marks_) < num_nodes ||
+          epoch_ == std::numeric_limits<uint32_t>::max()) {
+        marks_.assign(std::max(size(marks_), num_nodes), 0);
+        epoch_ = 0;
+      }
+      ++epoch_;
+    }
+
+    /**
+     * @brief Mark node `i`, returning whether it was already marked.
+     */
+    bool test_and_set(size_t i) {
+      if (marks_[i] == epoch_) {
+        return true;
+      }
+      marks_[i] = epoch_;
+      return false;
+    }
+  };
+
+  size_t max_degree(size_t level) const {
+    return level == 0 ? 2 * M_ : M_;
+  }
+
+  /**
+   * @brief Copy the neighbors of node `i` in layer `level` to `out`, under
+   * the node's lock if `Locked`.
+   */
+  template <bool Locked>
+  void get_neighbors(
+      node_type i, size_t level, std::vector<node_type>& out) const {
+    if constexpr (Locked) {
+      std::lock_guard<std::mutex> lock(locks_[i]);
+      out = neighbors_[i][level];
+    } else {
+      out = neighbors_[i][level];
+    }
+  }
+
+  /**
+   * @brief Greedily move from `current` to its nearest neighbor in layer
+   * `level` until no neighbor is nearer to `q`.
+   */
+  template <bool Locked>
+  node_type greedy_search(
+      const auto& q,
+      node_type current,
+      float& current_score,
+      size_t level,
+      std::vector<node_type>& buffer) const {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      get_neighbors<Locked>(current, level, buffer);
+      for (auto n : buffer) {
+        auto score = L2(q, vectors_[n]);
+        if (score < current_score) {
+          current_score = score;
+          current = n;
+          changed = true;
+        }
+      }
+    }
+    return current;
+  }
+
+  /**
+   * @brief Best-first search of layer `level` from `entry`, keeping the `ef`
+   * nearest nodes found.
+   *
+   * @return The nodes found and their scores, nearest first.
+   */
+  template <bool Locked>
+  std::vector<scored_node> search_layer(
+      const auto& q,
+      node_type entry,
+      float entry_score,
+      size_t ef,
+      size_t level,
+      visited_set& visited,
+      std::vector<node_type>& buffer) const {
+    visited.reset(size(ids_));
+    visited.test_and_set(entry);
+
+    // Nearest unexpanded candidate on top
+    std::priority_queue<
+        scored_node,
+        std::vector<scored_node>,
+        std::greater<scored_node>>
+        candidates;
+    // Farthest result on top
+    std::priority_queue<scored_node> results;
+    candidates.emplace(entry_score, entry);
+    results.emplace(entry_score, entry);
+
+    while (!candidates.empty()) {
+      auto [score, c] = candidates.top();
+      if (score > std::get<0>(results.top()) && size(results) >= ef) {
+        break;
+      }
+      candidates.pop();
+
+      get_neighbors<Locked>(c, level, buffer);
+      for (auto n : buffer) {
+        if (visited.test_and_set(n)) {
+          continue;
+        }
+        auto n_score = L2(q, vectors_[n]);
+        if (size(results) < ef || n_score < std::get<0>(results.top())) {
+          candidates.emplace(n_score, n);
+          results.emplace(n_score, n);
+          if (size(results) > ef) {
+            results.pop();
+          }
+        }
+      }
+    }
+
+    std::vector<scored_node> found(size(results));
+    for (auto i = size(found); i > 0; --i) {
+      found[i - 1] = results.top();
+      results.pop();
+    }
+    return found;
+  }
+
+  /**
+   * @brief Choose up to `max_neighbors` of `candidates` (sorted nearest
+   * first) with the diversity heuristic: a candidate is kept only if it is
+   * nearer to the node than to any candidate already kept.
+   */
+  std::vector<node_type> select_neighbors(
+      const std::vector<scored_node>& candidates, size_t max_neighbors) const {
+    std::vector<node_type> selected;
+    selected.reserve(max_neighbors);
+    for (auto&& [score, c] : candidates) {
+      if (size(selected) >= max_neighbors) {
+        break;
+      }
+      bool keep = true;
+      for (auto s : selected) {
+        if (L2(vectors_[c], vectors_[s]) < score) {
+          keep = false;
+          break;
+        }
+      }
+      if (keep) {
+        selected.push_back(c);
+      }
+    }
+    return selected;
+  }
+
+  /**
+   * @brief Add a link from node `from` to node `to` in layer `level`,
+   * pruning the neighbors of `from` if it has too many.
+   */
+  void link(node_type from, node_type to, size_t level) {
+    std::lock_guard<std::mutex> lock(locks_[from]);
+    auto& neighbors = neighbors_[from][level];
+    if (std::find(begin(neighbors), end(neighbors), to) != end(neighbors)) {
+      return;
+    }
+    if (size(neighbors) < max_degree(level)) {
+      neighbors.push_back(to);
+      return;
+    }
+    std::vector<scored_node> candidates;
+    candidates.reserve(size(neighbors) + 1);
+    candidates.emplace_back(L2(vectors_[from], vectors_[to]), to);
+    for (auto n : neighbors) {
+      candidates.emplace_back(L2(vectors_[from], vectors_[n]), n);
+    }
+    std::sort(begin(candidates), end(candidates));
+    neighbors = select_neighbors(candidates, max_degree(level));
+  }
+
+  /**
+   * @brief Insert node `i` into the graph.
+   */
+  void insert(
+      node_type i, visited_set& visited, std::vector<node_type>& buffer) {
+    int level = levels_[i];
+    auto q = vectors_[i];
+
+    std::unique_lock<std::mutex> entry_lock(entry_lock_);
+    auto max_level = max_level_;
+    auto entry = entry_point_;
+    if (level <= max_level) {
+      entry_lock.unlock();
+    }
+    if (max_level < 0) {
+      entry_point_ = i;
+      max_level_ = level;
+      return;
+    }
+
+    float entry_score = L2(q, vectors_[entry]);
+    for (int l = max_level; l > level; --l) {
+      entry = greedy_search<true>(q, entry, entry_score, l, buffer);
+    }
+    for (int l = std::min(level, max_level); l >= 0; --l) {
+      auto candidates = search_layer<true>(
+          q, entry, entry_score, ef_construction_, l, visited, buffer);
+      auto selected = select_neighbors(candidates, M_);
+      {
+        std::lock_guard<std::mutex> lock(locks_[i]);
+        neighbors_[i][l] = selected;
+      }
+      for (auto n : selected) {
+        link(n, i, l);
+      }
+      std::tie(entry_score, entry) = candidates.front();
+    }
+
+    if (level > max_level) {
+      entry_point_ = i;
+      max_level_ = level;
+    }
+  }
+
+  /**
+   * @brief Draw the level of every node.
+   */
+  std::vector<uint32_t> draw_levels(size_t num_nodes) {
+    auto mult = 1.0 / std::log(static_cast<double>(std::max<size_t>(M_, 2)));
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<uint32_t> levels(num_nodes);
+    for (auto& level : levels) {
+      level = static_cast<uint32_t>(-std::log(1.0 - dist(gen_)) * mult);
+    }
+    return levels;
+  }
+
+  void reset_graph(size_t num_nodes) {
+    neighbors_.assign(num_nodes, {});
+    for (size_t i = 0; i < num_nodes; ++i) {
+      neighbors_[i].resize(levels_[i] + 1);
+    }
+    locks_ = std::make_unique<std::mutex[]>(num_nodes);
+    entry_point_ = 0;
+    max_level_ = -1;
+  }
+
+ public:
+  /**
+   * @brief Create an empty index.
+   *
+   * @param dimension Dimension of the vectors, or 0 for an index that is to
+   * be load()ed.
+   * @param M Maximum number of neighbors per node in the upper layers (twice
+   * that in the bottom layer).
+   * @param ef_construction Width of the beam search used to find the
+   * neighbors of a node being inserted.
+   * @param nthreads Number of threads, 0 to use all cores.
+   */
+  hnsw_index(
+      size_t dimension,
+      size_t M = 16,
+      size_t ef_construction = 200,
+      size_t nthreads = 0)
+      : dimension_(dimension)
+      , M_(M)
+      , ef_construction_(ef_construction)
+      , nthreads_(
+            nthreads == 0 ? std::thread::hardware_concurrency() : nthreads) {
+    if (M_ < 2) {
+      throw std::runtime_error("M must be at least 2");
+    }
+    if (ef_construction_ == 0) {
+      throw std::runtime_error("ef_construction must be positive");
+    }
+  }
+
+  /**
+   * @brief Build the graph over the columns of `vectors`, replacing the
+   * contents of the index.  The id of column `i` is `ids[i]`.
+   */
+  void add(const ColMajorMatrix<T>& vectors, const std::vector<id_type>& ids) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_nodes = vectors.num_cols();
+    if (size(ids) != num_nodes) {
+      throw std::runtime_error(
+          "Number of ids does not match number of vectors");
+    }
+    if (vectors.num_rows() != dimension_) {
+      throw std::runtime_error("Vector dimension does not match the index");
+    }
+    if (num_nodes > std::numeric_limits<node_type>::max()) {
+      throw std::runtime_error("Too many vectors for an hnsw index");
+    }
+
+    vectors_ = ColMajorMatrix<T>(dimension_, num_nodes);
+    std::copy(
+        vectors.data(),
+        vectors.data() + dimension_ * num_nodes,
+        vectors_.data());
+    ids_ = ids;
+    levels_ = draw_levels(num_nodes);
+    reset_graph(num_nodes);
+
+    // Threads take the next node to insert from a shared counter
+    std::atomic<size_t> next{0};
+    auto worker = [this, &next, num_nodes]() {
+      visited_set visited;
+      std::vector<node_type> buffer;
+      for (auto i = next++; i < num_nodes; i = next++) {
+        insert(i, visited, buffer);
+      }
+    };
+    std::vector<std::future<void>> futs;
+    for (size_t n = 1; n < nthreads_; ++n) {
+      futs.emplace_back(std::async(std::launch::async, worker));
+    }
+    worker();
+    for (auto&& f : futs) {
+      f.get();
+    }
+  }
+
+  /**
+   * @brief Build the graph with the column numbers of `vectors` as ids.
+   */
+  void add(const ColMajorMatrix<T>& vectors) {
+    std::vector<id_type> ids(vectors.num_cols());
+    std::iota(begin(ids), end(ids), 0);
+    add(vectors, ids);
+  }
+
+  /**
+   * @brief Find the (approximate) `k_nn` nearest neighbors of each query,
+   * with a beam of width `max(ef_search(), k_nn)` in the bottom layer.
+   *
+   * @return Matrix whose column `j` holds the ids of the neighbors of query
+   * `j`, nearest first.  Columns are padded with
+   * `std::numeric_limits<size_t>::max()` if the index holds fewer than
+   * `k_nn` vectors.
+   */
+  auto search(const auto& query, size_t k_nn) const {
+    scoped_timer _{tdb_func__};
+
+    ColMajorMatrix<size_t> top_k(k_nn, query.num_cols());
+    std::fill(
+        top_k.data(),
+        top_k.data() + k_nn * query.num_cols(),
+        std::numeric_limits<size_t>::max());
+    if (max_level_ < 0) {
+      return top_k;
+    }
+
+    auto ef = std::max(ef_search_, k_nn);
+    size_t num_queries = query.num_cols();
+    size_t nthreads = std::min(nthreads_, std::max<size_t>(num_queries, 1));
+    size_t per_thread = (num_queries + nthreads - 1) / nthreads;
+
+    auto search_range = [&](size_t first, size_t last) {
+      visited_set visited;
+      std::vector<node_type> buffer;
+      for (size_t j = first; j < last; ++j) {
+        auto q = query[j];
+        auto entry = entry_point_;
+        float entry_score = L2(q, vectors_[entry]);
+        for (int l = max_level_; l > 0; --l) {
+          entry = greedy_search<false>(q, entry, entry_score, l, buffer);
+        }
+        auto found = search_layer<false>(
+            q, entry, entry_score, ef, 0, visited, buffer);
+        for (size_t i = 0; i < std::min(k_nn, size(found)); ++i) {
+          top_k(i, j) = ids_[std::get<1>(found[i])];
+        }
+      }
+    };
+
+    std::vector<std::future<void>> futs;
+    for (size_t n = 1; n < nthreads; ++n) {
+      auto first = std::min(n * per_thread, num_queries);
+      auto last = std::min((n + 1) * per_thread, num_queries);
+      if (first != last) {
+        futs.emplace_back(
+            std::async(std::launch::async, search_range, first, last));
+      }
+    }
+    search_range(0, std::min(per_thread, num_queries));
+    for (auto&& f : futs) {
+      f.get();
+    }
+    return top_k;
+  }
+
+  /**
+   * @brief Write the index to a new TileDB group at `group_uri`.  The
+   * adjacency lists are stored in CSR form: the neighbors of node `i` in
+   * layer `l` are `neighbors[offsets[r], offsets[r+1])`, where `r` counts
+   * the (node, layer) pairs, node by node and layer by layer, before it.
+   * The group metadata records `index_type` "HNSW" and the graph
+   * parameters.
+   */
+  void save(const tiledb::Context& ctx, const std::string& group_uri) const {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+
+    if (max_level_ < 0) {
+      throw std::runtime_error("Cannot save an index that has no vectors");
+    }
+    if (tiledb::Object::object(ctx, group_uri).type() !=
+        tiledb::Object::Type::Invalid) {
+      throw std::runtime_error(group_uri + " already exists");
+    }
+
+    std::vector<uint64_t> offsets{0};
+    std::vector<uint32_t> neighbors;
+    for (auto&& node : neighbors_) {
+      for (auto&& layer : node) {
+        neighbors.insert(end(neighbors), begin(layer), end(layer));
+        offsets.push_back(size(neighbors));
+      }
+    }
+    auto ids = std::vector<uint64_t>(begin(ids_), end(ids_));
+    auto levels = std::vector<uint64_t>(begin(levels_), end(levels_));
+
+    tiledb::Group::create(ctx, group_uri);
+    tiledb::Group group(ctx, group_uri, TILEDB_WRITE);
+
+    auto vectors_uri = group_uri + "/" + vectors_name;
+    auto ids_uri = group_uri + "/" + ids_name;
+    auto levels_uri = group_uri + "/" + levels_name;
+    auto offsets_uri = group_uri + "/" + offsets_name;
+    auto neighbors_uri = group_uri + "/" + neighbors_name;
+    write_matrix(ctx, vectors_, vectors_uri);
+    write_vector(ctx, ids, ids_uri);
+    write_vector(ctx, levels, levels_uri);
+    write_vector(ctx, offsets, offsets_uri);
+    group.add_member(vectors_uri, false, vectors_name);
+    group.add_member(ids_uri, false, ids_name);
+    group.add_member(levels_uri, false, levels_name);
+    group.add_member(offsets_uri, false, offsets_name);
+    // An index of a single vector has no edges
+    if (!neighbors.empty()) {
+      write_vector(ctx, neighbors, neighbors_uri);
+      group.add_member(neighbors_uri, false, neighbors_name);
+    }
+
+    int64_t M = M_;
+    int64_t ef_construction = ef_construction_;
+    int64_t ef_search = ef_search_;
+    int64_t entry_point = entry_point_;
+    int64_t max_level = max_level_;
+    put_string_metadata(group, "dataset_type", "vector_search");
+    put_string_metadata(group, "index_type", "HNSW");
+    put_string_metadata(group, "dtype", dtype_name<T>());
+    group.put_metadata("M", TILEDB_INT64, 1, &M);
+    group.put_metadata("ef_construction", TILEDB_INT64, 1, &ef_construction);
+    group.put_metadata("ef_search", TILEDB_INT64, 1, &ef_search);
+    group.put_metadata("entry_point", TILEDB_INT64, 1, &entry_point);
+    group.put_metadata("max_level", TILEDB_INT64, 1, &max_level);
+    put_string_metadata(group, "storage_version", "0.2");
+    group.close();
+  }
+
+  /**
+   * @brief Open an index from the TileDB group at `group_uri`, as written by
+   * `save()`.
+   */
+  void load(const tiledb::Context& ctx, const std::string& group_uri) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+
+    tiledb::Group group(ctx, group_uri, TILEDB_READ);
+    if (get_string_metadata(group, "index_type", "") != "HNSW") {
+      throw std::runtime_error(group_uri + " is not an HNSW index");
+    }
+    auto dtype = get_string_metadata(group, "dtype", dtype_name<T>());
+    if (dtype != dtype_name<T>()) {
+      throw std::runtime_error(
+          "Index at " + group_uri + " has dtype " + dtype + ", expected " +
+          dtype_name<T>());
+    }
+
+    auto get_int = [&](const std::string& key) {
+      tiledb_datatype_t type;
+      uint32_t num;
+      const void* value = nullptr;
+      group.get_metadata(key, &type, &num, &value);
+      if (value == nullptr || type != TILEDB_INT64) {
+        throw std::runtime_error("Missing " + key + " in " + group_uri);
+      }
+      return *static_cast<const int64_t*>(value);
+    };
+    M_ = get_int("M");
+    ef_construction_ = get_int("ef_construction");
+    ef_search_ = get_int("ef_search");
+    auto entry_point = get_int("entry_point");
+    auto max_level = get_int("max_level");
+
+    auto vectors = tdbColMajorMatrix<T>(ctx, group.member(vectors_name).uri());
+    vectors.load();
+    dimension_ = vectors.num_rows();
+    vectors_ = std::move(static_cast<ColMajorMatrix<T>&>(vectors));
+
+    auto ids = read_vector<uint64_t>(ctx, group.member(ids_name).uri());
+    ids_ = std::vector<id_type>(begin(ids), end(ids));
+    auto levels = read_vector<uint64_t>(ctx, group.member(levels_name).uri());
+    levels_ = std::vector<uint32_t>(begin(levels), end(levels));
+    auto offsets = read_vector<uint64_t>(ctx, group.member(offsets_name).uri());
+    std::vector<uint32_t> neighbors;
+    if (offsets.back() != 0) {
+      neighbors =
+          read_vector<uint32_t>(ctx, group.member(neighbors_name).uri());
+    }
+
+    auto num_nodes = vectors_.num_cols();
+    size_t num_lists = 0;
+    for (auto level : levels_) {
+      num_lists += level + 1;
+    }
+    if (size(ids_) != num_nodes || size(levels_) != num_nodes ||
+        size(offsets) != num_lists + 1 || offsets.back() != size(neighbors)) {
+      throw std::runtime_error("Inconsistent hnsw index at " + group_uri);
+    }
+
+    reset_graph(num_nodes);
+    size_t r = 0;
+    for (size_t i = 0; i < num_nodes; ++i) {
+      for (auto&& layer : neighbors_[i]) {
+        layer.assign(
+            begin(neighbors) + offsets[r], begin(neighbors) + offsets[r + 1]);
+        ++r;
+      }
+    }
+    entry_point_ = entry_point;
+    max_level_ = max_level;
+    group.close();
+  }
+
+  void set_ef_search(size_t ef_search) {
+    ef_search_ = std::max<size_t>(1, ef_search);
+  }
+
+  size_t ef_search() const {
+    return ef_search_;
+  }
+
+  void set_nthreads(size_t nthreads) {
+    nthreads_ = nthreads == 0 ? std::thread::hardware_concurrency() : nthreads;
+  }
+
+  size_t dimension() const {
+    return dimension_;
+  }
+
+  size_t M() const {
+    return M_;
+  }
+
+  size_t ef_construction() const {
+    return ef_construction_;
+  }
+
+  size_t num_vectors() const {
+    return size(ids_);
+  }
+
+  int max_level() const {
+    return max_level_;
+  }
+
+  /**
+   * @brief Neighbors of node `i` (the `i`th vector added) in layer `level`.
+   */
+  const auto& neighbors(size_t i, size_t level) const {
+    return neighbors_[i][level];
+  }
+};
+
+#endif  // TILEDB_HNSW_INDEX_H
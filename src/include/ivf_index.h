@@ -35,11 +35,18 @@
  * - Call train() to build the index
  * - OR Call load() to load the index from TileDB arrays
  * - Call add() to add vectors to the index (alt. add with ids)
+ * - Call update() and remove() to add or delete vectors incrementally; these
+ *   go to a delta store that is searched along with the main index until
+ *   compact() folds it back into the main index.  compact_async() does the
+ *   same in a background thread while the index is still searched and
+ *   updated
  * - Call search() to query the index, returning the ids of the nearest vectors,
- *   and optionally the distances.
+ *   and optionally the distances.  search_adaptive() instead probes only as
+ *   many partitions as each query needs, up to a maximum.
  * - Compute the recall of the search results.
  *
- * - Call save() to save the index to disk
+ * - Call save() to save the index to a TileDB group, in the same layout as
+ *   Python ingestion
  * - Call reset() to clear the index
  *
  * Still WIP.
@@ -49,15 +56,42 @@
 #define TILEDB_IVF_INDEX_H
 
 #include <atomic>
+#include <cmath>
+#include <future>
+#include <mutex>
+#include <optional>
 #include <random>
+#include <string>
 #include <thread>
 
+#include <tiledb/tiledb>
+
 #include "algorithm.h"
 #include "defs.h"
 #include "linalg.h"
 
 #include "detail/flat/qv.h"
+#include "detail/ivf/adaptive.h"
+#include "detail/ivf/binary.h"
+#include "detail/ivf/coarse.h"
+#include "detail/ivf/delta.h"
+#include "detail/ivf/filter.h"
 #include "detail/ivf/index.h"
+#include "detail/ivf/partition_stats.h"
+
+/**
+ * Algorithm used for the kmeans iterations.  Both produce the same clustering
+ * (up to ties), but `hamerly` maintains per-vector distance bounds so that
+ * most distance computations can be skipped once the centroids settle down.
+ * `balanced` caps the size of every partition (see `train_balanced_no_init`).
+ */
+enum class kmeans_algorithm { lloyd, hamerly, balanced };
+
+/**
+ * How to choose the initial centroids.  `none` uses the current centroids,
+ * e.g., ones that have been supplied by the user.
+ */
+enum class kmeans_init { none, random, kmeanspp, kmeans_parallel };
 
 template <class T, class shuffled_ids_type, class indices_type>
 class kmeans_index {
@@ -76,7 +110,218 @@ class kmeans_index {
   std::vector<shuffled_ids_type> shuffled_ids_;
   ColMajorMatrix<T> shuffled_db_;
 
+  // Position of each id in the main arrays, rebuilt whenever they change,
+  // so that updates only tombstone ids that are in the main arrays and
+  // `rerank` fetches current positions
+  detail::ivf::id_position_map<shuffled_ids_type> id_positions_;
+
+  // Vectors added or removed since the last add() or compact()
+  detail::ivf::ivf_delta<T, shuffled_ids_type> delta_;
+
+  // Number of vectors absorbed by each centroid during mini-batch training
+  std::vector<size_t> mini_batch_counts_;
+
+  // Bounds on partition sizes for balanced training, as multiples of the mean
+  // partition size
+  double max_partition_factor_{1.5};
+  double min_partition_factor_{0.25};
+
+  // Whether the centroids come from balanced training, in which case add()
+  // caps the size of the stored partitions as well
+  bool balanced_{false};
+
+  // Coarse quantizer over `centroids_`, from hierarchical training or
+  // `build_coarse_quantizer()`.  It is used to select the partitions to
+  // search when `nlist_` is at least `coarse_min_nlist_`.
+  detail::ivf::coarse_quantizer<T, indices_type> coarse_;
+  size_t coarse_min_nlist_{16384};
+
+  // Binary codes of `shuffled_db_`.  When `binary_survivors_` is nonzero,
+  // search() scores only that many vectors of each partition it probes,
+  // chosen by Hamming distance (see `set_binary_prefilter()`).
+  detail::ivf::binary_codes binary_;
+  size_t binary_survivors_{0};
+
+  // Radius, size and range of norms of each partition, used by search()
+  // and search_adaptive() to skip partitions that cannot hold a neighbor
+  detail::ivf::partition_stats stats_;
+
+  // Held by the operations that read or replace the main arrays and the
+  // delta store, so that compact_async() can swap in the compacted arrays
+  // from its own thread.  Recursive since search_adaptive() may fall back
+  // to search().
+  std::recursive_mutex mutex_;
+
+  // Updates made while compact_async() is running.  They are in `delta_` as
+  // well, but are also recorded here to become the delta store once the
+  // compacted arrays are swapped in.
+  std::optional<detail::ivf::ivf_delta<T, shuffled_ids_type>> pending_;
+
+  void check_not_compacting() const {
+    if (pending_) {
+      throw std::runtime_error("A compaction is in progress");
+    }
+  }
+
+  /**
+   * @brief Copy columns `order[start, stop)` of `training_set` into a new
+   * matrix with element type `T`.
+   */
+  template <class Array>
+  auto gather_columns(
+      const Array& training_set,
+      const std::vector<size_t>& order,
+      size_t start,
+      size_t stop) {
+    auto batch = ColMajorMatrix<T>(dimension_, stop - start);
+    for (size_t i = start; i < stop; ++i) {
+      auto from = training_set[order[i]];
+      std::transform(
+          begin(from), end(from), begin(batch[i - start]), [](auto&& x) {
+            return static_cast<T>(x);
+          });
+    }
+    return batch;
+  }
+
+  /**
+   * @brief Choose the centroids from `points` with kmeans++, where point `i`
+   * counts as `weights[i]` vectors.
+   */
+  void weighted_kmeans_pp(
+      const ColMajorMatrix<T>& points, const std::vector<double>& weights) {
+    auto num_points = points.num_cols();
+
+    std::discrete_distribution<size_t> first(begin(weights), end(weights));
+    auto choice = first(gen);
+    std::copy(
+        begin(points[choice]), end(points[choice]), begin(centroids_[0]));
+
+    std::vector<double> distances(
+        num_points, std::numeric_limits<double>::max());
+    std::vector<double> probabilities(num_points);
+
+    for (size_t i = 1; i < nlist_; ++i) {
+      stdx::execution::indexed_parallel_policy par{nthreads_};
+      stdx::range_for_each(
+          std::move(par),
+          points,
+          [this, &distances, &probabilities, &weights, i](
+              auto&& vec, size_t n, size_t j) {
+            double distance = sum_of_squares(vec, centroids_[i - 1]);
+            distances[j] = std::min(distances[j], distance);
+            probabilities[j] = weights[j] * distances[j];
+          });
+
+      std::discrete_distribution<size_t> next(
+          begin(probabilities), end(probabilities));
+      auto next_index = next(gen);
+      std::copy(
+          begin(points[next_index]),
+          end(points[next_index]),
+          begin(centroids_[i]));
+    }
+  }
+
+  /**
+   * @brief Group vector indices by partition.  The indices of the vectors in
+   * partition `j` are `members[offsets[j], offsets[j+1])`.
+   */
+  auto bucket_by_partition(const std::vector<size_t>& parts) {
+    std::vector<size_t> offsets(nlist_ + 1, 0);
+    for (auto&& p : parts) {
+      ++offsets[p + 1];
+    }
+    std::inclusive_scan(begin(offsets), end(offsets), begin(offsets));
+    std::vector<size_t> members(size(parts));
+    auto fill = offsets;
+    for (size_t i = 0; i < size(parts); ++i) {
+      members[fill[parts[i]]++] = i;
+    }
+    return std::make_tuple(std::move(offsets), std::move(members));
+  }
+
+  /**
+   * @brief Set each centroid to the mean of the vectors assigned to it.  The
+   * vectors are bucketed by partition so that the centroids can be computed
+   * in parallel.  Centroids with no vectors are copied from `centroids_`.
+   */
+  void update_centroids(
+      const ColMajorMatrix<T>& training_set,
+      const std::vector<size_t>& parts,
+      ColMajorMatrix<T>& new_centroids) {
+    std::vector<size_t> offsets, members;
+    std::tie(offsets, members) = bucket_by_partition(parts);
+
+    stdx::execution::indexed_parallel_policy par{nthreads_};
+    stdx::range_for_each(
+        std::move(par),
+        new_centroids,
+        [this, &training_set, &offsets, &members](
+            auto&& centroid, size_t n, size_t j) {
+          auto degree = offsets[j + 1] - offsets[j];
+          if (degree == 0) {
+            std::copy(
+                begin(centroids_[j]), end(centroids_[j]), begin(centroid));
+            return;
+          }
+          std::vector<double> sum(dimension_, 0.0);
+          for (size_t m = offsets[j]; m < offsets[j + 1]; ++m) {
+            auto vector = training_set[members[m]];
+            for (size_t k = 0; k < dimension_; ++k) {
+              sum[k] += vector[k];
+            }
+          }
+          for (size_t k = 0; k < dimension_; ++k) {
+            centroid[k] = sum[k] / degree;
+          }
+        });
+  }
+
+  void update_id_positions() {
+    id_positions_ =
+        detail::ivf::id_position_map<shuffled_ids_type>(shuffled_ids_);
+  }
+
+  /**
+   * @brief Whether a vector with id `id` is in the main arrays.
+   */
+  bool in_main(shuffled_ids_type id) const {
+    return id_positions_.find(id) != id_positions_.npos;
+  }
+
  public:
+  /**
+   * @brief Names of the arrays in an index group, by storage version.  These
+   * must match `storage_formats` in the Python API.
+   */
+  static auto array_names(const std::string& storage_version) {
+    struct names {
+      std::string centroids;
+      std::string index;
+      std::string ids;
+      std::string parts;
+      std::string coarse_centroids{"coarse_centroids"};
+      std::string coarse_offsets{"coarse_offsets"};
+      std::string coarse_members{"coarse_members"};
+      std::string binary_codes{"binary_codes"};
+      std::string binary_center{"binary_center"};
+      std::string partition_stats{"partition_stats"};
+      std::string tombstones{"tombstones"};
+      std::string id_positions{"id_positions"};
+    };
+    if (storage_version == "0.1") {
+      return names{"centroids.tdb", "index.tdb", "ids.tdb", "parts.tdb"};
+    } else if (storage_version == "0.2") {
+      return names{
+          "partition_centroids",
+          "partition_indexes",
+          "shuffled_vector_ids",
+          "shuffled_vectors"};
+    }
+    throw std::runtime_error("Unsupported storage version " + storage_version);
+  }
+
   kmeans_index(
       size_t dimension,
       size_t nlist,
@@ -88,7 +333,8 @@ class kmeans_index {
       , max_iter_(max_iter)
       , tol_(tol)
       , nthreads_(nthreads)
-      , centroids_(dimension, nlist) {
+      , centroids_(dimension, nlist)
+      , delta_(dimension, nlist) {
   }
 
   /**
@@ -211,6 +457,126 @@ class kmeans_index {
     }
   }
 
+  /**
+   * @brief Use the scalable kmeans++ ("kmeans||") algorithm of Bahmani et al.
+   * to choose initial centroids.  Rather than choosing `nlist_` centroids one
+   * at a time, each with a full pass over the training set, a small number of
+   * rounds is made, each of which samples (in parallel) about `oversampling *
+   * nlist_` candidates with probability proportional to their squared distance
+   * from the candidates chosen so far.  Each candidate is then weighted by the
+   * number of training vectors closest to it and the centroids are chosen from
+   * the candidates with weighted kmeans++.  A training set with fewer than
+   * `nlist_` vectors has too few candidates, so plain kmeans++ is used.
+   *
+   * @param training_set Vectors to choose the centroids from.
+   * @param num_rounds Number of sampling rounds.
+   * @param oversampling Expected number of candidates sampled per round, as a
+   * multiple of `nlist_`.
+   */
+  void kmeans_parallel_init(
+      const ColMajorMatrix<T>& training_set,
+      size_t num_rounds = 5,
+      double oversampling = 2.0) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_vectors = training_set.num_cols();
+    if (num_vectors < nlist_) {
+      kmeans_pp(training_set);
+      return;
+    }
+
+    // Indices of the candidates in the training set
+    std::vector<size_t> candidates;
+    std::uniform_int_distribution<size_t> dis(0, num_vectors - 1);
+    candidates.push_back(dis(gen));
+
+    // Squared distance from each vector to (and index of) its closest candidate
+    std::vector<double> distances(
+        num_vectors, std::numeric_limits<double>::max());
+    std::vector<size_t> nearest(num_vectors, 0);
+
+    std::vector<std::mt19937> gens;
+    for (size_t n = 0; n < nthreads_; ++n) {
+      gens.emplace_back(gen());
+    }
+
+    size_t num_new = 1;
+    for (size_t round = 0;; ++round) {
+      auto first_new = size(candidates) - num_new;
+      std::vector<double> cost(nthreads_, 0.0);
+      {
+        stdx::execution::indexed_parallel_policy par{nthreads_};
+        stdx::range_for_each(
+            std::move(par),
+            training_set,
+            [&](auto&& vec, size_t n, size_t i) {
+              for (size_t c = first_new; c < size(candidates); ++c) {
+                double distance =
+                    sum_of_squares(vec, training_set[candidates[c]]);
+                if (distance < distances[i]) {
+                  distances[i] = distance;
+                  nearest[i] = c;
+                }
+              }
+              cost[n] += distances[i];
+            });
+      }
+      double total = std::accumulate(begin(cost), end(cost), 0.0);
+      if (round == num_rounds || total == 0.0) {
+        break;
+      }
+
+      double ell = oversampling * nlist_;
+      std::vector<std::vector<size_t>> sampled(nthreads_);
+      {
+        stdx::execution::indexed_parallel_policy par{nthreads_};
+        stdx::range_for_each(
+            std::move(par),
+            training_set,
+            [&](auto&& vec, size_t n, size_t i) {
+              std::uniform_real_distribution<double> uniform(0.0, 1.0);
+              if (uniform(gens[n]) < ell * distances[i] / total) {
+                sampled[n].push_back(i);
+              }
+            });
+      }
+      num_new = 0;
+      for (auto&& s : sampled) {
+        candidates.insert(end(candidates), begin(s), end(s));
+        num_new += size(s);
+      }
+      if (num_new == 0) {
+        break;
+      }
+    }
+
+    std::vector<double> weights(size(candidates), 0.0);
+    for (size_t i = 0; i < num_vectors; ++i) {
+      weights[nearest[i]] += 1.0;
+    }
+
+    // Not enough distinct candidates (e.g., many duplicate vectors) -- pad
+    // with vectors chosen uniformly at random
+    if (size(candidates) < nlist_) {
+      std::vector<bool> chosen(num_vectors, false);
+      for (auto&& c : candidates) {
+        chosen[c] = true;
+      }
+      while (size(candidates) < nlist_) {
+        auto i = dis(gen);
+        if (!chosen[i]) {
+          chosen[i] = true;
+          candidates.push_back(i);
+          weights.push_back(1.0);
+        }
+      }
+    }
+
+    auto candidate_vectors = gather_columns(
+        training_set, candidates, 0, size(candidates));
+    weighted_kmeans_pp(candidate_vectors, weights);
+  }
+
   /**
    * @brief Use kmeans algorithm to cluster vectors into centroids.
    */
@@ -223,26 +589,13 @@ class kmeans_index {
       auto parts =
           detail::flat::qv_partition(centroids_, training_set, nthreads_);
 
-      // for (auto & p : parts) {
-      //   std::cout << p << " ";
-      // }
-      // std::cout << std::endl;
+      // Centroids with no vectors keep their place, as in Hamerly training
+      auto new_centroids = ColMajorMatrix<T>(dimension_, nlist_);
+      update_centroids(training_set, parts, new_centroids);
+      centroids_ = std::move(new_centroids);
 
-      for (size_t j = 0; j < nlist_; ++j) {
-        std::fill(begin(centroids_[j]), end(centroids_[j]), 0.0);
-      }
       std::fill(begin(degrees), end(degrees), 0);
-
-      stdx::execution::indexed_parallel_policy par{nthreads_};
-
-      // @todo parallelize -- use a temp centroid matrix for each thread
-      for (size_t i = 0; i < training_set.num_cols(); ++i) {
-        auto part = parts[i];
-        auto centroid = centroids_[part];
-        auto vector = training_set[i];
-        for (size_t j = 0; j < dimension_; ++j) {
-          centroid[j] += vector[j];
-        }
+      for (auto&& part : parts) {
         ++degrees[part];
       }
 
@@ -253,18 +606,10 @@ class kmeans_index {
       auto min = *mm.first;
       auto max = *mm.second;
       auto diff = max - min;
-      std::cout << "avg: " << average << " sum: " << sum << " min: " << min
-                << " max: " << max << " diff: " << diff << std::endl;
-
-      // @todo parallelize
-
-      for (size_t j = 0; j < nlist_; ++j) {
-        auto centroid = centroids_[j];
-        for (size_t k = 0; k < dimension_; ++k) {
-          if (degrees[j] != 0) {
-            centroid[k] /= degrees[j];
-          }
-        }
+      if (global_debug) {
+        std::cerr << "# Partition sizes avg: " << average << " sum: " << sum
+                  << " min: " << min << " max: " << max << " diff: " << diff
+                  << std::endl;
       }
     }
 
@@ -292,15 +637,835 @@ class kmeans_index {
 #endif
   }
 
-  void train(const ColMajorMatrix<T>& training_set) {
-    kmeans_pp(training_set);
-    train_no_init(training_set);
+  /**
+   * @brief Use Hamerly's algorithm ("Making k-means even faster") to cluster
+   * vectors into centroids.  Each vector keeps an upper bound on the distance
+   * to its assigned centroid and a lower bound on the distance to every other
+   * centroid.  Together with half the distance from each centroid to its
+   * nearest neighboring centroid, these bounds let us skip the distance
+   * computations for any vector that provably cannot change partitions.
+   *
+   * Performs the same sequence of assignment and update steps as
+   * `train_no_init`, but stops early if no vector changes partitions.
+   * Unlike `train_no_init`, a centroid with no vectors keeps its previous
+   * value.
+   *
+   * @return The number of vector-centroid distances that were computed.
+   */
+  size_t train_hamerly_no_init(const ColMajorMatrix<T>& training_set) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_vectors = training_set.num_cols();
+
+    std::vector<size_t> parts(num_vectors);
+    std::vector<double> upper(num_vectors);
+    std::vector<double> lower(num_vectors);
+    std::vector<double> half_separation(nlist_);
+    std::vector<double> moved(nlist_);
+
+    auto distance = [](auto&& a, auto&& b) {
+      return std::sqrt(static_cast<double>(sum_of_squares(a, b)));
+    };
+
+    // Exact assignment, also recording the distance to the second closest
+    // centroid as the lower bound
+    auto assign = [this, &parts, &upper, &lower, &distance](
+                      auto&& vec, size_t i) {
+      double first = std::numeric_limits<double>::max();
+      double second = std::numeric_limits<double>::max();
+      size_t part = 0;
+      for (size_t j = 0; j < nlist_; ++j) {
+        auto score = distance(vec, centroids_[j]);
+        if (score < first) {
+          second = first;
+          first = score;
+          part = j;
+        } else if (score < second) {
+          second = score;
+        }
+      }
+      parts[i] = part;
+      upper[i] = first;
+      lower[i] = second;
+    };
+
+    std::vector<size_t> num_distances(nthreads_, 0);
+    std::vector<size_t> num_changed(nthreads_, 0);
+    {
+      stdx::execution::indexed_parallel_policy par{nthreads_};
+      stdx::range_for_each(
+          std::move(par),
+          training_set,
+          [&assign](auto&& vec, size_t n, size_t i) { assign(vec, i); });
+    }
+    num_distances[0] += num_vectors * nlist_;
+
+    for (size_t iter = 0; iter < max_iter_; ++iter) {
+      auto new_centroids = ColMajorMatrix<T>(dimension_, nlist_);
+      update_centroids(training_set, parts, new_centroids);
+      for (size_t j = 0; j < nlist_; ++j) {
+        moved[j] = distance(centroids_[j], new_centroids[j]);
+      }
+      centroids_ = std::move(new_centroids);
+
+      if (iter + 1 == max_iter_) {
+        break;
+      }
+
+      // Largest and second largest centroid movement
+      size_t max_moved = std::distance(
+          begin(moved), std::max_element(begin(moved), end(moved)));
+      double second_moved = 0.0;
+      for (size_t j = 0; j < nlist_; ++j) {
+        if (j != max_moved) {
+          second_moved = std::max(second_moved, moved[j]);
+        }
+      }
+
+      // O(nlist^2) distances, so computed in parallel lest they dominate the
+      // (mostly skipped) assignment step
+      {
+        stdx::execution::indexed_parallel_policy par{nthreads_};
+        stdx::range_for_each(
+            std::move(par),
+            centroids_,
+            [&](auto&& centroid, size_t n, size_t j) {
+              double min_separation = std::numeric_limits<double>::max();
+              for (size_t k = 0; k < nlist_; ++k) {
+                if (k != j) {
+                  min_separation = std::min(
+                      min_separation, distance(centroid, centroids_[k]));
+                }
+              }
+              half_separation[j] = min_separation / 2.0;
+            });
+      }
+
+      std::fill(begin(num_changed), end(num_changed), 0);
+      stdx::execution::indexed_parallel_policy par{nthreads_};
+      stdx::range_for_each(
+          std::move(par),
+          training_set,
+          [&](auto&& vec, size_t n, size_t i) {
+            auto part = parts[i];
+            upper[i] += moved[part];
+            lower[i] -= (part == max_moved) ? second_moved : moved[max_moved];
+
+            auto bound = std::max(half_separation[part], lower[i]);
+            if (upper[i] <= bound) {
+              return;
+            }
+            upper[i] = distance(vec, centroids_[part]);
+            ++num_distances[n];
+            if (upper[i] <= bound) {
+              return;
+            }
+            assign(vec, i);
+            num_distances[n] += nlist_;
+            if (parts[i] != part) {
+              ++num_changed[n];
+            }
+          });
+
+      if (std::accumulate(begin(num_changed), end(num_changed), 0UL) == 0) {
+        break;
+      }
+    }
+
+    return std::accumulate(begin(num_distances), end(num_distances), 0UL);
+  }
+
+  /**
+   * @brief Set the bounds on partition sizes used by balanced training, as
+   * multiples of the mean partition size (number of vectors / nlist).
+   */
+  void set_partition_size_limits(double max_factor, double min_factor) {
+    if (max_factor < 1.0 || min_factor < 0.0 || min_factor > 1.0) {
+      throw std::runtime_error("Invalid partition size limits");
+    }
+    max_partition_factor_ = max_factor;
+    min_partition_factor_ = min_factor;
+  }
+
+  /**
+   * @brief Largest partition allowed by balanced training when `num_vectors`
+   * vectors are divided among the partitions.
+   */
+  size_t partition_capacity(size_t num_vectors) const {
+    return static_cast<size_t>(std::ceil(
+        max_partition_factor_ * static_cast<double>(num_vectors) / nlist_));
+  }
+
+  /**
+   * @brief Assign each vector to a partition the way the centroids were
+   * trained: with `balanced_partition` (capped at `partition_capacity`) if
+   * they come from balanced training, otherwise to the closest centroid.
+   *
+   * @return The partition number of each vector.
+   */
+  template <class V>
+  std::vector<size_t> partition(const V& vectors) {
+    if (balanced_) {
+      return balanced_partition(
+          vectors, partition_capacity(vectors.num_cols()));
+    }
+    return detail::flat::qv_partition(centroids_, vectors, nthreads_);
+  }
+
+  /**
+   * @brief Whether `partition()` caps the partition sizes.  This is set by
+   * `train()` and `train_hierarchical()` according to the algorithm used.
+   */
+  bool balanced() const {
+    return balanced_;
+  }
+
+  void set_balanced(bool balanced) {
+    balanced_ = balanced;
+  }
+
+  /**
+   * @brief Assign each vector to a centroid such that no partition holds more
+   * than `capacity` vectors.  Vectors are first assigned to their closest
+   * centroid.  Each overfull partition keeps the `capacity` vectors closest
+   * to its centroid and the rest overflow to the closest centroid that still
+   * has room.
+   *
+   * @return The partition number of each vector.
+   */
+  template <class V>
+  std::vector<size_t> balanced_partition(const V& vectors, size_t capacity) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_vectors = vectors.num_cols();
+    if (capacity * nlist_ < num_vectors) {
+      throw std::runtime_error(
+          "Partition capacity is too small for the number of vectors");
+    }
+
+    auto parts = detail::flat::qv_partition(centroids_, vectors, nthreads_);
+
+    std::vector<double> distances(num_vectors);
+    {
+      stdx::execution::indexed_parallel_policy par{nthreads_};
+      stdx::range_for_each(
+          std::move(par), vectors, [&](auto&& vec, size_t n, size_t i) {
+            distances[i] = sum_of_squares(vec, centroids_[parts[i]]);
+          });
+    }
+
+    std::vector<size_t> offsets, members;
+    std::tie(offsets, members) = bucket_by_partition(parts);
+
+    std::vector<size_t> sizes(nlist_);
+    std::vector<size_t> overflow;
+    for (size_t j = 0; j < nlist_; ++j) {
+      auto first = begin(members) + offsets[j];
+      auto last = begin(members) + offsets[j + 1];
+      sizes[j] = last - first;
+      if (sizes[j] > capacity) {
+        std::nth_element(
+            first, first + capacity, last, [&](size_t a, size_t b) {
+              return distances[a] < distances[b];
+            });
+        overflow.insert(end(overflow), first + capacity, last);
+        sizes[j] = capacity;
+      }
+    }
+    if (empty(overflow)) {
+      return parts;
+    }
+
+    // Closest few centroids for each overflow vector, in order of distance
+    size_t num_candidates = std::min<size_t>(nlist_, 16);
+    std::vector<std::vector<size_t>> candidates(size(overflow));
+    {
+      stdx::execution::indexed_parallel_policy par{nthreads_};
+      stdx::range_for_each(
+          std::move(par), overflow, [&](auto&& i, size_t n, size_t o) {
+            std::vector<std::pair<double, size_t>> scores(nlist_);
+            for (size_t j = 0; j < nlist_; ++j) {
+              scores[j] = {sum_of_squares(vectors[i], centroids_[j]), j};
+            }
+            std::partial_sort(
+                begin(scores), begin(scores) + num_candidates, end(scores));
+            candidates[o].resize(num_candidates);
+            for (size_t c = 0; c < num_candidates; ++c) {
+              candidates[o][c] = scores[c].second;
+            }
+          });
+    }
+
+    for (size_t o = 0; o < size(overflow); ++o) {
+      auto i = overflow[o];
+      auto found = std::find_if(
+          begin(candidates[o]), end(candidates[o]), [&](size_t j) {
+            return sizes[j] < capacity;
+          });
+      size_t part;
+      if (found != end(candidates[o])) {
+        part = *found;
+      } else {
+        // All of the closest centroids are full -- search all of them
+        double min_score = std::numeric_limits<double>::max();
+        part = nlist_;
+        for (size_t j = 0; j < nlist_; ++j) {
+          if (sizes[j] < capacity) {
+            double score = sum_of_squares(vectors[i], centroids_[j]);
+            if (score < min_score) {
+              min_score = score;
+              part = j;
+            }
+          }
+        }
+      }
+      parts[i] = part;
+      ++sizes[part];
+    }
+
+    return parts;
+  }
+
+  /**
+   * @brief Eliminate partitions with fewer than `min_size` vectors by moving
+   * their centroids into the largest partitions.  The vectors of a small
+   * partition are merged into their next closest partitions and the largest
+   * partition is split in two with a few iterations of 2-means, with one of
+   * the halves taking over the small partition's centroid.
+   *
+   * @return The number of partitions that were split.
+   */
+  size_t split_and_merge(
+      const ColMajorMatrix<T>& training_set,
+      std::vector<size_t>& parts,
+      size_t min_size) {
+    std::vector<size_t> sizes(nlist_, 0);
+    for (auto&& p : parts) {
+      ++sizes[p];
+    }
+
+    size_t num_splits = 0;
+    for (; num_splits < nlist_; ++num_splits) {
+      auto small = std::distance(
+          begin(sizes), std::min_element(begin(sizes), end(sizes)));
+      auto large = std::distance(
+          begin(sizes), std::max_element(begin(sizes), end(sizes)));
+      if (sizes[small] >= min_size || sizes[large] < 2 * min_size + 2) {
+        break;
+      }
+
+      std::vector<size_t> small_members;
+      std::vector<size_t> large_members;
+      for (size_t i = 0; i < size(parts); ++i) {
+        if (parts[i] == small) {
+          small_members.push_back(i);
+        } else if (parts[i] == large) {
+          large_members.push_back(i);
+        }
+      }
+
+      // Split the large partition, seeding 2-means with its centroid and its
+      // farthest member
+      std::vector<double> a(begin(centroids_[large]), end(centroids_[large]));
+      auto farthest = *std::max_element(
+          begin(large_members), end(large_members), [&](size_t x, size_t y) {
+            return sum_of_squares(training_set[x], centroids_[large]) <
+                   sum_of_squares(training_set[y], centroids_[large]);
+          });
+      std::vector<double> b(
+          begin(training_set[farthest]), end(training_set[farthest]));
+      std::vector<bool> to_b(size(large_members));
+      for (size_t iter = 0; iter < 5; ++iter) {
+        std::vector<double> sum_a(dimension_, 0.0), sum_b(dimension_, 0.0);
+        size_t count_a = 0, count_b = 0;
+        for (size_t m = 0; m < size(large_members); ++m) {
+          auto vec = training_set[large_members[m]];
+          double da = 0.0, db = 0.0;
+          for (size_t k = 0; k < dimension_; ++k) {
+            da += (vec[k] - a[k]) * (vec[k] - a[k]);
+            db += (vec[k] - b[k]) * (vec[k] - b[k]);
+          }
+          to_b[m] = db < da;
+          auto& sum = to_b[m] ? sum_b : sum_a;
+          for (size_t k = 0; k < dimension_; ++k) {
+            sum[k] += vec[k];
+          }
+          ++(to_b[m] ? count_b : count_a);
+        }
+        if (count_a == 0 || count_b == 0) {
+          break;
+        }
+        for (size_t k = 0; k < dimension_; ++k) {
+          a[k] = sum_a[k] / count_a;
+          b[k] = sum_b[k] / count_b;
+        }
+      }
+      std::copy(begin(a), end(a), begin(centroids_[large]));
+      std::copy(begin(b), end(b), begin(centroids_[small]));
+
+      // Merge the small partition into the closest of the remaining
+      // centroids (which now include both halves of the large partition)
+      for (auto&& i : small_members) {
+        double min_score = std::numeric_limits<double>::max();
+        size_t part = large;
+        for (size_t j = 0; j < nlist_; ++j) {
+          if (j == static_cast<size_t>(small)) {
+            continue;
+          }
+          double score = sum_of_squares(training_set[i], centroids_[j]);
+          if (score < min_score) {
+            min_score = score;
+            part = j;
+          }
+        }
+        --sizes[small];
+        ++sizes[part];
+        parts[i] = part;
+      }
+      for (size_t m = 0; m < size(large_members); ++m) {
+        if (to_b[m]) {
+          parts[large_members[m]] = small;
+          --sizes[large];
+          ++sizes[small];
+        }
+      }
+    }
+    return num_splits;
+  }
+
+  /**
+   * @brief Kmeans with bounded partition sizes.  Each iteration assigns the
+   * vectors with `balanced_partition`, so that no partition holds more than
+   * `max_partition_factor_` times the mean partition size, and then moves
+   * every centroid to the mean of its partition.  Once the iterations are
+   * done, partitions smaller than `min_partition_factor_` times the mean are
+   * merged away and the largest partitions split to replace them, followed
+   * by a final capped assignment and update.
+   *
+   * @return The partition number of each training vector under the final
+   * centroids (respecting the size cap).
+   */
+  std::vector<size_t> train_balanced_no_init(
+      const ColMajorMatrix<T>& training_set) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_vectors = training_set.num_cols();
+    double mean = static_cast<double>(num_vectors) / nlist_;
+    auto capacity = partition_capacity(num_vectors);
+    auto min_size = static_cast<size_t>(min_partition_factor_ * mean);
+
+    auto new_centroids = ColMajorMatrix<T>(dimension_, nlist_);
+    auto parts = balanced_partition(training_set, capacity);
+    for (size_t iter = 0; iter < max_iter_; ++iter) {
+      update_centroids(training_set, parts, new_centroids);
+      std::swap(centroids_, new_centroids);
+      auto new_parts = balanced_partition(training_set, capacity);
+      if (new_parts == parts) {
+        break;
+      }
+      parts = std::move(new_parts);
+    }
+
+    if (split_and_merge(training_set, parts, min_size) > 0) {
+      update_centroids(training_set, parts, new_centroids);
+      std::swap(centroids_, new_centroids);
+      parts = balanced_partition(training_set, capacity);
+    }
+    return parts;
+  }
+
+  /**
+   * @brief Split `nlist_` centroids among coarse partitions of the given
+   * sizes, in proportion to their sizes (largest remainder method).  Every
+   * non-empty partition gets at least one centroid and no partition gets more
+   * centroids than it has vectors.
+   */
+  std::vector<size_t> allocate_fine_centroids(
+      const std::vector<size_t>& sizes) {
+    double total = std::accumulate(begin(sizes), end(sizes), 0.0);
+    std::vector<size_t> counts(size(sizes), 0);
+    std::vector<double> remainders(size(sizes), 0.0);
+    for (size_t c = 0; c < size(sizes); ++c) {
+      double quota = nlist_ * sizes[c] / total;
+      counts[c] = std::min<size_t>(sizes[c], std::max<size_t>(1, quota));
+      if (sizes[c] == 0) {
+        counts[c] = 0;
+      }
+      remainders[c] = quota - counts[c];
+    }
+    auto allocated = std::accumulate(begin(counts), end(counts), 0UL);
+    while (allocated < nlist_) {
+      size_t best = size(sizes);
+      for (size_t c = 0; c < size(sizes); ++c) {
+        if (counts[c] < sizes[c] &&
+            (best == size(sizes) || remainders[c] > remainders[best])) {
+          best = c;
+        }
+      }
+      ++counts[best];
+      remainders[best] -= 1.0;
+      ++allocated;
+    }
+    while (allocated > nlist_) {
+      size_t best = size(sizes);
+      for (size_t c = 0; c < size(sizes); ++c) {
+        if (counts[c] > 1 &&
+            (best == size(sizes) || remainders[c] < remainders[best])) {
+          best = c;
+        }
+      }
+      --counts[best];
+      remainders[best] += 1.0;
+      --allocated;
+    }
+    return counts;
+  }
+
+  /**
+   * @brief Two-level kmeans for large `nlist_`.  The training set is first
+   * clustered into `num_coarse` coarse partitions, and then each coarse
+   * partition is clustered independently (and in parallel) into a share of
+   * the `nlist_` fine centroids proportional to its size.  Each level costs
+   * O(N * sqrt(nlist)) distance computations per iteration when `num_coarse`
+   * is about sqrt(nlist), rather than O(N * nlist) for flat kmeans.
+   *
+   * The fine centroids are stored in `centroids_`, as with the flat trainers,
+   * grouped by coarse partition.  The coarse centroids and the map from coarse
+   * to fine centroids are available from `get_coarse_centroids()` and
+   * `get_coarse_offsets()`.
+   *
+   * @param training_set Vectors to cluster.
+   * @param num_coarse Number of coarse partitions (0 means sqrt(nlist)).
+   * @param algorithm Kmeans algorithm to use at both levels.
+   */
+  void train_hierarchical(
+      const ColMajorMatrix<T>& training_set,
+      size_t num_coarse = 0,
+      kmeans_algorithm algorithm = kmeans_algorithm::hamerly) {
+    scoped_timer _{__FUNCTION__};
+
+    if (num_coarse == 0) {
+      num_coarse = std::max<size_t>(1, std::sqrt(nlist_));
+    }
+    num_coarse = std::min(num_coarse, nlist_);
+    if (training_set.num_cols() < nlist_) {
+      throw std::runtime_error(
+          "Training set must contain at least nlist vectors");
+    }
+
+    auto coarse = kmeans_index<T, shuffled_ids_type, indices_type>(
+        dimension_, num_coarse, max_iter_, tol_, nthreads_);
+    coarse.set_partition_size_limits(
+        max_partition_factor_, min_partition_factor_);
+    coarse.train(training_set, algorithm);
+
+    auto parts = detail::flat::qv_partition(
+        coarse.get_centroids(), training_set, nthreads_);
+    std::vector<size_t> offsets, members;
+    std::tie(offsets, members) = coarse.bucket_by_partition(parts);
+
+    std::vector<size_t> sizes(num_coarse);
+    for (size_t c = 0; c < num_coarse; ++c) {
+      sizes[c] = offsets[c + 1] - offsets[c];
+    }
+    auto counts = allocate_fine_centroids(sizes);
+
+    std::vector<indices_type> coarse_offsets(num_coarse + 1);
+    coarse_offsets[0] = 0;
+    for (size_t c = 0; c < num_coarse; ++c) {
+      coarse_offsets[c + 1] = coarse_offsets[c] + counts[c];
+    }
+
+    // Coarse partitions are trained concurrently, dividing the threads
+    // among them
+    size_t fine_threads = std::max<size_t>(1, nthreads_ / num_coarse);
+    size_t outer_threads = std::min(nthreads_, num_coarse);
+    stdx::execution::indexed_parallel_policy par{outer_threads};
+    stdx::range_for_each(
+        std::move(par), counts, [&](auto&& count, size_t n, size_t c) {
+          if (count == 0) {
+            return;
+          }
+          auto subset = gather_columns(
+              training_set, members, offsets[c], offsets[c + 1]);
+          auto fine = kmeans_index<T, shuffled_ids_type, indices_type>(
+              dimension_, count, max_iter_, tol_, fine_threads);
+          fine.set_partition_size_limits(
+              max_partition_factor_, min_partition_factor_);
+          fine.train(subset, algorithm);
+          for (size_t j = 0; j < count; ++j) {
+            std::copy(
+                begin(fine.get_centroids()[j]),
+                end(fine.get_centroids()[j]),
+                begin(centroids_[coarse_offsets[c] + j]));
+          }
+        });
+
+    // The fine centroids are already grouped by coarse partition
+    std::vector<indices_type> coarse_members(nlist_);
+    std::iota(begin(coarse_members), end(coarse_members), 0);
+    coarse_ = detail::ivf::coarse_quantizer<T, indices_type>(
+        std::move(coarse.get_centroids()),
+        std::move(coarse_offsets),
+        std::move(coarse_members));
+    balanced_ = algorithm == kmeans_algorithm::balanced;
+  }
+
+  /**
+   * @brief Build the coarse quantizer used to select partitions for large
+   * `nlist_`, by clustering the current centroids into `num_coarse` coarse
+   * partitions.  This is done by `add()` (and `load()`) when `nlist_` is at
+   * least the threshold given to `set_coarse_quantizer()`, unless
+   * `train_hierarchical` has already provided one.
+   *
+   * @param num_coarse Number of coarse partitions (0 means sqrt(nlist)).
+   */
+  void build_coarse_quantizer(size_t num_coarse = 0) {
+    scoped_timer _{__FUNCTION__};
+
+    if (num_coarse == 0) {
+      num_coarse = std::max<size_t>(1, std::sqrt(nlist_));
+    }
+    num_coarse = std::min(num_coarse, nlist_);
+
+    auto coarse = kmeans_index<T, shuffled_ids_type, indices_type>(
+        dimension_, num_coarse, max_iter_, tol_, nthreads_);
+    coarse.train(centroids_, kmeans_algorithm::hamerly);
+    auto labels = detail::flat::qv_partition(
+        coarse.get_centroids(), centroids_, nthreads_);
+
+    auto nprobe = coarse_.nprobe();
+    coarse_ = detail::ivf::coarse_quantizer<T, indices_type>::from_labels(
+        std::move(coarse.get_centroids()), labels);
+    coarse_.set_nprobe(nprobe);
+  }
+
+  /**
+   * @brief Set when the coarse quantizer is used to select partitions.
+   *
+   * @param min_nlist The coarse quantizer is built and used for indexes with
+   * at least this many partitions.
+   * @param nprobe Minimum number of coarse partitions searched per query.
+   */
+  void set_coarse_quantizer(size_t min_nlist, size_t nprobe) {
+    coarse_min_nlist_ = min_nlist;
+    coarse_.set_nprobe(nprobe);
+  }
+
+  void train(
+      const ColMajorMatrix<T>& training_set,
+      kmeans_algorithm algorithm = kmeans_algorithm::lloyd,
+      kmeans_init init = kmeans_init::kmeans_parallel) {
+    switch (init) {
+      case kmeans_init::none:
+        break;
+      case kmeans_init::random:
+        kmeans_random_init(training_set);
+        break;
+      case kmeans_init::kmeanspp:
+        kmeans_pp(training_set);
+        break;
+      case kmeans_init::kmeans_parallel:
+        kmeans_parallel_init(training_set);
+        break;
+    }
+    switch (algorithm) {
+      case kmeans_algorithm::lloyd:
+        train_no_init(training_set);
+        break;
+      case kmeans_algorithm::hamerly:
+        train_hamerly_no_init(training_set);
+        break;
+      case kmeans_algorithm::balanced:
+        train_balanced_no_init(training_set);
+        break;
+    }
+    balanced_ = algorithm == kmeans_algorithm::balanced;
+  }
+
+  /**
+   * @brief Make one pass of mini-batch kmeans (Sculley, "Web-Scale K-Means
+   * Clustering") over a training set that may be larger than memory.  The
+   * training set is consumed one loaded block at a time (e.g., a
+   * `tdbColMajorMatrix` constructed with an `upper_bound`), so only a single
+   * block and one batch need to be resident.  Each block is visited in random
+   * order, `batch_size` vectors at a time.  Every batch is assigned to the
+   * current centroids and each centroid is then moved towards its assigned
+   * vectors with a per-centroid learning rate of 1 / (number of vectors the
+   * centroid has absorbed so far).
+   *
+   * The element type of the training set may differ from `T`, so that, e.g.,
+   * `uint8_t` vectors can be used to train `float` centroids.  If no mini-batch
+   * pass has been made yet, the centroids are initialized with kmeans|| run on
+   * a sample of the first block.
+   *
+   * @param training_set Blocked training set.  If it is loadable, its first
+   * block must already have been loaded.
+   * @param batch_size Number of vectors in each mini batch.
+   * @param max_vectors Maximum number of vectors to use (0 means all).
+   * @return The sum of the squared distances moved by the centroids.
+   */
+  template <class Array>
+  double train_mini_batch_pass(
+      Array& training_set, size_t batch_size, size_t max_vectors = 0) {
+    scoped_timer _{__FUNCTION__};
+
+    if (batch_size == 0) {
+      throw std::runtime_error("Mini batch size must be positive");
+    }
+
+    auto old_centroids = ColMajorMatrix<T>(dimension_, nlist_);
+    std::copy(
+        centroids_.data(),
+        centroids_.data() + dimension_ * nlist_,
+        old_centroids.data());
+
+    size_t num_seen = 0;
+    do {
+      auto num_block = training_set.num_cols();
+      if (max_vectors != 0) {
+        num_block = std::min(num_block, max_vectors - num_seen);
+      }
+      if (num_block == 0) {
+        break;
+      }
+
+      std::vector<size_t> order(num_block);
+      std::iota(begin(order), end(order), 0);
+      std::shuffle(begin(order), end(order), gen);
+
+      if (empty(mini_batch_counts_)) {
+        auto sample_size = std::min(num_block, std::max(batch_size, nlist_));
+        if (sample_size < nlist_) {
+          throw std::runtime_error(
+              "First block must contain at least nlist vectors");
+        }
+        auto sample = gather_columns(training_set, order, 0, sample_size);
+        kmeans_parallel_init(sample);
+        mini_batch_counts_.resize(nlist_, 0);
+        old_centroids = ColMajorMatrix<T>(dimension_, nlist_);
+        std::copy(
+            centroids_.data(),
+            centroids_.data() + dimension_ * nlist_,
+            old_centroids.data());
+      }
+
+      for (size_t start = 0; start < num_block; start += batch_size) {
+        auto stop = std::min(start + batch_size, num_block);
+        auto batch = gather_columns(training_set, order, start, stop);
+        auto parts = detail::flat::qv_partition(centroids_, batch, nthreads_);
+
+        // Bucket the batch by centroid so that each centroid can be updated
+        // independently (and in parallel).
+        std::vector<size_t> offsets, members;
+        std::tie(offsets, members) = bucket_by_partition(parts);
+
+        stdx::execution::indexed_parallel_policy par{nthreads_};
+        stdx::range_for_each(
+            std::move(par),
+            centroids_,
+            [this, &batch, &offsets, &members](
+                auto&& centroid, size_t n, size_t j) {
+              for (size_t m = offsets[j]; m < offsets[j + 1]; ++m) {
+                auto vector = batch[members[m]];
+                double eta = 1.0 / static_cast<double>(++mini_batch_counts_[j]);
+                for (size_t k = 0; k < dimension_; ++k) {
+                  centroid[k] +=
+                      eta * (static_cast<double>(vector[k]) - centroid[k]);
+                }
+              }
+            });
+      }
+      num_seen += num_block;
+      if constexpr (is_loadable_v<decltype(training_set)>) {
+        if (max_vectors != 0 && num_seen >= max_vectors) {
+          break;
+        }
+        if (!training_set.load()) {
+          break;
+        }
+      } else {
+        break;
+      }
+    } while (true);
+
+    double shift = 0.0;
+    for (size_t j = 0; j < nlist_; ++j) {
+      shift += sum_of_squares(centroids_[j], old_centroids[j]);
+    }
+    return shift;
+  }
+
+  /**
+   * @brief Train with mini-batch kmeans, streaming the training set from the
+   * TileDB array at `uri`, `upper_bound` vectors at a time.  At most
+   * `max_iter_` passes are made over the data, stopping early when the
+   * centroids move less than `tol_` (relative to their squared norm) in a
+   * pass.
+   *
+   * @tparam V Element type of the array
+   */
+  template <class V>
+  void train_mini_batch(
+      const tiledb::Context& ctx,
+      const std::string& uri,
+      size_t upper_bound,
+      size_t batch_size,
+      size_t max_vectors = 0) {
+    train_mini_batch(
+        [&]() { return tdbColMajorMatrix<V>(ctx, uri, upper_bound); },
+        batch_size,
+        max_vectors);
+  }
+
+  /**
+   * @brief Train with mini-batch kmeans as above, but with the training set
+   * supplied by `make_source`, which must return a new (unloaded) blocked
+   * matrix, e.g., a `tdbColMajorMatrix` or an `mmapColMajorMatrix`, each time
+   * it is called.
+   */
+  template <class SourceFactory>
+    requires std::invocable<SourceFactory>
+  void train_mini_batch(
+      SourceFactory&& make_source, size_t batch_size, size_t max_vectors = 0) {
+    scoped_timer _{__FUNCTION__};
+
+    for (size_t iter = 0; iter < max_iter_; ++iter) {
+      auto training_set = make_source();
+      if (!training_set.load()) {
+        throw std::runtime_error("Training set is empty");
+      }
+      if (training_set.num_rows() != dimension_) {
+        throw std::runtime_error(
+            "Training set dimension does not match index dimension");
+      }
+      auto shift = train_mini_batch_pass(training_set, batch_size, max_vectors);
+
+      double norm = 0.0;
+      for (size_t j = 0; j < nlist_; ++j) {
+        norm += std::inner_product(
+            begin(centroids_[j]),
+            end(centroids_[j]),
+            begin(centroids_[j]),
+            0.0);
+      }
+      if (shift <= tol_ * norm) {
+        break;
+      }
+    }
   }
 
-#if 0
-  // @todo WIP
+  /**
+   * @brief Partition `db` with the current centroids (see `partition()`),
+   * replacing the contents of the index.  The ids of the vectors are their
+   * column numbers in `db`.
+   */
   void add(const ColMajorMatrix<T>& db) {
-    auto parts = detail::flat::qv_partition(centroids_, db, nthreads_);
+    scoped_timer _{__FUNCTION__};
+    std::lock_guard lock(mutex_);
+    check_not_compacting();
+
+    auto parts = partition(db);
     std::vector<size_t> degrees(centroids_.num_cols());
     std::vector<indices_type> indices(centroids_.num_cols() + 1);
     std::vector shuffled_ids = std::vector<shuffled_ids_type>(db.num_cols());
@@ -334,12 +1499,630 @@ class kmeans_index {
     indices_ = std::move(indices);
     shuffled_ids_ = std::move(shuffled_ids);
     shuffled_db_ = std::move(shuffled_db);
+    update_id_positions();
+    delta_ = detail::ivf::ivf_delta<T, shuffled_ids_type>(dimension_, nlist_);
+
+    if (nlist_ >= coarse_min_nlist_ && coarse_.num_fine() != nlist_) {
+      build_coarse_quantizer();
+    }
+    update_binary_codes();
+    update_partition_stats();
+  }
+
+  /**
+   * @brief Recompute the partition statistics after the shuffled vectors
+   * have changed.
+   */
+  void update_partition_stats() {
+    stats_ = detail::ivf::partition_stats::compute(
+        shuffled_db_, centroids_, indices_, nthreads_);
+  }
+
+  const detail::ivf::partition_stats& get_partition_stats() const {
+    return stats_;
+  }
+
+  /**
+   * @brief Rebuild the binary codes if the prefilter is enabled, otherwise
+   * drop them, after the shuffled vectors have changed.
+   */
+  void update_binary_codes() {
+    binary_ = detail::ivf::binary_codes{};
+    if (binary_survivors_ > 0) {
+      binary_ = detail::ivf::binary_codes::encode(shuffled_db_, nthreads_);
+    }
+  }
+
+  /**
+   * @brief Use binary codes to prefilter the vectors scored by search():
+   * within each partition probed, only the `num_survivors` vectors whose
+   * codes are nearest the query's in Hamming distance are scored with the
+   * full distance.  Zero disables the prefilter.  The prefilter is not
+   * applied while the index has pending updates or when partitions are
+   * selected with the coarse quantizer.
+   */
+  void set_binary_prefilter(size_t num_survivors) {
+    binary_survivors_ = num_survivors;
+    if (num_survivors > 0 &&
+        binary_.num_vectors() != shuffled_db_.num_cols()) {
+      binary_ = detail::ivf::binary_codes::encode(shuffled_db_, nthreads_);
+    }
+  }
+
+  auto& get_binary_codes() {
+    return binary_;
+  }
+
+  /**
+   * @brief Add vectors with the given ids to the delta store, replacing any
+   * vectors already in the index with the same ids.
+   */
+  void update(
+      const ColMajorMatrix<T>& vectors,
+      const std::vector<shuffled_ids_type>& ids) {
+    std::lock_guard lock(mutex_);
+    delta_.add(centroids_, vectors, ids, nthreads_, [this](auto&& id) {
+      return in_main(id);
+    });
+    if (pending_) {
+      pending_->add(centroids_, vectors, ids, nthreads_);
+    }
+  }
+
+  /**
+   * @brief Delete the vectors with the given ids.
+   */
+  void remove(const std::vector<shuffled_ids_type>& ids) {
+    std::lock_guard lock(mutex_);
+    delta_.remove(ids, [this](auto&& id) { return in_main(id); });
+    if (pending_) {
+      pending_->remove(ids);
+    }
+  }
+
+  /**
+   * @brief Fold the delta store into the main partitioned arrays.
+   */
+  void compact() {
+    std::lock_guard lock(mutex_);
+    check_not_compacting();
+    if (delta_.empty()) {
+      return;
+    }
+    std::tie(shuffled_db_, indices_, shuffled_ids_) =
+        delta_.compact(shuffled_db_, indices_, shuffled_ids_);
+    update_id_positions();
+    delta_.clear();
+    update_binary_codes();
+    update_partition_stats();
+  }
+
+  /**
+   * @brief Fold the delta store into the main partitioned arrays in a
+   * background thread.  The compacted arrays are built from a copy of the
+   * delta store while the index keeps being searched, updated and removed
+   * from, then swapped in under `mutex_`; updates made in the meantime stay
+   * in the delta store.  add(), compact(), load() and save() throw until
+   * the returned future is ready, and the index must outlive it.
+   */
+  std::future<void> compact_async() {
+    std::lock_guard lock(mutex_);
+    check_not_compacting();
+    pending_.emplace(dimension_, nlist_);
+    return std::async(std::launch::async, [this, snapshot = delta_]() {
+      try {
+        // The main arrays are only replaced under `mutex_` by operations
+        // that throw while `pending_` is set, so they can be read unlocked
+        auto&& [db, indices, ids] =
+            snapshot.compact(shuffled_db_, indices_, shuffled_ids_);
+
+        std::lock_guard lock(mutex_);
+        shuffled_db_ = std::move(db);
+        indices_ = std::move(indices);
+        shuffled_ids_ = std::move(ids);
+        update_id_positions();
+        delta_ = std::move(*pending_);
+        pending_.reset();
+        delta_.prune_tombstones([this](auto&& id) { return in_main(id); });
+        update_binary_codes();
+        update_partition_stats();
+      } catch (...) {
+        // `delta_` still holds every update, so the index is unchanged
+        std::lock_guard lock(mutex_);
+        pending_.reset();
+        throw;
+      }
+    });
+  }
+
+  /**
+   * @brief Find the `k_nn` nearest neighbors of each query, searching the
+   * `nprobe` partitions closest to it (including their delta partitions).
+   * For large `nlist_` the partitions are selected with the coarse quantizer
+   * (see `set_coarse_quantizer()`).  Unless vectors have been added since
+   * the index was built, probed partitions that the partition statistics
+   * rule out are skipped.
+   *
+   * @return Matrix whose column `j` holds the ids of the neighbors of query
+   * `j`, nearest first.
+   */
+  auto search(const ColMajorMatrix<T>& query, size_t nprobe, size_t k_nn) {
+    std::lock_guard lock(mutex_);
+    auto is_live = [this](auto&& id) { return !delta_.is_deleted(id); };
+    if (nlist_ >= coarse_min_nlist_ && coarse_.num_fine() == nlist_) {
+      auto&& [active_partitions, active_queries] =
+          detail::ivf::partition_ivf_index(
+              coarse_, centroids_, query, nprobe, nthreads_);
+      auto min_scores = detail::ivf::query_infinite_ram_min_scores(
+          shuffled_db_,
+          query,
+          indices_,
+          shuffled_ids_,
+          active_partitions,
+          active_queries,
+          k_nn,
+          nthreads_,
+          is_live);
+      if (!delta_.empty()) {
+        delta_.search(
+            query, active_partitions, active_queries, min_scores, nthreads_);
+      }
+      return detail::ivf::get_top_k_ids(min_scores, k_nn);
+    }
+    // Deletions are skipped by these kernels, but vectors in the delta store
+    // are covered by neither the binary codes nor the statistics
+    if (delta_.num_vectors() == 0 && binary_survivors_ > 0) {
+      return detail::ivf::binary_query_infinite_ram(
+          shuffled_db_,
+          binary_,
+          centroids_,
+          query,
+          indices_,
+          shuffled_ids_,
+          nprobe,
+          k_nn,
+          binary_survivors_,
+          nthreads_,
+          is_live);
+    }
+    if (delta_.num_vectors() == 0 && stats_.num_partitions() == nlist_) {
+      return detail::ivf::pruned_query_infinite_ram(
+          shuffled_db_,
+          centroids_,
+          stats_,
+          query,
+          indices_,
+          shuffled_ids_,
+          nprobe,
+          k_nn,
+          nthreads_,
+          is_live);
+    }
+    if (delta_.empty()) {
+      return detail::ivf::query_infinite_ram(
+          shuffled_db_,
+          centroids_,
+          query,
+          indices_,
+          shuffled_ids_,
+          nprobe,
+          k_nn,
+          false,
+          nthreads_);
+    }
+    return detail::ivf::query_infinite_ram(
+        shuffled_db_,
+        centroids_,
+        query,
+        indices_,
+        shuffled_ids_,
+        delta_,
+        nprobe,
+        k_nn,
+        false,
+        nthreads_);
+  }
+
+  /**
+   * @brief Find the `k_nn` nearest neighbors of each query, probing its
+   * partitions in order of centroid distance until the partition radii show
+   * that no further partition can hold a nearer vector, or `max_nprobe`
+   * partitions have been searched.  Deleted vectors are skipped.  Indexes
+   * with vectors added since they were built are searched with search(),
+   * probing `max_nprobe` partitions, since the statistics do not cover the
+   * delta store.
+   */
+  auto search_adaptive(
+      const ColMajorMatrix<T>& query,
+      size_t max_nprobe,
+      size_t k_nn,
+      std::vector<size_t>* num_probed = nullptr) {
+    std::lock_guard lock(mutex_);
+    if (delta_.num_vectors() != 0) {
+      return search(query, max_nprobe, k_nn);
+    }
+    if (stats_.num_partitions() != nlist_) {
+      throw std::runtime_error("search_adaptive requires the index vectors");
+    }
+    return detail::ivf::adaptive_query_infinite_ram(
+        shuffled_db_,
+        centroids_,
+        stats_,
+        query,
+        indices_,
+        shuffled_ids_,
+        max_nprobe,
+        k_nn,
+        nthreads_,
+        num_probed,
+        [this](auto&& id) { return !delta_.is_deleted(id); });
+  }
+
+  /**
+   * @brief Find the `k_nn` nearest neighbors of each query among the
+   * vectors whose ids pass `filter` (an `id_bitmap` or any predicate on
+   * ids), including pending updates.  The filter is tested before vectors
+   * are scored; if few enough vectors pass, all of them are searched rather
+   * than `nprobe` partitions (see `filter.h`).
+   */
+  auto search_filtered(
+      const ColMajorMatrix<T>& query,
+      auto&& filter,
+      size_t nprobe,
+      size_t k_nn) {
+    std::lock_guard lock(mutex_);
+    auto is_live = [&](auto&& id) {
+      return filter(id) && !delta_.is_deleted(id);
+    };
+    if (delta_.empty()) {
+      return detail::ivf::filtered_query_infinite_ram(
+          shuffled_db_,
+          centroids_,
+          query,
+          indices_,
+          shuffled_ids_,
+          is_live,
+          nprobe,
+          k_nn,
+          nthreads_);
+    }
+
+    auto positions = detail::ivf::filtered_positions(shuffled_ids_, is_live);
+    if (detail::ivf::use_filtered_brute_force(
+            size(positions) + delta_.num_vectors(),
+            shuffled_db_.num_cols() + delta_.num_vectors(),
+            nprobe,
+            nlist_)) {
+      auto min_scores = detail::ivf::brute_force_min_scores(
+          shuffled_db_, shuffled_ids_, positions, query, k_nn, nthreads_);
+      delta_.search_all(query, min_scores, nthreads_, filter);
+      return detail::ivf::get_top_k_ids(min_scores, k_nn);
+    }
+
+    auto&& [active_partitions, active_queries] =
+        detail::ivf::partition_ivf_index(centroids_, query, nprobe, nthreads_);
+    auto min_scores = detail::ivf::query_infinite_ram_min_scores(
+        shuffled_db_,
+        query,
+        indices_,
+        shuffled_ids_,
+        active_partitions,
+        active_queries,
+        k_nn,
+        nthreads_,
+        is_live);
+    delta_.search(
+        query,
+        active_partitions,
+        active_queries,
+        min_scores,
+        nthreads_,
+        filter);
+    return detail::ivf::get_top_k_ids(min_scores, k_nn);
+  }
+
+  auto& get_delta() {
+    return delta_;
+  }
+
+  /**
+   * @brief Map from the ids of the vectors in the main arrays to their
+   * positions, as used by `detail::ivf::rerank`.  It is rebuilt whenever the
+   * main arrays change, i.e., by add(), compact() and load().
+   */
+  const auto& get_id_positions() const {
+    return id_positions_;
+  }
+
+  /**
+   * @brief Write the index to a new TileDB group at `group_uri`, using the
+   * same layout (array names, element types and group metadata) as Python
+   * ingestion, so that the index can be opened with `IVFFlatIndex` or
+   * queried with `query_finite_ram`.  Any pending updates are compacted
+   * first.
+   */
+  void save(const tiledb::Context& ctx, const std::string& group_uri) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+    std::lock_guard lock(mutex_);
+    check_not_compacting();
+
+    if (size(indices_) != nlist_ + 1) {
+      throw std::runtime_error("Cannot save an index that has no vectors");
+    }
+    if (tiledb::Object::object(ctx, group_uri).type() !=
+        tiledb::Object::Type::Invalid) {
+      throw std::runtime_error(group_uri + " already exists");
+    }
+    compact();
+
+    std::string storage_version = "0.2";
+    auto names = array_names(storage_version);
+
+    tiledb::Group::create(ctx, group_uri);
+    tiledb::Group group(ctx, group_uri, TILEDB_WRITE);
+
+    // Python always stores centroids as float32 and indices and ids as uint64
+    auto centroids = ColMajorMatrix<float>(dimension_, nlist_);
+    std::copy(
+        centroids_.data(),
+        centroids_.data() + dimension_ * nlist_,
+        centroids.data());
+    auto indices = std::vector<uint64_t>(begin(indices_), end(indices_));
+    auto ids = std::vector<uint64_t>(begin(shuffled_ids_), end(shuffled_ids_));
+
+    auto centroids_uri = group_uri + "/" + names.centroids;
+    auto index_uri = group_uri + "/" + names.index;
+    auto ids_uri = group_uri + "/" + names.ids;
+    auto parts_uri = group_uri + "/" + names.parts;
+    write_matrix(ctx, centroids, centroids_uri);
+    write_vector(ctx, indices, index_uri);
+    write_vector(ctx, ids, ids_uri);
+    write_matrix(ctx, shuffled_db_, parts_uri);
+
+    group.add_member(centroids_uri, false, names.centroids);
+    group.add_member(index_uri, false, names.index);
+    group.add_member(ids_uri, false, names.ids);
+    group.add_member(parts_uri, false, names.parts);
+
+    if (!coarse_.empty()) {
+      auto coarse_centroids_uri = group_uri + "/" + names.coarse_centroids;
+      auto coarse_offsets_uri = group_uri + "/" + names.coarse_offsets;
+      auto coarse_members_uri = group_uri + "/" + names.coarse_members;
+      coarse_.save(
+          ctx, coarse_centroids_uri, coarse_offsets_uri, coarse_members_uri);
+
+      group.add_member(coarse_centroids_uri, false, names.coarse_centroids);
+      group.add_member(coarse_offsets_uri, false, names.coarse_offsets);
+      group.add_member(coarse_members_uri, false, names.coarse_members);
+    }
+
+    if (!binary_.empty()) {
+      auto binary_codes_uri = group_uri + "/" + names.binary_codes;
+      auto binary_center_uri = group_uri + "/" + names.binary_center;
+      binary_.save(ctx, binary_codes_uri, binary_center_uri);
+      group.add_member(binary_codes_uri, false, names.binary_codes);
+      group.add_member(binary_center_uri, false, names.binary_center);
+    }
+
+    if (!stats_.empty()) {
+      auto stats_uri = group_uri + "/" + names.partition_stats;
+      stats_.save(ctx, stats_uri);
+      group.add_member(stats_uri, false, names.partition_stats);
+    }
+
+    auto id_positions_uri = group_uri + "/" + names.id_positions;
+    id_positions_.save(ctx, id_positions_uri);
+    group.add_member(id_positions_uri, false, names.id_positions);
+
+    int64_t partitions = nlist_;
+    put_string_metadata(group, "dataset_type", "vector_search");
+    put_string_metadata(group, "dtype", dtype_name<T>());
+    group.put_metadata("partitions", TILEDB_INT64, 1, &partitions);
+    put_string_metadata(group, "storage_version", storage_version);
+    if (balanced_) {
+      group.put_metadata(
+          "max_partition_factor", TILEDB_FLOAT64, 1, &max_partition_factor_);
+    }
+    group.close();
+  }
+
+  /**
+   * @brief Open an index from the TileDB group at `group_uri`, as written by
+   * `save()` or by Python ingestion.  The shuffled vectors are only read if
+   * `load_vectors` is true; they are not needed to query the index with
+   * `query_finite_ram`.
+   */
+  void load(
+      const tiledb::Context& ctx,
+      const std::string& group_uri,
+      bool load_vectors = true) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+    std::lock_guard lock(mutex_);
+    check_not_compacting();
+
+    tiledb::Group group(ctx, group_uri, TILEDB_READ);
+    auto storage_version =
+        get_string_metadata(group, "storage_version", "0.1");
+    auto dtype = get_string_metadata(group, "dtype", dtype_name<T>());
+    if (dtype != dtype_name<T>()) {
+      throw std::runtime_error(
+          "Index at " + group_uri + " has dtype " + dtype + ", expected " +
+          dtype_name<T>());
+    }
+    auto names = array_names(storage_version);
+
+    // Only written for indexes with balanced partitions
+    {
+      tiledb_datatype_t type;
+      uint32_t num;
+      const void* value = nullptr;
+      group.get_metadata("max_partition_factor", &type, &num, &value);
+      balanced_ = value != nullptr;
+      if (balanced_) {
+        if (type != TILEDB_FLOAT64) {
+          throw std::runtime_error("Metadata max_partition_factor is not f64");
+        }
+        max_partition_factor_ = *static_cast<const double*>(value);
+      }
+    }
+
+    auto centroids =
+        tdbColMajorMatrix<float>(ctx, group.member(names.centroids).uri());
+    centroids.load();
+    dimension_ = centroids.num_rows();
+    nlist_ = centroids.num_cols();
+    centroids_ = ColMajorMatrix<T>(dimension_, nlist_);
+    std::copy(
+        centroids.data(),
+        centroids.data() + dimension_ * nlist_,
+        centroids_.data());
+
+    auto indices = read_vector<uint64_t>(ctx, group.member(names.index).uri());
+    if (size(indices) != nlist_ + 1) {
+      throw std::runtime_error(
+          "Size of partition index does not match number of centroids");
+    }
+    indices_ = std::vector<indices_type>(begin(indices), end(indices));
+
+    auto ids = read_vector<uint64_t>(ctx, group.member(names.ids).uri());
+    shuffled_ids_ = std::vector<shuffled_ids_type>(begin(ids), end(ids));
+    update_id_positions();
+
+    if (load_vectors) {
+      auto shuffled_db =
+          tdbColMajorMatrix<T>(ctx, group.member(names.parts).uri());
+      shuffled_db.load();
+      shuffled_db_ = std::move(static_cast<ColMajorMatrix<T>&>(shuffled_db));
+    }
+
+    auto coarse_centroids_uri = member_uri(group, names.coarse_centroids);
+    auto coarse_offsets_uri = member_uri(group, names.coarse_offsets);
+    auto coarse_members_uri = member_uri(group, names.coarse_members);
+    auto binary_codes_uri = member_uri(group, names.binary_codes);
+    auto binary_center_uri = member_uri(group, names.binary_center);
+    auto stats_uri = member_uri(group, names.partition_stats);
+    auto tombstones_uri = member_uri(group, names.tombstones);
+    group.close();
+
+    mini_batch_counts_.clear();
+    delta_ = detail::ivf::ivf_delta<T, shuffled_ids_type>(dimension_, nlist_);
+
+    // The coarse quantizer is optional: it is only written for large nlist
+    auto nprobe = coarse_.nprobe();
+    coarse_ = detail::ivf::coarse_quantizer<T, indices_type>{};
+    if (!coarse_centroids_uri.empty()) {
+      coarse_ = detail::ivf::coarse_quantizer<T, indices_type>(
+          ctx, coarse_centroids_uri, coarse_offsets_uri, coarse_members_uri);
+    } else if (nlist_ >= coarse_min_nlist_) {
+      build_coarse_quantizer();
+    }
+    coarse_.set_nprobe(nprobe);
+
+    // So are the binary codes, which are only useful with the vectors
+    binary_ = detail::ivf::binary_codes{};
+    if (load_vectors && !binary_codes_uri.empty()) {
+      binary_ = detail::ivf::binary_codes(
+          ctx, binary_codes_uri, binary_center_uri);
+    } else if (load_vectors) {
+      update_binary_codes();
+    }
+
+    // Indexes from older ingestion have no statistics; they can be computed
+    // if the vectors are loaded
+    stats_ = detail::ivf::partition_stats{};
+    if (!stats_uri.empty()) {
+      stats_ = detail::ivf::partition_stats(ctx, stats_uri);
+    } else if (load_vectors) {
+      update_partition_stats();
+    }
+
+    // Vectors deleted since the index was written are skipped by every
+    // search until the index is compacted and saved
+    if (!tombstones_uri.empty()) {
+      delta_.add_tombstones(read_id_bitmap(ctx, tombstones_uri));
+    }
+  }
+
+  /**
+   * @brief Write the ids deleted with `remove()` to the tombstones array of
+   * the index group at `group_uri` (creating it if need be), so that they
+   * are skipped when the index is next loaded, without rewriting the
+   * partitioned arrays.  Vectors added with `update()` are not written.
+   */
+  void save_tombstones(
+      const tiledb::Context& ctx, const std::string& group_uri) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+    std::lock_guard lock(mutex_);
+
+    tiledb::Group read_group(ctx, group_uri, TILEDB_READ);
+    auto storage_version =
+        get_string_metadata(read_group, "storage_version", "0.1");
+    auto names = array_names(storage_version);
+    auto tombstones_uri = member_uri(read_group, names.tombstones);
+    read_group.close();
+
+    // Only ids of vectors in the main arrays are tombstoned, so all of them
+    // are written; the array is appended to rather than rewritten
+    if (!tombstones_uri.empty()) {
+      auto tombstones = read_id_bitmap(ctx, tombstones_uri);
+      update_id_bitmap(
+          ctx, tombstones, delta_.tombstones().ids(), tombstones_uri);
+      return;
+    }
+    tombstones_uri = group_uri + "/" + names.tombstones;
+    write_id_bitmap(ctx, delta_.tombstones(), tombstones_uri);
+    tiledb::Group group(ctx, group_uri, TILEDB_WRITE);
+    group.add_member(tombstones_uri, false, names.tombstones);
+    group.close();
   }
-#endif
 
   auto& get_centroids() {
     return centroids_;
   }
+
+  /**
+   * @brief The main partitioned arrays, i.e., the vectors grouped by
+   * partition, the offsets of the partitions and the ids of the vectors.
+   * They do not include the pending updates in `get_delta()`.
+   */
+  auto& get_shuffled_db() {
+    return shuffled_db_;
+  }
+
+  auto& get_indices() {
+    return indices_;
+  }
+
+  auto& get_shuffled_ids() {
+    return shuffled_ids_;
+  }
+
+  /**
+   * @brief Coarse centroids from `train_hierarchical` or
+   * `build_coarse_quantizer`, empty otherwise.
+   */
+  auto& get_coarse_centroids() {
+    return coarse_.centroids();
+  }
+
+  /**
+   * @brief Map from coarse to fine centroids: the fine centroids of coarse
+   * centroid `c` are the columns `members[offsets[c], offsets[c+1])` of
+   * `get_centroids()`, where `members` is `get_coarse_members()`.  After
+   * `train_hierarchical` the members are in order, so these are simply the
+   * columns `[offsets[c], offsets[c+1])`.
+   */
+  auto& get_coarse_offsets() {
+    return coarse_.offsets();
+  }
+
+  auto& get_coarse_members() {
+    return coarse_.members();
+  }
+
+  auto& get_coarse_quantizer() {
+    return coarse_;
+  }
 };
 
 #endif  // TILEDB_IVF_INDEX_H
@@ -0,0 +1,595 @@
+/**
+ * @file   ivf_pq_index.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Header-only ivf index whose partitions hold product-quantization (PQ)
+ * codes of the vectors instead of the vectors themselves (see
+ * `detail/ivf/pq.h`).  With `num_subspaces` one-byte codes per vector, a
+ * float vector of dimension d takes `num_subspaces` bytes instead of 4 * d.
+ *
+ * With `num_bits` 4, each subspace has 16 codewords, codes take half a byte
+ * and the partitions are scanned with the "fast scan" kernel of
+ * `detail/ivf/fast_scan.h`, which keeps the distance tables in SIMD
+ * registers.  Such an index is less accurate but faster to search and
+ * smaller; it can only be searched in memory.
+ *
+ * The basic use case is:
+ * - Create an instance of the index
+ * - Call train() to learn the partition centroids and, from the residuals of
+ *   the training vectors to their centroids, the PQ codebooks
+ * - Call add() to encode vectors into the index
+ * - Call search() to query the index, returning the ids of the
+ *   (approximate) nearest vectors
+ * - Call save() to write the index to a TileDB group, and load() to open it
+ *   again.  An index opened without its codes can be queried with
+ *   search_finite_ram(), which reads only the probed partitions.
+ *
+ * The group uses the array names of storage version 0.2 for the centroids,
+ * partition index and ids, so these are laid out as for IVF_FLAT.
+ */
+
+#ifndef TILEDB_IVF_PQ_INDEX_H
+#define TILEDB_IVF_PQ_INDEX_H
+
+#include <cmath>
+#include <concepts>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "defs.h"
+
+#include "detail/flat/qv.h"
+#include "detail/ivf/fast_scan.h"
+#include "detail/ivf/pq.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "ivf_index.h"
+#include "linalg.h"
+#include "utils/timer.h"
+
+template <
+    class T,
+    class shuffled_ids_type = uint64_t,
+    class indices_type = uint64_t>
+class ivf_pq_index {
+  using kmeans_type = kmeans_index<float, shuffled_ids_type, indices_type>;
+
+  size_t dimension_{0};
+  size_t nlist_;
+  size_t num_subspaces_;
+  size_t num_bits_{8};
+  size_t max_iter_;
+  double tol_;
+  size_t nthreads_{std::thread::hardware_concurrency()};
+
+  ColMajorMatrix<float> centroids_;
+  ColMajorMatrix<float> codebooks_;
+  std::vector<indices_type> indices_;
+  std::vector<shuffled_ids_type> shuffled_ids_;
+  // With 8-bit codes, one column of `num_subspaces_` codes per vector.
+  // With 4-bit codes, one column per block of packed codes; partition `p`
+  // occupies the blocks `[block_indices_[p], block_indices_[p+1])`.
+  ColMajorMatrix<uint8_t> codes_;
+  std::vector<indices_type> block_indices_;
+
+  // Arrays of an index opened with load()
+  std::string codes_uri_;
+  std::string ids_uri_;
+
+  static constexpr const char* codebooks_name = "pq_codebooks";
+  static constexpr const char* codes_name = "pq_codes";
+
+  /**
+   * @brief Assign the first `n` vectors of `block` to partitions and encode
+   * their residuals, appending the partitions to `labels` and the codes to
+   * `codes` (`num_subspaces_` bytes per vector).
+   */
+  void encode_block(
+      const auto& block,
+      size_t n,
+      std::vector<uint32_t>& labels,
+      std::vector<uint8_t>& codes) {
+    auto parts = detail::flat::qv_partition(centroids_, block, nthreads_);
+
+    auto first = size(labels);
+    labels.insert(end(labels), begin(parts), begin(parts) + n);
+    codes.resize(codes.size() + n * num_subspaces_);
+
+    std::vector<size_t> columns(n);
+    std::iota(begin(columns), end(columns), 0);
+    stdx::execution::indexed_parallel_policy par{nthreads_};
+    stdx::range_for_each(
+        std::move(par), columns, [&](auto&& i, size_t, size_t) {
+          auto vec = block[i];
+          auto centroid = centroids_[parts[i]];
+          std::vector<float> residual(dimension_);
+          for (size_t k = 0; k < dimension_; ++k) {
+            residual[k] = vec[k] - centroid[k];
+          }
+          auto code = codes.data() + (first + i) * num_subspaces_;
+          encode(residual, code);
+        });
+  }
+
+  /**
+   * @brief Encode `residual` as the nearest codeword of each subspace.
+   */
+  void encode(const std::vector<float>& residual, uint8_t* code) const {
+    for (size_t m = 0; m < num_subspaces_; ++m) {
+      auto b = detail::ivf::pq_subspace_begin(m, dimension_, num_subspaces_);
+      auto e =
+          detail::ivf::pq_subspace_begin(m + 1, dimension_, num_subspaces_);
+      float best_score = std::numeric_limits<float>::max();
+      size_t best = 0;
+      for (size_t k = 0; k < num_codewords(); ++k) {
+        auto codeword = codebooks_[k];
+        float score = 0;
+        for (size_t i = b; i < e; ++i) {
+          float diff = residual[i] - codeword[i];
+          score += diff * diff;
+        }
+        if (score < best_score) {
+          best_score = score;
+          best = k;
+        }
+      }
+      code[m] = best;
+    }
+  }
+
+  /**
+   * @brief Shuffle the codes (in source order) into partition order,
+   * replacing the contents of the index.  The ids of the vectors are their
+   * positions in the source.
+   */
+  void shuffle(
+      const std::vector<uint32_t>& labels, const std::vector<uint8_t>& codes) {
+    auto num_vectors = size(labels);
+
+    std::vector<indices_type> indices(nlist_ + 1, 0);
+    for (auto p : labels) {
+      ++indices[p + 1];
+    }
+    std::inclusive_scan(begin(indices), end(indices), begin(indices));
+
+    auto shuffled_ids = std::vector<shuffled_ids_type>(num_vectors);
+    auto shuffled_codes = ColMajorMatrix<uint8_t>(num_subspaces_, num_vectors);
+    auto fill = indices;
+    for (size_t i = 0; i < num_vectors; ++i) {
+      auto pos = fill[labels[i]]++;
+      shuffled_ids[pos] = i;
+      std::copy(
+          codes.data() + i * num_subspaces_,
+          codes.data() + (i + 1) * num_subspaces_,
+          shuffled_codes[pos].data());
+    }
+
+    if (num_bits_ == 4) {
+      auto block_indices = detail::ivf::fast_scan_block_indices(indices);
+      auto packed = ColMajorMatrix<uint8_t>(
+          detail::ivf::fast_scan_block_bytes(num_subspaces_),
+          block_indices.back());
+      for (size_t p = 0; p < nlist_; ++p) {
+        detail::ivf::fast_scan_pack(
+            shuffled_codes[indices[p]].data(),
+            indices[p + 1] - indices[p],
+            num_subspaces_,
+            packed[block_indices[p]].data());
+      }
+      shuffled_codes = std::move(packed);
+      block_indices_ = std::move(block_indices);
+    }
+
+    indices_ = std::move(indices);
+    shuffled_ids_ = std::move(shuffled_ids);
+    codes_ = std::move(shuffled_codes);
+  }
+
+  size_t num_codewords() const {
+    return size_t{1} << num_bits_;
+  }
+
+ public:
+  ivf_pq_index(
+      size_t dimension,
+      size_t nlist,
+      size_t num_subspaces,
+      size_t max_iter,
+      double tol,
+      size_t nthreads,
+      size_t num_bits = 8)
+      : dimension_(dimension)
+      , nlist_(nlist)
+      , num_subspaces_(num_subspaces)
+      , num_bits_(num_bits)
+      , max_iter_(max_iter)
+      , tol_(tol)
+      , nthreads_(
+            nthreads == 0 ? std::thread::hardware_concurrency() : nthreads)
+      , centroids_(dimension, nlist)
+      , codebooks_(dimension, size_t{1} << num_bits) {
+    // A dimension of 0 is for an index that is to be load()ed
+    if (dimension_ != 0 &&
+        (num_subspaces_ == 0 || num_subspaces_ > dimension_)) {
+      throw std::runtime_error(
+          "Number of subspaces must be between 1 and the dimension");
+    }
+    if (num_bits_ != 4 && num_bits_ != 8) {
+      throw std::runtime_error("Codes must have 4 or 8 bits");
+    }
+  }
+
+  /**
+   * @brief Learn the partition centroids from `training_set` with kmeans,
+   * and then, for each subspace, the codewords from the residuals of the
+   * training vectors to their centroids.
+   */
+  void train(const auto& training_set) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_vectors = training_set.num_cols();
+    auto residuals = ColMajorMatrix<float>(dimension_, num_vectors);
+    for (size_t j = 0; j < num_vectors; ++j) {
+      std::copy(
+          begin(training_set[j]), end(training_set[j]), begin(residuals[j]));
+    }
+
+    auto coarse = kmeans_type(dimension_, nlist_, max_iter_, tol_, nthreads_);
+    coarse.train(residuals, kmeans_algorithm::hamerly);
+    centroids_ = std::move(coarse.get_centroids());
+
+    auto parts = detail::flat::qv_partition(centroids_, residuals, nthreads_);
+    for (size_t j = 0; j < num_vectors; ++j) {
+      auto centroid = centroids_[parts[j]];
+      for (size_t k = 0; k < dimension_; ++k) {
+        residuals(k, j) -= centroid[k];
+      }
+    }
+
+    // Codewords beyond the number of training vectors are left at zero
+    auto num_trained = std::min<size_t>(num_codewords(), num_vectors);
+    codebooks_ = ColMajorMatrix<float>(dimension_, num_codewords());
+    std::fill(
+        codebooks_.data(),
+        codebooks_.data() + dimension_ * num_codewords(),
+        0.0f);
+
+    // Subspaces are trained concurrently, dividing the threads among them
+    size_t fine_threads = std::max<size_t>(1, nthreads_ / num_subspaces_);
+    size_t outer_threads = std::min(nthreads_, num_subspaces_);
+    std::vector<size_t> subspaces(num_subspaces_);
+    stdx::execution::indexed_parallel_policy par{outer_threads};
+    stdx::range_for_each(
+        std::move(par), subspaces, [&](auto&&, size_t n, size_t m) {
+          auto b =
+              detail::ivf::pq_subspace_begin(m, dimension_, num_subspaces_);
+          auto e = detail::ivf::pq_subspace_begin(
+              m + 1, dimension_, num_subspaces_);
+          auto sub = ColMajorMatrix<float>(e - b, num_vectors);
+          for (size_t j = 0; j < num_vectors; ++j) {
+            for (size_t i = b; i < e; ++i) {
+              sub(i - b, j) = residuals(i, j);
+            }
+          }
+          auto quantizer =
+              kmeans_type(e - b, num_trained, max_iter_, tol_, fine_threads);
+          quantizer.train(sub, kmeans_algorithm::hamerly);
+          for (size_t k = 0; k < num_trained; ++k) {
+            for (size_t i = b; i < e; ++i) {
+              codebooks_(i, k) = quantizer.get_centroids()(i - b, k);
+            }
+          }
+        });
+  }
+
+  /**
+   * @brief Encode the vectors of `db`, replacing the contents of the index.
+   * The ids of the vectors are their column numbers in `db`.
+   */
+  void add(const auto& db) {
+    scoped_timer _{__FUNCTION__};
+
+    std::vector<uint32_t> labels;
+    std::vector<uint8_t> codes;
+    encode_block(db, db.num_cols(), labels, codes);
+    shuffle(labels, codes);
+  }
+
+  /**
+   * @brief Encode the vectors supplied by `make_source`, which must return a
+   * new (unloaded) blocked matrix, replacing the contents of the index.  At
+   * most one block of vectors is resident at a time; only the codes are
+   * kept.  The ids of the vectors are their column numbers in the source.
+   *
+   * @param num_vectors Number of source vectors to add (0 means all).
+   * @return The number of vectors added.
+   */
+  template <class SourceFactory>
+    requires std::invocable<SourceFactory>
+  size_t add_blocked(SourceFactory&& make_source, size_t num_vectors = 0) {
+    scoped_timer _{__FUNCTION__};
+
+    if (num_vectors == 0) {
+      num_vectors = std::numeric_limits<size_t>::max();
+    }
+
+    std::vector<uint32_t> labels;
+    std::vector<uint8_t> codes;
+    auto db = make_source();
+    while (db.load() && db.col_offset() < num_vectors) {
+      auto n = std::min<size_t>(db.num_cols(), num_vectors - db.col_offset());
+      encode_block(db, n, labels, codes);
+    }
+    shuffle(labels, codes);
+    return size(labels);
+  }
+
+  /**
+   * @brief Find the (approximate) `k_nn` nearest neighbors of each query,
+   * searching the `nprobe` partitions closest to it.
+   *
+   * @return Matrix whose column `j` holds the ids of the neighbors of query
+   * `j`, nearest first.
+   */
+  auto search(const auto& query, size_t nprobe, size_t k_nn) {
+    if (num_bits_ == 4) {
+      return detail::ivf::fast_scan_query_infinite_ram(
+          codes_,
+          centroids_,
+          codebooks_,
+          query,
+          indices_,
+          block_indices_,
+          shuffled_ids_,
+          num_subspaces_,
+          nprobe,
+          k_nn,
+          nthreads_);
+    }
+    return detail::ivf::pq_query_infinite_ram(
+        codes_,
+        centroids_,
+        codebooks_,
+        query,
+        indices_,
+        shuffled_ids_,
+        nprobe,
+        k_nn,
+        nthreads_);
+  }
+
+  /**
+   * @brief Like `search()`, but for an index opened with `load()`, reading
+   * the codes of the probed partitions from TileDB at most `upper_bound`
+   * vectors at a time.  Only supported for 8-bit codes.
+   */
+  auto search_finite_ram(
+      tiledb::Context& ctx,
+      const auto& query,
+      size_t nprobe,
+      size_t k_nn,
+      size_t upper_bound) {
+    if (codes_uri_.empty()) {
+      throw std::runtime_error("Index has not been loaded from TileDB");
+    }
+    if (num_bits_ != 8) {
+      throw std::runtime_error(
+          "Finite RAM search is only supported for 8-bit codes");
+    }
+    return detail::ivf::pq_query_finite_ram<shuffled_ids_type>(
+        ctx,
+        codes_uri_,
+        centroids_,
+        codebooks_,
+        query,
+        indices_,
+        ids_uri_,
+        nprobe,
+        k_nn,
+        upper_bound,
+        nthreads_);
+  }
+
+  /**
+   * @brief Write the index to a new TileDB group at `group_uri`.  The group
+   * metadata records `index_type` "IVF_PQ", the number of subspaces and
+   * the number of bits per code.
+   */
+  void save(const tiledb::Context& ctx, const std::string& group_uri) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+
+    if (size(indices_) != nlist_ + 1) {
+      throw std::runtime_error("Cannot save an index that has no vectors");
+    }
+    if (tiledb::Object::object(ctx, group_uri).type() !=
+        tiledb::Object::Type::Invalid) {
+      throw std::runtime_error(group_uri + " already exists");
+    }
+
+    std::string storage_version = "0.2";
+    auto names = kmeans_type::array_names(storage_version);
+
+    tiledb::Group::create(ctx, group_uri);
+    tiledb::Group group(ctx, group_uri, TILEDB_WRITE);
+
+    auto indices = std::vector<uint64_t>(begin(indices_), end(indices_));
+    auto ids = std::vector<uint64_t>(begin(shuffled_ids_), end(shuffled_ids_));
+
+    auto centroids_uri = group_uri + "/" + names.centroids;
+    auto index_uri = group_uri + "/" + names.index;
+    auto ids_uri = group_uri + "/" + names.ids;
+    auto codebooks_uri = group_uri + "/" + codebooks_name;
+    auto codes_uri = group_uri + "/" + codes_name;
+    write_matrix(ctx, centroids_, centroids_uri);
+    write_vector(ctx, indices, index_uri);
+    write_vector(ctx, ids, ids_uri);
+    write_matrix(ctx, codebooks_, codebooks_uri);
+    write_matrix(ctx, codes_, codes_uri);
+
+    group.add_member(centroids_uri, false, names.centroids);
+    group.add_member(index_uri, false, names.index);
+    group.add_member(ids_uri, false, names.ids);
+    group.add_member(codebooks_uri, false, codebooks_name);
+    group.add_member(codes_uri, false, codes_name);
+
+    int64_t partitions = nlist_;
+    int64_t num_subspaces = num_subspaces_;
+    int64_t num_bits = num_bits_;
+    put_string_metadata(group, "dataset_type", "vector_search");
+    put_string_metadata(group, "index_type", "IVF_PQ");
+    put_string_metadata(group, "dtype", dtype_name<T>());
+    group.put_metadata("partitions", TILEDB_INT64, 1, &partitions);
+    group.put_metadata("num_subspaces", TILEDB_INT64, 1, &num_subspaces);
+    group.put_metadata("num_bits", TILEDB_INT64, 1, &num_bits);
+    put_string_metadata(group, "storage_version", storage_version);
+    group.close();
+  }
+
+  /**
+   * @brief Open an index from the TileDB group at `group_uri`, as written by
+   * `save()`.  The codes and ids are only read if `load_codes` is true;
+   * otherwise the index can only be queried with `search_finite_ram()`.
+   */
+  void load(
+      const tiledb::Context& ctx,
+      const std::string& group_uri,
+      bool load_codes = true) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+
+    tiledb::Group group(ctx, group_uri, TILEDB_READ);
+    if (get_string_metadata(group, "index_type", "") != "IVF_PQ") {
+      throw std::runtime_error(group_uri + " is not an IVF_PQ index");
+    }
+    auto dtype = get_string_metadata(group, "dtype", dtype_name<T>());
+    if (dtype != dtype_name<T>()) {
+      throw std::runtime_error(
+          "Index at " + group_uri + " has dtype " + dtype + ", expected " +
+          dtype_name<T>());
+    }
+    auto storage_version =
+        get_string_metadata(group, "storage_version", "0.2");
+    auto names = kmeans_type::array_names(storage_version);
+
+    tiledb_datatype_t type;
+    uint32_t num;
+    const void* value = nullptr;
+    group.get_metadata("num_subspaces", &type, &num, &value);
+    if (value == nullptr || type != TILEDB_INT64) {
+      throw std::runtime_error("Missing num_subspaces in " + group_uri);
+    }
+    num_subspaces_ = *static_cast<const int64_t*>(value);
+
+    // Indexes written before 4-bit codes were supported have 8-bit codes
+    value = nullptr;
+    group.get_metadata("num_bits", &type, &num, &value);
+    num_bits_ = (value != nullptr && type == TILEDB_INT64) ?
+                    *static_cast<const int64_t*>(value) :
+                    8;
+
+    auto centroids =
+        tdbColMajorMatrix<float>(ctx, group.member(names.centroids).uri());
+    centroids.load();
+    dimension_ = centroids.num_rows();
+    nlist_ = centroids.num_cols();
+    centroids_ = std::move(static_cast<ColMajorMatrix<float>&>(centroids));
+
+    auto codebooks =
+        tdbColMajorMatrix<float>(ctx, group.member(codebooks_name).uri());
+    codebooks.load();
+    codebooks_ = std::move(static_cast<ColMajorMatrix<float>&>(codebooks));
+
+    auto indices = read_vector<uint64_t>(ctx, group.member(names.index).uri());
+    if (size(indices) != nlist_ + 1) {
+      throw std::runtime_error(
+          "Size of partition index does not match number of centroids");
+    }
+    indices_ = std::vector<indices_type>(begin(indices), end(indices));
+    block_indices_.clear();
+    if (num_bits_ == 4) {
+      block_indices_ = detail::ivf::fast_scan_block_indices(indices_);
+    }
+
+    codes_uri_ = group.member(codes_name).uri();
+    ids_uri_ = group.member(names.ids).uri();
+
+    if (load_codes) {
+      auto ids = read_vector<uint64_t>(ctx, ids_uri_);
+      shuffled_ids_ = std::vector<shuffled_ids_type>(begin(ids), end(ids));
+      auto codes = tdbColMajorMatrix<uint8_t>(ctx, codes_uri_);
+      codes.load();
+      codes_ = std::move(static_cast<ColMajorMatrix<uint8_t>&>(codes));
+    } else {
+      shuffled_ids_.clear();
+      codes_ = ColMajorMatrix<uint8_t>{};
+    }
+    group.close();
+  }
+
+  void set_nthreads(size_t nthreads) {
+    nthreads_ = nthreads == 0 ? std::thread::hardware_concurrency() : nthreads;
+  }
+
+  size_t dimension() const {
+    return dimension_;
+  }
+
+  size_t num_subspaces() const {
+    return num_subspaces_;
+  }
+
+  size_t num_bits() const {
+    return num_bits_;
+  }
+
+  auto& get_centroids() {
+    return centroids_;
+  }
+
+  auto& get_codebooks() {
+    return codebooks_;
+  }
+
+  auto& get_codes() {
+    return codes_;
+  }
+
+  auto& get_indices() {
+    return indices_;
+  }
+
+  auto& get_ids() {
+    return shuffled_ids_;
+  }
+};
+
+#endif  // TILEDB_IVF_PQ_INDEX_H
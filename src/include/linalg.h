@@ -36,7 +36,8 @@
  * their storage while also presenting the span and mdspan interfaces.
  *
  * The tdbMatrix class is derived from Matrix, but gets its initial data
- * from a given TileDB array.
+ * from a given TileDB array.  Similarly, mmapBlockedMatrix gets its data from
+ * a local file in one of the standard benchmark formats (fvecs, etc).
  *
  */
 
@@ -46,6 +47,8 @@
 #include "detail/linalg/choose_blas.h"
 #include "detail/linalg/linalg_defs.h"
 #include "detail/linalg/matrix.h"
+#include "detail/linalg/mmap_matrix.h"
+#include "detail/linalg/sq8.h"
 #include "detail/linalg/tdb_helpers.h"
 #include "detail/linalg/tdb_io.h"
 #include "detail/linalg/tdb_matrix.h"
@@ -0,0 +1,108 @@
+/**
+ * @file   test_utils.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Generators of test data and a recall measure shared by the unit tests.
+ *
+ */
+
+#ifndef TDB_TEST_UTILS_H
+#define TDB_TEST_UTILS_H
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "../defs.h"
+#include "../linalg.h"
+
+/**
+ * `n` vectors uniformly distributed in [-100, 100]^dimension.
+ */
+inline auto uniform_vectors(size_t dimension, size_t n, unsigned seed = 1234) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> dist(-100, 100);
+  ColMajorMatrix<float> data(dimension, n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < dimension; ++j) {
+      data(j, i) = dist(gen);
+    }
+  }
+  return data;
+}
+
+/**
+ * `num_clusters` gaussian blobs of `n` vectors each, with centers spaced far
+ * apart relative to the spread of each blob.  Vector `i` belongs to blob
+ * `i % num_clusters`.
+ */
+inline auto gaussian_blobs(size_t dimension, size_t num_clusters, size_t n) {
+  std::mt19937 gen(1234);
+  std::uniform_real_distribution<float> center_dist(-1000, 1000);
+  std::normal_distribution<float> noise(0, 10);
+  ColMajorMatrix<float> centers(dimension, num_clusters);
+  for (size_t i = 0; i < num_clusters; ++i) {
+    for (size_t j = 0; j < dimension; ++j) {
+      centers(j, i) = center_dist(gen);
+    }
+  }
+  ColMajorMatrix<float> data(dimension, num_clusters * n);
+  for (size_t i = 0; i < num_clusters * n; ++i) {
+    for (size_t j = 0; j < dimension; ++j) {
+      data(j, i) = centers(j, i % num_clusters) + noise(gen);
+    }
+  }
+  return data;
+}
+
+/**
+ * Fraction of the exact `k_nn` nearest neighbors of each query found in
+ * `top_k`.
+ */
+inline double recall(
+    const ColMajorMatrix<float>& data,
+    const ColMajorMatrix<float>& query,
+    const ColMajorMatrix<size_t>& top_k,
+    size_t k_nn) {
+  size_t found = 0;
+  for (size_t j = 0; j < query.num_cols(); ++j) {
+    std::vector<std::tuple<float, size_t>> scores(data.num_cols());
+    for (size_t i = 0; i < data.num_cols(); ++i) {
+      scores[i] = {L2(query[j], data[i]), i};
+    }
+    std::partial_sort(begin(scores), begin(scores) + k_nn, end(scores));
+    for (size_t i = 0; i < k_nn; ++i) {
+      auto id = std::get<1>(scores[i]);
+      found += std::find(begin(top_k[j]), end(top_k[j]), id) != end(top_k[j]);
+    }
+  }
+  return static_cast<double>(found) / (query.num_cols() * k_nn);
+}
+
+#endif  // TDB_TEST_UTILS_H
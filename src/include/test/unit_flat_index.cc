@@ -0,0 +1,353 @@
+/**
+ * @file   unit_flat_index.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include <catch2/catch_all.hpp>
+
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "../defs.h"
+#include "../detail/flat/groundtruth.h"
+#include "../detail/flat/qv.h"
+#include "../flat_index.h"
+#include "../linalg.h"
+
+bool global_debug = false;
+
+/**
+ * `n` random vectors with elements in [0, 255], as type `T`.
+ */
+template <class T>
+auto flat_random(size_t dimension, size_t n, unsigned seed = 1234) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> dist(0, 255);
+  ColMajorMatrix<T> data(dimension, n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < dimension; ++j) {
+      data(j, i) = static_cast<T>(dist(gen));
+    }
+  }
+  return data;
+}
+
+/**
+ * Check that `scores` and `ids` hold the exact `k_nn` nearest neighbors of
+ * each query, nearest first.  The ids are column numbers of `data`.
+ */
+template <class T>
+void check_exact(
+    const ColMajorMatrix<T>& data,
+    const ColMajorMatrix<float>& query,
+    const ColMajorMatrix<float>& scores,
+    const ColMajorMatrix<size_t>& ids,
+    size_t k_nn) {
+  for (size_t j = 0; j < query.num_cols(); ++j) {
+    std::vector<float> expected(data.num_cols());
+    for (size_t i = 0; i < data.num_cols(); ++i) {
+      expected[i] = L2(query[j], data[i]);
+    }
+    std::sort(begin(expected), end(expected));
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(scores(i, j) == expected[i]);
+      // Ties may be reported in either order
+      CHECK(L2(query[j], data[ids(i, j)]) == expected[i]);
+    }
+  }
+}
+
+TEST_CASE("flat_index: test test", "[flat_index]") {
+  REQUIRE(true);
+}
+
+TEST_CASE("flat_index: kernels", "[flat_index]") {
+  size_t dimension = 8;
+  size_t k_nn = 7;
+  auto data = flat_random<uint8_t>(dimension, 500);
+  auto query = flat_random<float>(dimension, 13, 5678);
+
+  auto copy = ColMajorMatrix<uint8_t>(dimension, data.num_cols());
+  std::copy(
+      data.data(), data.data() + dimension * data.num_cols(), copy.data());
+  auto index = flat_index<uint8_t>(std::move(copy), {}, 4);
+  CHECK(index.dimension() == dimension);
+  CHECK(index.num_vectors() == 500);
+
+  // The elements are small integers, so gemm scores are exact too
+  std::vector<flat_kernel> kernels{
+      flat_kernel::automatic, flat_kernel::qv, flat_kernel::vq};
+#if defined(TILEDB_VS_ENABLE_BLAS)
+  kernels.push_back(flat_kernel::gemm);
+#endif
+  for (auto kernel : kernels) {
+    index.set_kernel(kernel);
+    auto&& [scores, ids] = index.search(query, k_nn);
+    check_exact(data, query, scores, ids, k_nn);
+
+    // A single query, and more threads than queries
+    auto one = ColMajorMatrix<float>(dimension, 1);
+    std::copy(query.data(), query.data() + dimension, one.data());
+    auto&& [one_scores, one_ids] = index.search(one, k_nn);
+    check_exact(data, one, one_scores, one_ids, k_nn);
+  }
+
+#if !defined(TILEDB_VS_ENABLE_BLAS)
+  index.set_kernel(flat_kernel::gemm);
+  CHECK_THROWS(index.search(query, k_nn));
+#endif
+
+  auto wrong = ColMajorMatrix<float>(dimension + 1, 1);
+  CHECK_THROWS(index.search(wrong, k_nn));
+}
+
+TEST_CASE("flat_index: ids and padding", "[flat_index]") {
+  size_t dimension = 4;
+  auto data = flat_random<float>(dimension, 3);
+  auto copy = ColMajorMatrix<float>(dimension, 3);
+  std::copy(data.data(), data.data() + dimension * 3, copy.data());
+
+  CHECK_THROWS(flat_index<float>(ColMajorMatrix<float>(dimension, 3), {1, 2}));
+
+  auto index = flat_index<float>(std::move(copy), {30, 10, 20}, 2);
+  auto&& [scores, ids] = index.search(data, 5);
+  for (size_t j = 0; j < 3; ++j) {
+    CHECK(scores(0, j) == 0);
+    CHECK(ids(0, j) == 10 * ((j + 2) % 3 + 1));
+    CHECK(scores(3, j) == std::numeric_limits<float>::max());
+    CHECK(ids(3, j) == std::numeric_limits<size_t>::max());
+  }
+}
+
+TEST_CASE("flat_index: deletions", "[flat_index]") {
+  size_t dimension = 8;
+  size_t k_nn = 5;
+  auto data = flat_random<float>(dimension, 300);
+  auto query = flat_random<float>(dimension, 10, 5678);
+
+  // Ids are the column numbers plus 1000
+  auto copy = ColMajorMatrix<float>(dimension, data.num_cols());
+  std::copy(
+      data.data(), data.data() + dimension * data.num_cols(), copy.data());
+  std::vector<uint64_t> ids(data.num_cols());
+  std::iota(begin(ids), end(ids), 1000);
+  auto index = flat_index<float>(std::move(copy), ids, 3);
+
+  // Delete the nearest neighbor of each query
+  auto&& [scores, found] = index.search(query, k_nn);
+  std::vector<uint64_t> deleted(query.num_cols());
+  for (size_t j = 0; j < query.num_cols(); ++j) {
+    deleted[j] = found(0, j);
+  }
+  index.remove(deleted);
+  CHECK(index.deleted().count() <= query.num_cols());
+
+  // Ids not in the index are ignored
+  auto num_deleted = index.deleted().count();
+  index.remove({5, 1u << 30});
+  CHECK(index.deleted().count() == num_deleted);
+  CHECK(!index.deleted().contains(1u << 30));
+  CHECK(!index.deleted().contains(5));
+
+  std::vector<flat_kernel> kernels{flat_kernel::qv, flat_kernel::vq};
+#if defined(TILEDB_VS_ENABLE_BLAS)
+  kernels.push_back(flat_kernel::gemm);
+#endif
+  for (auto kernel : kernels) {
+    index.set_kernel(kernel);
+    auto&& [after_scores, after] = index.search(query, k_nn);
+    for (size_t j = 0; j < query.num_cols(); ++j) {
+      for (size_t i = 0; i < k_nn; ++i) {
+        CHECK(
+            std::find(begin(deleted), end(deleted), after(i, j)) ==
+            end(deleted));
+      }
+    }
+  }
+
+  // Clearing the deletions restores the original results
+  index.set_deleted(id_bitmap{});
+  auto&& [restored_scores, restored] = index.search(query, k_nn);
+  CHECK(std::equal(
+      found.data(), found.data() + k_nn * query.num_cols(), restored.data()));
+
+  // The kernel for unindexed databases skips columns too
+  auto top_k = detail::flat::qv_query_heap(
+      data, query, k_nn, 2, [](size_t i) { return i % 2 == 0; });
+  for (size_t j = 0; j < query.num_cols(); ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(top_k(i, j) % 2 == 0);
+    }
+  }
+}
+
+TEST_CASE("flat_index: accumulate ranges", "[flat_index]") {
+  size_t dimension = 8;
+  size_t k_nn = 6;
+  auto data = flat_random<float>(dimension, 400);
+  auto query = flat_random<float>(dimension, 40, 5678);
+
+  auto copy = ColMajorMatrix<float>(dimension, data.num_cols());
+  std::copy(
+      data.data(), data.data() + dimension * data.num_cols(), copy.data());
+  auto index = flat_index<float>(std::move(copy), {}, 3);
+
+  std::vector<flat_kernel> kernels{flat_kernel::qv, flat_kernel::vq};
+#if defined(TILEDB_VS_ENABLE_BLAS)
+  kernels.push_back(flat_kernel::gemm);
+#endif
+  for (auto kernel : kernels) {
+    index.set_kernel(kernel);
+    // Several gemms per block
+    index.set_query_block(7);
+
+    using heap_type = flat_index<float>::heap_type;
+    std::vector<heap_type> min_scores(query.num_cols(), heap_type(k_nn));
+    // A range of one vector, an empty one and one past the end
+    std::vector<std::pair<size_t, size_t>> ranges{
+        {0, 150}, {150, 151}, {151, 151}, {151, 300}, {300, 1000}};
+    for (auto&& [first, last] : ranges) {
+      index.accumulate(query, k_nn, first, last, min_scores);
+    }
+    auto&& [scores, ids] = index.top_k(min_scores, k_nn);
+    check_exact(data, query, scores, ids, k_nn);
+  }
+}
+
+TEST_CASE("flat_index: streaming", "[flat_index][read-write]") {
+  size_t dimension = 8;
+  size_t k_nn = 5;
+  auto data = flat_random<float>(dimension, 1000);
+  auto query = flat_random<float>(dimension, 20, 5678);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+  auto ids_uri = uri + "_ids";
+
+  tiledb::Context ctx;
+  write_matrix(ctx, data, uri);
+  std::vector<uint64_t> ids(data.num_cols());
+  std::iota(begin(ids), end(ids), 100);
+  write_vector(ctx, ids, ids_uri);
+
+  CHECK_THROWS(flat_index<uint8_t>(ctx, uri));
+
+  // Whole array, and blocks of 30 columns (the last one short)
+  for (size_t budget : {size_t{0}, 2 * 30 * dimension * sizeof(float)}) {
+    auto index = flat_index<float>(ctx, uri, "", budget, 3);
+    CHECK(index.num_vectors() == data.num_cols());
+    auto&& [scores, top_ids] = index.search(query, k_nn);
+    check_exact(data, query, scores, top_ids, k_nn);
+  }
+
+  auto index = flat_index<float>(ctx, uri, ids_uri, 4096, 2);
+  auto&& [scores, top_ids] = index.search(data, 1);
+  for (size_t j = 0; j < data.num_cols(); ++j) {
+    CHECK(scores(0, j) == 0);
+    CHECK(top_ids(0, j) == j + 100);
+  }
+
+  std::filesystem::remove_all(uri);
+  std::filesystem::remove_all(ids_uri);
+}
+
+TEST_CASE("flat_index: groundtruth checkpoints", "[flat_index][read-write]") {
+  size_t dimension = 8;
+  size_t k_nn = 10;
+  auto data = flat_random<uint8_t>(dimension, 1000);
+  auto query = flat_random<float>(dimension, 25, 5678);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+  auto gt_ids_uri = uri + "_gt_ids";
+  auto gt_distances_uri = uri + "_gt_distances";
+  auto checkpoint_uri = uri + "_checkpoint";
+
+  tiledb::Context ctx;
+  write_matrix(ctx, data, uri);
+  auto index = flat_index<uint8_t>(ctx, uri, "", 2 * 64 * dimension, 2);
+
+  // Stop after two checkpoints of 300 vectors, then resume
+  CHECK(!detail::flat::blocked_groundtruth<int32_t>(
+      ctx,
+      index,
+      query,
+      k_nn,
+      gt_ids_uri,
+      gt_distances_uri,
+      checkpoint_uri,
+      300,
+      2));
+  CHECK(detail::flat::blocked_groundtruth<int32_t>(
+      ctx,
+      index,
+      query,
+      k_nn,
+      gt_ids_uri,
+      gt_distances_uri,
+      checkpoint_uri,
+      300));
+
+  // A checkpoint is only valid for the problem it was written for
+  CHECK_THROWS(detail::flat::blocked_groundtruth<int32_t>(
+      ctx,
+      index,
+      query,
+      k_nn + 1,
+      gt_ids_uri + "_x",
+      gt_distances_uri + "_x",
+      checkpoint_uri,
+      300));
+
+  auto gt_ids = tdbColMajorMatrix<int32_t>(ctx, gt_ids_uri);
+  gt_ids.load();
+  auto gt_distances = tdbColMajorMatrix<float>(ctx, gt_distances_uri);
+  gt_distances.load();
+  auto ids = ColMajorMatrix<size_t>(k_nn, query.num_cols());
+  for (size_t j = 0; j < query.num_cols(); ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      ids(i, j) = gt_ids(i, j);
+    }
+  }
+  check_exact(
+      data,
+      query,
+      static_cast<ColMajorMatrix<float>&>(gt_distances),
+      ids,
+      k_nn);
+
+  std::filesystem::remove_all(uri);
+  std::filesystem::remove_all(gt_ids_uri);
+  std::filesystem::remove_all(gt_distances_uri);
+  std::filesystem::remove_all(checkpoint_uri);
+}
@@ -0,0 +1,132 @@
+/**
+ * @file   unit_hnsw_index.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include <catch2/catch_all.hpp>
+
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "../defs.h"
+#include "../hnsw_index.h"
+#include "../linalg.h"
+#include "test_utils.h"
+
+bool global_debug = false;
+
+TEST_CASE("hnsw_index: test test", "[hnsw_index]") {
+  REQUIRE(true);
+}
+
+TEST_CASE("hnsw_index: build and search", "[hnsw_index]") {
+  size_t dimension = 16;
+  size_t num_vectors = 2000;
+  size_t M = 8;
+  size_t k_nn = 10;
+  auto data = uniform_vectors(dimension, num_vectors);
+  auto query = uniform_vectors(dimension, 50, 5678);
+
+  CHECK_THROWS(hnsw_index<float>(dimension, 1));
+
+  auto index = hnsw_index<float>(dimension, M, 100, 4);
+  index.add(data);
+  CHECK(index.num_vectors() == num_vectors);
+  REQUIRE(index.max_level() >= 0);
+
+  // Degrees are bounded, and links are to other nodes
+  for (size_t i = 0; i < num_vectors; ++i) {
+    auto&& neighbors = index.neighbors(i, 0);
+    CHECK(size(neighbors) <= 2 * M);
+    CHECK(!neighbors.empty());
+    CHECK(std::find(begin(neighbors), end(neighbors), i) == end(neighbors));
+  }
+
+  // Every vector is its own nearest neighbor
+  auto self = index.search(data, 1);
+  size_t found = 0;
+  for (size_t i = 0; i < num_vectors; ++i) {
+    found += self(0, i) == i;
+  }
+  CHECK(found >= num_vectors * 99 / 100);
+
+  // A wider beam finds more of the true neighbors
+  index.set_ef_search(10);
+  auto narrow = recall(data, query, index.search(query, k_nn), k_nn);
+  index.set_ef_search(200);
+  auto wide = recall(data, query, index.search(query, k_nn), k_nn);
+  CHECK(wide >= narrow);
+  CHECK(wide >= 0.95);
+
+  // Ids are reported rather than positions, and missing results are padded
+  auto small = hnsw_index<float>(dimension, M, 100, 2);
+  ColMajorMatrix<float> three(dimension, 3);
+  std::copy(data.data(), data.data() + 3 * dimension, three.data());
+  small.add(three, {30, 10, 20});
+  auto top_k = small.search(three, 5);
+  for (size_t j = 0; j < 3; ++j) {
+    CHECK(top_k(0, j) == 10 * ((j + 2) % 3 + 1));
+    CHECK(top_k(3, j) == std::numeric_limits<size_t>::max());
+  }
+}
+
+TEST_CASE("hnsw_index: save and load", "[hnsw_index][read-write]") {
+  size_t dimension = 8;
+  auto data = uniform_vectors(dimension, 500);
+
+  auto index = hnsw_index<float>(dimension, 8, 50, 2);
+  index.add(data);
+  index.set_ef_search(32);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+
+  tiledb::Context ctx;
+  index.save(ctx, uri);
+  CHECK_THROWS(index.save(ctx, uri));
+
+  auto loaded = hnsw_index<float>(0);
+  loaded.load(ctx, uri);
+  CHECK(loaded.dimension() == dimension);
+  CHECK(loaded.M() == 8);
+  CHECK(loaded.ef_search() == 32);
+  CHECK(loaded.max_level() == index.max_level());
+
+  auto expected = index.search(data, 5);
+  auto found = loaded.search(data, 5);
+  CHECK(std::equal(
+      expected.data(), expected.data() + 5 * data.num_cols(), found.data()));
+
+  auto wrong_type = hnsw_index<uint8_t>(0);
+  CHECK_THROWS(wrong_type.load(ctx, uri));
+
+  std::filesystem::remove_all(uri);
+}
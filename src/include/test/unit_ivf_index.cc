@@ -31,13 +31,20 @@
 
 #include <catch2/catch_all.hpp>
 
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <random>
+#include <set>
 #include <vector>
 
 #include "../defs.h"
+#include "../detail/ivf/ingest.h"
+#include "../detail/ivf/rerank.h"
 #include "../ivf_index.h"
 #include "../linalg.h"
+#include "test_utils.h"
 
 bool global_debug = false;
 
@@ -57,6 +64,1287 @@ void debug_centroids(auto& index) {
   std::cout << std::endl;
 }
 
+/**
+ * Three well separated clusters of `n` vectors each, around (10, 10, 10, 10),
+ * (100, 10, 10, 100) and (10, 100, 100, 10).
+ */
+template <class T = float>
+auto three_clusters(size_t n) {
+  std::vector<std::array<float, 4>> centers = {
+      {10, 10, 10, 10}, {100, 10, 10, 100}, {10, 100, 100, 10}};
+  ColMajorMatrix<T> training_data(4, 3 * n);
+  for (size_t i = 0; i < 3 * n; ++i) {
+    for (size_t j = 0; j < 4; ++j) {
+      training_data(j, i) = centers[i % 3][j] + (i / 3 + j) % 5;
+    }
+  }
+  return std::make_tuple(std::move(training_data), centers);
+}
+
+template <class Index>
+void check_three_clusters(
+    Index& index, const std::vector<std::array<float, 4>>& centers) {
+  for (auto&& c : centers) {
+    float min_score = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < index.get_centroids().num_cols(); ++i) {
+      min_score = std::min(min_score, L2(c, index.get_centroids()[i]));
+    }
+    CHECK(min_score < 4 * 4 * 4);
+  }
+}
+
+TEST_CASE("ivf_index: mini batch kmeans", "[ivf_index]") {
+  SECTION("float") {
+    auto&& [training_data, centers] = three_clusters<float>(200);
+    auto index = kmeans_index<float, uint32_t, uint32_t>(4, 3, 5, 1e-4, 2);
+    index.train_mini_batch_pass(training_data, 32);
+    check_three_clusters(index, centers);
+    auto shift = index.train_mini_batch_pass(training_data, 32);
+    CHECK(shift < 4 * 4 * 4);
+  }
+
+  SECTION("uint8_t") {
+    auto&& [training_data, centers] = three_clusters<uint8_t>(200);
+    auto index = kmeans_index<float, uint32_t, uint32_t>(4, 3, 5, 1e-4, 2);
+    index.train_mini_batch_pass(training_data, 50, 450);
+    check_three_clusters(index, centers);
+  }
+}
+
+TEST_CASE("ivf_index: hamerly matches lloyd", "[ivf_index]") {
+  size_t dimension = 16;
+  size_t nlist = 12;
+  size_t max_iter = 8;
+  auto training_data = gaussian_blobs(dimension, nlist, 100);
+
+  auto lloyd = kmeans_index<float, uint32_t, uint32_t>(
+      dimension, nlist, max_iter, 1e-4, 4);
+  auto hamerly = kmeans_index<float, uint32_t, uint32_t>(
+      dimension, nlist, max_iter, 1e-4, 4);
+  lloyd.kmeans_pp(training_data);
+  std::copy(
+      lloyd.get_centroids().data(),
+      lloyd.get_centroids().data() + dimension * nlist,
+      hamerly.get_centroids().data());
+
+  lloyd.train_no_init(training_data);
+  auto num_distances = hamerly.train_hamerly_no_init(training_data);
+  CHECK(num_distances < training_data.num_cols() * nlist * max_iter);
+
+  // Only the partitions that hold vectors are compared, so that the test
+  // does not depend on where either variant leaves an empty centroid
+  auto parts =
+      detail::flat::qv_partition(lloyd.get_centroids(), training_data, 4);
+  std::vector<size_t> degrees(nlist, 0);
+  for (auto p : parts) {
+    ++degrees[p];
+  }
+  CHECK(std::count(begin(degrees), end(degrees), 0) < nlist / 2);
+  for (size_t i = 0; i < nlist; ++i) {
+    if (degrees[i] == 0) {
+      continue;
+    }
+    for (size_t j = 0; j < dimension; ++j) {
+      CHECK(
+          std::abs(
+              hamerly.get_centroids()(j, i) - lloyd.get_centroids()(j, i)) <
+          1e-2);
+    }
+  }
+}
+
+TEST_CASE("ivf_index: kmeans|| initialization", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 10;
+  auto training_data = gaussian_blobs(dimension, nlist, 50);
+
+  auto index =
+      kmeans_index<float, uint32_t, uint32_t>(dimension, nlist, 10, 1e-4, 4);
+  index.kmeans_parallel_init(training_data);
+
+  auto& centroids = index.get_centroids();
+  CHECK(centroids.num_cols() == nlist);
+
+  // Every centroid is a distinct training vector
+  for (size_t i = 0; i < nlist; ++i) {
+    size_t matches = 0;
+    for (size_t j = 0; j < training_data.num_cols(); ++j) {
+      matches += std::equal(
+          centroids[i].begin(), centroids[i].end(), training_data[j].begin());
+    }
+    CHECK(matches == 1);
+    for (size_t j = i + 1; j < nlist; ++j) {
+      CHECK(!std::equal(
+          centroids[i].begin(), centroids[i].end(), centroids[j].begin()));
+    }
+  }
+
+  // Well separated blobs should each get a centroid of their own
+  for (size_t c = 0; c < nlist; ++c) {
+    float min_score = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < nlist; ++i) {
+      min_score = std::min(min_score, L2(training_data[c], centroids[i]));
+    }
+    CHECK(min_score < 4 * 4 * 10 * 10 * dimension);
+  }
+
+  // Too few training vectors for kmeans||, so kmeans++ is used instead
+  auto small = ColMajorMatrix<float>(dimension, nlist / 2);
+  std::copy(
+      training_data.data(),
+      training_data.data() + dimension * (nlist / 2),
+      small.data());
+  auto small_index =
+      kmeans_index<float, uint32_t, uint32_t>(dimension, nlist, 10, 1e-4, 4);
+  CHECK_NOTHROW(small_index.train(small));
+}
+
+TEST_CASE("ivf_index: balanced kmeans", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 8;
+
+  // Vector i of the blobs belongs to blob i % nlist.  Keep all of blob 0 but
+  // only a fifth of each of the others.
+  auto blobs = gaussian_blobs(dimension, nlist, 100);
+  std::vector<size_t> keep;
+  for (size_t i = 0; i < blobs.num_cols(); ++i) {
+    if (i % nlist == 0 || i < 20 * nlist) {
+      keep.push_back(i);
+    }
+  }
+  ColMajorMatrix<float> training_data(dimension, size(keep));
+  for (size_t i = 0; i < size(keep); ++i) {
+    std::copy(
+        begin(blobs[keep[i]]), end(blobs[keep[i]]), begin(training_data[i]));
+  }
+
+  auto index =
+      kmeans_index<float, uint32_t, uint32_t>(dimension, nlist, 10, 1e-4, 4);
+  index.set_partition_size_limits(1.25, 0.5);
+  index.kmeans_pp(training_data);
+  auto parts = index.train_balanced_no_init(training_data);
+
+  CHECK(size(parts) == training_data.num_cols());
+  std::vector<size_t> sizes(nlist, 0);
+  for (auto&& p : parts) {
+    REQUIRE(p < nlist);
+    ++sizes[p];
+  }
+  double mean = training_data.num_cols() / (double)nlist;
+  for (auto&& s : sizes) {
+    CHECK(s <= std::ceil(1.25 * mean));
+    CHECK(s >= 0.5 * mean);
+  }
+}
+
+TEST_CASE("ivf_index: balanced partitions after add", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 8;
+
+  // As above, blob 0 holds five times as many vectors as the others
+  auto blobs = gaussian_blobs(dimension, nlist, 100);
+  std::vector<size_t> keep;
+  for (size_t i = 0; i < blobs.num_cols(); ++i) {
+    if (i % nlist == 0 || i < 20 * nlist) {
+      keep.push_back(i);
+    }
+  }
+  ColMajorMatrix<float> db(dimension, size(keep));
+  for (size_t i = 0; i < size(keep); ++i) {
+    std::copy(begin(blobs[keep[i]]), end(blobs[keep[i]]), begin(db[i]));
+  }
+
+  auto index =
+      kmeans_index<float, uint32_t, uint32_t>(dimension, nlist, 10, 1e-4, 4);
+  index.set_partition_size_limits(1.25, 0.5);
+  index.train(db, kmeans_algorithm::balanced, kmeans_init::kmeanspp);
+  CHECK(index.balanced());
+  index.add(db);
+
+  auto& indices = index.get_indices();
+  REQUIRE(size(indices) == nlist + 1);
+  CHECK(indices[nlist] == db.num_cols());
+  auto capacity = index.partition_capacity(db.num_cols());
+  CHECK(capacity == std::ceil(1.25 * db.num_cols() / (double)nlist));
+  for (size_t j = 0; j < nlist; ++j) {
+    CHECK(indices[j + 1] - indices[j] <= capacity);
+  }
+
+  // Every vector is stored exactly once
+  auto ids = index.get_shuffled_ids();
+  std::sort(begin(ids), end(ids));
+  for (size_t i = 0; i < size(ids); ++i) {
+    CHECK(ids[i] == i);
+  }
+
+  // Training with another algorithm turns the cap off
+  index.train(db, kmeans_algorithm::lloyd, kmeans_init::none);
+  CHECK(!index.balanced());
+}
+
+TEST_CASE("ivf_index: hierarchical kmeans", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t num_coarse = 6;
+  size_t nlist = 27;
+  auto training_data = gaussian_blobs(dimension, num_coarse, 200);
+
+  auto index =
+      kmeans_index<float, uint32_t, uint32_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train_hierarchical(training_data, num_coarse);
+
+  auto& coarse = index.get_coarse_centroids();
+  auto& offsets = index.get_coarse_offsets();
+  CHECK(coarse.num_cols() == num_coarse);
+  REQUIRE(size(offsets) == num_coarse + 1);
+  CHECK(offsets[0] == 0);
+  CHECK(offsets[num_coarse] == nlist);
+
+  // Equal sized blobs each get their share of the fine centroids, and each
+  // fine centroid lies in the coarse partition it is mapped to
+  auto& centroids = index.get_centroids();
+  for (size_t c = 0; c < num_coarse; ++c) {
+    CHECK(offsets[c + 1] - offsets[c] >= nlist / num_coarse);
+    CHECK(offsets[c + 1] - offsets[c] <= nlist / num_coarse + 1);
+    for (auto j = offsets[c]; j < offsets[c + 1]; ++j) {
+      size_t nearest = 0;
+      for (size_t k = 1; k < num_coarse; ++k) {
+        if (L2(centroids[j], coarse[k]) < L2(centroids[j], coarse[nearest])) {
+          nearest = k;
+        }
+      }
+      CHECK(nearest == c);
+    }
+  }
+}
+
+TEST_CASE("ivf_index: coarse quantizer", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t num_blobs = 8;
+  size_t nlist = 64;
+  size_t nprobe = 4;
+  auto data = gaussian_blobs(dimension, num_blobs, 100);
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+
+  // Searching every coarse partition selects exactly the same partitions as
+  // scoring all of the centroids
+  index.set_coarse_quantizer(1, nlist);
+  index.add(data);
+
+  auto& quantizer = index.get_coarse_quantizer();
+  auto& offsets = index.get_coarse_offsets();
+  auto members = index.get_coarse_members();
+  REQUIRE(quantizer.num_fine() == nlist);
+  CHECK(index.get_coarse_centroids().num_cols() == 8);
+  REQUIRE(size(offsets) == 9);
+  CHECK(offsets[8] == nlist);
+  std::sort(begin(members), end(members));
+  for (size_t i = 0; i < nlist; ++i) {
+    CHECK(members[i] == i);
+  }
+
+  ColMajorMatrix<float> query(dimension, 2 * num_blobs);
+  for (size_t j = 0; j < 2 * num_blobs; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+  auto&& [coarse_parts, coarse_queries] = detail::ivf::partition_ivf_index(
+      quantizer, index.get_centroids(), query, nprobe, 4);
+  auto&& [flat_parts, flat_queries] = detail::ivf::partition_ivf_index(
+      index.get_centroids(), query, nprobe, 4);
+  CHECK(coarse_parts == flat_parts);
+  CHECK(coarse_queries == flat_queries);
+
+  // And so do the coarse query kernels
+  auto coarse_top_k = detail::ivf::coarse_query_infinite_ram(
+      index.get_shuffled_db(),
+      quantizer,
+      index.get_centroids(),
+      query,
+      index.get_indices(),
+      index.get_shuffled_ids(),
+      nprobe,
+      3,
+      4,
+      [](auto&&) { return true; });
+  auto flat_top_k = detail::ivf::query_infinite_ram(
+      index.get_shuffled_db(),
+      index.get_centroids(),
+      query,
+      index.get_indices(),
+      index.get_shuffled_ids(),
+      nprobe,
+      3,
+      false,
+      4);
+  REQUIRE(coarse_top_k.num_cols() == flat_top_k.num_cols());
+  for (size_t j = 0; j < coarse_top_k.num_cols(); ++j) {
+    CHECK(std::equal(
+        begin(coarse_top_k[j]), end(coarse_top_k[j]), begin(flat_top_k[j])));
+  }
+
+  // With well separated blobs, the nearest coarse partitions hold the
+  // partitions that matter
+  index.set_coarse_quantizer(1, 2);
+  auto top_k = index.search(query, nprobe, 1);
+  for (size_t j = 0; j < 2 * num_blobs; ++j) {
+    CHECK(top_k(0, j) == j);
+  }
+}
+
+TEST_CASE("ivf_index: invert top centroids", "[ivf_index]") {
+  size_t num_parts = 50;
+  size_t nprobe = 4;
+  size_t num_queries = GENERATE(0, 1, 7, 100);
+  size_t nthreads = GENERATE(1, 3, 8);
+
+  // Only even partitions are probed, so odd ones are empty
+  std::mt19937 gen(num_queries);
+  std::vector<size_t> even(num_parts / 2);
+  for (size_t c = 0; c < size(even); ++c) {
+    even[c] = 2 * c;
+  }
+  auto top_centroids = ColMajorMatrix<size_t>(nprobe, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::shuffle(begin(even), end(even), gen);
+    std::copy(begin(even), begin(even) + nprobe, begin(top_centroids[j]));
+  }
+
+  // The multimap-based inversion it replaced
+  auto centroid_query = std::multimap<size_t, size_t>{};
+  auto active_centroids = std::set<size_t>{};
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t p = 0; p < nprobe; ++p) {
+      centroid_query.emplace(top_centroids(p, j), j);
+      active_centroids.emplace(top_centroids(p, j));
+    }
+  }
+  auto expected_parts =
+      std::vector<size_t>(begin(active_centroids), end(active_centroids));
+
+  auto&& [active_partitions, active_queries] =
+      detail::ivf::invert_top_centroids(top_centroids, num_queries, nthreads);
+  CHECK(active_partitions == expected_parts);
+  REQUIRE(active_queries.size() == size(expected_parts));
+  for (size_t i = 0; i < size(expected_parts); ++i) {
+    CHECK(active_partitions[i] % 2 == 0);
+    auto range = centroid_query.equal_range(expected_parts[i]);
+    std::vector<size_t> expected_queries;
+    for (auto it = range.first; it != range.second; ++it) {
+      expected_queries.push_back(it->second);
+    }
+    CHECK(std::equal(
+        begin(active_queries[i]),
+        end(active_queries[i]),
+        begin(expected_queries),
+        end(expected_queries)));
+  }
+}
+
+TEST_CASE("ivf_index: unrolled kernels stay within partitions", "[ivf_index]") {
+  // Partition 1 starts at an odd offset and holds an odd number of vectors;
+  // the vector just past its end matches the queries exactly, so scoring it
+  // would return the wrong neighbor
+  size_t dimension = 4;
+  std::vector<float> values{0, 0, 0, 10, 10.5f, 9.5f, 10.2f, 9.8f, 11, 20, 20};
+  std::vector<size_t> indices{0, 3, 8, 11};
+  auto shuffled_db = ColMajorMatrix<float>(dimension, size(values));
+  std::vector<size_t> shuffled_ids(size(values));
+  for (size_t i = 0; i < size(values); ++i) {
+    std::fill(begin(shuffled_db[i]), end(shuffled_db[i]), values[i]);
+    shuffled_ids[i] = 100 + i;
+  }
+  auto centroids = ColMajorMatrix<float>(dimension, 3);
+  for (size_t c = 0; c < 3; ++c) {
+    std::fill(begin(centroids[c]), end(centroids[c]), 10.0f * c);
+  }
+
+  // An odd number of queries also exercises the unpaired query
+  size_t num_queries = 3;
+  auto query = ColMajorMatrix<float>(dimension, num_queries);
+  std::fill(query.data(), query.data() + dimension * num_queries, 11.0f);
+
+  auto reg_blocked = detail::ivf::nuv_query_heap_infinite_ram_reg_blocked(
+      shuffled_db, centroids, query, indices, shuffled_ids, 1, 1, false, 2);
+  auto applied = detail::ivf::query_infinite_ram(
+      shuffled_db, centroids, query, indices, shuffled_ids, 1, 1, false, 2);
+  for (size_t j = 0; j < num_queries; ++j) {
+    CHECK(reg_blocked(0, j) == 104);
+    CHECK(applied(0, j) == 104);
+  }
+}
+
+TEST_CASE("ivf_index: gemm partition selection", "[ivf_index]") {
+  size_t dimension = 16;
+  size_t nlist = 1000;
+  size_t num_queries = 100;
+  size_t nprobe = 10;
+  auto centroids = gaussian_blobs(dimension, nlist, 1);
+  auto query = gaussian_blobs(dimension, num_queries, 1);
+
+  auto gemm_top =
+      detail::ivf::gemm_top_centroids(centroids, query, nprobe, 4);
+  auto qv_top =
+      detail::flat::qv_query_nth(centroids, query, nprobe, false, 4);
+  REQUIRE(gemm_top.num_rows() == nprobe);
+  REQUIRE(gemm_top.num_cols() == num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::sort(begin(gemm_top[j]), end(gemm_top[j]));
+    std::sort(begin(qv_top[j]), end(qv_top[j]));
+    CHECK(std::equal(begin(gemm_top[j]), end(gemm_top[j]), begin(qv_top[j])));
+  }
+}
+
+TEST_CASE("ivf_index: binary prefilter", "[ivf_index]") {
+  // Bits are set for components above the center, packed 64 to a word
+  std::vector<float> center(70, 0.0f);
+  std::vector<float> v(70, -1.0f);
+  v[0] = v[63] = v[64] = v[69] = 1.0f;
+  uint64_t code[2];
+  detail::ivf::binary_encode(v, center, code);
+  CHECK(code[0] == ((uint64_t{1} << 63) | 1));
+  CHECK(code[1] == ((uint64_t{1} << 5) | 1));
+  uint64_t zero[2] = {0, 0};
+  CHECK(detail::ivf::hamming(code, zero, 2) == 4);
+
+  size_t dimension = 32;
+  size_t nlist = 8;
+  size_t nprobe = 2;
+  size_t k_nn = 10;
+  // The codes only discriminate between vectors on different sides of the
+  // center, so use one blob around it rather than well separated ones
+  auto data = gaussian_blobs(dimension, 1, 1600);
+  size_t num_queries = 50;
+  ColMajorMatrix<float> query(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+  auto expected = index.search(query, nprobe, k_nn);
+
+  // Keeping every vector gives the unfiltered result
+  index.set_binary_prefilter(data.num_cols());
+  REQUIRE(index.get_binary_codes().num_vectors() == data.num_cols());
+  auto unfiltered = index.search(query, nprobe, k_nn);
+  for (size_t j = 0; j < num_queries; ++j) {
+    CHECK(std::equal(
+        begin(unfiltered[j]), end(unfiltered[j]), begin(expected[j])));
+  }
+
+  // A vector's own code is at Hamming distance 0, so it always survives
+  index.set_binary_prefilter(4 * k_nn);
+  auto filtered = index.search(query, nprobe, k_nn);
+  size_t found = 0;
+  for (size_t j = 0; j < num_queries; ++j) {
+    CHECK(filtered(0, j) == j);
+    for (size_t i = 0; i < k_nn; ++i) {
+      found +=
+          std::find(begin(expected[j]), end(expected[j]), filtered(i, j)) !=
+          end(expected[j]);
+    }
+  }
+  CHECK(found >= num_queries * k_nn / 2);
+
+  // Deleted vectors are neither survivors nor results, and deleting does
+  // not drop the codes
+  std::vector<uint64_t> deleted(num_queries);
+  std::iota(begin(deleted), end(deleted), 0);
+  index.remove(deleted);
+  auto live = index.search(query, nprobe, k_nn);
+  CHECK(index.get_binary_codes().num_vectors() == data.num_cols());
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(live(i, j) >= num_queries);
+    }
+  }
+  index.compact();
+
+  // Disabling the prefilter drops the codes when the vectors change
+  index.set_binary_prefilter(0);
+  index.add(data);
+  CHECK(index.get_binary_codes().empty());
+}
+
+TEST_CASE("ivf_index: adaptive nprobe", "[ivf_index]") {
+  size_t dimension = 16;
+  size_t nlist = 10;
+  size_t k_nn = 5;
+  auto data = gaussian_blobs(dimension, nlist, 200);
+  size_t num_queries = 40;
+  ColMajorMatrix<float> query(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+
+  // Every vector lies within the radius of its partition
+  auto& stats = index.get_partition_stats();
+  REQUIRE(stats.num_partitions() == nlist);
+  auto parts = detail::flat::qv_partition(index.get_centroids(), data, 4);
+  for (size_t i = 0; i < data.num_cols(); ++i) {
+    auto p = parts[i];
+    CHECK(
+        std::sqrt(L2(index.get_centroids()[p], data[i])) <=
+        stats.radius(p) * (1 + 1e-6f));
+  }
+
+  // Allowed to probe every partition, the adaptive search is exact, yet the
+  // blobs are far enough apart that most queries stop after one
+  auto expected = index.search(query, nlist, k_nn);
+  std::vector<size_t> num_probed;
+  auto adaptive = index.search_adaptive(query, nlist, k_nn, &num_probed);
+  REQUIRE(size(num_probed) == num_queries);
+  size_t total_probed = 0;
+  for (size_t j = 0; j < num_queries; ++j) {
+    CHECK(std::equal(
+        begin(adaptive[j]), end(adaptive[j]), begin(expected[j])));
+    CHECK(num_probed[j] >= 1);
+    total_probed += num_probed[j];
+  }
+  CHECK(total_probed < num_queries * nlist / 2);
+
+  // Probing is capped at max_nprobe
+  index.search_adaptive(query, 1, k_nn, &num_probed);
+  CHECK(
+      std::count(begin(num_probed), end(num_probed), 1) == num_queries);
+
+  // Deleted vectors are skipped, and the search is still exact
+  index.remove({0});
+  num_probed.clear();
+  auto live = index.search_adaptive(query, nlist, k_nn, &num_probed);
+  expected = index.search(query, nlist, k_nn);
+  CHECK(live(0, 0) != 0);
+  REQUIRE(size(num_probed) == num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    CHECK(std::equal(begin(live[j]), end(live[j]), begin(expected[j])));
+  }
+
+  // The statistics do not cover added vectors, so these use a fixed nprobe
+  auto added = ColMajorMatrix<float>(dimension, 1);
+  std::copy(begin(data[0]), end(data[0]), begin(added[0]));
+  index.update(added, {100000});
+  auto pending = index.search_adaptive(query, nlist, k_nn);
+  CHECK(pending(0, 0) == 100000);
+  index.compact();
+  CHECK(index.get_partition_stats().num_partitions() == nlist);
+}
+
+TEST_CASE("ivf_index: partition statistics", "[ivf_index]") {
+  size_t dimension = 16;
+  size_t nlist = 8;
+  size_t k_nn = 5;
+  auto data = gaussian_blobs(dimension, nlist, 100);
+  size_t num_queries = 30;
+  ColMajorMatrix<float> query(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[7 * j]), end(data[7 * j]), begin(query[j]));
+    query(j % dimension, j) += 0.5f;
+  }
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+  auto& centroids = index.get_centroids();
+  auto& stats = index.get_partition_stats();
+  REQUIRE(stats.num_partitions() == nlist);
+
+  // The statistics cover every vector of their partition, so the bound
+  // never exceeds the distance from a query to one of its vectors
+  auto parts = detail::flat::qv_partition(centroids, data, 4);
+  std::vector<uint64_t> counts(nlist, 0);
+  for (size_t i = 0; i < data.num_cols(); ++i) {
+    auto p = parts[i];
+    ++counts[p];
+    float norm = std::sqrt(std::inner_product(
+        begin(data[i]), end(data[i]), begin(data[i]), 0.0f));
+    CHECK(norm >= stats.min_norm(p) * (1 - 1e-6f));
+    CHECK(norm <= stats.max_norm(p) * (1 + 1e-6f));
+    for (size_t j = 0; j < num_queries; ++j) {
+      float query_norm = std::sqrt(std::inner_product(
+          begin(query[j]), end(query[j]), begin(query[j]), 0.0f));
+      auto bound = stats.lower_bound(
+          p, std::sqrt(L2(query[j], centroids[p])), query_norm);
+      CHECK(bound <= std::sqrt(L2(query[j], data[i])) * (1 + 1e-5f));
+    }
+  }
+  for (size_t p = 0; p < nlist; ++p) {
+    CHECK(stats.count(p) == counts[p]);
+  }
+
+  // Accumulating the partitioned vectors a block at a time, with blocks
+  // that split partitions, gives the same statistics
+  std::vector<uint64_t> indices(nlist + 1, 0);
+  std::partial_sum(begin(counts), end(counts), begin(indices) + 1);
+  auto shuffled = ColMajorMatrix<float>(dimension, data.num_cols());
+  auto cursors = indices;
+  for (size_t i = 0; i < data.num_cols(); ++i) {
+    std::copy(
+        begin(data[i]), end(data[i]), begin(shuffled[cursors[parts[i]]++]));
+  }
+  auto blocked = detail::ivf::partition_stats(nlist);
+  for (size_t first = 0; first < data.num_cols(); first += 37) {
+    auto n = std::min<size_t>(37, data.num_cols() - first);
+    auto block = ColMajorMatrix<float>(dimension, n);
+    std::copy(
+        shuffled[first].data(),
+        shuffled[first].data() + dimension * n,
+        block.data());
+    blocked.accumulate(block, first, centroids, indices, 3);
+  }
+  for (size_t p = 0; p < nlist; ++p) {
+    CHECK(blocked.count(p) == stats.count(p));
+    CHECK(blocked.radius(p) == stats.radius(p));
+    CHECK(blocked.min_norm(p) == stats.min_norm(p));
+    CHECK(blocked.max_norm(p) == stats.max_norm(p));
+  }
+
+  // Skipping partitions does not change the results
+  std::vector<uint64_t> ids(data.num_cols());
+  std::iota(begin(ids), end(ids), 0);
+  for (size_t nprobe : {size_t{1}, size_t{3}, nlist}) {
+    auto expected = detail::ivf::query_infinite_ram(
+        shuffled, centroids, query, indices, ids, nprobe, k_nn, false, 4);
+    auto pruned = detail::ivf::pruned_query_infinite_ram(
+        shuffled, centroids, blocked, query, indices, ids, nprobe, k_nn, 4);
+    CHECK(std::equal(
+        expected.data(),
+        expected.data() + k_nn * num_queries,
+        pruned.data()));
+  }
+  // Nor does skipping deleted vectors, although the statistics cover them
+  auto is_live = [](auto&& id) { return id % 3 != 0; };
+  for (size_t nprobe : {size_t{1}, size_t{3}, nlist}) {
+    auto expected = detail::ivf::qv_query_heap_infinite_ram(
+        shuffled,
+        centroids,
+        query,
+        indices,
+        ids,
+        nprobe,
+        k_nn,
+        false,
+        4,
+        is_live);
+    auto pruned = detail::ivf::pruned_query_infinite_ram(
+        shuffled,
+        centroids,
+        blocked,
+        query,
+        indices,
+        ids,
+        nprobe,
+        k_nn,
+        4,
+        is_live);
+    CHECK(std::equal(
+        expected.data(),
+        expected.data() + k_nn * num_queries,
+        pruned.data()));
+  }
+  auto wrong = detail::ivf::partition_stats(nlist - 1);
+  CHECK_THROWS(detail::ivf::pruned_query_infinite_ram(
+      shuffled, centroids, wrong, query, indices, ids, nlist, k_nn, 4));
+}
+
+TEST_CASE("ivf_index: filtered search", "[ivf_index]") {
+  size_t dimension = 16;
+  size_t nlist = 8;
+  size_t k_nn = 5;
+  auto data = gaussian_blobs(dimension, nlist, 100);
+  size_t num_queries = 20;
+  ColMajorMatrix<float> query(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[37 * j]), end(data[37 * j]), begin(query[j]));
+  }
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+
+  // Exact nearest neighbors among the vectors passing the filter
+  auto exact = [&](auto&& filter) {
+    auto top_k = ColMajorMatrix<size_t>(k_nn, num_queries);
+    for (size_t j = 0; j < num_queries; ++j) {
+      auto heap = fixed_min_pair_heap<float, size_t>(k_nn);
+      for (size_t i = 0; i < data.num_cols(); ++i) {
+        if (filter(i)) {
+          heap.insert(L2(query[j], data[i]), i);
+        }
+      }
+      std::sort_heap(begin(heap), end(heap));
+      for (size_t i = 0; i < k_nn; ++i) {
+        top_k(i, j) = std::get<1>(heap[i]);
+      }
+    }
+    return top_k;
+  };
+
+  // Few enough vectors pass that they are all searched, so the results are
+  // exact even probing a single partition
+  auto sparse = id_bitmap{};
+  for (size_t i = 3; i < data.num_cols(); i += 10) {
+    sparse.set(i);
+  }
+  auto expected = exact(sparse);
+  auto found = index.search_filtered(query, sparse, 1, k_nn);
+  CHECK(std::equal(
+      expected.data(), expected.data() + k_nn * num_queries, found.data()));
+
+  // Otherwise only the probed partitions are searched, but every result
+  // passes the filter; the queries' own blobs hold their neighbors
+  auto dense = [&](auto&& id) { return (id / nlist) % 2 == 1; };
+  expected = exact(dense);
+  found = index.search_filtered(query, dense, 2, k_nn);
+  size_t matches = 0;
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(dense(found(i, j)));
+      matches += std::find(begin(expected[j]), end(expected[j]), found(i, j)) !=
+                 end(expected[j]);
+    }
+  }
+  CHECK(matches == k_nn * num_queries);
+
+  // Pending updates are filtered too
+  index.remove({3, 13});
+  ColMajorMatrix<float> added(dimension, 1);
+  std::copy(begin(query[0]), end(query[0]), begin(added[0]));
+  index.update(added, std::vector<uint64_t>{23});
+  found = index.search_filtered(query, sparse, 1, k_nn);
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(found(i, j) != 3);
+      CHECK(found(i, j) != 13);
+      CHECK(sparse(found(i, j)));
+    }
+  }
+  CHECK(found(0, 0) == 23);
+  found = index.search_filtered(query, dense, 2, k_nn);
+  CHECK(std::find(begin(found[0]), end(found[0]), 23) == end(found[0]));
+}
+
+TEST_CASE("ivf_index: incremental update and delete", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 6;
+  auto data = gaussian_blobs(dimension, nlist, 50);
+  size_t num_vectors = data.num_cols();
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+
+  // Queries are (copies of) the first few vectors, one per blob
+  ColMajorMatrix<float> query(dimension, nlist);
+  for (size_t j = 0; j < nlist; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+
+  auto top_k = index.search(query, 2, 1);
+  for (size_t j = 0; j < nlist; ++j) {
+    CHECK(top_k(0, j) == j);
+  }
+
+  // Delete the exact matches; the nearest neighbors must change
+  std::vector<uint64_t> deleted(nlist);
+  std::iota(begin(deleted), end(deleted), 0);
+  index.remove(deleted);
+  top_k = index.search(query, 2, 3);
+  for (size_t j = 0; j < nlist; ++j) {
+    for (size_t i = 0; i < 3; ++i) {
+      CHECK(top_k(i, j) >= nlist);
+      CHECK(top_k(i, j) < num_vectors);
+    }
+  }
+
+  // Add the queries back under new ids, which are not tombstoned
+  std::vector<uint64_t> new_ids(nlist);
+  std::iota(begin(new_ids), end(new_ids), num_vectors);
+  index.update(query, new_ids);
+  CHECK(index.get_delta().num_vectors() == nlist);
+  CHECK(index.get_delta().num_tombstones() == nlist);
+  top_k = index.search(query, 2, 1);
+  for (size_t j = 0; j < nlist; ++j) {
+    CHECK(top_k(0, j) == num_vectors + j);
+  }
+
+  // Replacing a vector moves it
+  ColMajorMatrix<float> moved(dimension, 1);
+  for (size_t i = 0; i < dimension; ++i) {
+    moved(i, 0) = data(i, 1) + 1;
+  }
+  index.update(moved, {num_vectors});
+  CHECK(index.get_delta().num_vectors() == nlist);
+  CHECK(index.get_delta().num_tombstones() == nlist);
+  top_k = index.search(query, 2, 1);
+  CHECK(top_k(0, 0) != num_vectors);
+  CHECK(index.search(moved, 2, 1)(0, 0) == num_vectors);
+
+  // Compaction preserves the results and empties the delta
+  auto before = index.search(query, 2, 3);
+  index.compact();
+  CHECK(index.get_delta().empty());
+  auto after = index.search(query, 2, 3);
+  for (size_t j = 0; j < nlist; ++j) {
+    CHECK(before(0, j) == after(0, j));
+    for (size_t i = 0; i < 3; ++i) {
+      CHECK(after(i, j) >= nlist);
+    }
+  }
+}
+
+TEST_CASE("ivf_index: asynchronous compaction", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 6;
+  auto data = gaussian_blobs(dimension, nlist, 50);
+  size_t num_vectors = data.num_cols();
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+
+  ColMajorMatrix<float> query(dimension, nlist);
+  for (size_t j = 0; j < nlist; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+
+  // Move the first vector of each blob to a new id
+  std::vector<uint64_t> deleted(nlist);
+  std::iota(begin(deleted), end(deleted), 0);
+  index.remove(deleted);
+  std::vector<uint64_t> new_ids(nlist);
+  std::iota(begin(new_ids), end(new_ids), num_vectors);
+  index.update(query, new_ids);
+
+  // Updates made while the compaction runs outlive it, whether they land
+  // before or after the swap
+  auto compaction = index.compact_async();
+  ColMajorMatrix<float> moved(dimension, 1);
+  for (size_t i = 0; i < dimension; ++i) {
+    moved(i, 0) = data(i, 1) + 1;
+  }
+  index.remove({num_vectors});
+  index.update(moved, {num_vectors + nlist});
+  auto during = index.search(query, 2, 1);
+  compaction.get();
+
+  CHECK(size(index.get_shuffled_ids()) == num_vectors);
+  CHECK(index.get_delta().num_vectors() == 1);
+  CHECK(index.get_delta().num_tombstones() == 1);
+  CHECK(index.get_delta().is_deleted(num_vectors));
+  for (size_t j = 0; j < nlist; ++j) {
+    CHECK(
+        index.get_id_positions().find(num_vectors + j) !=
+        index.get_id_positions().npos);
+  }
+
+  auto top_k = index.search(query, 2, 1);
+  CHECK(top_k(0, 0) != num_vectors);
+  CHECK(top_k(0, 0) == during(0, 0));
+  for (size_t j = 1; j < nlist; ++j) {
+    CHECK(top_k(0, j) == num_vectors + j);
+    CHECK(during(0, j) == num_vectors + j);
+  }
+  CHECK(index.search(moved, 2, 1)(0, 0) == num_vectors + nlist);
+
+  index.compact();
+  CHECK(index.get_delta().empty());
+  CHECK(index.search(moved, 2, 1)(0, 0) == num_vectors + nlist);
+  auto after = index.search(query, 2, 1);
+  for (size_t j = 0; j < nlist; ++j) {
+    CHECK(after(0, j) == top_k(0, j));
+  }
+}
+
+TEST_CASE("ivf_index: tombstone bitmap", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 6;
+  size_t k_nn = 4;
+  auto data = gaussian_blobs(dimension, nlist, 50);
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 4);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+
+  ColMajorMatrix<float> query(dimension, nlist);
+  for (size_t j = 0; j < nlist; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+
+  // Tombstones read with the index are applied like deletions; every
+  // vector of the first blob is deleted
+  auto tombstones = id_bitmap{};
+  for (size_t i = 0; i < data.num_cols(); i += nlist) {
+    tombstones.set(i);
+  }
+  index.get_delta().add_tombstones(tombstones);
+  index.get_delta().add_tombstones(tombstones);
+  CHECK(index.get_delta().num_tombstones() == tombstones.count());
+  auto top_k = index.search(query, 2, k_nn);
+  for (size_t j = 0; j < nlist; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(!tombstones.contains(top_k(i, j)));
+    }
+  }
+  for (size_t j = 1; j < nlist; ++j) {
+    CHECK(top_k(0, j) == j);
+  }
+
+  // As do the kernels that query the partitioned arrays directly
+  auto ids = detail::ivf::qv_query_heap_infinite_ram(
+      index.get_shuffled_db(),
+      index.get_centroids(),
+      query,
+      index.get_indices(),
+      index.get_shuffled_ids(),
+      2,
+      k_nn,
+      false,
+      2,
+      [&](auto&& id) { return !tombstones.contains(id); });
+  for (size_t j = 0; j < nlist; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      CHECK(!tombstones.contains(ids(i, j)));
+    }
+  }
+  for (size_t j = 1; j < nlist; ++j) {
+    CHECK(ids(0, j) == j);
+  }
+
+  // Compaction drops the deleted vectors
+  index.compact();
+  CHECK(index.get_delta().empty());
+  CHECK(
+      index.get_shuffled_ids().size() == data.num_cols() - tombstones.count());
+}
+
+TEST_CASE("ivf_index: save and load", "[ivf_index][read-write]") {
+  size_t dimension = 8;
+  size_t nlist = 4;
+  auto data = gaussian_blobs(dimension, nlist, 25);
+
+  auto index =
+      kmeans_index<float, uint32_t, uint32_t>(dimension, nlist, 10, 1e-4, 2);
+  index.train(data, kmeans_algorithm::hamerly);
+  index.add(data);
+  index.remove({0});
+  index.set_binary_prefilter(10);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+
+  tiledb::Context ctx;
+  index.save(ctx, uri);
+  CHECK_THROWS(index.save(ctx, uri));
+
+  auto loaded =
+      kmeans_index<float, uint32_t, uint32_t>(0, 0, 10, 1e-4, 2);
+  loaded.load(ctx, uri);
+  auto& codes = index.get_binary_codes().codes();
+  auto& loaded_codes = loaded.get_binary_codes().codes();
+  REQUIRE(loaded_codes.num_cols() == codes.num_cols());
+  CHECK(std::equal(
+      codes.data(),
+      codes.data() + codes.num_rows() * codes.num_cols(),
+      loaded_codes.data()));
+  loaded.set_binary_prefilter(10);
+  auto& stats = index.get_partition_stats();
+  auto& loaded_stats = loaded.get_partition_stats();
+  REQUIRE(loaded_stats.num_partitions() == nlist);
+  for (size_t p = 0; p < nlist; ++p) {
+    CHECK(loaded_stats.radius(p) == stats.radius(p));
+    CHECK(loaded_stats.count(p) == stats.count(p));
+    CHECK(loaded_stats.min_norm(p) == stats.min_norm(p));
+    CHECK(loaded_stats.max_norm(p) == stats.max_norm(p));
+  }
+  CHECK(loaded.get_centroids().num_rows() == dimension);
+  CHECK(loaded.get_centroids().num_cols() == nlist);
+  CHECK(std::equal(
+      index.get_centroids().data(),
+      index.get_centroids().data() + dimension * nlist,
+      loaded.get_centroids().data()));
+
+  ColMajorMatrix<float> query(dimension, 2);
+  std::copy(begin(data[0]), end(data[0]), begin(query[0]));
+  std::copy(begin(data[1]), end(data[1]), begin(query[1]));
+  auto expected = index.search(query, 2, 5);
+  auto found = loaded.search(query, 2, 5);
+  CHECK(std::equal(
+      expected.data(), expected.data() + 2 * 5, found.data()));
+
+  auto wrong_type =
+      kmeans_index<uint8_t, uint32_t, uint32_t>(0, 0, 10, 1e-4, 2);
+  CHECK_THROWS(wrong_type.load(ctx, uri));
+
+  std::filesystem::remove_all(uri);
+}
+
+TEST_CASE("ivf_index: native ingestion", "[ivf_index][read-write]") {
+  size_t dimension = 8;
+  size_t nlist = 4;
+  auto data = gaussian_blobs(dimension, nlist, 25);
+  auto num_vectors = data.num_cols();
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+  std::filesystem::create_directories(uri);
+  auto source_uri = uri + "/source";
+  auto centroids_uri = uri + "/centroids";
+  auto index_uri = uri + "/index";
+  auto ids_uri = uri + "/ids";
+  auto parts_uri = uri + "/parts";
+
+  tiledb::Context ctx;
+  write_matrix(ctx, data, source_uri);
+  create_matrix(ctx, ColMajorMatrix<float>(dimension, nlist), centroids_uri);
+  std::vector<uint64_t> indices(nlist + 1);
+  create_vector(ctx, indices, index_uri);
+  std::vector<uint64_t> ids(num_vectors);
+  create_vector(ctx, ids, ids_uri);
+  create_matrix(ctx, ColMajorMatrix<float>(dimension, num_vectors), parts_uri);
+
+  // A small upper bound forces several passes over the source.  The
+  // training sample is either the whole source, fits in one block, or is
+  // spilled to a file.
+  size_t training_sample_size = GENERATE(0, 20, 60);
+  auto n = detail::ivf::ivf_ingest<float>(
+      ctx,
+      source_uri,
+      centroids_uri,
+      index_uri,
+      ids_uri,
+      parts_uri,
+      0,
+      nlist,
+      training_sample_size,
+      10,
+      1e-4,
+      30,
+      2,
+      true,
+      "",
+      "",
+      0.0,
+      uri + "/coarse",
+      nlist);
+  CHECK(n == num_vectors);
+
+  auto centroids = tdbColMajorMatrix<float>(ctx, centroids_uri);
+  centroids.load();
+  indices = read_vector<uint64_t>(ctx, index_uri);
+  ids = read_vector<uint64_t>(ctx, ids_uri);
+  auto parts = tdbColMajorMatrix<float>(ctx, parts_uri);
+  parts.load();
+
+  CHECK(indices[0] == 0);
+  CHECK(indices[nlist] == num_vectors);
+  auto sorted_ids = ids;
+  std::sort(begin(sorted_ids), end(sorted_ids));
+  for (size_t i = 0; i < num_vectors; ++i) {
+    CHECK(sorted_ids[i] == i);
+  }
+  auto nearest = detail::flat::qv_partition(centroids, parts, 2);
+  for (size_t p = 0; p < nlist; ++p) {
+    for (size_t i = indices[p]; i < indices[p + 1]; ++i) {
+      CHECK(nearest[i] == p);
+      CHECK(std::equal(begin(parts[i]), end(parts[i]), begin(data[ids[i]])));
+    }
+  }
+
+  // nlist reaches the (lowered) threshold, so a coarse quantizer is written,
+  // and searching through it finds each vector itself
+  auto quantizer = detail::ivf::coarse_quantizer<float, uint64_t>(
+      ctx,
+      uri + "/coarse_centroids",
+      uri + "/coarse_offsets",
+      uri + "/coarse_members");
+  CHECK(quantizer.num_fine() == nlist);
+  auto top_k = detail::ivf::coarse_query_finite_ram<float, uint64_t>(
+      ctx,
+      parts_uri,
+      quantizer,
+      centroids,
+      data,
+      indices,
+      ids_uri,
+      1,
+      1,
+      30,
+      2,
+      [](auto&&) { return true; });
+  for (size_t j = 0; j < num_vectors; ++j) {
+    CHECK(top_k(0, j) == j);
+  }
+
+  std::filesystem::remove_all(uri);
+}
+
+TEST_CASE(
+    "ivf_index: native balanced ingestion", "[ivf_index][read-write]") {
+  size_t dimension = 8;
+  size_t nlist = 4;
+
+  // Blob 0 holds five times as many vectors as the others
+  auto blobs = gaussian_blobs(dimension, nlist, 50);
+  std::vector<size_t> keep;
+  for (size_t i = 0; i < blobs.num_cols(); ++i) {
+    if (i % nlist == 0 || i < 10 * nlist) {
+      keep.push_back(i);
+    }
+  }
+  ColMajorMatrix<float> data(dimension, size(keep));
+  for (size_t i = 0; i < size(keep); ++i) {
+    std::copy(begin(blobs[keep[i]]), end(blobs[keep[i]]), begin(data[i]));
+  }
+  auto num_vectors = data.num_cols();
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+  std::filesystem::create_directories(uri);
+  auto source_uri = uri + "/source";
+  auto centroids_uri = uri + "/centroids";
+  auto index_uri = uri + "/index";
+  auto ids_uri = uri + "/ids";
+  auto parts_uri = uri + "/parts";
+
+  tiledb::Context ctx;
+  write_matrix(ctx, data, source_uri);
+  create_matrix(ctx, ColMajorMatrix<float>(dimension, nlist), centroids_uri);
+  std::vector<uint64_t> indices(nlist + 1);
+  create_vector(ctx, indices, index_uri);
+  std::vector<uint64_t> ids(num_vectors);
+  create_vector(ctx, ids, ids_uri);
+  create_matrix(ctx, ColMajorMatrix<float>(dimension, num_vectors), parts_uri);
+
+  size_t upper_bound = 30;
+  double factor = 1.25;
+  auto n = detail::ivf::ivf_ingest<float>(
+      ctx,
+      source_uri,
+      centroids_uri,
+      index_uri,
+      ids_uri,
+      parts_uri,
+      0,
+      nlist,
+      upper_bound,
+      10,
+      1e-4,
+      upper_bound,
+      2,
+      true,
+      "",
+      "",
+      factor);
+  CHECK(n == num_vectors);
+
+  // Each block is capped separately, so a partition may exceed the overall
+  // cap by rounding in every block
+  indices = read_vector<uint64_t>(ctx, index_uri);
+  ids = read_vector<uint64_t>(ctx, ids_uri);
+  auto num_blocks = (num_vectors + upper_bound - 1) / upper_bound;
+  auto capacity = std::ceil(factor * num_vectors / nlist) + num_blocks;
+  CHECK(indices[nlist] == num_vectors);
+  for (size_t p = 0; p < nlist; ++p) {
+    CHECK(indices[p + 1] - indices[p] <= capacity);
+  }
+  std::sort(begin(ids), end(ids));
+  for (size_t i = 0; i < num_vectors; ++i) {
+    CHECK(ids[i] == i);
+  }
+
+  std::filesystem::remove_all(uri);
+}
+
+TEST_CASE("ivf_index: native sq8 ingestion", "[ivf_index][read-write]") {
+  size_t dimension = 8;
+  size_t nlist = 4;
+  auto data = gaussian_blobs(dimension, nlist, 25);
+  auto num_vectors = data.num_cols();
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+  std::filesystem::create_directories(uri);
+  auto source_uri = uri + "/source";
+  auto centroids_uri = uri + "/centroids";
+  auto index_uri = uri + "/index";
+  auto ids_uri = uri + "/ids";
+  auto parts_uri = uri + "/parts";
+  auto sq8_uri = uri + "/sq8";
+
+  tiledb::Context ctx;
+  write_matrix(ctx, data, source_uri);
+  create_matrix(ctx, ColMajorMatrix<float>(dimension, nlist), centroids_uri);
+  std::vector<uint64_t> indices(nlist + 1);
+  create_vector(ctx, indices, index_uri);
+  std::vector<uint64_t> ids(num_vectors);
+  create_vector(ctx, ids, ids_uri);
+  create_matrix(
+      ctx, ColMajorMatrix<uint8_t>(dimension, num_vectors), parts_uri);
+
+  auto n = detail::ivf::ivf_ingest<float>(
+      ctx,
+      source_uri,
+      centroids_uri,
+      index_uri,
+      ids_uri,
+      parts_uri,
+      0,
+      nlist,
+      0,
+      10,
+      1e-4,
+      30,
+      2,
+      true,
+      sq8_uri);
+  CHECK(n == num_vectors);
+
+  auto params = tdbColMajorMatrix<float>(ctx, sq8_uri);
+  params.load();
+  auto codec = sq8_codec(params);
+  auto centroids = tdbColMajorMatrix<float>(ctx, centroids_uri);
+  centroids.load();
+  indices = read_vector<uint64_t>(ctx, index_uri);
+  ids = read_vector<uint64_t>(ctx, ids_uri);
+  auto parts = tdbColMajorMatrix<uint8_t>(ctx, parts_uri);
+  parts.load();
+
+  // The codes decode to the source vectors, and (the centroids being in
+  // code space) are nearest to the centroid of their partition
+  auto decoded = codec.decode(parts);
+  auto nearest = detail::flat::qv_partition(centroids, parts, 2);
+  for (size_t p = 0; p < nlist; ++p) {
+    for (size_t i = indices[p]; i < indices[p + 1]; ++i) {
+      CHECK(nearest[i] == p);
+      for (size_t k = 0; k < dimension; ++k) {
+        CHECK(
+            std::abs(decoded(k, i) - data(k, ids[i])) <=
+            codec.step() / 2 + 1e-4);
+      }
+    }
+  }
+
+  std::filesystem::remove_all(uri);
+}
+
 #if 0
 
 TEST_CASE("ivf_index: test kmeans initializations", "[ivf_index]") {
@@ -118,6 +1406,119 @@ debug_centroids(index);
 
 
 // kmeans and kmeans indexing still WIP
+TEST_CASE("ivf_index: id position map", "[ivf_index]") {
+  std::vector<uint64_t> shuffled_ids{42, 7, 1000, 3, 99};
+  auto map = detail::ivf::id_position_map<uint64_t>(shuffled_ids);
+  CHECK(map.size() == 5);
+  for (size_t p = 0; p < size(shuffled_ids); ++p) {
+    CHECK(map.find(shuffled_ids[p]) == p);
+  }
+  CHECK(map.find(0) == map.npos);
+  CHECK(map.find(50) == map.npos);
+  CHECK(map.find(5000) == map.npos);
+}
+
+TEST_CASE("ivf_index: id positions follow compaction", "[ivf_index]") {
+  size_t dimension = 8;
+  size_t nlist = 4;
+  auto data = gaussian_blobs(dimension, nlist, 25);
+
+  auto index =
+      kmeans_index<float, uint64_t, uint64_t>(dimension, nlist, 10, 1e-4, 2);
+  index.train(data);
+  index.add(data);
+
+  auto check_positions = [&index]() {
+    auto& shuffled_ids = index.get_shuffled_ids();
+    CHECK(index.get_id_positions().size() == size(shuffled_ids));
+    for (size_t p = 0; p < size(shuffled_ids); ++p) {
+      CHECK(index.get_id_positions().find(shuffled_ids[p]) == p);
+    }
+  };
+  check_positions();
+
+  // Compaction moves vectors, so the map is rebuilt
+  ColMajorMatrix<float> added(dimension, 1);
+  std::copy(begin(data[0]), end(data[0]), begin(added[0]));
+  index.update(added, std::vector<uint64_t>{500});
+  index.remove({7, 8});
+  index.compact();
+  check_positions();
+  CHECK(index.get_id_positions().find(7) == index.get_id_positions().npos);
+  CHECK(index.get_id_positions().find(500) != index.get_id_positions().npos);
+}
+
+TEST_CASE("ivf_index: rerank candidates", "[ivf_index][read-write]") {
+  size_t dimension = 8;
+  size_t num_vectors = 200;
+  auto data = gaussian_blobs(dimension, 4, 50);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+  std::filesystem::create_directories(uri);
+  auto parts_uri = uri + "/parts";
+  auto map_uri = uri + "/map";
+
+  // Store the vectors in reverse order, with ids 1000 + source position
+  auto parts = ColMajorMatrix<float>(dimension, num_vectors);
+  std::vector<uint64_t> shuffled_ids(num_vectors);
+  for (size_t p = 0; p < num_vectors; ++p) {
+    auto i = num_vectors - 1 - p;
+    std::copy(begin(data[i]), end(data[i]), begin(parts[p]));
+    shuffled_ids[p] = 1000 + i;
+  }
+
+  tiledb::Context ctx;
+  write_matrix(ctx, parts, parts_uri);
+  detail::ivf::id_position_map<uint64_t>(shuffled_ids).save(ctx, map_uri);
+  auto map = detail::ivf::id_position_map<uint64_t>(ctx, map_uri);
+  CHECK(map.size() == num_vectors);
+
+  size_t num_queries = 3;
+  auto query = ColMajorMatrix<float>(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[j * 10]), end(data[j * 10]), begin(query[j]));
+  }
+  std::vector<std::vector<uint64_t>> candidates{
+      {1000, 1001, 1150, 1199, 1000},
+      {1010, 5, 1011, 1100, 1101, 1102, 1103},
+      {1020}};
+
+  size_t k_nn = 3;
+  for (size_t max_gap : {0, 16, 1000}) {
+    auto&& [scores, ids] = detail::ivf::rerank<float>(
+        ctx, parts_uri, map, query, candidates, k_nn, 2, max_gap);
+    for (size_t j = 0; j < num_queries; ++j) {
+      // Each query is one of its candidates
+      CHECK(ids(0, j) == 1000 + j * 10);
+      CHECK(scores(0, j) == 0);
+      for (size_t i = 1; i < k_nn; ++i) {
+        if (ids(i, j) == std::numeric_limits<size_t>::max()) {
+          continue;
+        }
+        CHECK(scores(i - 1, j) <= scores(i, j));
+        CHECK(scores(i, j) == L2(query[j], data[ids(i, j) - 1000]));
+      }
+    }
+    // Repeated and unknown ids are ignored
+    CHECK(ids(2, 0) != 1000);
+    CHECK(ids(1, 2) == std::numeric_limits<size_t>::max());
+    CHECK(scores(1, 2) == std::numeric_limits<float>::max());
+  }
+
+  // Candidates that are not live, e.g., deleted, are ignored
+  auto is_live = [](auto&& id) { return id != 1000; };
+  auto&& [scores, ids] = detail::ivf::rerank<float>(
+      ctx, parts_uri, map, query, candidates, k_nn, 2, 16, is_live);
+  for (size_t i = 0; i < k_nn; ++i) {
+    CHECK(ids(i, 0) != 1000);
+  }
+  CHECK(ids(0, 1) == 1010);
+
+  std::filesystem::remove_all(uri);
+}
+
 #if 0
 
 TEST_CASE("ivf_index: test kmeans", "[ivf_index]") {
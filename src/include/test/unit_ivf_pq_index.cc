@@ -0,0 +1,262 @@
+/**
+ * @file   unit_ivf_pq_index.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include <catch2/catch_all.hpp>
+
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "../defs.h"
+#include "../ivf_pq_index.h"
+#include "../linalg.h"
+#include "test_utils.h"
+
+bool global_debug = false;
+
+TEST_CASE("ivf_pq_index: test test", "[ivf_pq_index]") {
+  REQUIRE(true);
+}
+
+TEST_CASE("ivf_pq_index: subspaces", "[ivf_pq_index]") {
+  // Subspaces cover the dimensions even if they do not divide evenly
+  CHECK(detail::ivf::pq_subspace_begin(0, 10, 4) == 0);
+  CHECK(detail::ivf::pq_subspace_begin(1, 10, 4) == 2);
+  CHECK(detail::ivf::pq_subspace_begin(2, 10, 4) == 5);
+  CHECK(detail::ivf::pq_subspace_begin(3, 10, 4) == 7);
+  CHECK(detail::ivf::pq_subspace_begin(4, 10, 4) == 10);
+
+  CHECK_THROWS(ivf_pq_index<float>(8, 4, 9, 10, 1e-4, 1));
+  CHECK_THROWS(ivf_pq_index<float>(8, 4, 0, 10, 1e-4, 1));
+}
+
+TEST_CASE("ivf_pq_index: train, add and search", "[ivf_pq_index]") {
+  size_t dimension = 16;
+  size_t nlist = 8;
+  size_t num_subspaces = 8;
+  auto data = gaussian_blobs(dimension, nlist, 100);
+  size_t num_vectors = data.num_cols();
+
+  auto index =
+      ivf_pq_index<float>(dimension, nlist, num_subspaces, 10, 1e-4, 4);
+  index.train(data);
+  index.add(data);
+
+  CHECK(index.get_centroids().num_cols() == nlist);
+  CHECK(index.get_codebooks().num_rows() == dimension);
+  CHECK(index.get_codebooks().num_cols() == detail::ivf::pq_num_codewords);
+  CHECK(index.get_codes().num_rows() == num_subspaces);
+  CHECK(index.get_codes().num_cols() == num_vectors);
+  REQUIRE(size(index.get_indices()) == nlist + 1);
+  CHECK(index.get_indices()[nlist] == num_vectors);
+
+  auto ids = index.get_ids();
+  std::sort(begin(ids), end(ids));
+  for (size_t i = 0; i < num_vectors; ++i) {
+    CHECK(ids[i] == i);
+  }
+
+  // The codes approximate the vectors closely enough that almost every
+  // vector is its own nearest neighbor
+  size_t num_queries = 100;
+  ColMajorMatrix<float> query(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+  auto top_k = index.search(query, 2, 1);
+  size_t found = 0;
+  for (size_t j = 0; j < num_queries; ++j) {
+    found += top_k(0, j) == j;
+  }
+  CHECK(found >= 90);
+}
+
+TEST_CASE("ivf_pq_index: fast scan kernel", "[ivf_pq_index]") {
+  using namespace detail::ivf;
+
+  // 40 vectors span two blocks, the second one partial; an odd number of
+  // subspaces is padded
+  size_t num_subspaces = 5;
+  size_t n = 40;
+  std::mt19937 gen(1234);
+  std::uniform_int_distribution<int> code_dist(0, 15);
+  std::vector<uint8_t> codes(n * num_subspaces);
+  for (auto& c : codes) {
+    c = code_dist(gen);
+  }
+  auto block_bytes = fast_scan_block_bytes(num_subspaces);
+  CHECK(block_bytes == 6 * 16);
+  std::vector<uint8_t> packed(2 * block_bytes);
+  fast_scan_pack(codes.data(), n, num_subspaces, packed.data());
+
+  std::uniform_real_distribution<float> dist(0, 100);
+  std::vector<float> table(num_subspaces * fast_scan_num_codewords);
+  for (auto& t : table) {
+    t = dist(gen);
+  }
+  std::vector<uint8_t> qtable;
+  float bias, inv_scale;
+  fast_scan_quantize_table(table, num_subspaces, qtable, bias, inv_scale);
+
+  uint16_t sums[fast_scan_block_size];
+  for (size_t b = 0; b < 2; ++b) {
+    fast_scan_block(
+        packed.data() + b * block_bytes, qtable.data(), num_subspaces, sums);
+    for (size_t i = 0; i < fast_scan_block_size; ++i) {
+      auto v = b * fast_scan_block_size + i;
+      if (v >= n) {
+        break;
+      }
+      uint32_t expected = 0;
+      float exact = 0;
+      for (size_t m = 0; m < num_subspaces; ++m) {
+        auto code = codes[v * num_subspaces + m];
+        expected += qtable[m * 16 + code];
+        exact += table[m * fast_scan_num_codewords + code];
+      }
+      CHECK(sums[i] == expected);
+      // Each entry is rounded by at most half a quantization step
+      CHECK(
+          std::abs(bias + sums[i] * inv_scale - exact) <=
+          num_subspaces * inv_scale);
+    }
+  }
+
+  std::vector<uint64_t> indices{0, 40, 40, 72};
+  CHECK(
+      fast_scan_block_indices(indices) == std::vector<uint64_t>{0, 2, 2, 3});
+}
+
+TEST_CASE("ivf_pq_index: 4-bit codes", "[ivf_pq_index]") {
+  size_t dimension = 16;
+  size_t nlist = 8;
+  size_t num_subspaces = 8;
+  auto data = gaussian_blobs(dimension, nlist, 100);
+  size_t num_vectors = data.num_cols();
+
+  CHECK_THROWS(ivf_pq_index<float>(8, 4, 2, 10, 1e-4, 1, 6));
+
+  auto index =
+      ivf_pq_index<float>(dimension, nlist, num_subspaces, 10, 1e-4, 4, 4);
+  index.train(data);
+  index.add(data);
+
+  CHECK(index.num_bits() == 4);
+  CHECK(index.get_codebooks().num_cols() == 16);
+  CHECK(
+      index.get_codes().num_rows() ==
+      detail::ivf::fast_scan_block_bytes(num_subspaces));
+  REQUIRE(size(index.get_indices()) == nlist + 1);
+  CHECK(index.get_indices()[nlist] == num_vectors);
+
+  size_t num_queries = 100;
+  ColMajorMatrix<float> query(dimension, num_queries);
+  for (size_t j = 0; j < num_queries; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+
+  // With 16 codewords per subspace the codes are coarser, so check that
+  // each query finds itself among its nearest neighbors
+  size_t k_nn = 10;
+  auto top_k = index.search(query, 2, k_nn);
+  size_t found = 0;
+  for (size_t j = 0; j < num_queries; ++j) {
+    for (size_t i = 0; i < k_nn; ++i) {
+      found += top_k(i, j) == j;
+    }
+  }
+  CHECK(found >= 80);
+
+  // Every result is a vector of the query's cluster
+  for (size_t j = 0; j < num_queries; ++j) {
+    CHECK(top_k(0, j) % nlist == j % nlist);
+  }
+}
+
+TEST_CASE("ivf_pq_index: save and load", "[ivf_pq_index][read-write]") {
+  size_t dimension = 16;
+  size_t nlist = 4;
+  size_t num_subspaces = 4;
+  auto data = gaussian_blobs(dimension, nlist, 100);
+
+  auto index =
+      ivf_pq_index<float>(dimension, nlist, num_subspaces, 10, 1e-4, 2);
+  index.train(data);
+  index.add(data);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+
+  tiledb::Context ctx;
+  index.save(ctx, uri);
+  CHECK_THROWS(index.save(ctx, uri));
+
+  ColMajorMatrix<float> query(dimension, 4);
+  for (size_t j = 0; j < 4; ++j) {
+    std::copy(begin(data[j]), end(data[j]), begin(query[j]));
+  }
+  auto expected = index.search(query, 2, 5);
+
+  auto loaded = ivf_pq_index<float>(0, 0, 1, 10, 1e-4, 2);
+  loaded.load(ctx, uri);
+  CHECK(loaded.num_subspaces() == num_subspaces);
+  auto found = loaded.search(query, 2, 5);
+  CHECK(std::equal(expected.data(), expected.data() + 4 * 5, found.data()));
+
+  auto streamed = ivf_pq_index<float>(0, 0, 1, 10, 1e-4, 2);
+  streamed.load(ctx, uri, false);
+  CHECK(streamed.get_codes().num_cols() == 0);
+  found = streamed.search_finite_ram(ctx, query, 2, 5, 50);
+  CHECK(std::equal(expected.data(), expected.data() + 4 * 5, found.data()));
+
+  auto wrong_type = ivf_pq_index<uint8_t>(0, 0, 1, 10, 1e-4, 2);
+  CHECK_THROWS(wrong_type.load(ctx, uri));
+
+  std::filesystem::remove_all(uri);
+
+  // 4-bit codes are saved packed
+  auto index4 =
+      ivf_pq_index<float>(dimension, nlist, num_subspaces, 10, 1e-4, 2, 4);
+  index4.train(data);
+  index4.add(data);
+  index4.save(ctx, uri);
+  expected = index4.search(query, 2, 5);
+
+  auto loaded4 = ivf_pq_index<float>(0, 0, 1, 10, 1e-4, 2);
+  loaded4.load(ctx, uri);
+  CHECK(loaded4.num_bits() == 4);
+  found = loaded4.search(query, 2, 5);
+  CHECK(std::equal(expected.data(), expected.data() + 4 * 5, found.data()));
+  CHECK_THROWS(loaded4.search_finite_ram(ctx, query, 2, 5, 50));
+
+  std::filesystem::remove_all(uri);
+}
@@ -728,3 +728,140 @@ TEMPLATE_LIST_TEST_CASE(
         std::equal(A.data(), A.data() + A.num_rows() * A.num_cols(), B.data()));
   }
 }
+
+TEST_CASE("linalg: mmap vecs files", "[linalg][mmap]") {
+  size_t dimension = 3;
+  size_t num_vectors = 7;
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto base = (tempDir / std::filesystem::path(tmpnam(nullptr)).filename())
+                  .string();
+
+  auto element = [](size_t i, size_t j) { return (uint8_t)(10 * j + i); };
+  auto write_file = [&](const std::string& path, auto elt, bool bin) {
+    using U = decltype(elt);
+    auto fp = fopen(path.c_str(), "wb");
+    if (bin) {
+      uint32_t header[2]{(uint32_t)num_vectors, (uint32_t)dimension};
+      fwrite(header, sizeof(header), 1, fp);
+    }
+    for (size_t j = 0; j < num_vectors; ++j) {
+      if (!bin) {
+        int32_t d = dimension;
+        fwrite(&d, sizeof(d), 1, fp);
+      }
+      for (size_t i = 0; i < dimension; ++i) {
+        U u = element(i, j);
+        fwrite(&u, sizeof(u), 1, fp);
+      }
+    }
+    fclose(fp);
+  };
+
+  std::vector<std::string> paths;
+  paths.push_back(base + ".fvecs");
+  write_file(paths.back(), float{}, false);
+  paths.push_back(base + ".ivecs");
+  write_file(paths.back(), int32_t{}, false);
+  paths.push_back(base + ".bvecs");
+  write_file(paths.back(), uint8_t{}, false);
+  paths.push_back(base + ".u8bin");
+  write_file(paths.back(), uint8_t{}, true);
+  paths.push_back(base + ".fbin");
+  write_file(paths.back(), float{}, true);
+
+  for (auto&& path : paths) {
+    CHECK(is_vecs_file(path));
+
+    // Blocks of 3, 3 and 1 vectors, converted to float
+    auto A = mmapColMajorMatrix<float>(path, 3);
+    CHECK(A.num_array_rows() == dimension);
+    CHECK(A.num_array_cols() == num_vectors);
+    size_t seen = 0;
+    while (A.load()) {
+      CHECK(A.col_offset() == seen);
+      CHECK(A.num_rows() == dimension);
+      for (size_t j = 0; j < A.num_cols(); ++j) {
+        for (size_t i = 0; i < dimension; ++i) {
+          CHECK(A(i, j) == element(i, seen + j));
+        }
+      }
+      seen += A.num_cols();
+    }
+    CHECK(seen == num_vectors);
+
+    auto B = mmapPreLoadMatrix<uint8_t>(path);
+    CHECK(B.num_cols() == num_vectors);
+    CHECK(B(2, 6) == element(2, 6));
+  }
+
+  CHECK(!is_vecs_file(base + ".tdb"));
+  CHECK(!is_vecs_file("s3://bucket/base.fvecs"));
+
+  // A truncated file is rejected
+  auto fp = fopen(paths[0].c_str(), "ab");
+  fputc(0, fp);
+  fclose(fp);
+  CHECK_THROWS(mmapColMajorMatrix<float>(paths[0]));
+
+  for (auto&& path : paths) {
+    std::filesystem::remove(path);
+  }
+}
+
+TEST_CASE("linalg: sq8 codec", "[linalg][sq8]") {
+  size_t dimension = 4;
+  size_t num_vectors = 100;
+  auto A = ColMajorMatrix<float>(dimension, num_vectors);
+  for (size_t j = 0; j < num_vectors; ++j) {
+    // Ranges of 1, 10, 100 and 0
+    A(0, j) = j / 100.0f;
+    A(1, j) = -5.0f + j / 10.0f;
+    A(2, j) = static_cast<float>(j);
+    A(3, j) = 7.0f;
+  }
+
+  auto codec = sq8_codec(dimension);
+  codec.fit(A, 50);
+  codec.fit(A);
+  CHECK(codec.dimension() == dimension);
+  CHECK(std::abs(codec.step() - 99.0f / 255.0f) < 1e-6);
+
+  auto codes = codec.encode(A);
+  auto decoded = codec.decode(codes);
+  for (size_t j = 0; j < num_vectors; ++j) {
+    CHECK(codes(2, j) == std::nearbyint(j * 255.0f / 99.0f));
+    CHECK(codes(3, j) == 0);
+    for (size_t i = 0; i < dimension; ++i) {
+      CHECK(std::abs(decoded(i, j) - A(i, j)) <= codec.step() / 2 + 1e-5);
+    }
+  }
+
+  // Distances in code space are a fixed multiple of the original ones
+  auto T = codec.transform(A);
+  auto sum_of_squares = [dimension](auto&& a, auto&& b) {
+    float sum = 0;
+    for (size_t i = 0; i < dimension; ++i) {
+      sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+  };
+  auto d = sum_of_squares(A[3], A[71]);
+  auto t = sum_of_squares(T[3], T[71]);
+  CHECK(std::abs(t * codec.step() * codec.step() - d) < 1e-3 * d);
+
+  // Out of range values are clamped
+  auto B = ColMajorMatrix<float>(dimension, 1);
+  B(0, 0) = -1;
+  B(1, 0) = 1000;
+  B(2, 0) = 50;
+  B(3, 0) = 7;
+  auto b = codec.encode(B);
+  CHECK(b(0, 0) == 0);
+  CHECK(b(1, 0) == 255);
+
+  auto copy = sq8_codec(codec.params());
+  CHECK(copy.step() == codec.step());
+  auto codes2 = copy.encode(A);
+  CHECK(std::equal(
+      codes.data(), codes.data() + dimension * num_vectors, codes2.data()));
+}
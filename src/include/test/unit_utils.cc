@@ -30,6 +30,9 @@
  */
 
 #include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <limits>
+#include "utils/id_bitmap.h"
 #include "utils/utils.h"
 
 TEST_CASE("utils: test", "[utils]") {
@@ -99,3 +102,82 @@ TEST_CASE("utils: test", "[utils]") {
   CHECK(!is_local_array("http://www.tiledb.com/index.html"));
   CHECK(!is_local_array("https://www.tiledb.com/index.html"));
 }
+
+TEST_CASE("utils: id_bitmap", "[utils]") {
+  auto bitmap = id_bitmap{};
+  CHECK(bitmap.empty());
+  CHECK(!bitmap.contains(0));
+
+  CHECK(bitmap.set(0));
+  CHECK(bitmap.set(63));
+  CHECK(bitmap.set(64));
+  CHECK(bitmap.set(99));
+  CHECK(!bitmap.set(99));
+  CHECK(bitmap.count() == 4);
+  CHECK(bitmap.contains(63));
+  CHECK(bitmap(64));
+  CHECK(!bitmap.contains(1));
+  CHECK(!bitmap.contains(100));
+  CHECK(!bitmap.contains(1000000));
+
+  CHECK(bitmap.reset(63));
+  CHECK(!bitmap.reset(1000));
+  CHECK(!bitmap.contains(63));
+  CHECK(bitmap.count() == 3);
+
+  // Large ids (e.g., hashes) take no more room than small ones
+  bitmap.set(uint64_t{1} << 40);
+  bitmap.set(std::numeric_limits<uint64_t>::max());
+  CHECK(bitmap.count() == 5);
+  CHECK(bitmap.num_chunks() == 3);
+  CHECK(bitmap.contains(uint64_t{1} << 40));
+  CHECK(!bitmap.contains((uint64_t{1} << 40) + 1));
+  CHECK(bitmap.contains(std::numeric_limits<uint64_t>::max()));
+
+  std::vector<uint64_t> ids;
+  bitmap.for_each([&](uint64_t id) { ids.push_back(id); });
+  CHECK(
+      ids == std::vector<uint64_t>{
+                 0,
+                 64,
+                 99,
+                 uint64_t{1} << 40,
+                 std::numeric_limits<uint64_t>::max()});
+  CHECK(bitmap.ids() == ids);
+
+  // Emptied chunks are dropped
+  bitmap.reset(uint64_t{1} << 40);
+  CHECK(bitmap.num_chunks() == 2);
+
+  auto from_ids = id_bitmap::from_ids(std::vector<uint32_t>{5, 3, 70});
+  CHECK(from_ids.count() == 3);
+  CHECK(from_ids.contains(3));
+  CHECK(from_ids.contains(5));
+  CHECK(from_ids.contains(70));
+
+  from_ids.clear();
+  CHECK(from_ids.empty());
+  CHECK(!from_ids.contains(3));
+
+  // A chunk holding many ids switches to a bitmap and back, without
+  // changing the set
+  auto dense = id_bitmap{};
+  auto base = uint64_t{7} << 16;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    dense.set(base + 3 * i);
+  }
+  CHECK(dense.count() == 10000);
+  CHECK(dense.num_chunks() == 1);
+  CHECK(dense.contains(base + 3 * 9999));
+  CHECK(!dense.contains(base + 1));
+  for (uint64_t i = 0; i < 9000; ++i) {
+    CHECK(dense.reset(base + 3 * i));
+  }
+  CHECK(dense.count() == 1000);
+  CHECK(!dense.contains(base));
+  ids.clear();
+  dense.for_each([&](uint64_t id) { ids.push_back(id); });
+  CHECK(ids.size() == 1000);
+  CHECK(ids.front() == base + 3 * 9000);
+  CHECK(std::is_sorted(begin(ids), end(ids)));
+}
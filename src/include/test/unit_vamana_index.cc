@@ -0,0 +1,183 @@
+/**
+ * @file   unit_vamana_index.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include <catch2/catch_all.hpp>
+
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "../defs.h"
+#include "../linalg.h"
+#include "../vamana_index.h"
+#include "test_utils.h"
+
+bool global_debug = false;
+
+TEST_CASE("vamana_index: test test", "[vamana_index]") {
+  REQUIRE(true);
+}
+
+TEST_CASE("vamana_index: build and search", "[vamana_index]") {
+  size_t dimension = 16;
+  size_t num_vectors = 2000;
+  size_t R = 16;
+  size_t k_nn = 10;
+  auto data = uniform_vectors(dimension, num_vectors);
+  auto query = uniform_vectors(dimension, 50, 5678);
+
+  CHECK_THROWS(vamana_index<float>(dimension, 1));
+  CHECK_THROWS(vamana_index<float>(dimension, 16, 8));
+  CHECK_THROWS(vamana_index<float>(dimension, 16, 32, 0.5f));
+
+  auto index = vamana_index<float>(dimension, R, 50, 1.2f, 8, 4);
+  index.add(data);
+  CHECK(index.num_vectors() == num_vectors);
+  CHECK(index.num_subspaces() == 8);
+  CHECK(index.medoid() < num_vectors);
+
+  // Degrees are bounded, and links are to other nodes
+  for (size_t i = 0; i < num_vectors; ++i) {
+    auto neighbors = index.neighbors(i);
+    CHECK(size(neighbors) <= R);
+    CHECK(!neighbors.empty());
+    CHECK(std::find(begin(neighbors), end(neighbors), i) == end(neighbors));
+  }
+
+  // Every vector is its own nearest neighbor
+  index.set_search_list_size(32);
+  auto self = index.search(data, 1);
+  size_t found = 0;
+  for (size_t i = 0; i < num_vectors; ++i) {
+    found += self(0, i) == i;
+  }
+  CHECK(found >= num_vectors * 99 / 100);
+
+  // A longer candidate list finds more of the true neighbors, and the beam
+  // width only changes how many records are read at a time
+  index.set_search_list_size(10);
+  auto narrow = recall(data, query, index.search(query, k_nn), k_nn);
+  index.set_search_list_size(100);
+  auto wide = recall(data, query, index.search(query, k_nn), k_nn);
+  CHECK(wide >= narrow);
+  CHECK(wide >= 0.95);
+  index.set_beam_width(1);
+  CHECK(recall(data, query, index.search(query, k_nn), k_nn) >= 0.9);
+
+  // Ids are reported rather than positions, and missing results are padded
+  auto small = vamana_index<float>(dimension, 2, 4, 1.2f, 4, 2);
+  ColMajorMatrix<float> three(dimension, 3);
+  std::copy(data.data(), data.data() + 3 * dimension, three.data());
+  small.add(three, {30, 10, 20});
+  auto top_k = small.search(three, 5);
+  for (size_t j = 0; j < 3; ++j) {
+    CHECK(top_k(0, j) == 10 * ((j + 2) % 3 + 1));
+    CHECK(top_k(3, j) == std::numeric_limits<size_t>::max());
+  }
+}
+
+TEST_CASE("vamana_index: blocked build", "[vamana_index][mmap]") {
+  size_t dimension = 16;
+  size_t num_vectors = 500;
+  auto data = uniform_vectors(dimension, num_vectors);
+
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto path = (tempDir / std::filesystem::path(tmpnam(nullptr)).filename())
+                  .string() +
+              ".fbin";
+  auto fp = fopen(path.c_str(), "wb");
+  uint32_t header[2] = {(uint32_t)num_vectors, (uint32_t)dimension};
+  fwrite(header, sizeof(header), 1, fp);
+  fwrite(data.data(), sizeof(float), num_vectors * dimension, fp);
+  fclose(fp);
+
+  // Blocks that do not divide the number of vectors added, the last of
+  // which is only partly used
+  size_t num_added = 450;
+  auto index = vamana_index<float>(dimension, 16, 50, 1.2f, 8, 4);
+  CHECK(
+      index.add_blocked(
+          [&]() { return mmapColMajorMatrix<float>(path, 120); }, num_added) ==
+      num_added);
+  CHECK(index.num_vectors() == num_added);
+
+  // The records hold the vectors at their column numbers
+  auto self = index.search(data, 1);
+  size_t found = 0;
+  for (size_t i = 0; i < num_added; ++i) {
+    found += self(0, i) == i;
+  }
+  CHECK(found >= num_added * 99 / 100);
+
+  auto wrong = vamana_index<float>(dimension / 2, 16, 50, 1.2f, 4, 4);
+  CHECK_THROWS(
+      wrong.add_blocked([&]() { return mmapColMajorMatrix<float>(path); }));
+
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("vamana_index: save and load", "[vamana_index][read-write]") {
+  size_t dimension = 8;
+  auto data = uniform_vectors(dimension, 500);
+
+  auto index = vamana_index<float>(dimension, 8, 32, 1.2f, 4, 2);
+  index.add(data);
+  index.set_search_list_size(24);
+
+  auto tmpfilename = std::string(tmpnam(nullptr));
+  auto tempDir = std::filesystem::temp_directory_path();
+  auto uri = (tempDir / tmpfilename).string();
+
+  tiledb::Context ctx;
+  index.save(ctx, uri);
+  CHECK_THROWS(index.save(ctx, uri));
+  CHECK_THROWS(index.search_finite_ram(ctx, data, 5));
+
+  auto loaded = vamana_index<float>(0);
+  loaded.load(ctx, uri);
+  CHECK(loaded.dimension() == dimension);
+  CHECK(loaded.R() == 8);
+  CHECK(loaded.search_list_size() == 24);
+  CHECK(loaded.medoid() == index.medoid());
+  CHECK_THROWS(loaded.search(data, 5));
+
+  // Reading the records from TileDB gives the same results as from memory
+  auto expected = index.search(data, 5);
+  auto found = loaded.search_finite_ram(ctx, data, 5);
+  CHECK(std::equal(
+      expected.data(), expected.data() + 5 * data.num_cols(), found.data()));
+
+  auto wrong_type = vamana_index<uint8_t>(0);
+  CHECK_THROWS(wrong_type.load(ctx, uri));
+
+  std::filesystem::remove_all(uri);
+}
@@ -0,0 +1,266 @@
+/**
+ * @file   id_bitmap.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * A set of vector ids stored as a compressed bitmap, in the manner of
+ * roaring bitmaps, so that its size depends on the number of ids rather
+ * than on how large they are (ids may be arbitrary 64-bit values, e.g.,
+ * hashes).  The ids are split into chunks of 2^16 by their high bits.  A
+ * chunk holding few ids keeps their low 16 bits as a sorted array; once it
+ * holds more than 4096 (when the array would outgrow 8 KiB), it switches to
+ * a bitmap of 2^16 bits.  Membership is a binary search over the chunks and
+ * then either a binary search of the array or a shift and a mask, cheap
+ * enough to test for every vector a query kernel visits, before its
+ * distance is computed.
+ *
+ * The set is callable, returning membership, so it can be passed to the
+ * kernels that take an `is_live` predicate.  It is also used to record
+ * deleted ids (tombstones), which are stored as an array of the ids (see
+ * `write_id_bitmap()` in tdb_io.h).
+ */
+
+#ifndef TILEDB_ID_BITMAP_H
+#define TILEDB_ID_BITMAP_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+class id_bitmap {
+  static constexpr unsigned chunk_bits = 16;
+  static constexpr size_t chunk_size = size_t{1} << chunk_bits;
+  static constexpr size_t chunk_words = chunk_size / 64;
+
+  // Largest number of ids a chunk keeps as an array
+  static constexpr size_t max_array_size = 4096;
+
+  struct chunk {
+    uint64_t key{0};
+    size_t count{0};
+
+    // Sorted low bits of the ids, or (if not empty) a bitmap of them
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> words;
+
+    bool contains(uint16_t low) const {
+      if (!words.empty()) {
+        return (words[low / 64] >> (low % 64)) & 1;
+      }
+      return std::binary_search(begin(array), end(array), low);
+    }
+
+    bool set(uint16_t low) {
+      if (!words.empty()) {
+        auto& word = words[low / 64];
+        auto bit = uint64_t{1} << (low % 64);
+        if (word & bit) {
+          return false;
+        }
+        word |= bit;
+        ++count;
+        return true;
+      }
+      auto it = std::lower_bound(begin(array), end(array), low);
+      if (it != end(array) && *it == low) {
+        return false;
+      }
+      array.insert(it, low);
+      ++count;
+      if (count > max_array_size) {
+        words.assign(chunk_words, 0);
+        for (auto a : array) {
+          words[a / 64] |= uint64_t{1} << (a % 64);
+        }
+        array = std::vector<uint16_t>{};
+      }
+      return true;
+    }
+
+    bool reset(uint16_t low) {
+      if (!words.empty()) {
+        auto& word = words[low / 64];
+        auto bit = uint64_t{1} << (low % 64);
+        if (!(word & bit)) {
+          return false;
+        }
+        word &= ~bit;
+        --count;
+        if (count <= max_array_size / 2) {
+          for_each([this](uint16_t a) { array.push_back(a); });
+          words = std::vector<uint64_t>{};
+        }
+        return true;
+      }
+      auto it = std::lower_bound(begin(array), end(array), low);
+      if (it == end(array) || *it != low) {
+        return false;
+      }
+      array.erase(it);
+      --count;
+      return true;
+    }
+
+    template <class F>
+    void for_each(F&& f) const {
+      if (words.empty()) {
+        for (auto a : array) {
+          f(a);
+        }
+        return;
+      }
+      for (size_t w = 0; w < words.size(); ++w) {
+        for (auto word = words[w]; word != 0; word &= word - 1) {
+          f(static_cast<uint16_t>(64 * w + std::countr_zero(word)));
+        }
+      }
+    }
+  };
+
+  // In increasing order of key
+  std::vector<chunk> chunks_;
+  size_t count_{0};
+
+  auto find_chunk(uint64_t key) const {
+    return std::lower_bound(
+        begin(chunks_), end(chunks_), key, [](const chunk& c, uint64_t k) {
+          return c.key < k;
+        });
+  }
+
+ public:
+  id_bitmap() = default;
+
+  /**
+   * @brief The set of `ids`.
+   */
+  template <class R>
+  static id_bitmap from_ids(const R& ids) {
+    id_bitmap bitmap;
+    for (auto id : ids) {
+      bitmap.set(id);
+    }
+    return bitmap;
+  }
+
+  /**
+   * @brief Add `id`.
+   * @return Whether `id` was not already in the set.
+   */
+  bool set(uint64_t id) {
+    auto key = id >> chunk_bits;
+    auto it = chunks_.begin() + (find_chunk(key) - chunks_.cbegin());
+    if (it == chunks_.end() || it->key != key) {
+      it = chunks_.insert(it, chunk{key});
+    }
+    if (!it->set(static_cast<uint16_t>(id))) {
+      return false;
+    }
+    ++count_;
+    return true;
+  }
+
+  /**
+   * @brief Remove `id`.
+   * @return Whether `id` was in the set.
+   */
+  bool reset(uint64_t id) {
+    auto key = id >> chunk_bits;
+    auto it = chunks_.begin() + (find_chunk(key) - chunks_.cbegin());
+    if (it == chunks_.end() || it->key != key ||
+        !it->reset(static_cast<uint16_t>(id))) {
+      return false;
+    }
+    if (it->count == 0) {
+      chunks_.erase(it);
+    }
+    --count_;
+    return true;
+  }
+
+  void clear() {
+    chunks_.clear();
+    count_ = 0;
+  }
+
+  bool contains(uint64_t id) const {
+    if (chunks_.empty()) {
+      return false;
+    }
+    auto key = id >> chunk_bits;
+    auto it = find_chunk(key);
+    return it != chunks_.end() && it->key == key &&
+           it->contains(static_cast<uint16_t>(id));
+  }
+
+  bool operator()(uint64_t id) const {
+    return contains(id);
+  }
+
+  /**
+   * @brief Number of ids in the set.
+   */
+  size_t count() const {
+    return count_;
+  }
+
+  bool empty() const {
+    return count_ == 0;
+  }
+
+  /**
+   * @brief Number of chunks, each of which holds at least one id and takes
+   * at most 8 KiB.
+   */
+  size_t num_chunks() const {
+    return chunks_.size();
+  }
+
+  /**
+   * @brief Call `f` on each id in the set, in increasing order.
+   */
+  template <class F>
+  void for_each(F&& f) const {
+    for (auto&& c : chunks_) {
+      auto high = c.key << chunk_bits;
+      c.for_each([&](uint16_t low) { f(uint64_t{high | low}); });
+    }
+  }
+
+  /**
+   * @brief The ids in the set, in increasing order.
+   */
+  std::vector<uint64_t> ids() const {
+    std::vector<uint64_t> result;
+    result.reserve(count_);
+    for_each([&result](uint64_t id) { result.push_back(id); });
+    return result;
+  }
+};
+
+#endif  // TILEDB_ID_BITMAP_H
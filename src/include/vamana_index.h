@@ -0,0 +1,1006 @@
+/**
+ * @file   vamana_index.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Header-only Vamana (DiskANN) graph index, whose vectors and graph are
+ * meant to be kept on disk rather than in memory.
+ *
+ * Every vector is a node of a single-layer proximity graph with at most `R`
+ * neighbors per node.  The graph is built with two passes of insertions
+ * over all the nodes, the second with the relaxed "robust prune" (`alpha`
+ * > 1) that keeps some long edges, so that searches from the medoid reach
+ * any part of the graph in a few hops.
+ *
+ * Each node is stored as a fixed-size record holding its vector and its
+ * adjacency list, in a TileDB array with one column per record and tiles
+ * of about one disk sector.  Only the PQ codes of the vectors (see
+ * detail/ivf/pq.h) and the ids are held in memory.  A search is a beam
+ * search guided by the PQ distances: each step reads the records of the
+ * `beam_width` nearest unexpanded candidates with a single multi-range
+ * read, scores them exactly with their full vectors, and adds their
+ * neighbors to the candidate list with their PQ distances.  The result is
+ * the nearest of the expanded nodes by exact distance.
+ *
+ * The basic use case is:
+ * - Create an instance of the index
+ * - Call add() (or add_blocked()) to build the index over a set of vectors
+ * - Call save() to write the index to a TileDB group
+ * - Call load() to open it again, without reading the records, and
+ *   search_finite_ram() to query it.  search() queries a newly built index,
+ *   whose records are still in memory.
+ */
+
+#ifndef TILEDB_VAMANA_INDEX_H
+#define TILEDB_VAMANA_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include <tiledb/tiledb>
+
+#include "defs.h"
+
+#include "detail/ivf/pq.h"
+#include "detail/linalg/tdb_io.h"
+#include "detail/linalg/tdb_matrix.h"
+#include "ivf_index.h"
+#include "linalg.h"
+#include "utils/fixed_min_queues.h"
+#include "utils/timer.h"
+
+template <class T, class id_type = uint64_t>
+class vamana_index {
+  using kmeans_type = kmeans_index<float, id_type, uint64_t>;
+
+  using node_type = uint32_t;
+  using scored_node = std::tuple<float, node_type>;
+
+  size_t dimension_{0};
+  size_t R_{64};
+  size_t L_build_{100};
+  float alpha_{1.2f};
+  size_t num_subspaces_{0};
+  size_t L_search_{64};
+  size_t beam_width_{4};
+  size_t max_iter_{10};
+  double tol_{1e-4};
+  size_t nthreads_{std::thread::hardware_concurrency()};
+  std::mt19937 gen_{1234};
+
+  // Codewords are trained on at most this many vectors
+  size_t max_training_{65536};
+
+  ColMajorMatrix<float> codebooks_;
+  ColMajorMatrix<uint8_t> codes_;
+  std::vector<id_type> ids_;
+  node_type medoid_{0};
+
+  // Node records of a newly built index.  Column `i` holds the vector of
+  // node `i`, followed by its degree and `R_` neighbor slots.
+  ColMajorMatrix<uint8_t> records_;
+
+  // Node records of an index opened with load()
+  std::string nodes_uri_;
+
+  static constexpr const char* nodes_name = "vamana_nodes";
+  static constexpr const char* codes_name = "vamana_pq_codes";
+  static constexpr const char* codebooks_name = "vamana_pq_codebooks";
+  static constexpr const char* ids_name = "vamana_ids";
+
+  // Records are grouped into tiles of about this many bytes
+  static constexpr size_t sector_size = 4096;
+
+  size_t vector_bytes() const {
+    return dimension_ * sizeof(T);
+  }
+
+  size_t record_size() const {
+    return vector_bytes() + (R_ + 1) * sizeof(node_type);
+  }
+
+  /**
+   * @brief List of the (at most `L`) nearest candidates found so far by a
+   * search, nearest first, with whether each has been expanded.
+   */
+  class candidate_list {
+    std::vector<std::tuple<float, node_type, bool>> list_;
+    size_t L_;
+
+   public:
+    explicit candidate_list(size_t L)
+        : L_(L) {
+      list_.reserve(L + 1);
+    }
+
+    void insert(float score, node_type n) {
+      if (size(list_) == L_ && score >= std::get<0>(list_.back())) {
+        return;
+      }
+      auto pos = std::upper_bound(
+          begin(list_),
+          end(list_),
+          score,
+          [](float s, auto&& c) { return s < std::get<0>(c); });
+      list_.emplace(pos, score, n, false);
+      if (size(list_) > L_) {
+        list_.pop_back();
+      }
+    }
+
+    /**
+     * @brief Mark up to `width` of the nearest unexpanded candidates as
+     * expanded, returning them in `out`.
+     */
+    void expand(size_t width, std::vector<scored_node>& out) {
+      out.clear();
+      for (auto& [score, n, expanded] : list_) {
+        if (size(out) == width) {
+          break;
+        }
+        if (!expanded) {
+          expanded = true;
+          out.emplace_back(score, n);
+        }
+      }
+    }
+  };
+
+  /**
+   * @brief Choose the neighbors of node `p` from `candidates` (pairs of
+   * distance to `p` and node) with the robust prune of the Vamana paper:
+   * a candidate is dropped if some nearer kept candidate is closer to it,
+   * by a factor of `alpha`, than `p` is.
+   */
+  std::vector<node_type> robust_prune(
+      const auto& vectors,
+      node_type p,
+      std::vector<scored_node>& candidates,
+      float alpha) const {
+    std::sort(begin(candidates), end(candidates));
+    candidates.erase(
+        std::unique(begin(candidates), end(candidates)), end(candidates));
+    candidates.erase(
+        std::remove_if(
+            begin(candidates),
+            end(candidates),
+            [p](auto&& c) { return std::get<1>(c) == p; }),
+        end(candidates));
+
+    // The scores are squared distances
+    auto alpha2 = alpha * alpha;
+    std::vector<node_type> selected;
+    std::vector<bool> removed(size(candidates), false);
+    for (size_t i = 0; i < size(candidates) && size(selected) < R_; ++i) {
+      if (removed[i]) {
+        continue;
+      }
+      auto c = std::get<1>(candidates[i]);
+      selected.push_back(c);
+      for (size_t j = i + 1; j < size(candidates); ++j) {
+        if (!removed[j] &&
+            alpha2 * L2(vectors[c], vectors[std::get<1>(candidates[j])]) <=
+                std::get<0>(candidates[j])) {
+          removed[j] = true;
+        }
+      }
+    }
+    return selected;
+  }
+
+  /**
+   * @brief Graph under construction, with one mutex per node.
+   */
+  struct build_graph {
+    std::vector<std::vector<node_type>> neighbors;
+    std::unique_ptr<std::mutex[]> locks;
+
+    explicit build_graph(size_t num_nodes)
+        : neighbors(num_nodes)
+        , locks(std::make_unique<std::mutex[]>(num_nodes)) {
+    }
+
+    void get(node_type i, std::vector<node_type>& out) {
+      std::lock_guard<std::mutex> lock(locks[i]);
+      out = neighbors[i];
+    }
+  };
+
+  /**
+   * @brief Insert node `p` into `graph`: search for it from the medoid,
+   * choose its neighbors among the nodes expanded by the search and its
+   * current neighbors, and add the reverse links.
+   */
+  void insert(
+      const auto& vectors,
+      build_graph& graph,
+      node_type p,
+      float alpha,
+      std::vector<node_type>& buffer) {
+    auto q = vectors[p];
+
+    candidate_list candidates(L_build_);
+    std::unordered_set<node_type> visited{medoid_};
+    candidates.insert(L2(q, vectors[medoid_]), medoid_);
+
+    std::vector<scored_node> expanded;
+    std::vector<scored_node> step;
+    for (;;) {
+      candidates.expand(1, step);
+      if (step.empty()) {
+        break;
+      }
+      auto c = std::get<1>(step[0]);
+      expanded.push_back(step[0]);
+      graph.get(c, buffer);
+      for (auto n : buffer) {
+        if (visited.insert(n).second) {
+          candidates.insert(L2(q, vectors[n]), n);
+        }
+      }
+    }
+
+    graph.get(p, buffer);
+    for (auto n : buffer) {
+      expanded.emplace_back(L2(q, vectors[n]), n);
+    }
+    auto selected = robust_prune(vectors, p, expanded, alpha);
+    {
+      std::lock_guard<std::mutex> lock(graph.locks[p]);
+      graph.neighbors[p] = selected;
+    }
+
+    for (auto n : selected) {
+      std::lock_guard<std::mutex> lock(graph.locks[n]);
+      auto& links = graph.neighbors[n];
+      if (std::find(begin(links), end(links), p) != end(links)) {
+        continue;
+      }
+      if (size(links) < R_) {
+        links.push_back(p);
+        continue;
+      }
+      std::vector<scored_node> pruned;
+      pruned.reserve(size(links) + 1);
+      pruned.emplace_back(L2(vectors[n], q), p);
+      for (auto m : links) {
+        pruned.emplace_back(L2(vectors[n], vectors[m]), m);
+      }
+      links = robust_prune(vectors, n, pruned, alpha);
+    }
+  }
+
+  /**
+   * @brief Learn the PQ codebooks from (up to `max_training_` of) the
+   * columns of `vectors`, as for `ivf_pq_index`, but from the vectors
+   * themselves rather than from residuals.
+   */
+  void train_codebooks(const auto& vectors) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_training = std::min(vectors.num_cols(), max_training_);
+    auto num_trained = std::min(detail::ivf::pq_num_codewords, num_training);
+    codebooks_ =
+        ColMajorMatrix<float>(dimension_, detail::ivf::pq_num_codewords);
+    std::fill(
+        codebooks_.data(),
+        codebooks_.data() + dimension_ * detail::ivf::pq_num_codewords,
+        0.0f);
+
+    size_t fine_threads = std::max<size_t>(1, nthreads_ / num_subspaces_);
+    size_t outer_threads = std::min(nthreads_, num_subspaces_);
+    std::vector<size_t> subspaces(num_subspaces_);
+    stdx::execution::indexed_parallel_policy par{outer_threads};
+    stdx::range_for_each(
+        std::move(par), subspaces, [&](auto&&, size_t n, size_t m) {
+          auto b =
+              detail::ivf::pq_subspace_begin(m, dimension_, num_subspaces_);
+          auto e = detail::ivf::pq_subspace_begin(
+              m + 1, dimension_, num_subspaces_);
+          auto sub = ColMajorMatrix<float>(e - b, num_training);
+          for (size_t j = 0; j < num_training; ++j) {
+            for (size_t i = b; i < e; ++i) {
+              sub(i - b, j) = vectors(i, j);
+            }
+          }
+          auto quantizer =
+              kmeans_type(e - b, num_trained, max_iter_, tol_, fine_threads);
+          quantizer.train(sub, kmeans_algorithm::hamerly);
+          for (size_t k = 0; k < num_trained; ++k) {
+            for (size_t i = b; i < e; ++i) {
+              codebooks_(i, k) = quantizer.get_centroids()(i - b, k);
+            }
+          }
+        });
+  }
+
+  /**
+   * @brief Encode every column of `vectors` as the nearest codeword of each
+   * subspace.
+   */
+  void encode(const auto& vectors) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_nodes = vectors.num_cols();
+    codes_ = ColMajorMatrix<uint8_t>(num_subspaces_, num_nodes);
+
+    std::vector<size_t> columns(num_nodes);
+    std::iota(begin(columns), end(columns), 0);
+    stdx::execution::indexed_parallel_policy par{nthreads_};
+    stdx::range_for_each(
+        std::move(par), columns, [&](auto&& j, size_t, size_t) {
+          auto vec = vectors[j];
+          for (size_t m = 0; m < num_subspaces_; ++m) {
+            auto b =
+                detail::ivf::pq_subspace_begin(m, dimension_, num_subspaces_);
+            auto e = detail::ivf::pq_subspace_begin(
+                m + 1, dimension_, num_subspaces_);
+            float best_score = std::numeric_limits<float>::max();
+            size_t best = 0;
+            for (size_t k = 0; k < detail::ivf::pq_num_codewords; ++k) {
+              auto codeword = codebooks_[k];
+              float score = 0;
+              for (size_t i = b; i < e; ++i) {
+                float diff = static_cast<float>(vec[i]) - codeword[i];
+                score += diff * diff;
+              }
+              if (score < best_score) {
+                best_score = score;
+                best = k;
+              }
+            }
+            codes_(m, j) = static_cast<uint8_t>(best);
+          }
+        });
+  }
+
+  /**
+   * @brief The node nearest to the mean of `vectors`.
+   */
+  static node_type find_medoid(const auto& vectors) {
+    auto dimension = vectors.num_rows();
+    auto num_nodes = vectors.num_cols();
+    std::vector<double> sum(dimension, 0.0);
+    for (size_t j = 0; j < num_nodes; ++j) {
+      for (size_t i = 0; i < dimension; ++i) {
+        sum[i] += vectors(i, j);
+      }
+    }
+    std::vector<float> mean(dimension);
+    for (size_t i = 0; i < dimension; ++i) {
+      mean[i] = static_cast<float>(sum[i] / num_nodes);
+    }
+    node_type medoid = 0;
+    float best = std::numeric_limits<float>::max();
+    for (size_t j = 0; j < num_nodes; ++j) {
+      auto score = L2(mean, vectors[j]);
+      if (score < best) {
+        best = score;
+        medoid = j;
+      }
+    }
+    return medoid;
+  }
+
+  /**
+   * @brief Pack the vectors and the graph into node records.
+   */
+  void pack_records(const auto& vectors, const build_graph& graph) {
+    auto num_nodes = vectors.num_cols();
+    records_ = ColMajorMatrix<uint8_t>(record_size(), num_nodes);
+    std::fill(records_.data(), records_.data() + record_size() * num_nodes, 0);
+    for (size_t j = 0; j < num_nodes; ++j) {
+      auto record = records_[j].data();
+      std::memcpy(record, vectors[j].data(), vector_bytes());
+      node_type degree = size(graph.neighbors[j]);
+      std::memcpy(record + vector_bytes(), &degree, sizeof(node_type));
+      std::memcpy(
+          record + vector_bytes() + sizeof(node_type),
+          graph.neighbors[j].data(),
+          degree * sizeof(node_type));
+    }
+  }
+
+  /**
+   * @brief Reads node records from the array at `nodes_uri_`, keeping the
+   * array open between reads.
+   */
+  class node_reader {
+    tiledb::Context ctx_;
+    std::string uri_;
+    tiledb::Array array_;
+    size_t record_size_;
+
+   public:
+    node_reader(
+        const tiledb::Context& ctx, const std::string& uri, size_t record_size)
+        : ctx_(ctx)
+        , uri_(uri)
+        , array_(tiledb_helpers::open_array(tdb_func__, ctx, uri, TILEDB_READ))
+        , record_size_(record_size) {
+    }
+
+    ~node_reader() {
+      array_.close();
+    }
+
+    /**
+     * @brief Read the records of `nodes`, which must be sorted and
+     * distinct, into the first columns of `buffer`, with one query.
+     */
+    void operator()(
+        const std::vector<node_type>& nodes, ColMajorMatrix<uint8_t>& buffer) {
+      tiledb::Subarray subarray(ctx_, array_);
+      subarray.add_range(0, 0, (int)record_size_ - 1);
+      for (auto n : nodes) {
+        subarray.add_range(1, (int)n, (int)n);
+      }
+      tiledb::Query query(ctx_, array_);
+      query.set_subarray(subarray)
+          .set_layout(TILEDB_COL_MAJOR)
+          .set_data_buffer(
+              "values", buffer.data(), size(nodes) * record_size_);
+      tiledb_helpers::submit_query(tdb_func__, uri_, query);
+      if (tiledb::Query::Status::COMPLETE != query.query_status()) {
+        throw std::runtime_error("Incomplete read of " + uri_);
+      }
+    }
+  };
+
+  /**
+   * @brief Beam search for query `q`, reading node records with
+   * `read(nodes, buffer)`.
+   *
+   * @return The `k_nn` nearest expanded nodes, nearest first.
+   */
+  template <class Reader>
+  std::vector<scored_node> beam_search(
+      const auto& q,
+      size_t k_nn,
+      Reader& read,
+      std::vector<float>& table,
+      ColMajorMatrix<uint8_t>& buffer) const {
+    std::vector<float> q_vec(begin(q), end(q));
+    detail::ivf::pq_distance_table(q_vec, codebooks_, num_subspaces_, table);
+    auto pq_score = [&](node_type n) {
+      float score = 0;
+      for (size_t m = 0; m < num_subspaces_; ++m) {
+        score += table[m * detail::ivf::pq_num_codewords + codes_(m, n)];
+      }
+      return score;
+    };
+
+    candidate_list candidates(std::max(L_search_, k_nn));
+    std::unordered_set<node_type> visited{medoid_};
+    candidates.insert(pq_score(medoid_), medoid_);
+
+    auto heap = fixed_min_pair_heap<float, node_type>(k_nn);
+    std::vector<scored_node> step;
+    std::vector<node_type> nodes;
+    std::vector<T> vec(dimension_);
+    std::vector<node_type> neighbors(R_);
+    for (;;) {
+      candidates.expand(beam_width_, step);
+      if (step.empty()) {
+        break;
+      }
+      nodes.clear();
+      for (auto&& [score, n] : step) {
+        nodes.push_back(n);
+      }
+      std::sort(begin(nodes), end(nodes));
+      read(nodes, buffer);
+
+      for (size_t c = 0; c < size(nodes); ++c) {
+        auto record = buffer[c].data();
+        std::memcpy(vec.data(), record, vector_bytes());
+        heap.insert(L2(q_vec, vec), nodes[c]);
+
+        node_type degree;
+        std::memcpy(&degree, record + vector_bytes(), sizeof(node_type));
+        std::memcpy(
+            neighbors.data(),
+            record + vector_bytes() + sizeof(node_type),
+            degree * sizeof(node_type));
+        for (size_t i = 0; i < degree; ++i) {
+          if (visited.insert(neighbors[i]).second) {
+            candidates.insert(pq_score(neighbors[i]), neighbors[i]);
+          }
+        }
+      }
+    }
+
+    std::vector<scored_node> found(begin(heap), end(heap));
+    std::sort(begin(found), end(found));
+    return found;
+  }
+
+  /**
+   * @brief Search for every query on `nthreads_` threads, each with its own
+   * reader from `make_reader()`.
+   */
+  template <class ReaderFactory>
+  auto search_with(
+      const auto& query, size_t k_nn, ReaderFactory&& make_reader) const {
+    ColMajorMatrix<size_t> top_k(k_nn, query.num_cols());
+    std::fill(
+        top_k.data(),
+        top_k.data() + k_nn * query.num_cols(),
+        std::numeric_limits<size_t>::max());
+    if (ids_.empty()) {
+      return top_k;
+    }
+
+    size_t num_queries = query.num_cols();
+    size_t nthreads = std::min(nthreads_, std::max<size_t>(num_queries, 1));
+    size_t per_thread = (num_queries + nthreads - 1) / nthreads;
+
+    auto search_range = [&](size_t first, size_t last) {
+      auto read = make_reader();
+      std::vector<float> table;
+      ColMajorMatrix<uint8_t> buffer(record_size(), beam_width_);
+      for (size_t j = first; j < last; ++j) {
+        auto found = beam_search(query[j], k_nn, read, table, buffer);
+        for (size_t i = 0; i < std::min(k_nn, size(found)); ++i) {
+          top_k(i, j) = ids_[std::get<1>(found[i])];
+        }
+      }
+    };
+
+    std::vector<std::future<void>> futs;
+    for (size_t n = 1; n < nthreads; ++n) {
+      auto first = std::min(n * per_thread, num_queries);
+      auto last = std::min((n + 1) * per_thread, num_queries);
+      if (first != last) {
+        futs.emplace_back(
+            std::async(std::launch::async, search_range, first, last));
+      }
+    }
+    search_range(0, std::min(per_thread, num_queries));
+    for (auto&& f : futs) {
+      f.get();
+    }
+    return top_k;
+  }
+
+ public:
+  /**
+   * @brief Create an empty index.
+   *
+   * @param dimension Dimension of the vectors, or 0 for an index that is to
+   * be load()ed.
+   * @param R Maximum number of neighbors per node.
+   * @param L_build Length of the candidate list of the searches used to
+   * find the neighbors of a node being inserted.
+   * @param alpha Pruning factor of the second pass of the build; larger
+   * values keep more long edges.
+   * @param num_subspaces Number of PQ subspaces (bytes per in-memory code),
+   * 0 for one per four dimensions.
+   * @param nthreads Number of threads, 0 to use all cores.
+   */
+  vamana_index(
+      size_t dimension,
+      size_t R = 64,
+      size_t L_build = 100,
+      float alpha = 1.2f,
+      size_t num_subspaces = 0,
+      size_t nthreads = 0)
+      : dimension_(dimension)
+      , R_(R)
+      , L_build_(L_build)
+      , alpha_(alpha)
+      , num_subspaces_(
+            num_subspaces == 0 ? std::max<size_t>(1, dimension / 4) :
+                                 num_subspaces)
+      , nthreads_(
+            nthreads == 0 ? std::thread::hardware_concurrency() : nthreads) {
+    if (R_ < 2) {
+      throw std::runtime_error("R must be at least 2");
+    }
+    if (L_build_ < R_) {
+      throw std::runtime_error("L_build must be at least R");
+    }
+    if (alpha_ < 1.0f) {
+      throw std::runtime_error("alpha must be at least 1");
+    }
+    if (dimension_ != 0 && num_subspaces_ > dimension_) {
+      throw std::runtime_error(
+          "Number of subspaces must not exceed the dimension");
+    }
+  }
+
+  /**
+   * @brief Build the index over the columns of `vectors`, replacing its
+   * contents.  The id of column `i` is `ids[i]`.  The vectors must be in
+   * memory for the build; afterwards they are only kept in the node
+   * records.
+   */
+  void add(const ColMajorMatrix<T>& vectors, const std::vector<id_type>& ids) {
+    scoped_timer _{__FUNCTION__};
+
+    auto num_nodes = vectors.num_cols();
+    if (size(ids) != num_nodes) {
+      throw std::runtime_error(
+          "Number of ids does not match number of vectors");
+    }
+    if (vectors.num_rows() != dimension_) {
+      throw std::runtime_error("Vector dimension does not match the index");
+    }
+    if (num_nodes == 0) {
+      throw std::runtime_error("Cannot build an index with no vectors");
+    }
+    if (num_nodes > std::numeric_limits<node_type>::max()) {
+      throw std::runtime_error("Too many vectors for a vamana index");
+    }
+
+    train_codebooks(vectors);
+    encode(vectors);
+    ids_ = ids;
+    medoid_ = find_medoid(vectors);
+    nodes_uri_.clear();
+
+    std::vector<node_type> order(num_nodes);
+    std::iota(begin(order), end(order), 0);
+    std::shuffle(begin(order), end(order), gen_);
+
+    // The first pass builds a sparse graph, the second adds long edges
+    build_graph graph(num_nodes);
+    for (auto alpha : {1.0f, alpha_}) {
+      std::atomic<size_t> next{0};
+      auto worker = [&]() {
+        std::vector<node_type> buffer;
+        for (auto i = next++; i < num_nodes; i = next++) {
+          insert(vectors, graph, order[i], alpha, buffer);
+        }
+      };
+      std::vector<std::future<void>> futs;
+      for (size_t n = 1; n < nthreads_; ++n) {
+        futs.emplace_back(std::async(std::launch::async, worker));
+      }
+      worker();
+      for (auto&& f : futs) {
+        f.get();
+      }
+    }
+
+    pack_records(vectors, graph);
+  }
+
+  /**
+   * @brief Build the index with the column numbers of `vectors` as ids.
+   */
+  void add(const ColMajorMatrix<T>& vectors) {
+    std::vector<id_type> ids(vectors.num_cols());
+    std::iota(begin(ids), end(ids), 0);
+    add(vectors, ids);
+  }
+
+  /**
+   * @brief Build the index over the vectors supplied by `make_source`, which
+   * must return a new (unloaded) blocked matrix, reading it a block at a
+   * time into a matrix sized from the source's `num_array_cols()`.  The ids
+   * of the vectors are their column numbers in the source.
+   *
+   * @param num_vectors Number of source vectors to add (0 means all).
+   * @return The number of vectors added.
+   */
+  template <class SourceFactory>
+    requires std::invocable<SourceFactory>
+  size_t add_blocked(SourceFactory&& make_source, size_t num_vectors = 0) {
+    scoped_timer _{__FUNCTION__};
+
+    if (num_vectors == 0) {
+      num_vectors = std::numeric_limits<size_t>::max();
+    }
+
+    // Each block is copied straight to its place in the vectors to build
+    // from, which are only copied again into the node records
+    auto db = make_source();
+    if (db.num_array_rows() != dimension_) {
+      throw std::runtime_error("Vector dimension does not match the index");
+    }
+    num_vectors = std::min<size_t>(num_vectors, db.num_array_cols());
+    ColMajorMatrix<T> vectors(dimension_, num_vectors);
+    while (db.load() && db.col_offset() < num_vectors) {
+      auto n = std::min<size_t>(db.num_cols(), num_vectors - db.col_offset());
+      std::copy(
+          db.data(),
+          db.data() + n * dimension_,
+          vectors.data() + db.col_offset() * dimension_);
+    }
+    add(vectors);
+    return num_vectors;
+  }
+
+  /**
+   * @brief Find the (approximate) `k_nn` nearest neighbors of each query in
+   * a newly built index, reading the node records from memory.
+   *
+   * @return Matrix whose column `j` holds the ids of the neighbors of query
+   * `j`, nearest first.  Columns are padded with
+   * `std::numeric_limits<size_t>::max()` if the search finds fewer than
+   * `k_nn` vectors.
+   */
+  auto search(const auto& query, size_t k_nn) const {
+    scoped_timer _{tdb_func__};
+
+    if (records_.num_cols() == 0 && !ids_.empty()) {
+      throw std::runtime_error(
+          "Index records are not in memory; use search_finite_ram()");
+    }
+    return search_with(query, k_nn, [this]() {
+      return [this](
+                 const std::vector<node_type>& nodes,
+                 ColMajorMatrix<uint8_t>& buffer) {
+        for (size_t c = 0; c < size(nodes); ++c) {
+          std::copy(
+              begin(records_[nodes[c]]),
+              end(records_[nodes[c]]),
+              begin(buffer[c]));
+        }
+      };
+    });
+  }
+
+  /**
+   * @brief Like `search()`, but for an index opened with `load()`, reading
+   * the node records from TileDB as the searches expand them.
+   */
+  auto search_finite_ram(
+      const tiledb::Context& ctx, const auto& query, size_t k_nn) const {
+    scoped_timer _{tdb_func__ + " " + nodes_uri_};
+
+    if (nodes_uri_.empty()) {
+      throw std::runtime_error("Index has not been loaded from TileDB");
+    }
+    return search_with(query, k_nn, [&]() {
+      return node_reader(ctx, nodes_uri_, record_size());
+    });
+  }
+
+  /**
+   * @brief Write the index to a new TileDB group at `group_uri`.  The node
+   * records are stored in a dense array with one column per node and, to
+   * keep each read small, tiles of about one sector.  The group metadata
+   * records `index_type` "VAMANA" and the graph parameters.
+   */
+  void save(const tiledb::Context& ctx, const std::string& group_uri) const {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+
+    if (records_.num_cols() == 0) {
+      throw std::runtime_error("Cannot save an index that has no records");
+    }
+    if (tiledb::Object::object(ctx, group_uri).type() !=
+        tiledb::Object::Type::Invalid) {
+      throw std::runtime_error(group_uri + " already exists");
+    }
+
+    tiledb::Group::create(ctx, group_uri);
+    tiledb::Group group(ctx, group_uri, TILEDB_WRITE);
+
+    auto nodes_uri = group_uri + "/" + nodes_name;
+    auto codes_uri = group_uri + "/" + codes_name;
+    auto codebooks_uri = group_uri + "/" + codebooks_name;
+    auto ids_uri = group_uri + "/" + ids_name;
+
+    auto num_nodes = records_.num_cols();
+    auto nodes_per_tile = std::clamp<size_t>(
+        sector_size / record_size(), 1, num_nodes);
+    tiledb::Domain domain(ctx);
+    domain
+        .add_dimension(tiledb::Dimension::create<int>(
+            ctx, "rows", {{0, (int)record_size() - 1}}, (int)record_size()))
+        .add_dimension(tiledb::Dimension::create<int>(
+            ctx, "cols", {{0, (int)num_nodes - 1}}, (int)nodes_per_tile));
+    tiledb::ArraySchema schema(ctx, TILEDB_DENSE);
+    schema.set_domain(domain).set_order({{TILEDB_COL_MAJOR, TILEDB_COL_MAJOR}});
+    schema.add_attribute(tiledb::Attribute::create<uint8_t>(ctx, "values"));
+    tiledb::Array::create(nodes_uri, schema);
+    write_matrix(ctx, records_, nodes_uri, 0, false);
+
+    auto ids = std::vector<uint64_t>(begin(ids_), end(ids_));
+    write_matrix(ctx, codes_, codes_uri);
+    write_matrix(ctx, codebooks_, codebooks_uri);
+    write_vector(ctx, ids, ids_uri);
+    group.add_member(nodes_uri, false, nodes_name);
+    group.add_member(codes_uri, false, codes_name);
+    group.add_member(codebooks_uri, false, codebooks_name);
+    group.add_member(ids_uri, false, ids_name);
+
+    int64_t R = R_;
+    int64_t L_build = L_build_;
+    double alpha = alpha_;
+    int64_t L_search = L_search_;
+    int64_t beam_width = beam_width_;
+    int64_t medoid = medoid_;
+    put_string_metadata(group, "dataset_type", "vector_search");
+    put_string_metadata(group, "index_type", "VAMANA");
+    put_string_metadata(group, "dtype", dtype_name<T>());
+    group.put_metadata("R", TILEDB_INT64, 1, &R);
+    group.put_metadata("L_build", TILEDB_INT64, 1, &L_build);
+    group.put_metadata("alpha", TILEDB_FLOAT64, 1, &alpha);
+    group.put_metadata("L_search", TILEDB_INT64, 1, &L_search);
+    group.put_metadata("beam_width", TILEDB_INT64, 1, &beam_width);
+    group.put_metadata("medoid", TILEDB_INT64, 1, &medoid);
+    put_string_metadata(group, "storage_version", "0.2");
+    group.close();
+  }
+
+  /**
+   * @brief Open an index from the TileDB group at `group_uri`, as written by
+   * `save()`.  Only the PQ codes and the ids are read; the index is queried
+   * with `search_finite_ram()`.
+   */
+  void load(const tiledb::Context& ctx, const std::string& group_uri) {
+    scoped_timer _{__FUNCTION__ + std::string{" "} + group_uri};
+
+    tiledb::Group group(ctx, group_uri, TILEDB_READ);
+    if (get_string_metadata(group, "index_type", "") != "VAMANA") {
+      throw std::runtime_error(group_uri + " is not a VAMANA index");
+    }
+    auto dtype = get_string_metadata(group, "dtype", dtype_name<T>());
+    if (dtype != dtype_name<T>()) {
+      throw std::runtime_error(
+          "Index at " + group_uri + " has dtype " + dtype + ", expected " +
+          dtype_name<T>());
+    }
+
+    auto get_value = [&](const std::string& key, tiledb_datatype_t expected) {
+      tiledb_datatype_t type;
+      uint32_t num;
+      const void* value = nullptr;
+      group.get_metadata(key, &type, &num, &value);
+      if (value == nullptr || type != expected) {
+        throw std::runtime_error("Missing " + key + " in " + group_uri);
+      }
+      return value;
+    };
+    auto get_int = [&](const std::string& key) {
+      return *static_cast<const int64_t*>(get_value(key, TILEDB_INT64));
+    };
+    R_ = get_int("R");
+    L_build_ = get_int("L_build");
+    alpha_ = *static_cast<const double*>(get_value("alpha", TILEDB_FLOAT64));
+    L_search_ = get_int("L_search");
+    beam_width_ = get_int("beam_width");
+    medoid_ = get_int("medoid");
+
+    auto codebooks =
+        tdbColMajorMatrix<float>(ctx, group.member(codebooks_name).uri());
+    codebooks.load();
+    dimension_ = codebooks.num_rows();
+    codebooks_ = std::move(static_cast<ColMajorMatrix<float>&>(codebooks));
+
+    auto codes =
+        tdbColMajorMatrix<uint8_t>(ctx, group.member(codes_name).uri());
+    codes.load();
+    num_subspaces_ = codes.num_rows();
+    codes_ = std::move(static_cast<ColMajorMatrix<uint8_t>&>(codes));
+
+    auto ids = read_vector<uint64_t>(ctx, group.member(ids_name).uri());
+    ids_ = std::vector<id_type>(begin(ids), end(ids));
+
+    nodes_uri_ = group.member(nodes_name).uri();
+    auto schema = tiledb::ArraySchema(ctx, nodes_uri_);
+    auto rows = schema.domain().dimension(0).template domain<int>();
+    auto cols = schema.domain().dimension(1).template domain<int>();
+    if ((size_t)(rows.second - rows.first + 1) != record_size() ||
+        (size_t)(cols.second - cols.first + 1) != size(ids_) ||
+        codes_.num_cols() != size(ids_) || medoid_ >= size(ids_)) {
+      throw std::runtime_error("Inconsistent vamana index at " + group_uri);
+    }
+    records_ = ColMajorMatrix<uint8_t>{};
+    group.close();
+  }
+
+  /**
+   * @brief Set the length of the candidate list of a search; longer lists
+   * expand more nodes, trading speed for recall.
+   */
+  void set_search_list_size(size_t L_search) {
+    L_search_ = std::max<size_t>(1, L_search);
+  }
+
+  size_t search_list_size() const {
+    return L_search_;
+  }
+
+  /**
+   * @brief Set the number of nodes whose records are read together at each
+   * step of a search.
+   */
+  void set_beam_width(size_t beam_width) {
+    beam_width_ = std::max<size_t>(1, beam_width);
+  }
+
+  size_t beam_width() const {
+    return beam_width_;
+  }
+
+  void set_nthreads(size_t nthreads) {
+    nthreads_ = nthreads == 0 ? std::thread::hardware_concurrency() : nthreads;
+  }
+
+  size_t dimension() const {
+    return dimension_;
+  }
+
+  size_t R() const {
+    return R_;
+  }
+
+  size_t L_build() const {
+    return L_build_;
+  }
+
+  float alpha() const {
+    return alpha_;
+  }
+
+  size_t num_subspaces() const {
+    return num_subspaces_;
+  }
+
+  size_t num_vectors() const {
+    return size(ids_);
+  }
+
+  size_t medoid() const {
+    return medoid_;
+  }
+
+  /**
+   * @brief Neighbors of node `i` (the `i`th vector added) of a newly built
+   * index.
+   */
+  std::vector<node_type> neighbors(size_t i) const {
+    auto record = records_[i].data();
+    node_type degree;
+    std::memcpy(&degree, record + vector_bytes(), sizeof(node_type));
+    std::vector<node_type> result(degree);
+    std::memcpy(
+        result.data(),
+        record + vector_bytes() + sizeof(node_type),
+        degree * sizeof(node_type));
+    return result;
+  }
+};
+
+#endif  // TILEDB_VAMANA_INDEX_H
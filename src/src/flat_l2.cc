@@ -116,9 +116,9 @@ static constexpr const char USAGE[] =
 
   Options:
       -h, --help              show this screen
-      --db_uri URI            database URI with feature vectors
-      --query_uri URI         query URI with feature vectors to search for
-      --groundtruth_uri URI   ground truth URI
+      --db_uri URI            database URI with feature vectors (TileDB array or local fvecs, bvecs, etc file)
+      --query_uri URI         query URI with feature vectors to search for (TileDB array or local file)
+      --groundtruth_uri URI   ground truth URI (TileDB array or local ivecs file)
       --output_uri URI        output URI for results
       --k NN                  number of nearest neighbors to find [default: 10]
       --nqueries NN           size of queries subset to compare (0 = all) [default: 0]
@@ -174,17 +174,13 @@ int main(int argc, char* argv[]) {
 
   tiledb::Context ctx;
 
-  auto db = tdbColMajorMatrix<db_type>(ctx, db_uri, blocksize);  // blocked
-
-  auto query =
-      tdbColMajorMatrix<uint8_t>(ctx, query_uri, nqueries);  // just a slice
-  query.load();
+  auto query = read_matrix<uint8_t>(ctx, query_uri, nqueries);  // just a slice
 
   load_time.stop();
   std::cout << load_time << std::endl;
 
   // @todo decide on what the type of top_k::value should be
-  auto top_k = [&]() {
+  auto search = [&](auto&& db) {
     if (alg_name == "vq_nth") {
       if (verbose) {
         std::cout << "# Using vq_nth, nth = " << std::to_string(nth)
@@ -220,12 +216,18 @@ int main(int argc, char* argv[]) {
       }
     }
     throw std::runtime_error("incorrect or unset algorithm type: " + alg_name);
+  };
+
+  // The database is blocked, and may be a TileDB array or a local file
+  auto top_k = [&]() {
+    if (is_vecs_file(db_uri)) {
+      return search(mmapColMajorMatrix<db_type>(db_uri, blocksize));
+    }
+    return search(tdbColMajorMatrix<db_type>(ctx, db_uri, blocksize));
   }();
 
   if (!groundtruth_uri.empty()) {
-    auto groundtruth =
-        tdbColMajorMatrix<groundtruth_type>(ctx, groundtruth_uri);
-    groundtruth.load();
+    auto groundtruth = read_matrix<groundtruth_type>(ctx, groundtruth_uri);
 
     if (!validate_top_k(top_k, groundtruth)) {
       std::cout << "Validation failed" << std::endl;
@@ -0,0 +1,174 @@
+/**
+ * @file   groundtruth.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Driver program to compute exact ground truth for databases too large to
+ * hold in memory.  The database is streamed from a TileDB array in blocks
+ * that fit the memory budget and scored against the queries (with tiled
+ * gemms when built with BLAS), keeping the top k of each query in heaps.
+ * Progress is checkpointed every `--checkpoint_interval` vectors, and a run
+ * given the URI of an existing checkpoint resumes from it.
+ *
+ * The ids of the neighbors are written as a `k x nqueries` int32 array, as
+ * read by the other drivers' `--groundtruth_uri`, and their (squared L2)
+ * distances as a float array of the same shape.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <docopt.h>
+
+#include "defs.h"
+#include "detail/flat/groundtruth.h"
+#include "flat_index.h"
+#include "stats.h"
+#include "utils/timer.h"
+
+bool verbose = false;
+bool debug = false;
+bool global_debug = false;
+
+bool enable_stats = false;
+std::vector<json> core_stats;
+
+using groundtruth_type = int32_t;
+
+static constexpr const char USAGE[] =
+    R"(groundtruth: exact ground truth by blocked brute-force search.
+  Usage:
+      groundtruth (-h | --help)
+      groundtruth --db_uri URI --query_uri URI --ids_uri URI --distances_uri URI
+          [--checkpoint_uri URI] [--checkpoint_interval NN] [--max_checkpoints NN]
+          [--k NN] [--nqueries NN] [--memory_budget NN] [--query_block NN]
+          [--nthreads N] [--stats] [-d] [-v]
+
+  Options:
+      -h, --help                 show this screen
+      --db_uri URI               database URI with feature vectors (TileDB array)
+      --query_uri URI            query URI with feature vectors to search for (TileDB array or local file)
+      --ids_uri URI              output URI for the ids of the nearest neighbors
+      --distances_uri URI        output URI for the distances to the nearest neighbors
+      --checkpoint_uri URI       URI of the checkpoint group, resumed from if it exists
+      --checkpoint_interval NN   number of database vectors between checkpoints (0 = none) [default: 0]
+      --max_checkpoints NN       stop after writing this many checkpoints (0 = no limit) [default: 0]
+      --k NN                     number of nearest neighbors to find [default: 100]
+      --nqueries NN              size of queries subset to use (0 = all) [default: 0]
+      --memory_budget NN         bytes of database vectors to hold in memory (0 = all) [default: 0]
+      --query_block NN           number of queries scored by each gemm [default: 1024]
+      --nthreads N               number of threads to use in parallel loops (0 = all) [default: 0]
+      --stats                    log TileDB stats [default: false]
+      -d, --debug                run in debug mode [default: false]
+      -v, --verbose              run in verbose mode [default: false]
+)";
+
+int main(int argc, char* argv[]) {
+  scoped_timer _(tdb_func__ + std::string("all inclusive ground truth time"));
+
+  std::vector<std::string> strings(argv + 1, argv + argc);
+  auto args = docopt::docopt(USAGE, strings, true);
+
+  if (args["--help"].asBool()) {
+    std::cout << USAGE << std::endl;
+    return 0;
+  }
+
+  global_debug = debug = args["--debug"].asBool();
+  verbose = args["--verbose"].asBool();
+  enable_stats = args["--stats"].asBool();
+
+  std::string db_uri = args["--db_uri"].asString();
+  std::string query_uri = args["--query_uri"].asString();
+  std::string ids_uri = args["--ids_uri"].asString();
+  std::string distances_uri = args["--distances_uri"].asString();
+  std::string checkpoint_uri =
+      args["--checkpoint_uri"] ? args["--checkpoint_uri"].asString() : "";
+
+  size_t k = args["--k"].asLong();
+  size_t nqueries = args["--nqueries"].asLong();
+  size_t memory_budget = args["--memory_budget"].asLong();
+  size_t checkpoint_interval = args["--checkpoint_interval"].asLong();
+  size_t max_checkpoints = args["--max_checkpoints"].asLong();
+  size_t query_block = args["--query_block"].asLong();
+  size_t nthreads = args["--nthreads"].asLong();
+
+  if (nthreads == 0) {
+    nthreads = std::thread::hardware_concurrency();
+  }
+
+  tiledb::Context ctx;
+
+  auto run = [&](auto db_value, auto query_value) {
+    using T = decltype(db_value);
+    auto query = read_matrix<decltype(query_value)>(ctx, query_uri, nqueries);
+    auto index = flat_index<T>(ctx, db_uri, "", memory_budget, nthreads);
+    index.set_query_block(query_block);
+    if (verbose) {
+      std::cout << "# " << index.num_vectors() << " vectors of dimension "
+                << index.dimension() << ", " << query.num_cols()
+                << " queries" << std::endl;
+    }
+    return detail::flat::blocked_groundtruth<groundtruth_type>(
+        ctx,
+        index,
+        query,
+        k,
+        ids_uri,
+        distances_uri,
+        checkpoint_uri,
+        checkpoint_interval,
+        max_checkpoints);
+  };
+
+  auto db_type = tiledb::ArraySchema(ctx, db_uri).attribute(0).type();
+  bool uint8_queries =
+      is_vecs_file(query_uri) ?
+          query_uri.ends_with("bvecs") :
+          tiledb::ArraySchema(ctx, query_uri).attribute(0).type() ==
+              TILEDB_UINT8;
+
+  bool complete = false;
+  if (db_type == TILEDB_FLOAT32) {
+    complete = uint8_queries ? run(float{}, uint8_t{}) : run(float{}, float{});
+  } else if (db_type == TILEDB_UINT8) {
+    complete =
+        uint8_queries ? run(uint8_t{}, uint8_t{}) : run(uint8_t{}, float{});
+  } else {
+    throw std::runtime_error("Unsupported attribute type in " + db_uri);
+  }
+
+  if (!complete) {
+    std::cout << "# Stopped at checkpoint " << checkpoint_uri << std::endl;
+  }
+  if (enable_stats) {
+    std::cout << json{core_stats}.dump() << std::endl;
+  }
+}
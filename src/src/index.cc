@@ -42,6 +42,7 @@
 #include <docopt.h>
 
 #include "flat_query.h"
+#include "ivf_index.h"
 #include "ivf_query.h"
 #include "linalg.h"
 #include "utils/utils.h"
@@ -75,6 +76,7 @@ Usage:
     index (-h | --help)
     index [--kmeans] [--index]
            --db_uri URI --centroids_uri URI [--index_uri URI] [--parts_uri URI] [--ids_uri URI]
+          [--nlist NN] [--max_iter NN] [--tol NN]
           [--blocksize NN] [--nthreads N] [--nth] [--log FILE] [--force] [--dryrun] [-d] [-v]
 
 Options:
@@ -86,6 +88,9 @@ Options:
     --index_uri URI       URI with the paritioning index.  Output.
     --parts_uri URI       URI with the partitioned data.  Output.
     --ids_uri URI         URI with original IDs of vectors.  Output.
+    --nlist NN            number of centroids to compute with --kmeans [default: 100]
+    --max_iter NN         max number of kmeans passes over the data [default: 10]
+    --tol NN              relative centroid shift at which kmeans stops [default: 1e-4]
     --blocksize NN        number of vectors to process in a block (0 = all) [default: 0]
     --nthreads N          number of threads to use in parallel loops (0 = all) [default: 0]
     --nth                 use nth_element for top k [default: false]
@@ -126,12 +131,43 @@ int main(int argc, char* argv[]) {
   bool do_index = args["--index"].asBool();
 
   if (do_kmeans) {
-    // compute centroids
+    // Stream the db with mini-batch kmeans, so that it need not fit in memory
+    size_t blocksize = args["--blocksize"].asLong();
+    size_t nlist = args["--nlist"].asLong();
+    size_t max_iter = args["--max_iter"].asLong();
+    double tol = std::stod(args["--tol"].asString());
+
+    auto probe = tdbColMajorMatrix<db_type>(ctx, db_uri, 1);
+    probe.load();
+    auto index = kmeans_index<centroids_type, shuffled_ids_type, indices_type>(
+        probe.num_rows(), nlist, max_iter, tol, nthreads);
+    index.template train_mini_batch<db_type>(
+        ctx, db_uri, blocksize, std::max<size_t>(10'000, nlist));
+
+    if (!dryrun) {
+      if (is_local_array(centroids_uri) &&
+          std::filesystem::exists(centroids_uri)) {
+        std::cerr << "Error: URI " << centroids_uri
+                  << " already exists: " << std::endl;
+        std::cerr << "This is a dangerous operation, so we will not "
+                     "overwrite the file."
+                  << std::endl;
+        std::cerr << "Please delete the file manually and try again."
+                  << std::endl;
+        return 1;
+      }
+      write_matrix(ctx, index.get_centroids(), centroids_uri);
+    }
+    if (!do_index) {
+      return 0;
+    }
   }
 
   auto centroids = tdbColMajorMatrix<centroids_type>(ctx, centroids_uri);
+  centroids.load();
 
   auto db = tdbColMajorMatrix<db_type>(ctx, db_uri);
+  db.load();
 
   auto parts = qv_partition(centroids, db, nthreads);
   debug_matrix(parts, "parts");
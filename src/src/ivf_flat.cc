@@ -113,8 +113,8 @@ Options:
     --sizes_uri URI       URI with the parition sizes
     --parts_uri URI       URI with the partitioned data
     --ids_uri URI         URI with original IDs of vectors
-    --query_uri URI       URI storing query vectors
-    --groundtruth_uri URI URI storing ground truth vectors
+    --query_uri URI       URI storing query vectors (TileDB array or local fvecs, bvecs, etc file)
+    --groundtruth_uri URI URI storing ground truth vectors (TileDB array or local ivecs file)
     --output_uri URI      URI to store search results
     --k NN                number of nearest neighbors to search for [default: 10]
     --nprobe NN           number of centroid partitions to use [default: 100]
@@ -213,9 +213,7 @@ int main(int argc, char* argv[]) {
   }
   debug_matrix(indices, "indices");
 
-  auto q =
-      tdbColMajorMatrix<db_type, shuffled_ids_type>(ctx, query_uri, nqueries);
-  q.load();
+  auto q = read_matrix<db_type>(ctx, query_uri, nqueries);
   debug_matrix(q, "q");
 
   auto top_k = [&]() {
@@ -359,8 +357,7 @@ int main(int argc, char* argv[]) {
     auto groundtruth_uri = args["--groundtruth_uri"].asString();
 
     auto groundtruth =
-        tdbColMajorMatrix<groundtruth_type>(ctx, groundtruth_uri, nqueries);
-    groundtruth.load();
+        read_matrix<groundtruth_type>(ctx, groundtruth_uri, nqueries);
 
     if (global_debug) {
       std::cout << std::endl;
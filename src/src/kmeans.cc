@@ -0,0 +1,174 @@
+/**
+ * @file   kmeans.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2023 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Driver program to compute kmeans centroids for an ivf index.  Mostly useful
+ * for comparing the different training algorithms.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <docopt.h>
+
+#include "ivf_index.h"
+#include "linalg.h"
+#include "stats.h"
+#include "utils/timer.h"
+
+bool global_verbose = false;
+bool global_debug = false;
+
+bool enable_stats = false;
+std::vector<json> core_stats;
+
+using db_type = float;
+using shuffled_ids_type = uint64_t;
+using indices_type = uint64_t;
+
+static constexpr const char USAGE[] =
+    R"(kmeans: demo CLI program to compute kmeans centroids.
+Usage:
+    kmeans (-h | --help)
+    kmeans --db_uri URI --nlist NN [--centroids_uri URI] [--alg ALGO]
+          [--init INIT] [--max_factor F] [--min_factor F] [--max_iter NN]
+          [--coarse NN] [--coarse_centroids_uri URI] [--coarse_offsets_uri URI] [--tol TOL] [--blocksize NN] [--nthreads N]
+          [--log FILE] [--stats] [-d] [-v]
+
+Options:
+    -h, --help            show this screen
+    --db_uri URI          database URI with feature vectors
+    --nlist NN            number of centroids to compute
+    --centroids_uri URI   URI for output centroid vectors
+    --alg ALGO            kmeans algorithm to use (lloyd, hamerly, balanced) [default: lloyd]
+    --init INIT           centroid initialization (random, kmeanspp, kmeansparallel) [default: kmeansparallel]
+    --max_factor F        balanced: maximum partition size, relative to the mean [default: 1.5]
+    --min_factor F        balanced: minimum partition size, relative to the mean [default: 0.25]
+    --coarse NN           train hierarchically with NN coarse partitions (0 = flat) [default: 0]
+    --coarse_centroids_uri URI  URI for output coarse centroid vectors (with --coarse)
+    --coarse_offsets_uri URI    URI for output coarse to fine centroid offsets (with --coarse)
+    --max_iter NN         maximum number of kmeans iterations [default: 10]
+    --tol TOL             convergence tolerance [default: 1e-4]
+    --blocksize NN        number of vectors to train with (0 = all) [default: 0]
+    --nthreads N          number of threads to use in parallel loops (0 = all) [default: 0]
+    --log FILE            log info to FILE (- for stdout)
+    --stats               log TileDB stats [default: false]
+    -d, --debug           run in debug mode [default: false]
+    -v, --verbose         run in verbose mode [default: false]
+)";
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> strings(argv + 1, argv + argc);
+  auto args = docopt::docopt(USAGE, strings, true);
+
+  auto db_uri = args["--db_uri"].asString();
+  size_t nlist = args["--nlist"].asLong();
+  size_t max_iter = args["--max_iter"].asLong();
+  double tol = std::stod(args["--tol"].asString());
+  size_t blocksize = args["--blocksize"].asLong();
+  auto alg_name = args["--alg"].asString();
+  auto init_name = args["--init"].asString();
+  size_t num_coarse = args["--coarse"].asLong();
+
+  size_t nthreads = args["--nthreads"].asLong();
+  if (nthreads == 0) {
+    nthreads = std::thread::hardware_concurrency();
+  }
+  global_debug = args["--debug"].asBool();
+  global_verbose = args["--verbose"].asBool();
+  enable_stats = args["--stats"].asBool();
+
+  kmeans_algorithm algorithm;
+  if (alg_name == "lloyd") {
+    algorithm = kmeans_algorithm::lloyd;
+  } else if (alg_name == "hamerly") {
+    algorithm = kmeans_algorithm::hamerly;
+  } else if (alg_name == "balanced") {
+    algorithm = kmeans_algorithm::balanced;
+  } else {
+    std::cout << "Unknown algorithm: " << alg_name << std::endl;
+    return 1;
+  }
+
+  kmeans_init init;
+  if (init_name == "random") {
+    init = kmeans_init::random;
+  } else if (init_name == "kmeanspp") {
+    init = kmeans_init::kmeanspp;
+  } else if (init_name == "kmeansparallel") {
+    init = kmeans_init::kmeans_parallel;
+  } else {
+    std::cout << "Unknown initialization: " << init_name << std::endl;
+    return 1;
+  }
+
+  tiledb::Context ctx;
+
+  auto db = tdbColMajorMatrix<db_type>(ctx, db_uri, blocksize);
+  db.load();
+
+  auto index = kmeans_index<db_type, shuffled_ids_type, indices_type>(
+      db.num_rows(), nlist, max_iter, tol, nthreads);
+  index.set_partition_size_limits(
+      std::stod(args["--max_factor"].asString()),
+      std::stod(args["--min_factor"].asString()));
+  {
+    scoped_timer _{"kmeans " + alg_name + " " + init_name};
+    if (num_coarse == 0) {
+      index.train(db, algorithm, init);
+    } else {
+      index.train_hierarchical(db, num_coarse, algorithm);
+    }
+  }
+
+  if (args["--centroids_uri"]) {
+    write_matrix(ctx, index.get_centroids(), args["--centroids_uri"].asString());
+  }
+  if (num_coarse != 0 && args["--coarse_centroids_uri"]) {
+    write_matrix(
+        ctx,
+        index.get_coarse_centroids(),
+        args["--coarse_centroids_uri"].asString());
+  }
+  if (num_coarse != 0 && args["--coarse_offsets_uri"]) {
+    write_vector(
+        ctx,
+        index.get_coarse_offsets(),
+        args["--coarse_offsets_uri"].asString());
+  }
+
+  if (args["--log"]) {
+    dump_logs(args["--log"].asString(), alg_name, 0, 0, 0, nthreads, 0);
+  }
+  if (enable_stats) {
+    std::cout << json{core_stats}.dump() << std::endl;
+  }
+}